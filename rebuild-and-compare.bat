@@ -5,8 +5,9 @@ Release\convert-8080-to-z80-or-x86.exe -generate_z80_only stages\sargon-8080-and
 Release\convert-z80-to-x86.exe -relax stages\sargon-z80-and-x86.asm temp-sargon-x86.asm temp-sargon-asm-interface.h temp-report.txt
 Release\convert-z80-to-x86.exe -z80_only stages\sargon-z80-and-x86.asm temp-sargon-z80.asm temp-interface.h temp-report.txt
 
-REM Assemble the Z80 code with ZMAC cross assembler to stages\sargon-z80.lst
-zmac.exe --oo lst -c --od stages stages\sargon-z80.asm
+REM Assemble the Z80 code with ZMAC cross assembler to stages\sargon-z80.lst and stages\sargon-z80.hex
+REM (the Intel HEX image and the listing's symbols are what sargon-tests o runs)
+zmac.exe --oo lst,hex -c --od stages stages\sargon-z80.asm
 
 REM Check both routes generate same X86 code, and also whether anything has changed, (suggest also using git status)
 fc stages\sargon-x86.asm temp-sargon-x86.asm
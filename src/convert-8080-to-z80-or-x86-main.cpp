@@ -28,6 +28,10 @@
 void convert( bool relax_switch, std::string fin, std::string asm_fout,  std::string report_fout, std::string asm_interface_fout );
 std::string detabify( const std::string &s, bool push_comment_to_right=false );
 
+// Code label address table (asm) and names (C interface), for profilers
+static void label_table_asm( std::ostream &asm_out, const std::vector<std::string> &code_labels );
+static void label_table_h( std::ostream &h_out, const std::vector<std::string> &code_labels, const std::set<std::string> &call_targets );
+
 // Each source line can optionally be transformed to Z80 mnemonics (or hybrid Z80 plus X86 registers mnemonics)
 enum transform_t { transform_none, transform_z80, transform_hybrid };
 static transform_t transform_switch = transform_none;
@@ -494,6 +498,9 @@ void convert( bool relax_switch, std::string fin, std::string fout, std::string
     std::map< std::string, std::vector<std::string> > equates;
     std::map< std::string, std::set<std::vector<std::string>> > instructions;
     bool data_mode = true;
+    std::vector<std::string> code_labels;
+    std::set<std::string> call_targets;
+    bool label_table_emitted = false;
     translate_init();
     if( relax_switch )
         translate_init_slim_down();
@@ -741,6 +748,22 @@ void convert( bool relax_switch, std::string fin, std::string fout, std::string
                 line_out = "callback_enabled EQU 1";
             else if( line_original=="callback_enabled EQU 1" && !callback_enabled )
                 line_out = "callback_enabled EQU 0";
+
+            // X86 code CALLs are needed to identify routines for the label table
+            std::vector<std::string> fields;
+            util::split( line_original.substr(0,line_original.find(';')), fields );
+            for( size_t i=0; i+1<fields.size() && i<2; i++ )
+            {
+                if( util::toupper(fields[i]) == "CALL" )
+                    call_targets.insert(fields[i+1]);
+            }
+
+            // Code label addresses go at the end of the code, just before "_sargon ENDP"
+            if( generate_switch==generate_x86 && !label_table_emitted && util::toupper(line_original).find("ENDP")!=std::string::npos )
+            {
+                label_table_asm( asm_out, code_labels );
+                label_table_emitted = true;
+            }
             if( generate_switch != generate_z80_only )
                 util::putline( asm_out, line_out );
             continue;
@@ -795,6 +818,8 @@ void convert( bool relax_switch, std::string fin, std::string fout, std::string
                 asm_line_out += "\t;";
                 asm_line_out += stmt.comment;
             }
+            if( !data_mode && stmt.label!="" )
+                code_labels.push_back(stmt.label);
             asm_line_out = detabify(asm_line_out, generate_switch==generate_x86 );
             if( callback_macro && generate_switch==generate_z80_only && stmt.label=="" && stmt.comment=="" )
                 ;   // don't express a completely empty line
@@ -852,6 +877,14 @@ void convert( bool relax_switch, std::string fin, std::string fout, std::string
         {
             bool gen_z80 = (generate_switch==generate_z80 || generate_switch==generate_hybrid || generate_switch==generate_z80_only);
             std::string str_location = (gen_z80 ? "$" : util::sprintf( "0%xh", track_location ) );
+            if( !data_mode && stmt.equate=="" && stmt.label!="" && util::toupper(stmt.instruction)!="MACRO" )
+                code_labels.push_back(stmt.label);
+            if( !data_mode && stmt.parameters.size()>0 )
+            {
+                std::string s = util::toupper(stmt.instruction);
+                if( s=="CALL" || s=="CZ" || s=="CNZ" || s=="CC" || s=="CNC" || s=="CP" || s=="CM" || s=="CPE" || s=="CPO" )
+                    call_targets.insert( stmt.parameters[stmt.parameters.size()-1] );
+            }
             std::string asm_line_out;
             if( stmt.equate != "" )
             {
@@ -1070,6 +1103,8 @@ void convert( bool relax_switch, std::string fin, std::string fout, std::string
             util::putline( asm_out, asm_line_out );
         }
     }
+    if( label_table_emitted )
+        label_table_h( h_out, code_labels, call_targets );
     util::putline( h_out, "};" );
     util::putline( h_out, "#endif //SARGON_ASM_INTERFACE_H_INCLUDED" );
 
@@ -1115,6 +1150,38 @@ void convert( bool relax_switch, std::string fin, std::string fout, std::string
     }
 }
 
+// Emitted just before "_sargon ENDP", so the table is inside the PROC with the
+//  labels it refers to, and its own address marks the end of the code
+static void label_table_asm( std::ostream &asm_out, const std::vector<std::string> &code_labels )
+{
+    util::putline( asm_out, ";" );
+    util::putline( asm_out, "; Code label addresses, for profiling (names in sargon-asm-interface.h)" );
+    util::putline( asm_out, ";" );
+    util::putline( asm_out, "PUBLIC   _sargon_label_addresses" );
+    util::putline( asm_out, "_sargon_label_addresses:" );
+    for( const std::string &label: code_labels )
+        util::putline( asm_out, detabify( "\tDD\t" + label ) );
+}
+
+static void label_table_h( std::ostream &h_out, const std::vector<std::string> &code_labels, const std::set<std::string> &call_targets )
+{
+    util::putline( h_out, "" );
+    util::putline( h_out, "    // Code labels, for profiling. The assembly language exports the address of" );
+    util::putline( h_out, "    //  each label in the same order, routine is true for CALL targets" );
+    util::putline( h_out, "    extern uint32_t sargon_label_addresses[];" );
+    util::putline( h_out, "    struct sargon_label { const char *name; bool routine; };" );
+    util::putline( h_out, util::sprintf( "    const int sargon_nbr_labels = %d;", static_cast<int>(code_labels.size()) ) );
+    util::putline( h_out, "    const sargon_label sargon_labels[] =" );
+    util::putline( h_out, "    {" );
+    for( size_t i=0; i<code_labels.size(); i++ )
+    {
+        bool routine = call_targets.find(code_labels[i]) != call_targets.end();
+        util::putline( h_out, util::sprintf( "        { \"%s\", %s }%s", code_labels[i].c_str(),
+                                routine ? "true" : "false", i+1<code_labels.size() ? "," : "" ) );
+    }
+    util::putline( h_out, "    };" );
+}
+
 std::string detabify( const std::string &s, bool push_comment_to_right )
 {
     std::string ret;
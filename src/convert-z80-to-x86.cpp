@@ -16,6 +16,7 @@
 #include <assert.h>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <deque>
@@ -30,8 +31,12 @@ void translate_init( bool relax );
 // Return true if translated    
 bool translate_x86( const std::string &line, const std::string &instruction, const std::vector<std::string> &parameters, std::set<std::string> &labels, std::string &out );
 
+// Code label address table (asm) and names (C interface), for profilers
+static void label_table_asm( std::ostream &asm_out, const std::vector<std::string> &code_labels );
+static void label_table_h( std::ostream &h_out, const std::vector<std::string> &code_labels, const std::set<std::string> &call_targets );
+
 // Do the conversion (after obtaining filenames, switches etc)
-void convert( bool relax, bool z80_only, std::string fin, std::string asm_fout,  std::string report_fout, std::string asm_interface_fout );
+void convert( bool relax, bool z80_only, std::string fin, std::string asm_fout,  std::string report_fout, std::string asm_interface_fout, std::string profile_fin );
 
 // Present output lines with nice columns
 std::string detabify( const std::string &s, bool push_comment_to_right=false );
@@ -44,6 +49,7 @@ int main( int argc, const char *argv[] )
 {
     bool relax=false;
     bool z80_only=false;
+    std::string profile_fin;
 #ifdef _DEBUG
     const char *test_args[] =
     {
@@ -79,6 +85,12 @@ int main( int argc, const char *argv[] )
     "   that should match the code generated by convert-8080-to-z80-or-x86.exe with\n"
     "   its -z80_only flag.\n"
     "\n"
+    " -profile profile.txt\n"
+    "   Use a profile of per label execution counts (one \"LABEL count\" pair per\n"
+    "   line) to lay out the X86 code. Code that can only be reached by a jump or\n"
+    "   call and that the profile shows is never executed is moved to the end of the\n"
+    "   code, so hot code is packed together. Hot loop heads are aligned to 16 bytes.\n"
+    "\n"
     "During X86 conversion, the original line can be kept, discarded or commented out\n"
     " so -original_keep or -original_comment_out or -original_discard, default is\n"
     " -original_discard\n"
@@ -98,6 +110,12 @@ int main( int argc, const char *argv[] )
                 relax = true;
             else if( arg == "-z80_only" )
                 z80_only = true;
+            else if( arg == "-profile" && argc>=3 )
+            {
+                profile_fin = argv[argi+1];
+                argc--;
+                argi++;
+            }
             else if( arg == "-original_keep" )
                 original_switch = original_keep;
             else if( arg == "-original_discard" )
@@ -130,7 +148,7 @@ int main( int argc, const char *argv[] )
     std::string fout( argv[argi+1] );
     std::string asm_interface_fout = argc>=4 ? argv[argi+2] : fout + "-asm-interface.h";
     std::string report_fout = argc>=5 ? argv[argi+3] : fout + "-report.txt";
-    convert(relax,z80_only,fin,fout,report_fout,asm_interface_fout);
+    convert(relax,z80_only,fin,fout,report_fout,asm_interface_fout,profile_fin);
     return 0;
 }
 
@@ -389,8 +407,406 @@ static void parse( const std::string &line, statement &stmt )
     }
 }
 
-void convert( bool relax, bool z80_only, std::string fin, std::string fout, std::string report_fout, std::string asm_interface_fout )
+// Optional profile guided code layout (see -profile switch). The code is split into
+//  chunks, a chunk starts immediately after an unconditional transfer of control
+//  (RET, JP addr, JR addr) and ends with the next one. Nothing can fall through into
+//  a chunk, so a chunk can be moved without changing program behaviour. Chunks the
+//  profile says are cold are moved out of the way, to the end of the code, so that
+//  hot code is packed together. Hot loop heads (targets of backward jumps) are aligned
+struct layout_plan
 {
+    bool active=false;
+    std::vector<int> chunk_of_line;         // chunk number for each source line
+    std::set<int> cold_chunks;              // chunks to move to the end of the code
+    std::set<std::string> align_labels;     // hot loop heads to align
+    std::vector<std::string> report;        // for the report file
+};
+
+static bool layout_prepass( const std::string &fin, const std::string &profile_fin, layout_plan &plan )
+{
+    std::ifstream prof(profile_fin);
+    if( !prof )
+    {
+        printf( "Error; Cannot open profile file %s for reading\n", profile_fin.c_str() );
+        return false;
+    }
+
+    // Profile format is one "LABEL count" pair per line, ';' or '#' starts a comment line
+    std::map<std::string,unsigned long> counts;
+    unsigned long max_count = 0;
+    std::string line;
+    while( std::getline(prof,line) )
+    {
+        util::trim(line);
+        if( line.length()==0 || line[0]==';' || line[0]=='#' )
+            continue;
+        std::vector<std::string> fields;
+        util::split(line,fields);
+        if( fields.size() < 2 )
+        {
+            printf( "Error; Unexpected profile line [%s]\n", line.c_str() );
+            return false;
+        }
+        unsigned long count = strtoul( fields[1].c_str(), NULL, 10 );
+        counts[fields[0]] += count;
+        if( counts[fields[0]] > max_count )
+            max_count = counts[fields[0]];
+    }
+    if( max_count == 0 )
+    {
+        printf( "Error; Profile file %s has no non-zero counts\n", profile_fin.c_str() );
+        return false;
+    }
+    unsigned long hot_threshold = max_count/100;  // hot means at least 1% of the hottest label
+    if( hot_threshold == 0 )
+        hot_threshold = 1;
+
+    // Walk the source, tracking modes exactly as convert() does
+    std::ifstream in(fin);
+    if( !in )
+    {
+        printf( "Error; Cannot open file %s for reading\n", fin.c_str() );
+        return false;
+    }
+    enum { mode_normal, mode_x86, mode_z80, mode_not_z80 } mode = mode_normal;
+    bool data_mode = true;
+    int chunk = 0;
+    bool terminated = false;
+    std::set<std::string> defined;
+    std::map<int,std::string> chunk_first_label;
+    std::map<int,unsigned long> chunk_count;
+    std::set<int> pinned;
+    std::set<int> unknown;
+    std::set<std::string> backward_targets;
+    while( std::getline(in,line) )
+    {
+        util::rtrim(line);
+        std::string line_original = line;
+        util::replace_all(line,"\t"," ");
+        statement stmt;
+        parse( line, stmt );
+        std::string instruction = util::toupper(stmt.instruction);
+        if( stmt.label=="" && instruction.length()>0 && instruction[0]=='.' )
+        {
+            if( instruction == ".DATA" )
+                data_mode = true;
+            else if( instruction == ".CODE" )
+                data_mode = false;
+            else if( instruction == ".IF_Z80" )
+                mode = mode_z80;
+            else if( instruction == ".IF_X86" )
+                mode = mode_x86;
+            else if( instruction == ".ELSE" )
+                mode = (mode==mode_z80 ? mode_not_z80 : mode_z80);
+            else if( instruction == ".ENDIF" )
+                mode = mode_normal;
+        }
+
+        // A new chunk starts after an unconditional transfer of control
+        if( terminated && mode!=mode_z80 )
+        {
+            chunk++;
+            terminated = false;
+        }
+        plan.chunk_of_line.push_back(chunk);
+
+        // Pass through x86 segment and procedure structure must stay where it is
+        if( mode == mode_x86 )
+        {
+            std::vector<std::string> fields;
+            util::split(util::toupper(line),fields);
+            for( const std::string &f: fields )
+            {
+                if( f=="PROC" || f=="ENDP" || f=="SEGMENT" || f=="ENDS" || f=="END" || f=="MACRO" )
+                    pinned.insert(chunk);
+            }
+            continue;
+        }
+        if( mode==mode_z80 || (stmt.typ!=normal && stmt.typ!=equate) )
+            continue;
+        if( data_mode )
+        {
+            pinned.insert(chunk);
+            continue;
+        }
+        if( stmt.label != "" )
+        {
+            defined.insert(stmt.label);
+            if( chunk_first_label.find(chunk) == chunk_first_label.end() )
+                chunk_first_label[chunk] = stmt.label;
+            auto it = counts.find(stmt.label);
+            if( it != counts.end() )
+                chunk_count[chunk] += it->second;
+            else
+                unknown.insert(chunk);
+        }
+        size_t nbr = stmt.parameters.size();
+        if( instruction=="JP" || instruction=="JR" || instruction=="DJNZ" )
+        {
+            if( nbr>0 && defined.find(stmt.parameters[nbr-1]) != defined.end() )
+                backward_targets.insert(stmt.parameters[nbr-1]);
+        }
+        if( (instruction=="RET" && nbr==0) || ((instruction=="JP" || instruction=="JR") && nbr==1) )
+            terminated = true;
+    }
+
+    // The final chunk isn't terminated, so can't be moved. Neither can a chunk without
+    //  labels, since it can only be reached by falling into it. A label missing from the
+    //  profile is unknown rather than cold, so a profile should list every label, with
+    //  zero counts for labels never reached
+    pinned.insert(chunk);
+    for( int i=0; i<=chunk; i++ )
+    {
+        if( pinned.find(i)!=pinned.end() || unknown.find(i)!=unknown.end() ||
+            chunk_first_label.find(i)==chunk_first_label.end() )
+            continue;
+        if( chunk_count[i] == 0 )
+        {
+            plan.cold_chunks.insert(i);
+            plan.report.push_back( "Cold chunk moved to end of code: " + chunk_first_label[i] );
+        }
+    }
+    for( const std::string &s: backward_targets )
+    {
+        auto it = counts.find(s);
+        if( it != counts.end() && it->second >= hot_threshold )
+        {
+            plan.align_labels.insert(s);
+            plan.report.push_back( util::sprintf( "Hot loop head aligned: %s (count %lu)", s.c_str(), it->second ) );
+        }
+    }
+    plan.active = true;
+    return true;
+}
+
+// Static cost model, accumulated per label then rolled up into routines (labels that
+//  are CALL targets) for the report file
+struct label_cost
+{
+    std::string label;
+    unsigned int z80_instructions=0;
+    unsigned int z80_tstates=0;
+    unsigned int x86_instructions=0;
+    unsigned int flag_guards=0;
+    unsigned int macros=0;
+};
+
+enum z80_operand { op_none, op_r, op_special, op_hl_ind, op_idx_ind, op_bc_de_ind, op_sp_ind,
+                   op_nn_ind, op_hl, op_rr, op_idx, op_sp, op_af, op_n };
+
+static z80_operand z80_classify( const std::string &parm )
+{
+    std::string p = util::tolower(parm);
+    util::replace_all(p," ","");
+    if( p == "" )
+        return op_none;
+    if( p=="a" || p=="b" || p=="c" || p=="d" || p=="e" || p=="h" || p=="l" )
+        return op_r;
+    if( p=="i" || p=="r" )
+        return op_special;
+    if( p == "(hl)" )
+        return op_hl_ind;
+    if( util::prefix(p,"(ix") || util::prefix(p,"(iy") )
+        return op_idx_ind;
+    if( p=="(bc)" || p=="(de)" )
+        return op_bc_de_ind;
+    if( p == "(sp)" )
+        return op_sp_ind;
+    if( p[0] == '(' )
+        return op_nn_ind;
+    if( p == "hl" )
+        return op_hl;
+    if( p=="bc" || p=="de" )
+        return op_rr;
+    if( p=="ix" || p=="iy" )
+        return op_idx;
+    if( p == "sp" )
+        return op_sp;
+    if( p=="af" || p=="af'" )
+        return op_af;
+    return op_n;
+}
+
+// Z80 T-states for one instruction, from the Zilog Z80 CPU User Manual. Conditional
+//  jumps, calls and returns are costed as taken, DJNZ and CPIR as repeating
+static unsigned int z80_tstates( const std::string &instruction, const std::vector<std::string> &parameters )
+{
+    std::string ins = util::toupper(instruction);
+    size_t n = parameters.size();
+    z80_operand dst = n>0 ? z80_classify(parameters[0]) : op_none;
+    z80_operand src = n>1 ? z80_classify(parameters[1]) : op_none;
+    z80_operand last = n>0 ? z80_classify(parameters[n-1]) : op_none;
+    if( ins == "LD" )
+    {
+        if( dst == op_r )
+        {
+            switch( src )
+            {
+                case op_r:          return 4;
+                case op_special:    return 9;
+                case op_n:
+                case op_hl_ind:
+                case op_bc_de_ind:  return 7;
+                case op_nn_ind:     return 13;
+                case op_idx_ind:    return 19;
+                default:            break;
+            }
+        }
+        else if( dst==op_hl_ind || dst==op_bc_de_ind )
+            return src==op_n ? 10 : 7;
+        else if( dst == op_idx_ind )
+            return 19;
+        else if( dst == op_nn_ind )
+            return src==op_r ? 13 : (src==op_hl ? 16 : 20);
+        else if( dst==op_hl || dst==op_rr )
+            return src==op_nn_ind ? (dst==op_hl ? 16 : 20) : 10;
+        else if( dst == op_idx )
+            return src==op_nn_ind ? 20 : 14;
+        else if( dst == op_sp )
+            return src==op_idx ? 10 : (src==op_hl ? 6 : (src==op_nn_ind ? 20 : 10));
+        else if( dst == op_special )
+            return 9;
+        return 7;
+    }
+    if( ins=="ADD" || ins=="ADC" || ins=="SBC" )
+    {
+        if( dst == op_hl )
+            return ins=="ADD" ? 11 : 15;
+        if( dst == op_idx )
+            return 15;
+    }
+    if( ins=="ADD" || ins=="ADC" || ins=="SUB" || ins=="SBC" || ins=="AND" ||
+        ins=="OR"  || ins=="XOR" || ins=="CP" )
+    {
+        switch( last )
+        {
+            case op_r:          return 4;
+            case op_idx_ind:    return 19;
+            default:            return 7;
+        }
+    }
+    if( ins=="INC" || ins=="DEC" )
+    {
+        switch( dst )
+        {
+            case op_r:          return 4;
+            case op_hl_ind:     return 11;
+            case op_idx_ind:    return 23;
+            case op_idx:        return 10;
+            default:            return 6;
+        }
+    }
+    if( ins=="RLC" || ins=="RRC" || ins=="RL" || ins=="RR" ||
+        ins=="SLA" || ins=="SRA" || ins=="SRL" )
+        return last==op_r ? 8 : (last==op_hl_ind ? 15 : 23);
+    if( ins == "BIT" )
+        return last==op_r ? 8 : (last==op_hl_ind ? 12 : 20);
+    if( ins=="SET" || ins=="RES" )
+        return last==op_r ? 8 : (last==op_hl_ind ? 15 : 23);
+    if( ins == "PUSH" )
+        return dst==op_idx ? 15 : 11;
+    if( ins == "POP" )
+        return dst==op_idx ? 14 : 10;
+    if( ins == "EX" )
+        return dst==op_sp_ind ? (src==op_idx ? 23 : 19) : 4;
+    if( ins == "JP" )
+        return dst==op_hl_ind ? 4 : (dst==op_idx_ind ? 8 : 10);
+    if( ins == "JR" )
+        return 12;
+    if( ins == "DJNZ" )
+        return 13;
+    if( ins == "CALL" )
+        return 17;
+    if( ins == "RET" )
+        return n==0 ? 10 : 11;
+    if( ins=="NEG" || ins=="IM" )
+        return 8;
+    if( ins=="RLD" || ins=="RRD" )
+        return 18;
+    if( ins=="LDI" || ins=="LDD" || ins=="CPI" || ins=="CPD" )
+        return 16;
+    if( ins=="LDIR" || ins=="LDDR" || ins=="CPIR" || ins=="CPDR" )
+        return 21;
+    if( ins == "LDAR" )     // LD A,R
+        return 9;
+    return 4;   // RLA, RRA, RLCA, RRCA, EXX, DAA, CPL, CCF, SCF, NOP etc.
+}
+
+// Return the (upper case) mnemonic of an X86 instruction line, or "" if the line is a
+//  label, comment or assembler directive
+static std::string x86_mnemonic( const std::string &line )
+{
+    std::string s = line;
+    size_t offset = s.find(';');
+    if( offset != std::string::npos )
+        s = s.substr(0,offset);
+    std::vector<std::string> fields;
+    util::split(s,fields);
+    if( fields.size()>0 && util::suffix(fields[0],":") )
+        fields.erase(fields.begin());
+    if( fields.size() == 0 )
+        return "";
+    if( fields.size() >= 2 )
+    {
+        std::string second = util::toupper(fields[1]);
+        if( second=="MACRO" || second=="EQU" || second=="PROC" || second=="ENDP" ||
+            second=="SEGMENT" || second=="ENDS" || second=="=" )
+            return "";
+    }
+    std::string first = util::toupper(fields[0]);
+    static const std::set<std::string> directives =
+    {
+        "LOCAL", "ENDM", "IF", "ELSE", "ENDIF", "DB", "DW", "DD", "PUBLIC",
+        "EXTERN", "END", "ALIGN", "ORG"
+    };
+    if( first[0]=='.' || directives.find(first)!=directives.end() )
+        return "";
+    return first;
+}
+
+// Count the X86 instructions in translated code, expanding macros
+static void x86_cost( const std::string &out, const std::map<std::string,unsigned int> &macro_sizes, label_cost &cost )
+{
+    unsigned int nbr_lahf=0, nbr_sahf=0;
+    size_t start = 0;
+    while( start <= out.length() )
+    {
+        size_t offset = out.find('\n',start);
+        if( offset == std::string::npos )
+            offset = out.length();
+        std::string mnemonic = x86_mnemonic( out.substr(start,offset-start) );
+        start = offset+1;
+        if( mnemonic == "" )
+            continue;
+        auto it = macro_sizes.find(mnemonic);
+        if( it != macro_sizes.end() )
+        {
+            cost.macros++;
+            cost.x86_instructions += it->second;
+        }
+        else
+        {
+            cost.x86_instructions++;
+            if( mnemonic == "LAHF" )
+                nbr_lahf++;
+            else if( mnemonic == "SAHF" )
+                nbr_sahf++;
+        }
+    }
+
+    // A flag guard is a LAHF/SAHF pair wrapped around an instruction, (a lone LAHF
+    //  or SAHF is part of PUSH AF/POP AF emulation)
+    cost.flag_guards += (nbr_lahf<nbr_sahf ? nbr_lahf : nbr_sahf);
+}
+
+void convert( bool relax, bool z80_only, std::string fin, std::string fout, std::string report_fout, std::string asm_interface_fout, std::string profile_fin )
+{
+    layout_plan plan;
+    if( profile_fin != "" && !z80_only )
+    {
+        if( !layout_prepass( fin, profile_fin, plan ) )
+            return;
+    }
     std::ifstream in(fin);
     if( !in )
     {
@@ -453,6 +869,16 @@ void convert( bool relax, bool z80_only, std::string fin, std::string fout, std:
     bool data_mode = true;
     translate_init( relax );
 
+    // Static cost model, reported per routine at the end
+    std::vector<label_cost> costs(1);
+    costs[0].label = "(dispatch)";
+    std::set<std::string> call_targets;
+    std::vector<std::string> code_labels;
+    bool label_table_emitted = false;
+    std::map<std::string,unsigned int> macro_sizes;
+    std::string macro_being_defined;
+    bool z80_alternative = false;   // Z80 code in .IF_X86 .ELSE, replaced by X86 code
+
     // .IF controls let us switch between four modes
     enum { mode_normal, mode_x86, mode_z80, mode_not_z80 } mode = mode_normal;
 
@@ -489,11 +915,18 @@ void convert( bool relax, bool z80_only, std::string fin, std::string fout, std:
     */
 
     unsigned int track_location = 0;
+    unsigned int line_nbr = 0;
+    std::ostringstream cold_out;
     for(;;)
     {
         std::string line;
         if( !std::getline(in,line) )
             break;
+
+        // With a profile guided layout, cold chunks are diverted and emitted later
+        bool cold = plan.active && plan.cold_chunks.find(plan.chunk_of_line[line_nbr]) != plan.cold_chunks.end();
+        line_nbr++;
+        std::ostream &code_out = cold ? static_cast<std::ostream&>(cold_out) : static_cast<std::ostream&>(asm_out);
         util::rtrim(line);
         std::string line_original = line;
         util::replace_all(line,"\t"," ");
@@ -604,7 +1037,10 @@ void convert( bool relax, bool z80_only, std::string fin, std::string fout, std:
                 if( mode == mode_z80 )
                     mode = mode_not_z80;
                 else if( mode == mode_x86 )
+                {
                     mode = mode_z80;
+                    z80_alternative = true;
+                }
                 else
                     printf( "Error, unexpected .ELSE\n" );
                 handled = true;         
@@ -612,6 +1048,7 @@ void convert( bool relax, bool z80_only, std::string fin, std::string fout, std:
             else if( stmt.instruction == ".ENDIF" )
             {
                 mode = mode_normal;
+                z80_alternative = false;
                 handled = true;         
             }
         }
@@ -672,10 +1109,64 @@ void convert( bool relax, bool z80_only, std::string fin, std::string fout, std:
                 }
                 util::putline( h_out, h_line_out );
             }
-            util::putline( asm_out, line_original );
+
+            // Cold code goes at the end of the code, which is just before "_sargon ENDP"
+            if( !cold && cold_out.tellp()>0 && util::toupper(line_original).find("ENDP")!=std::string::npos )
+            {
+                util::putline( asm_out, ";" );
+                util::putline( asm_out, "; Cold code, moved here by profile guided layout" );
+                util::putline( asm_out, ";" );
+                asm_out << cold_out.str();
+                cold_out.str("");
+            }
+
+            // Code label addresses also go at the end of the code
+            if( !cold && !label_table_emitted && util::toupper(line_original).find("ENDP")!=std::string::npos )
+            {
+                label_table_asm( asm_out, code_labels );
+                label_table_emitted = true;
+            }
+            util::putline( code_out, line_original );
+
+            // Static cost of X86 code, macro bodies are costed where they are used
+            std::vector<std::string> fields;
+            util::split( line_original.substr(0,line_original.find(';')), fields );
+            if( fields.size()>=2 && util::toupper(fields[1])=="MACRO" )
+            {
+                macro_being_defined = util::toupper(fields[0]);
+                if( macro_sizes.find(macro_being_defined) != macro_sizes.end() )
+                    macro_being_defined = "";   // keep the first definition only
+                else
+                    macro_sizes[macro_being_defined] = 0;
+            }
+            else if( fields.size()>=1 && util::toupper(fields[0])=="ENDM" )
+                macro_being_defined = "";
+            else if( !data_mode )
+            {
+                std::string mnemonic = x86_mnemonic(line_original);
+                if( mnemonic != "" )
+                {
+                    if( macro_being_defined != "" )
+                        macro_sizes[macro_being_defined]++;
+                    else
+                    {
+                        costs.back().x86_instructions++;
+                        if( mnemonic=="CALL" && fields.size()>=2 )
+                            call_targets.insert(fields[fields.size()-1]);
+                    }
+                }
+            }
             continue;
         }
 
+        // Original Z80 code replaced by X86 code still counts towards the Z80 cost
+        if( mode==mode_z80 && z80_alternative && !handled && !data_mode &&
+            stmt.typ==normal && stmt.instruction!="" )
+        {
+            costs.back().z80_instructions++;
+            costs.back().z80_tstates += z80_tstates( stmt.instruction, stmt.parameters );
+        }
+
         if( mode == mode_z80  )
             continue;
 
@@ -685,17 +1176,17 @@ void convert( bool relax, bool z80_only, std::string fin, std::string fout, std:
             case empty:
                 line_original = "";
                 line_original = detabify(line_original);
-                util::putline( asm_out, line_original );
+                util::putline( code_out, line_original );
                 break;
             case comment_only:
                 line_original = ";" + stmt.comment;
                 line_original = detabify(line_original);
-                util::putline( asm_out, line_original );
+                util::putline( code_out, line_original );
                 break;
             case comment_only_indented:
                 line_original = "\t;" + stmt.comment;
                 line_original = detabify(line_original, true );
-                util::putline( asm_out, line_original );
+                util::putline( code_out, line_original );
                 break;
         }
         if( stmt.typ!=normal && stmt.typ!=equate )
@@ -708,12 +1199,12 @@ void convert( bool relax, bool z80_only, std::string fin, std::string fout, std:
         {
             case original_comment_out:
             {
-                util::putline( asm_out, detabify( ";" + line_original) );
+                util::putline( code_out, detabify( ";" + line_original) );
                 break;
             }
             case original_keep:
             {
-                util::putline( asm_out, detabify(line_original) );
+                util::putline( code_out, detabify(line_original) );
                 break;
             }
             default:
@@ -723,6 +1214,15 @@ void convert( bool relax, bool z80_only, std::string fin, std::string fout, std:
 
         // Generate code
         {
+            if( !data_mode && stmt.label!="" && plan.align_labels.find(stmt.label)!=plan.align_labels.end() )
+                util::putline( code_out, detabify("\tALIGN\t16") );
+            if( !data_mode && stmt.label!="" )
+            {
+                label_cost cost;
+                cost.label = stmt.label;
+                costs.push_back(cost);
+                code_labels.push_back(stmt.label);
+            }
             std::string str_location = util::sprintf( "0%xh", track_location );
             std::string asm_line_out;
             if( stmt.equate != "" )
@@ -894,6 +1394,7 @@ void convert( bool relax, bool z80_only, std::string fin, std::string fout, std:
                         asm_line_out += "\t;";
                         asm_line_out += stmt.comment;
                     }
+                    x86_cost( stmt.instruction, macro_sizes, costs.back() );
                 }
 
                 // Else do code translation
@@ -901,6 +1402,14 @@ void convert( bool relax, bool z80_only, std::string fin, std::string fout, std:
                 {
                     generated = translate_x86( line_original, stmt.instruction, stmt.parameters, labels, out );
                     show_original = !generated;
+                    if( generated && !data_mode )
+                    {
+                        costs.back().z80_instructions++;
+                        costs.back().z80_tstates += z80_tstates( stmt.instruction, stmt.parameters );
+                        x86_cost( out, macro_sizes, costs.back() );
+                        if( util::toupper(stmt.instruction)=="CALL" && stmt.parameters.size()>0 )
+                            call_targets.insert( stmt.parameters[stmt.parameters.size()-1] );
+                    }
                 }
                 if( show_original )
                 {
@@ -941,11 +1450,67 @@ void convert( bool relax, bool z80_only, std::string fin, std::string fout, std:
                 }
             }
             asm_line_out = detabify(asm_line_out, true );
-            util::putline( asm_out, asm_line_out );
+            util::putline( code_out, asm_line_out );
         }
     }
+    if( label_table_emitted )
+        label_table_h( h_out, code_labels, call_targets );
     util::putline( h_out, "};" );
     util::putline( h_out, "#endif //SARGON_ASM_INTERFACE_H_INCLUDED" );
+    if( cold_out.tellp() > 0 )
+    {
+        printf( "Error; Profile guided layout found no _sargon ENDP to place cold code before\n" );
+        asm_out << cold_out.str();
+    }
+
+    // Static cost report, roll up labels into routines (CALL targets)
+    std::vector<label_cost> routines;
+    for( const label_cost &cost: costs )
+    {
+        if( routines.size()==0 || call_targets.find(cost.label)!=call_targets.end() )
+            routines.push_back(cost);
+        else
+        {
+            label_cost &r = routines.back();
+            r.z80_instructions += cost.z80_instructions;
+            r.z80_tstates      += cost.z80_tstates;
+            r.x86_instructions += cost.x86_instructions;
+            r.flag_guards      += cost.flag_guards;
+            r.macros           += cost.macros;
+        }
+    }
+    std::sort( routines.begin(), routines.end(),
+        [](const label_cost &a, const label_cost &b) { return a.x86_instructions > b.x86_instructions; } );
+    util::putline(report_out,"\nSTATIC COST PER ROUTINE\n");
+    util::putline(report_out,"Z80 T-states assume conditional jumps, calls and returns are taken. X86 counts");
+    util::putline(report_out,"include expanded macro bodies. Guards are LAHF/SAHF pairs. Columns are white space");
+    util::putline(report_out,"separated so the table can be re-sorted with sort -k, eg sort -k6 -n -r\n");
+    util::putline(report_out,util::sprintf( "%-12s %8s %8s %8s %8s %8s %8s", "ROUTINE", "Z80-INS", "T-STATES", "X86-INS", "X86/Z80", "GUARDS", "MACROS" ) );
+    label_cost total;
+    for( const label_cost &r: routines )
+    {
+        util::putline(report_out,util::sprintf( "%-12s %8u %8u %8u %8.2f %8u %8u", r.label.c_str(),
+            r.z80_instructions, r.z80_tstates, r.x86_instructions,
+            r.z80_instructions ? (double)r.x86_instructions/r.z80_instructions : 0.0,
+            r.flag_guards, r.macros ) );
+        total.z80_instructions += r.z80_instructions;
+        total.z80_tstates      += r.z80_tstates;
+        total.x86_instructions += r.x86_instructions;
+        total.flag_guards      += r.flag_guards;
+        total.macros           += r.macros;
+    }
+    util::putline(report_out,util::sprintf( "%-12s %8u %8u %8u %8.2f %8u %8u", "(total)",
+        total.z80_instructions, total.z80_tstates, total.x86_instructions,
+        total.z80_instructions ? (double)total.x86_instructions/total.z80_instructions : 0.0,
+        total.flag_guards, total.macros ) );
+
+    // Profile guided layout report
+    if( plan.active )
+    {
+        util::putline(report_out,"\nLAYOUT\n");
+        for( const std::string &s: plan.report )
+            util::putline(report_out,s);
+    }
 
     // Summary report
     util::putline(report_out,"\nLABELS\n");
@@ -1056,6 +1621,38 @@ enum ParameterPattern
     none
 };
 
+// Emitted just before "_sargon ENDP", so the table is inside the PROC with the
+//  labels it refers to, and its own address marks the end of the code
+static void label_table_asm( std::ostream &asm_out, const std::vector<std::string> &code_labels )
+{
+    util::putline( asm_out, ";" );
+    util::putline( asm_out, "; Code label addresses, for profiling (names in sargon-asm-interface.h)" );
+    util::putline( asm_out, ";" );
+    util::putline( asm_out, "PUBLIC   _sargon_label_addresses" );
+    util::putline( asm_out, "_sargon_label_addresses:" );
+    for( const std::string &label: code_labels )
+        util::putline( asm_out, detabify( "\tDD\t" + label ) );
+}
+
+static void label_table_h( std::ostream &h_out, const std::vector<std::string> &code_labels, const std::set<std::string> &call_targets )
+{
+    util::putline( h_out, "" );
+    util::putline( h_out, "    // Code labels, for profiling. The assembly language exports the address of" );
+    util::putline( h_out, "    //  each label in the same order, routine is true for CALL targets" );
+    util::putline( h_out, "    extern uint32_t sargon_label_addresses[];" );
+    util::putline( h_out, "    struct sargon_label { const char *name; bool routine; };" );
+    util::putline( h_out, util::sprintf( "    const int sargon_nbr_labels = %d;", static_cast<int>(code_labels.size()) ) );
+    util::putline( h_out, "    const sargon_label sargon_labels[] =" );
+    util::putline( h_out, "    {" );
+    for( size_t i=0; i<code_labels.size(); i++ )
+    {
+        bool routine = call_targets.find(code_labels[i]) != call_targets.end();
+        util::putline( h_out, util::sprintf( "        { \"%s\", %s }%s", code_labels[i].c_str(),
+                                routine ? "true" : "false", i+1<code_labels.size() ? "," : "" ) );
+    }
+    util::putline( h_out, "    };" );
+}
+
 static int skip_counter=1;
 
 struct MnemonicConversion
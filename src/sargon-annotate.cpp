@@ -0,0 +1,560 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-annotate.cpp
+ *       Batch PGN annotation, Sargon's score and PV for every position
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+/*
+
+  The input is read one game at a time, so only the current game is ever in
+  memory. Each game is written out again with its tags unchanged, but with
+  movetext regenerated from the moves; the original comments, NAGs and
+  variations are dropped, and every move is followed by a comment like
+  {+0.25/5 Nf3 d5 c4}, Sargon's score from White's point of view (or #n,
+  #-n for a mate), PLYMAX and PV, for the position before the move.
+
+  Every position is looked up in the analysis cache first, and stored after
+  it is searched, so repeated positions (and transpositions) are searched
+  once only. The cache is a memory mapped file, which makes it the shared
+  hash map between worker processes too. Sargon has one global memory
+  image, so running on several cores means several processes; each worker
+  annotates every n'th game into its own part file, then the parts are
+  merged back into the original game order.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <setjmp.h>
+#include <string>
+#include <vector>
+#include "util.h"
+#include "thc.h"
+#include "sargon-interface.h"
+#include "sargon-asm-interface.h"
+#include "sargon-pv.h"
+#include "sargon-profile.h"
+#include "sargon-cache.h"
+#include "sargon-annotate.h"
+
+#if defined(_WIN32)
+#define popen  _popen
+#define pclose _pclose
+#endif
+
+#define ANNOTATE_DEFAULT_DEPTH      5
+#define ANNOTATE_MAX_DEPTH          20
+#define ANNOTATE_CACHE_MEGABYTES    256
+#define ANNOTATE_LINE_LENGTH        79
+
+// The iteration in progress, and its node limit, for callback()
+static bool searching;
+static jmp_buf jmp_buf_env;
+static unsigned long iteration_nodes_limit;     // 0 = no limit
+
+struct PGN_READER
+{
+    FILE        *f;
+    std::string pending;
+    bool        have_pending;
+    PGN_READER( FILE *file ) : f(file), have_pending(false) {}
+};
+
+struct PGN_GAME
+{
+    std::vector<std::string> tags;
+    std::string              movetext;
+};
+
+struct ANNOTATE_COUNTS
+{
+    unsigned long games;
+    unsigned long positions;
+    unsigned long searched;     // positions not found in the cache
+    ANNOTATE_COUNTS() : games(0), positions(0), searched(0) {}
+};
+
+static bool annotate_games( const std::string &in_file, const std::string &out_file, int worker,
+                            const ANNOTATE_OPTIONS &options, ANNOTATE_COUNTS &counts, std::string &error );
+static bool read_line( PGN_READER &reader, std::string &line );
+static bool read_game( PGN_READER &reader, PGN_GAME &game );
+static void write_game( FILE *out, const PGN_GAME &game );
+static void annotate_game( const PGN_GAME &game, const ANNOTATE_OPTIONS &options, FILE *out,
+                           ANNOTATE_COUNTS &counts );
+static bool parse_movetext( const std::string &movetext, thc::ChessRules &cr,
+                            std::vector<thc::Move> &moves, std::string &result, std::string &bad );
+static void analyse( const thc::ChessPosition &cp, const ANNOTATE_OPTIONS &options, PV &pv,
+                     ANNOTATE_COUNTS &counts );
+static bool run_iteration( const thc::ChessPosition &cp, int plymax, PV &pv );
+static std::string make_comment( const thc::ChessRules &cr, const PV &pv );
+static void wrap( FILE *out, std::string &line, const std::string &text );
+
+bool sargon_annotate( const std::string &self, const std::string &in_file,
+                      const std::string &out_file, const ANNOTATE_OPTIONS &options,
+                      std::string &error )
+{
+    // The cache does the deduplication, so we always need one
+    std::string cache_file = options.cache_file;
+    bool temporary_cache = (cache_file == "");
+    if( temporary_cache )
+        cache_file = out_file + ".cache";
+    if( !sargon_cache_open(cache_file,ANNOTATE_CACHE_MEGABYTES) )
+    {
+        error = util::sprintf( "Error; cannot open cache file %s", cache_file.c_str() );
+        return false;
+    }
+    ANNOTATE_COUNTS counts;
+    bool ok = true;
+
+    // Annotate the games here
+    if( options.jobs <= 1 )
+    {
+        ok = annotate_games( in_file, out_file, 0, options, counts, error );
+        sargon_cache_close();
+    }
+
+    // Or start the workers (the cache file is initialised now, so the workers
+    //  can share it), wait for them, then merge their part files
+    else
+    {
+        sargon_cache_close();
+        std::vector<FILE *> pipes;
+        for( int worker=0; ok && worker<options.jobs; worker++ )
+        {
+            std::string cmd = util::sprintf( "\"%s\" -annotate \"%s\" \"%s.part%d\" -worker %d/%d -depth %d -nodes %lu -cache \"%s\"",
+                                self.c_str(), in_file.c_str(), out_file.c_str(), worker, worker, options.jobs,
+                                options.depth, options.nodes, cache_file.c_str() );
+        #if defined(_WIN32)
+            cmd = "\"" + cmd + "\"";    // cmd.exe strips the outer quotes
+        #endif
+            FILE *f = popen( cmd.c_str(), "r" );
+            if( !f )
+            {
+                error = util::sprintf( "Error; cannot start worker process %s", cmd.c_str() );
+                ok = false;
+            }
+            else
+                pipes.push_back(f);
+        }
+        for( FILE *f: pipes )
+        {
+            char buf[256];
+            while( fgets(buf,sizeof(buf),f) )
+            {
+                unsigned long games, positions, searched;
+                if( 3 == sscanf_s(buf,"annotate-counts games %lu positions %lu searched %lu",&games,&positions,&searched) )
+                {
+                    counts.games     += games;
+                    counts.positions += positions;
+                    counts.searched  += searched;
+                }
+            }
+            if( pclose(f) != 0 && ok )
+            {
+                error = "Error; a worker process failed";
+                ok = false;
+            }
+        }
+
+        // Worker k has games k, k+jobs, k+2*jobs ..., so take one game from
+        //  each part in turn
+        std::vector<FILE *> parts;
+        FILE *out = NULL;
+        if( ok && fopen_s(&out,out_file.c_str(),"wb") )
+        {
+            error = util::sprintf( "Error; cannot write %s", out_file.c_str() );
+            ok = false;
+        }
+        for( int worker=0; ok && worker<options.jobs; worker++ )
+        {
+            FILE *f;
+            std::string part = util::sprintf( "%s.part%d", out_file.c_str(), worker );
+            if( fopen_s(&f,part.c_str(),"rb") )
+            {
+                error = util::sprintf( "Error; cannot read %s", part.c_str() );
+                ok = false;
+            }
+            else
+                parts.push_back(f);
+        }
+        if( ok )
+        {
+            std::vector<PGN_READER> readers;
+            for( FILE *f: parts )
+                readers.push_back( PGN_READER(f) );
+            for( bool more=true; more; )
+            {
+                more = false;
+                for( PGN_READER &reader: readers )
+                {
+                    PGN_GAME game;
+                    if( read_game(reader,game) )
+                    {
+                        write_game( out, game );
+                        more = true;
+                    }
+                }
+            }
+        }
+        for( FILE *f: parts )
+            fclose(f);
+        if( out )
+            fclose(out);
+        for( int worker=0; worker<options.jobs; worker++ )
+            remove( util::sprintf("%s.part%d",out_file.c_str(),worker).c_str() );
+    }
+    if( temporary_cache )
+        remove( cache_file.c_str() );
+    printf( "Annotated %lu games, %lu positions, %lu searched (the rest were repeats)\n",
+                counts.games, counts.positions, counts.searched );
+    return ok;
+}
+
+bool sargon_annotate_worker( const std::string &in_file, const std::string &out_file,
+                             int worker, const ANNOTATE_OPTIONS &options,
+                             std::string &error )
+{
+    if( !sargon_cache_open(options.cache_file,ANNOTATE_CACHE_MEGABYTES) )
+    {
+        error = util::sprintf( "Error; cannot open cache file %s", options.cache_file.c_str() );
+        return false;
+    }
+    ANNOTATE_COUNTS counts;
+    bool ok = annotate_games( in_file, out_file, worker, options, counts, error );
+    sargon_cache_close();
+    printf( "annotate-counts games %lu positions %lu searched %lu\n", counts.games, counts.positions, counts.searched );
+    return ok;
+}
+
+// Stream the input, annotating every jobs'th game from game worker
+static bool annotate_games( const std::string &in_file, const std::string &out_file, int worker,
+                            const ANNOTATE_OPTIONS &options, ANNOTATE_COUNTS &counts, std::string &error )
+{
+    FILE *in, *out;
+    if( fopen_s(&in,in_file.c_str(),"rb") )
+    {
+        error = util::sprintf( "Error; cannot read %s", in_file.c_str() );
+        return false;
+    }
+    if( fopen_s(&out,out_file.c_str(),"wb") )
+    {
+        fclose(in);
+        error = util::sprintf( "Error; cannot write %s", out_file.c_str() );
+        return false;
+    }
+    int jobs = options.jobs>1 ? options.jobs : 1;
+    PGN_READER reader(in);
+    PGN_GAME game;
+    for( unsigned long idx=0; read_game(reader,game); idx++ )
+    {
+        if( static_cast<int>(idx%jobs) != worker )
+            continue;
+        annotate_game( game, options, out, counts );
+        counts.games++;
+        if( counts.games%100 == 0 )
+        {
+            printf( "%lu games\n", counts.games );
+            fflush( stdout );
+        }
+    }
+    fclose(in);
+    fclose(out);
+    return true;
+}
+
+// Read a line of any length, without the line ending
+static bool read_line( PGN_READER &reader, std::string &line )
+{
+    if( reader.have_pending )
+    {
+        line = reader.pending;
+        reader.have_pending = false;
+        return true;
+    }
+    line.clear();
+    char buf[1024];
+    bool got = false;
+    while( fgets(buf,sizeof(buf),reader.f) )
+    {
+        got = true;
+        line += buf;
+        if( line.length()>0 && line[line.length()-1]=='\n' )
+            break;
+    }
+    while( line.length()>0 && (line[line.length()-1]=='\n' || line[line.length()-1]=='\r') )
+        line.pop_back();
+    return got;
+}
+
+// Read the tags and movetext of the next game, false at end of file
+static bool read_game( PGN_READER &reader, PGN_GAME &game )
+{
+    game.tags.clear();
+    game.movetext.clear();
+    bool in_movetext = false;
+    std::string line;
+    while( read_line(reader,line) )
+    {
+        util::trim(line);
+        if( line.length() == 0 )
+        {
+            if( in_movetext )
+                return true;
+        }
+        else if( line[0] == '[' )
+        {
+            if( in_movetext )
+            {
+                reader.pending = line;     // tags of the next game
+                reader.have_pending = true;
+                return true;
+            }
+            game.tags.push_back(line);
+        }
+        else if( line[0] != '%' )           // PGN escape
+        {
+            in_movetext = true;
+            game.movetext += line;
+            game.movetext += "\n";
+        }
+    }
+    return game.tags.size()>0 || in_movetext;
+}
+
+static void write_game( FILE *out, const PGN_GAME &game )
+{
+    for( const std::string &tag: game.tags )
+        fprintf( out, "%s\n", tag.c_str() );
+    fprintf( out, "\n%s\n", game.movetext.c_str() );
+}
+
+static void annotate_game( const PGN_GAME &game, const ANNOTATE_OPTIONS &options, FILE *out,
+                           ANNOTATE_COUNTS &counts )
+{
+    thc::ChessRules cr;
+    std::string result = "*";
+    for( const std::string &tag: game.tags )
+    {
+        size_t start = tag.find('"');
+        size_t end   = tag.rfind('"');
+        if( start==std::string::npos || end<=start )
+            continue;
+        std::string value = tag.substr( start+1, end-start-1 );
+        if( util::prefix(tag,"[FEN ") )
+            cr.Forsyth( value.c_str() );
+        else if( util::prefix(tag,"[Result ") )
+            result = value;
+    }
+    thc::ChessRules start = cr;
+    std::vector<thc::Move> moves;
+    std::string movetext_result, bad;
+    bool ok = parse_movetext( game.movetext, cr, moves, movetext_result, bad );
+    if( movetext_result != "" )
+        result = movetext_result;
+
+    // Tags unchanged, then the annotated moves
+    for( const std::string &tag: game.tags )
+        fprintf( out, "%s\n", tag.c_str() );
+    fprintf( out, "\n" );
+    std::string line;
+    cr = start;
+    for( thc::Move mv: moves )
+    {
+        PV pv;
+        analyse( cr, options, pv, counts );
+        if( cr.white )
+            wrap( out, line, util::sprintf("%d.",cr.full_move_count) );
+        else
+            wrap( out, line, util::sprintf("%d...",cr.full_move_count) );
+        wrap( out, line, mv.NaturalOut(&cr) );
+        wrap( out, line, make_comment(cr,pv) );
+        cr.PlayMove(mv);
+    }
+    if( !ok )
+        wrap( out, line, util::sprintf("{Cannot read move %s, rest of game skipped}",bad.c_str()) );
+    wrap( out, line, result );
+    fprintf( out, "%s\n\n", line.c_str() );
+}
+
+// Moves of the main line, skipping comments, variations, NAGs and move numbers
+static bool parse_movetext( const std::string &movetext, thc::ChessRules &cr,
+                            std::vector<thc::Move> &moves, std::string &result, std::string &bad )
+{
+    size_t len = movetext.length();
+    int variation_depth = 0;
+    for( size_t i=0; i<len; )
+    {
+        char c = movetext[i];
+        if( c == '{' )
+        {
+            size_t end = movetext.find( '}', i );
+            i = (end==std::string::npos ? len : end+1);
+        }
+        else if( c == ';' )
+        {
+            size_t end = movetext.find( '\n', i );
+            i = (end==std::string::npos ? len : end+1);
+        }
+        else if( c == '(' )
+        {
+            variation_depth++;
+            i++;
+        }
+        else if( c == ')' )
+        {
+            if( variation_depth > 0 )
+                variation_depth--;
+            i++;
+        }
+        else if( isspace(static_cast<unsigned char>(c)) )
+            i++;
+        else
+        {
+            size_t end = movetext.find_first_of( " \t\r\n{};()", i );
+            if( end == std::string::npos )
+                end = len;
+            std::string token = movetext.substr( i, end-i );
+            i = end;
+            if( variation_depth>0 || token[0]=='$' )
+                continue;
+            if( token=="1-0" || token=="0-1" || token=="1/2-1/2" || token=="*" )
+            {
+                result = token;
+                continue;
+            }
+
+            // Move number, possibly run into the move, eg "12." "12..." "12.e4"
+            size_t skip = 0;
+            while( skip<token.length() && isdigit(static_cast<unsigned char>(token[skip])) )
+                skip++;
+            if( skip>0 && skip<token.length() && token[skip]=='.' )
+            {
+                while( skip<token.length() && token[skip]=='.' )
+                    skip++;
+                token = token.substr(skip);
+            }
+            while( token.length()>0 && strchr("!?+#",token[token.length()-1]) )
+                token.pop_back();
+            if( token.length() == 0 )
+                continue;
+            thc::Move mv;
+            if( !mv.NaturalIn(&cr,token.c_str()) )
+            {
+                bad = token;
+                return false;
+            }
+            moves.push_back(mv);
+            cr.PlayMove(mv);
+        }
+    }
+    return true;
+}
+
+// Search to the fixed depth, or with increasing depth until the node budget
+//  is used up, looking in the cache before every search. An iteration that
+//  runs out of nodes is abandoned part way through (see callback()) and the
+//  PV from the last completed iteration is kept
+static void analyse( const thc::ChessPosition &cp, const ANNOTATE_OPTIONS &options, PV &pv,
+                     ANNOTATE_COUNTS &counts )
+{
+    int max_depth = options.depth;
+    if( max_depth <= 0 )
+        max_depth = options.nodes>0 ? ANNOTATE_MAX_DEPTH : ANNOTATE_DEFAULT_DEPTH;
+    else if( max_depth > ANNOTATE_MAX_DEPTH )
+        max_depth = ANNOTATE_MAX_DEPTH;
+    int plymax = options.nodes>0 ? 1 : max_depth;
+    unsigned long total = 0;
+    bool searched = false;
+    for( ; plymax<=max_depth; plymax++ )
+    {
+        unsigned long nodes;
+        if( !sargon_cache_lookup(cp,plymax,pv,nodes) )
+        {
+            sargon_nodes_clear();
+            iteration_nodes_limit = options.nodes>0 ? options.nodes-total : 0;
+            bool completed = run_iteration( cp, plymax, pv );
+            searched = true;
+            if( !completed )
+                break;  // pv is still the last completed iteration's
+            nodes = sargon_nodes();
+            sargon_cache_store( cp, plymax, pv, nodes );
+        }
+        total += nodes;
+        if( options.nodes>0 && total>=options.nodes )
+            break;
+    }
+    counts.positions++;
+    if( searched )
+        counts.searched++;
+}
+
+// Run one iteration, returns false if it was abandoned because the node
+//  budget ran out, in which case pv is unchanged
+static bool run_iteration( const thc::ChessPosition &cp, int plymax, PV &pv )
+{
+    if( setjmp(jmp_buf_env) )
+    {
+        searching = false;
+        sargon_perf_end();  // longjmp() bypassed the normal end of measurement
+        sargon_profile_leave();
+        return false;
+    }
+    searching = true;
+    sargon_run_engine( cp, plymax, pv, true );  // avoid_book = true, we want a search
+    searching = false;
+    return true;
+}
+
+void sargon_annotate_callback_after_genmov()
+{
+    // PLYMAX 1 is always completed, it's effectively instantaneous and gives
+    //  us a move
+    if( searching && iteration_nodes_limit && sargon_nodes()>=iteration_nodes_limit && peekb(PLYMAX)>1 )
+        longjmp( jmp_buf_env, 1 );
+}
+
+// eg "{+0.25/5 Nf3 d5 c4}", or "{#-2/4 ...}" if Black mates in two
+static std::string make_comment( const thc::ChessRules &cr, const PV &pv )
+{
+    thc::ChessRules temp = cr;
+    std::string moves;
+    std::string score = util::sprintf( "%+.2f", pv.value/100.0 );
+    for( size_t i=0; i<pv.variation.size(); i++ )
+    {
+        thc::Move mv = pv.variation[i];
+        moves += " " + mv.NaturalOut(&temp);
+        temp.PlayMove(mv);
+        thc::TERMINAL terminal;
+        if( temp.Evaluate(terminal) && (terminal==thc::TERMINAL_WCHECKMATE || terminal==thc::TERMINAL_BCHECKMATE) )
+        {
+            int mate = static_cast<int>(i+2)/2;
+            score = util::sprintf( "#%d", terminal==thc::TERMINAL_BCHECKMATE ? mate : 0-mate );
+            break;
+        }
+    }
+    return util::sprintf( "{%s/%d%s}", score.c_str(), pv.depth, moves.c_str() );
+}
+
+// Add text to the line, a word at a time, writing out full lines
+static void wrap( FILE *out, std::string &line, const std::string &text )
+{
+    std::vector<std::string> words;
+    util::split( text, words );
+    for( const std::string &word: words )
+    {
+        if( line.length()>0 && line.length()+1+word.length() > ANNOTATE_LINE_LENGTH )
+        {
+            fprintf( out, "%s\n", line.c_str() );
+            line.clear();
+        }
+        if( line.length() > 0 )
+            line += " ";
+        line += word;
+    }
+}
@@ -0,0 +1,48 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-annotate.h
+ *       Batch PGN annotation, Sargon's score and PV for every position
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+#ifndef SARGON_ANNOTATE_H_INCLUDED
+#define SARGON_ANNOTATE_H_INCLUDED
+
+#include <string>
+
+struct ANNOTATE_OPTIONS
+{
+    int           depth;        // maximum PLYMAX, 0 = 5 (or 20 with a node budget)
+    unsigned long nodes;        // node budget per position, 0 = none
+    int           jobs;         // worker processes
+    std::string   cache_file;   // "" = a temporary cache next to the output
+    ANNOTATE_OPTIONS() : depth(0), nodes(0), jobs(1) {}
+};
+
+// Annotate every game in a PGN file, writing each move followed by a
+//  comment with Sargon's score (White's point of view) and PV for the
+//  position before the move. Games are streamed, so the file can be any
+//  size. Positions are looked up in the analysis cache (sargon-cache.h)
+//  before being searched, so transpositions are only searched once. With
+//  jobs > 1 the games are shared between that many worker processes (each
+//  a copy of this program, self, started with the -worker option), sharing
+//  the same cache file. Returns false with an error message on failure
+bool sargon_annotate( const std::string &self, const std::string &in_file,
+                      const std::string &out_file, const ANNOTATE_OPTIONS &options,
+                      std::string &error );
+
+// Worker process, annotate every jobs'th game starting with game worker
+//  (0 based)
+bool sargon_annotate_worker( const std::string &in_file, const std::string &out_file,
+                             int worker, const ANNOTATE_OPTIONS &options,
+                             std::string &error );
+
+// The program's callback() must call this for each "after GENMOV()"
+//  callback, it abandons (longjmp()s out of) an iteration over the node budget
+void sargon_annotate_callback_after_genmov();
+
+#endif // SARGON_ANNOTATE_H_INCLUDED
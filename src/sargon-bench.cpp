@@ -0,0 +1,427 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-bench.cpp
+ *       Fixed depth benchmark, shared by sargon-engine and sargon-tests
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <sched.h>
+#endif
+#include "util.h"
+#include "thc.h"
+#include "sargon-asm-interface.h"
+#include "sargon-interface.h"
+#include "sargon-pv.h"
+#include "sargon-bench.h"
+
+// The bench positions are the non book positions from the tests[] table in
+//  sargon-tests.cpp (each distinct position once). Don't change them, or the
+//  node count signature changes
+static const char *bench_positions[] =
+{
+    "1r2kb1r/2pbpqp1/p1p2p2/2P2P2/2PP2P1/5N2/P3Q3/R1B2RK1 b k - 0 20",
+    "r1b2rk1/p3q3/5n2/2pp2p1/2p2p2/P1P2P2/2PBPQP1/1R2KB1R w K - 0 20",
+    "r4rk1/pb1pq1pp/5p2/2ppP3/5P2/2Q5/PPP3PP/2KR1B1R w - c6 0 15",
+    "r1b3kr/pp1R3p/3q2n1/3B4/8/3Q2P1/PP2PP2/R1B1K3 b Q - 0 21",
+    "2r1r1k1/p3q1pp/bp1pp3/8/2B5/4P3/PP2QPPP/2R2RK1 b - - 0 1",
+    "r4rk1/pR3p1p/8/5p2/2Bp4/5P2/PPP1KPP1/7R w - - 0 18",
+    "q1k2b1r/pp4pp/2n1b3/5p2/2P2B2/3QPP1N/PP4PP/R3K2R w KQ - 1 15",
+    "r2n2k1/5ppp/6q1/5N2/b7/1P6/3Q1PPP/3R2K1 w - - 0 1",
+    "2r1nrk1/5pbp/1p2p1p1/8/p2B4/PqNR2P1/1P3P1P/1Q1R2K1 w - - 0 1",
+    "3r2k1/1pq2ppp/pb1pp1b1/8/3B4/2N5/PPP1QPPP/4R1K1 w - - 0 1",
+    "r4r2/6kp/2pqppp1/p1R5/b2P4/4QN2/1P3PPP/2R3K1 w - - 0 1",
+    "6B1/2N5/7p/pR4p1/1b2P3/2N1kP2/PPPR2PP/2K5 w - - 0 34",
+    "2rq1r1k/3npp1p/3p1n1Q/pp1P2N1/8/2P4P/1P4P1/R4R1K w - - 0 1",
+    "8/8/q2pk3/2p5/8/3N4/8/4K2R w K - 0 1",
+    "3k4/8/8/7P/8/8/1p6/1K6 w - - 0 1"
+};
+
+// Output format is one line per position, then a summary line;
+//  bench position 1 depth 5 nodes 123456 time 45 bestmove e8d8
+//  ...
+//  bench depth 5 positions 15 nodes 2345678 time 987 nps 2376573
+BENCH sargon_bench( int depth, void (*print)( const std::string &line ),
+                    bool (*search)( const thc::ChessPosition &cp, int plymax, PV &pv ) )
+{
+    BENCH bench;
+    bench.depth = depth>0 ? depth : BENCH_DEFAULT_DEPTH;
+    if( bench.depth > 20 )
+        bench.depth = 20;
+    bench.nbr_positions = sizeof(bench_positions)/sizeof(bench_positions[0]);
+    for( int i=0; i<bench.nbr_positions; i++ )
+    {
+        thc::ChessRules cr;
+        cr.Forsyth( bench_positions[i] );
+        PV pv;
+        sargon_nodes_clear();
+        sargon_perf_clear();
+        std::chrono::time_point<std::chrono::steady_clock> base = std::chrono::steady_clock::now();
+        if( !search )
+            sargon_run_engine( cr, bench.depth, pv, true );     // avoid_book = true for repeatability
+        else if( !search( cr, bench.depth, pv ) )
+        {
+            bench.aborted = true;
+            return bench;
+        }
+        std::chrono::time_point<std::chrono::steady_clock> now = std::chrono::steady_clock::now();
+        std::chrono::milliseconds ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - base);
+        unsigned long elapsed = static_cast<unsigned long>(ms.count());
+        unsigned long nodes = sargon_nodes();
+        bench.nodes += nodes;
+        bench.ms    += elapsed;
+        std::string bestmove = sargon_export_move(BESTM);
+        print( util::sprintf( "bench position %d depth %d nodes %lu time %lu bestmove %s",
+                                i+1, bench.depth, nodes, elapsed, bestmove.c_str() ) );
+        if( sargon_perf_enabled() )
+        {
+            print( util::sprintf( "bench position %d %s", i+1, sargon_perf_report().c_str() ) );
+            sargon_perf_clear();
+        }
+    }
+
+    // Use 64 bit intermediate, 1000 * nodes can overflow 32 bits
+    unsigned long long ms = bench.ms>0 ? bench.ms : 1;
+    bench.nps = static_cast<unsigned long>( (1000ULL*bench.nodes) / ms );
+    print( util::sprintf( "bench depth %d positions %d nodes %lu time %lu nps %lu",
+                            bench.depth, bench.nbr_positions, bench.nodes, bench.ms, bench.nps ) );
+    return bench;
+}
+
+// Output format is a line for the memory all contexts share, then one line
+//  per depth;
+//  context shared 51776 image 61032
+//  ...
+//  context depth 5 fixed 224 ply_tables 32 move_list_max 9000 move_list_peak 618 bytes_max 9256 bytes_peak 874
+bool sargon_bench_context_bytes( int depth, void (*print)( const std::string &line ) )
+{
+    bool ok = true;
+    int max_depth = depth>0 ? depth : BENCH_DEFAULT_DEPTH;
+    if( max_depth > 20 )
+        max_depth = 20;
+    int nbr_positions = sizeof(bench_positions)/sizeof(bench_positions[0]);
+    SARGON_STATE_BYTES bytes = sargon_state_bytes( max_depth );
+    print( util::sprintf( "context shared %u image %u", bytes.shared, bytes.shared+bytes.total() ) );
+    for( int level=1; level<=max_depth; level++ )
+    {
+        unsigned int peak = 0;
+        for( int i=0; i<nbr_positions; i++ )
+        {
+            thc::ChessRules cr;
+            cr.Forsyth( bench_positions[i] );
+            PV pv;
+            sargon_nodes_clear();
+            sargon_run_engine( cr, level, pv, true );
+            if( sargon_move_list_peak() > peak )
+                peak = sargon_move_list_peak();
+        }
+        bytes = sargon_state_bytes( level );
+        unsigned int bytes_peak = bytes.fixed + bytes.ply_tables + peak;
+        print( util::sprintf( "context depth %d fixed %u ply_tables %u move_list_max %u move_list_peak %u bytes_max %u bytes_peak %u",
+                                level, bytes.fixed, bytes.ply_tables, bytes.move_list_max, peak, bytes.total(), bytes_peak ) );
+        if( peak > bytes.move_list_max )
+        {
+            print( util::sprintf( "Error; depth %d move list peak %u exceeds worst case %u", level, peak, bytes.move_list_max ) );
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Robust timing harness, per level results
+struct LEVEL_TIMING
+{
+    int                 level;
+    int                 iterations;     // each sample times this many passes through the positions
+    std::vector<double> samples;        // ms per position search, one per repetition
+    double              median;
+    double              mad;            // median absolute deviation
+    double              ci_lo;          // 95% confidence interval for the median
+    double              ci_hi;
+    LEVEL_TIMING() : level(0), iterations(1), median(0), mad(0), ci_lo(0), ci_hi(0) {}
+};
+
+static bool   pin_thread();
+static double median_of( std::vector<double> v );
+static void   calculate_stats( LEVEL_TIMING &lt );
+static double time_level( int level, int iterations );
+static void   write_json( const std::string &json_file, const std::vector<LEVEL_TIMING> &results, int reps, bool pinned );
+static bool   read_baseline( const std::string &baseline_file, std::vector<LEVEL_TIMING> &baseline );
+static double mann_whitney_z( const std::vector<double> &a, const std::vector<double> &b );
+
+bool sargon_bench_timing( int comprehensive, bool quiet, const std::string &json_file,
+                                                         const std::string &baseline_file )
+{
+    bool ok = true;
+    int reps       = comprehensive>1 ? (comprehensive==2?11:21) : 5;
+    int max_level  = comprehensive>2 ? 5 : 4;
+    std::vector<LEVEL_TIMING> results;
+    for( int level=1; level<=max_level; level++ )
+    {
+        LEVEL_TIMING lt;
+        lt.level = level;
+        lt.iterations = level<3 ? (level<2?100:10) : 1;    // same multipliers as timing tests
+        results.push_back(lt);
+    }
+    std::vector<LEVEL_TIMING> baseline;
+    if( baseline_file.length() > 0 )
+    {
+        if( !read_baseline(baseline_file,baseline) )
+        {
+            printf( "Error; cannot read baseline results from %s\n", baseline_file.c_str() );
+            return false;
+        }
+    }
+    bool pinned = pin_thread();
+    printf( "* Robust timing tests, %d positions, %d repetitions per level%s\n",
+        static_cast<int>(sizeof(bench_positions)/sizeof(bench_positions[0])), reps,
+        pinned ? ", thread pinned" : ", (could not pin thread)" );
+
+    // Warm up caches, branch predictors and CPU clock before measuring
+    for( LEVEL_TIMING &lt: results )
+        time_level( lt.level, lt.iterations );
+
+    // Interleave the levels, so slow drift in machine state is spread evenly
+    //  rather than biasing one level
+    for( int rep=0; rep<reps; rep++ )
+    {
+        for( LEVEL_TIMING &lt: results )
+            lt.samples.push_back( time_level(lt.level,lt.iterations) );
+        printf( "." );
+    }
+    printf( "\n" );
+    for( LEVEL_TIMING &lt: results )
+    {
+        calculate_stats(lt);
+        printf( "Level %d: median=%.4f ms MAD=%.4f ms (%.1f%%) 95%% CI=[%.4f,%.4f] ms\n",
+            lt.level, lt.median, lt.mad, lt.median>0.0 ? 100.0*lt.mad/lt.median : 0.0,
+            lt.ci_lo, lt.ci_hi );
+        if( !quiet )
+        {
+            printf( "         samples (ms):" );
+            for( double d: lt.samples )
+                printf( " %.4f", d );
+            printf( "\n" );
+        }
+        for( LEVEL_TIMING &base: baseline )
+        {
+            if( base.level != lt.level || base.samples.size()<2 )
+                continue;
+            calculate_stats(base);
+            double change = base.median>0.0 ? 100.0*(lt.median-base.median)/base.median : 0.0;
+            double z = mann_whitney_z( lt.samples, base.samples );
+
+            // Two sided test at 5% significance; z>0 means current run is slower
+            const char *verdict = "no significant change";
+            if( z > 1.96 )
+            {
+                verdict = "REGRESSION";
+                ok = false;
+            }
+            else if( z < -1.96 )
+                verdict = "IMPROVEMENT";
+            printf( "         baseline median=%.4f ms, change=%+.1f%%, z=%+.2f, %s\n",
+                base.median, change, z, verdict );
+        }
+    }
+    if( json_file.length() > 0 )
+        write_json( json_file, results, reps, pinned );
+    return ok;
+}
+
+// Pin to the current CPU and raise priority to reduce scheduler noise
+static bool pin_thread()
+{
+#if defined(_WIN32)
+    SetThreadPriority( GetCurrentThread(), THREAD_PRIORITY_HIGHEST );
+    return 0 != SetThreadAffinityMask( GetCurrentThread(), 1 );
+#elif defined(__linux__)
+    int cpu = sched_getcpu();
+    if( cpu < 0 )
+        return false;
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    CPU_SET( cpu, &set );
+    return 0 == sched_setaffinity( 0, sizeof(set), &set );
+#else
+    return false;
+#endif
+}
+
+// One sample; average ms per position search at this level
+static double time_level( int level, int iterations )
+{
+    int nbr_positions = sizeof(bench_positions)/sizeof(bench_positions[0]);
+    std::chrono::time_point<std::chrono::steady_clock> base = std::chrono::steady_clock::now();
+    for( int j=0; j<iterations; j++ )
+    {
+        for( int i=0; i<nbr_positions; i++ )
+        {
+            thc::ChessRules cr;
+            cr.Forsyth( bench_positions[i] );
+            PV pv;
+            sargon_run_engine( cr, level, pv, true );
+        }
+    }
+    std::chrono::time_point<std::chrono::steady_clock> now = std::chrono::steady_clock::now();
+    std::chrono::microseconds us = std::chrono::duration_cast<std::chrono::microseconds>(now - base);
+    return static_cast<double>(us.count()) / 1000.0 / (iterations*nbr_positions);
+}
+
+static double median_of( std::vector<double> v )
+{
+    size_t n = v.size();
+    if( n == 0 )
+        return 0.0;
+    std::sort( v.begin(), v.end() );
+    return n%2 ? v[n/2] : (v[n/2-1]+v[n/2]) / 2.0;
+}
+
+// Median and MAD are robust against the occasional outlier (an interrupt, a
+//  context switch) that would distort a mean and standard deviation. The
+//  median's confidence interval is distribution free, from order statistics
+static void calculate_stats( LEVEL_TIMING &lt )
+{
+    lt.median = median_of( lt.samples );
+    std::vector<double> deviations;
+    for( double d: lt.samples )
+        deviations.push_back( fabs(d-lt.median) );
+    lt.mad = median_of( deviations );
+    std::vector<double> sorted = lt.samples;
+    std::sort( sorted.begin(), sorted.end() );
+    int n = static_cast<int>(sorted.size());
+    if( n == 0 )
+        return;
+    double half_width = 1.96 * sqrt(static_cast<double>(n)) / 2.0;
+    int lo = static_cast<int>( floor(n/2.0 - half_width) );
+    int hi = static_cast<int>( ceil (n/2.0 + half_width) );
+    if( lo < 0 )
+        lo = 0;
+    if( hi > n-1 )
+        hi = n-1;
+    lt.ci_lo = sorted[lo];
+    lt.ci_hi = sorted[hi];
+}
+
+// Mann-Whitney U test, normal approximation, returns z (positive if a tends
+//  to be larger than b). Ranks of tied values are averaged
+static double mann_whitney_z( const std::vector<double> &a, const std::vector<double> &b )
+{
+    std::vector< std::pair<double,int> > all;
+    for( double d: a )
+        all.push_back( std::pair<double,int>(d,0) );
+    for( double d: b )
+        all.push_back( std::pair<double,int>(d,1) );
+    std::sort( all.begin(), all.end() );
+    double rank_sum_a = 0.0;
+    size_t i = 0;
+    while( i < all.size() )
+    {
+        size_t j = i;
+        while( j+1<all.size() && all[j+1].first==all[i].first )
+            j++;
+        double rank = (i+j)/2.0 + 1.0;
+        for( size_t k=i; k<=j; k++ )
+        {
+            if( all[k].second == 0 )
+                rank_sum_a += rank;
+        }
+        i = j+1;
+    }
+    double na = static_cast<double>(a.size());
+    double nb = static_cast<double>(b.size());
+    double u = rank_sum_a - na*(na+1.0)/2.0;
+    double mean = na*nb/2.0;
+    double sd = sqrt( na*nb*(na+nb+1.0)/12.0 );
+    return sd>0.0 ? (u-mean)/sd : 0.0;
+}
+
+static void write_json( const std::string &json_file, const std::vector<LEVEL_TIMING> &results, int reps, bool pinned )
+{
+    std::ofstream out( json_file );
+    if( !out )
+    {
+        printf( "Error; cannot write results to %s\n", json_file.c_str() );
+        return;
+    }
+    out << "{\n";
+    out << util::sprintf( "  \"positions\": %d,\n", static_cast<int>(sizeof(bench_positions)/sizeof(bench_positions[0])) );
+    out << util::sprintf( "  \"repetitions\": %d,\n", reps );
+    out << util::sprintf( "  \"pinned\": %s,\n", pinned?"true":"false" );
+    out << "  \"levels\": [\n";
+    for( size_t i=0; i<results.size(); i++ )
+    {
+        const LEVEL_TIMING &lt = results[i];
+        out << util::sprintf( "    { \"level\": %d, \"iterations\": %d, \"median_ms\": %.6f, \"mad_ms\": %.6f, \"ci95_lo_ms\": %.6f, \"ci95_hi_ms\": %.6f,\n",
+                              lt.level, lt.iterations, lt.median, lt.mad, lt.ci_lo, lt.ci_hi );
+        out << "      \"samples_ms\": [";
+        for( size_t j=0; j<lt.samples.size(); j++ )
+            out << util::sprintf( "%s%.6f", j>0?", ":"", lt.samples[j] );
+        out << util::sprintf( "] }%s\n", i+1<results.size() ? "," : "" );
+    }
+    out << "  ]\n";
+    out << "}\n";
+    printf( "Results written to %s\n", json_file.c_str() );
+}
+
+// Not a general JSON parser, just enough to read back the file write_json()
+//  produces; the level and samples_ms fields of each level object
+static bool read_baseline( const std::string &baseline_file, std::vector<LEVEL_TIMING> &baseline )
+{
+    std::ifstream in( baseline_file );
+    if( !in )
+        return false;
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string s = ss.str();
+    size_t offset = 0;
+    for(;;)
+    {
+        offset = s.find( "\"level\":", offset );
+        if( offset == std::string::npos )
+            break;
+        LEVEL_TIMING lt;
+        lt.level = atoi( s.c_str() + offset + 8 );
+        offset = s.find( "\"samples_ms\":", offset );
+        if( offset == std::string::npos )
+            break;
+        offset = s.find( '[', offset );
+        size_t end = s.find( ']', offset );
+        if( offset==std::string::npos || end==std::string::npos )
+            break;
+        const char *p = s.c_str() + offset + 1;
+        const char *q = s.c_str() + end;
+        while( p < q )
+        {
+            char *next;
+            double d = strtod( p, &next );
+            if( next == p )
+                p++;    // skip commas and spaces
+            else
+            {
+                lt.samples.push_back(d);
+                p = next;
+            }
+        }
+        baseline.push_back(lt);
+        offset = end;
+    }
+    return baseline.size() > 0;
+}
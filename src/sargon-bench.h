@@ -0,0 +1,57 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-bench.h
+ *       Fixed depth benchmark, shared by sargon-engine and sargon-tests
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+#ifndef SARGON_BENCH_H_INCLUDED
+#define SARGON_BENCH_H_INCLUDED
+
+#include <string>
+#include "thc.h"
+#include "sargon-pv.h"
+
+// Depth used if none is specified
+#define BENCH_DEFAULT_DEPTH 5
+
+// Benchmark summary
+struct BENCH
+{
+    int           depth;
+    int           nbr_positions;
+    unsigned long nodes;    // total nodes is a behaviour signature, should only change
+                            //  if Sargon's search changes
+    unsigned long ms;
+    unsigned long nps;
+    bool          aborted;
+    BENCH() : depth(0), nbr_positions(0), nodes(0), ms(0), nps(0), aborted(false) {}
+};
+
+// Run the benchmark (depth 0 means BENCH_DEFAULT_DEPTH), print() is called with
+//  each line of machine readable output as it becomes available. If search() is
+//  provided it runs each position instead of sargon_run_engine(), returning false
+//  abandons the benchmark (no summary line is printed and bench.aborted is set)
+BENCH sargon_bench( int depth, void (*print)( const std::string &line ),
+                    bool (*search)( const thc::ChessPosition &cp, int plymax, PV &pv ) = NULL );
+
+// Statistically robust timing of the bench positions at each level. Pins the
+//  thread, warms up then takes repeated samples (more with higher
+//  comprehensive), reporting median, MAD and 95% confidence interval per level.
+//  Optionally writes the results as JSON, and optionally compares against a
+//  baseline JSON file written by an earlier run. Returns false if a
+//  statistically significant regression versus the baseline is detected
+bool sargon_bench_timing( int comprehensive, bool quiet, const std::string &json_file,
+                                                         const std::string &baseline_file );
+
+// Bytes per context, the part of Sargon's memory a paused search saves at
+//  each depth 1 to depth (0 means BENCH_DEFAULT_DEPTH), the worst case and
+//  the most actually used by the bench positions, print() is called with
+//  each line. Returns false if the worst case is ever exceeded
+bool sargon_bench_context_bytes( int depth, void (*print)( const std::string &line ) );
+
+#endif // SARGON_BENCH_H_INCLUDED
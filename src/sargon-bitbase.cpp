@@ -0,0 +1,380 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-bitbase.cpp
+ *       Endgame tables for KQK, KRK and KPK, generated by retrograde analysis
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+/*
+
+  Each table has one byte per position, indexed by side to move, White king,
+  Black king and the square of the single other piece, always White's (a
+  position with the piece on Black's side is looked up with colours and
+  ranks flipped). The byte is 0 for a draw (or an illegal position),
+  otherwise the distance to mate in half moves plus one. An odd distance
+  means the side to move mates, an even distance means the side to move is
+  mated (0 = checkmated now).
+
+  Generation starts from the checkmates and works backwards one half move
+  per pass; a position is won in n if some move reaches a position lost in
+  n-1, lost in n if every move reaches a position won in n-1 or less. Legal
+  moves come from thc::ChessRules, once per position, and are kept as
+  successor positions so the passes are just table lookups. KPK promotes
+  into the KQK and KRK tables, so they are generated first. Everything
+  still unresolved when the passes stop changing anything is a draw.
+
+  The tables total 1.5 Mbytes, small enough to generate at startup (a few
+  seconds) or to save to a file.
+
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "util.h"
+#include "thc.h"
+#include "sargon-bitbase.h"
+
+enum { TABLE_KQK, TABLE_KRK, TABLE_KPK, NBR_TABLES };
+static const char table_pieces[NBR_TABLES] = { 'Q', 'R', 'P' };
+#define TABLE_SIZE (2*64*64*64)
+#define SUCCESSOR_DRAW 0xffffffff
+#define FILE_MAGIC "SargonBB1"
+
+static std::vector<unsigned char> tables[NBR_TABLES];
+static bool available;
+
+static void generate_table( int t );
+static bool setup_position( thc::ChessRules &cr, int t, bool white, int wk, int bk, int sq );
+static uint32_t successor( int t, bool white, int wk, int bk, int sq, thc::Move mv );
+static bool probe_raw( const thc::ChessPosition &cp, int &value );
+
+static inline int make_index( bool white, int wk, int bk, int sq )
+{
+    return (((white?0:1)*64 + wk)*64 + bk)*64 + sq;
+}
+
+static inline unsigned char table_value( uint32_t code )
+{
+    return code==SUCCESSOR_DRAW ? 0 : tables[code>>24][code&0xffffff];
+}
+
+void sargon_bitbase_generate()
+{
+    available = false;
+    for( int t=0; t<NBR_TABLES; t++ )   // KPK must come after KQK and KRK
+        generate_table(t);
+    available = true;
+}
+
+bool sargon_bitbase_write( const std::string &filename )
+{
+    if( !available )
+        return false;
+    FILE *f;
+    errno_t err = fopen_s( &f, filename.c_str(), "wb" );
+    if( err )
+        return false;
+    bool ok = (1 == fwrite(FILE_MAGIC,sizeof(FILE_MAGIC),1,f));
+    for( int t=0; ok && t<NBR_TABLES; t++ )
+        ok = (1 == fwrite(tables[t].data(),TABLE_SIZE,1,f));
+    fclose(f);
+    return ok;
+}
+
+bool sargon_bitbase_read( const std::string &filename )
+{
+    available = false;
+    FILE *f;
+    errno_t err = fopen_s( &f, filename.c_str(), "rb" );
+    if( err )
+        return false;
+    char magic[sizeof(FILE_MAGIC)];
+    bool ok = (1 == fread(magic,sizeof(magic),1,f)) && 0==memcmp(magic,FILE_MAGIC,sizeof(magic));
+    for( int t=0; ok && t<NBR_TABLES; t++ )
+    {
+        tables[t].resize(TABLE_SIZE);
+        ok = (1 == fread(tables[t].data(),TABLE_SIZE,1,f));
+    }
+    fclose(f);
+    available = ok;
+    return ok;
+}
+
+bool sargon_bitbase_available()
+{
+    return available;
+}
+
+bool sargon_bitbase_probe( const thc::ChessPosition &cp, int &dtm )
+{
+    int value;
+    if( !probe_raw(cp,value) )
+        return false;
+    int distance = value-1;
+    if( value == 0 )
+        dtm = 0;
+    else if( distance == 0 )
+        dtm = SARGON_BITBASE_MATED;
+    else
+        dtm = (distance&1) ? distance : 0-distance;
+    return true;
+}
+
+bool sargon_bitbase_best_move( thc::ChessRules &cr, thc::Move &mv, int &dtm )
+{
+    int value;
+    if( !probe_raw(cr,value) )
+        return false;
+    std::vector<thc::Move> moves;
+    cr.GenLegalMoveList( moves );
+    bool found = false;
+    int best_score = 0;
+    for( thc::Move candidate: moves )
+    {
+        thc::ChessRules temp = cr;
+        temp.PlayMove( candidate );
+        int after;
+        if( !probe_raw(temp,after) )
+            continue;
+
+        // Score from our point of view; the faster the win the better, the
+        //  slower the loss the better, a draw in between
+        int score, candidate_dtm;
+        if( after == 0 )
+        {
+            score = 0;
+            candidate_dtm = 0;
+        }
+        else if( ((after-1)&1) == 0 )   // opponent is mated
+        {
+            score = 1000 - after;
+            candidate_dtm = after;
+        }
+        else                            // opponent mates
+        {
+            score = after - 1000;
+            candidate_dtm = 0-after;
+        }
+        if( !found || score>best_score )
+        {
+            found = true;
+            best_score = score;
+            mv = candidate;
+            dtm = candidate_dtm;
+        }
+    }
+    if( moves.size() == 0 )
+        dtm = (value==1 ? SARGON_BITBASE_MATED : 0);
+    return found;
+}
+
+// Look up the stored value (0 draw, else distance to mate + 1) for a
+//  position, with colours flipped if necessary so the piece is White's
+static bool probe_raw( const thc::ChessPosition &cp, int &value )
+{
+    if( !available )
+        return false;
+    thc::ChessPosition temp = cp;
+    if( temp.wking_allowed() || temp.wqueen_allowed() || temp.bking_allowed() || temp.bqueen_allowed() )
+        return false;
+    int wk=-1, bk=-1, sq=-1;
+    char piece = ' ';
+    for( int i=0; i<64; i++ )
+    {
+        char c = cp.squares[i];
+        if( c == ' ' )
+            continue;
+        else if( c == 'K' )
+            wk = i;
+        else if( c == 'k' )
+            bk = i;
+        else if( sq >= 0 )
+            return false;       // more than three pieces
+        else
+        {
+            sq = i;
+            piece = c;
+        }
+    }
+    if( wk<0 || bk<0 )
+        return false;
+
+    // Trivial draws
+    if( sq<0 || piece=='B' || piece=='b' || piece=='N' || piece=='n' )
+    {
+        value = 0;
+        return true;
+    }
+
+    // Flip so the piece is White's
+    bool white = cp.white;
+    if( piece>='a' && piece<='z' )
+    {
+        int temp_wk = wk;
+        wk    = bk ^ 56;
+        bk    = temp_wk ^ 56;
+        sq    = sq ^ 56;
+        piece = static_cast<char>(piece - 'a' + 'A');
+        white = !white;
+    }
+    for( int t=0; t<NBR_TABLES; t++ )
+    {
+        if( piece == table_pieces[t] )
+        {
+            value = tables[t][ make_index(white,wk,bk,sq) ];
+            return true;
+        }
+    }
+    return false;
+}
+
+// Set up a position, return false if it's illegal
+static bool setup_position( thc::ChessRules &cr, int t, bool white, int wk, int bk, int sq )
+{
+    if( wk==bk || wk==sq || bk==sq )
+        return false;
+    int wk_file=wk%8, wk_rank=wk/8, bk_file=bk%8, bk_rank=bk/8;
+    if( abs(wk_file-bk_file)<=1 && abs(wk_rank-bk_rank)<=1 )
+        return false;
+    if( table_pieces[t]=='P' && (sq<8 || sq>=56) )
+        return false;
+    memset( cr.squares, ' ', 64 );
+    cr.squares[wk] = 'K';
+    cr.squares[bk] = 'k';
+    cr.squares[sq] = table_pieces[t];
+    cr.white = white;
+    cr.wking_square = static_cast<thc::Square>(wk);
+    cr.bking_square = static_cast<thc::Square>(bk);
+    cr.enpassant_target = thc::SQUARE_INVALID;
+    cr.wking  = 0;
+    cr.wqueen = 0;
+    cr.bking  = 0;
+    cr.bqueen = 0;
+    cr.half_move_clock = 0;
+    cr.full_move_count = 1;
+
+    // The side not to move mustn't be in check
+    if( white )
+        return !cr.AttackedSquare( static_cast<thc::Square>(bk), true );
+    return !cr.AttackedSquare( static_cast<thc::Square>(wk), false );
+}
+
+// Table and index of the position after a move
+static uint32_t successor( int t, bool white, int wk, int bk, int sq, thc::Move mv )
+{
+    if( white )
+    {
+        if( mv.src == wk )
+            wk = mv.dst;
+        else
+        {
+            sq = mv.dst;
+            if( mv.special == thc::SPECIAL_PROMOTION_QUEEN )
+                t = TABLE_KQK;
+            else if( mv.special == thc::SPECIAL_PROMOTION_ROOK )
+                t = TABLE_KRK;
+            else if( mv.special==thc::SPECIAL_PROMOTION_BISHOP || mv.special==thc::SPECIAL_PROMOTION_KNIGHT )
+                return SUCCESSOR_DRAW;
+        }
+    }
+    else
+    {
+        bk = mv.dst;
+        if( bk == sq )
+            return SUCCESSOR_DRAW;  // K v K
+    }
+    return (static_cast<uint32_t>(t)<<24) | static_cast<uint32_t>( make_index(!white,wk,bk,sq) );
+}
+
+static void generate_table( int t )
+{
+    std::vector<unsigned char> &table = tables[t];
+    table.assign( TABLE_SIZE, 0 );
+
+    // Successors of every legal position, checkmates resolved immediately
+    std::vector<uint32_t> offsets(TABLE_SIZE+1);
+    std::vector<uint32_t> successors;
+    std::vector<int> pending;
+    thc::ChessRules cr;
+    std::vector<thc::Move> moves;
+    for( int idx=0; idx<TABLE_SIZE; idx++ )
+    {
+        offsets[idx] = static_cast<uint32_t>(successors.size());
+        int sq = idx&63, bk = (idx>>6)&63, wk = (idx>>12)&63;
+        bool white = ((idx>>18)&1) == 0;
+        if( !setup_position(cr,t,white,wk,bk,sq) )
+            continue;
+        moves.clear();
+        cr.GenLegalMoveList( moves );
+        if( moves.size() == 0 )
+        {
+            bool in_check = white ? cr.AttackedSquare(cr.wking_square,false) : cr.AttackedSquare(cr.bking_square,true);
+            if( in_check )
+                table[idx] = 1;     // checkmated, distance 0
+            continue;               // else stalemate, a draw
+        }
+        for( thc::Move mv: moves )
+            successors.push_back( successor(t,white,wk,bk,sq,mv) );
+        pending.push_back(idx);
+    }
+    offsets[TABLE_SIZE] = static_cast<uint32_t>(successors.size());
+
+    // Longest mate in the tables we promote into, we can't stop before then
+    int longest = 0;
+    for( int i=0; i<t; i++ )
+    {
+        for( unsigned char v: tables[i] )
+        {
+            if( v > longest )
+                longest = v;
+        }
+    }
+
+    // Work backwards from the mates, one half move per pass
+    int quiet_passes = 0;
+    for( int n=1; n<255 && pending.size()>0; n++ )
+    {
+        bool win = (n&1) != 0;
+        size_t kept = 0;
+        for( size_t i=0; i<pending.size(); i++ )
+        {
+            int idx = pending[i];
+            bool resolved;
+            if( win )
+            {
+                // Won in n if some move reaches a position lost in n-1
+                resolved = false;
+                for( uint32_t j=offsets[idx]; !resolved && j<offsets[idx+1]; j++ )
+                    resolved = (table_value(successors[j]) == n);
+            }
+            else
+            {
+                // Lost in n if every move reaches a position won in n-1 or less
+                resolved = true;
+                for( uint32_t j=offsets[idx]; resolved && j<offsets[idx+1]; j++ )
+                {
+                    int v = table_value(successors[j]);
+                    resolved = (v>0 && v<=n && ((v-1)&1)==1);
+                }
+            }
+            if( resolved )
+                table[idx] = static_cast<unsigned char>(n+1);
+            else
+                pending[kept++] = idx;
+        }
+        bool changed = (kept != pending.size());
+        pending.resize(kept);
+        if( changed || n<=longest )
+            quiet_passes = 0;
+        else if( ++quiet_passes >= 2 )
+            break;
+    }
+    // anything still pending is a draw, already 0
+}
@@ -0,0 +1,45 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-bitbase.h
+ *       Endgame tables for KQK, KRK and KPK, generated by retrograde analysis
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+#ifndef SARGON_BITBASE_H_INCLUDED
+#define SARGON_BITBASE_H_INCLUDED
+
+#include <string>
+#include "thc.h"
+
+// Generate the tables in memory, takes a few seconds
+void sargon_bitbase_generate();
+
+// Save generated tables, or load tables saved earlier. Returns false on
+//  failure
+bool sargon_bitbase_write( const std::string &filename );
+bool sargon_bitbase_read( const std::string &filename );
+bool sargon_bitbase_available();
+
+// Distance to mate for a side to move that is already checkmated (which
+//  would otherwise be 0, a draw)
+#define SARGON_BITBASE_MATED (-1000)
+
+// Look up a position. Returns false if the position isn't covered (or the
+//  tables aren't available). Otherwise dtm is the distance to mate in half
+//  moves, positive if the side to move mates, negative if the side to move
+//  is mated, 0 if the position is drawn, SARGON_BITBASE_MATED if the side to
+//  move is checkmated
+bool sargon_bitbase_probe( const thc::ChessPosition &cp, int &dtm );
+
+// Best move in a covered position; the fastest mate, a move that holds the
+//  draw, or the longest resistance. Returns false if the position isn't
+//  covered, or if there is no move, in which case dtm is SARGON_BITBASE_MATED
+//  or 0 (stalemate). Otherwise dtm is as for sargon_bitbase_probe() after
+//  the move
+bool sargon_bitbase_best_move( thc::ChessRules &cr, thc::Move &mv, int &dtm );
+
+#endif // SARGON_BITBASE_H_INCLUDED
@@ -0,0 +1,39 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-book.h
+ *       Memory mapped opening book, Polyglot .bin layout
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+#ifndef SARGON_BOOK_H_INCLUDED
+#define SARGON_BOOK_H_INCLUDED
+
+#include <stdint.h>
+#include <string>
+#include "thc.h"
+
+// Open (memory map) a book, closing any previous book. An empty filename
+//  just closes. Returns false if the file can't be mapped or isn't a book
+bool sargon_book_open( const std::string &filename );
+void sargon_book_close();
+bool sargon_book_is_open();
+
+// Book key for a position
+uint64_t sargon_book_key( const thc::ChessPosition &cp );
+
+// Find a book move for the position, choosing randomly amongst the
+//  candidates in proportion to their weights. Returns false if none
+bool sargon_book_probe( thc::ChessRules &cr, thc::Move &mv );
+
+// Make a book from a text file, one game (or line) per text line as a list
+//  of moves in UCI format, eg "e2e4 e7e5 g1f3 b8c6". Positions up to plies
+//  half moves deep are included, weight is the number of times a move was
+//  played. Returns false (with an error message) on failure
+bool sargon_book_make( const std::string &in_filename, const std::string &out_filename,
+                       int plies, std::string &error );
+
+#endif // SARGON_BOOK_H_INCLUDED
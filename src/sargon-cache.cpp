@@ -0,0 +1,344 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-cache.cpp
+ *       Persistent (memory mapped file) cache of completed iterations
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+/*
+
+  Sargon's search is completely deterministic, the same position searched to
+  the same PLYMAX always gives the same PV, score and node count. So a
+  completed iteration can be remembered forever, and a training partner that
+  sees the same positions over and over again (across many engine restarts)
+  can skip straight past iterations it has done before.
+
+  The cache file is a 64 byte header followed by buckets of 4 records of 64
+  bytes, the whole file is memory mapped. A position and depth hash to one
+  bucket. Eviction within a bucket is by the clock (second chance)
+  algorithm; a hit sets a record's referenced flag, the victim is the first
+  record without the flag, clearing flags along the way.
+
+  Each record carries a checksum over its contents (not the referenced
+  flag, which is only a hint). A record half written when the engine (or
+  the machine) crashed fails the checksum and is treated as empty, so the
+  file never needs repair.
+
+  The same checksum makes it safe for several processes to map the file at
+  once (the PGN annotator's worker processes do this); a record torn by two
+  simultaneous stores is just a miss. A lookup copies the record before
+  checking it, so a store that lands part way through the lookup can't
+  slip past the checksum either.
+
+*/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "util.h"
+#include "thc.h"
+#include "sargon-pv.h"
+#include "sargon-book.h"
+#include "sargon-cache.h"
+
+#define CACHE_MAGIC "SgnCch2"     // 2, keys became Polyglot keys
+#define CACHE_WAYS 4
+#define CACHE_MAX_PV 20
+
+struct CACHE_HEADER
+{
+    char     magic[8];
+    uint32_t nbr_buckets;
+    uint32_t record_size;
+    uint8_t  unused[48];
+};
+
+struct CACHE_RECORD
+{
+    uint64_t key;
+    uint32_t nodes;
+    int16_t  value;
+    uint8_t  depth;         // 0 = empty
+    uint8_t  pv_len;
+    uint16_t pv[CACHE_MAX_PV];  // src | dst<<6 | promotion<<12
+    uint32_t checksum;
+    uint8_t  referenced;    // clock flag, not covered by checksum
+    uint8_t  unused[3];
+};
+
+// Mapped file
+static unsigned char *cache_base;
+static size_t cache_size;
+static uint32_t cache_nbr_buckets;
+#if defined(_WIN32)
+static HANDLE cache_file = INVALID_HANDLE_VALUE;
+static HANDLE cache_mapping;
+#endif
+
+// Statistics
+static unsigned long hits;
+static unsigned long misses;
+static unsigned long stores;
+static unsigned long evictions;
+
+static uint64_t make_key( const thc::ChessPosition &cp, int depth );
+static uint32_t calculate_checksum( const CACHE_RECORD &r );
+static CACHE_RECORD *bucket( uint64_t key );
+
+bool sargon_cache_open( const std::string &filename, unsigned int megabytes )
+{
+    static_assert( sizeof(CACHE_HEADER)==64 && sizeof(CACHE_RECORD)==64, "cache layout" );
+    sargon_cache_close();
+    if( filename == "" )
+        return true;
+    if( megabytes < 1 )
+        megabytes = 1;
+    uint32_t nbr_buckets = static_cast<uint32_t>( (megabytes*1024ULL*1024ULL - sizeof(CACHE_HEADER)) / (CACHE_WAYS*sizeof(CACHE_RECORD)) );
+    size_t size = sizeof(CACHE_HEADER) + static_cast<size_t>(nbr_buckets)*CACHE_WAYS*sizeof(CACHE_RECORD);
+
+    // Map the file, growing or shrinking it to size
+#if defined(_WIN32)
+    cache_file = CreateFileA( filename.c_str(), GENERIC_READ|GENERIC_WRITE, FILE_SHARE_READ|FILE_SHARE_WRITE, NULL,
+                              OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+    if( cache_file == INVALID_HANDLE_VALUE )
+        return false;
+
+    // Several processes can share the file (see sargon-annotate.cpp), but
+    //  a file mapped by another process can't have its end of file set
+    LARGE_INTEGER li, current;
+    li.QuadPart = static_cast<LONGLONG>(size);
+    bool sized = GetFileSizeEx(cache_file,&current) && current.QuadPart==li.QuadPart;
+    if( !sized && (!SetFilePointerEx(cache_file,li,NULL,FILE_BEGIN) || !SetEndOfFile(cache_file)) )
+    {
+        sargon_cache_close();
+        return false;
+    }
+    cache_mapping = CreateFileMappingA( cache_file, NULL, PAGE_READWRITE, 0, 0, NULL );
+    if( cache_mapping )
+        cache_base = static_cast<unsigned char *>( MapViewOfFile(cache_mapping,FILE_MAP_ALL_ACCESS,0,0,0) );
+    if( !cache_base )
+    {
+        sargon_cache_close();
+        return false;
+    }
+#else
+    int fd = open( filename.c_str(), O_RDWR|O_CREAT, 0644 );
+    if( fd < 0 )
+        return false;
+    if( ftruncate(fd,static_cast<off_t>(size)) != 0 )
+    {
+        close(fd);
+        return false;
+    }
+    void *p = mmap( NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0 );
+    close(fd);  // the mapping keeps the file open
+    if( p == MAP_FAILED )
+        return false;
+    cache_base = static_cast<unsigned char *>(p);
+#endif
+    cache_size = size;
+    cache_nbr_buckets = nbr_buckets;
+
+    // A new file, or a different size (records would be in the wrong
+    //  buckets), starts empty
+    CACHE_HEADER *header = reinterpret_cast<CACHE_HEADER *>(cache_base);
+    if( 0!=memcmp(header->magic,CACHE_MAGIC,sizeof(header->magic)) ||
+        header->nbr_buckets!=nbr_buckets || header->record_size!=sizeof(CACHE_RECORD) )
+    {
+        memset( cache_base, 0, size );
+        memcpy( header->magic, CACHE_MAGIC, sizeof(header->magic) );
+        header->nbr_buckets = nbr_buckets;
+        header->record_size = sizeof(CACHE_RECORD);
+    }
+    hits = misses = stores = evictions = 0;
+    return true;
+}
+
+void sargon_cache_close()
+{
+#if defined(_WIN32)
+    if( cache_base )
+    {
+        FlushViewOfFile( cache_base, 0 );
+        UnmapViewOfFile( cache_base );
+    }
+    if( cache_mapping )
+        CloseHandle( cache_mapping );
+    if( cache_file != INVALID_HANDLE_VALUE )
+        CloseHandle( cache_file );
+    cache_mapping = NULL;
+    cache_file = INVALID_HANDLE_VALUE;
+#else
+    if( cache_base )
+    {
+        msync( cache_base, cache_size, MS_SYNC );
+        munmap( cache_base, cache_size );
+    }
+#endif
+    cache_base = NULL;
+    cache_size = 0;
+    cache_nbr_buckets = 0;
+}
+
+bool sargon_cache_is_open()
+{
+    return cache_base != NULL;
+}
+
+bool sargon_cache_lookup( const thc::ChessPosition &cp, int depth, PV &pv, unsigned long &nodes )
+{
+    if( !cache_base )
+        return false;
+    uint64_t key = make_key(cp,depth);
+    CACHE_RECORD *r = bucket(key);
+    for( int i=0; i<CACHE_WAYS; i++, r++ )
+    {
+        // Another process can rewrite the record at any time, so check and
+        //  use a copy, never the record itself
+        CACHE_RECORD rec;
+        memcpy( &rec, r, sizeof(rec) );
+        if( rec.key!=key || rec.depth!=depth || rec.checksum!=calculate_checksum(rec) )
+            continue;
+
+        // Replay the PV, any problem is treated as a miss
+        thc::ChessRules cr;
+        static_cast<thc::ChessPosition &>(cr) = cp;
+        PV temp;
+        bool ok = (rec.pv_len>0 && rec.pv_len<=CACHE_MAX_PV);
+        for( int j=0; ok && j<rec.pv_len; j++ )
+        {
+            int code = rec.pv[j];
+            int src = code&0x3f, dst = (code>>6)&0x3f, promotion = (code>>12)&7;
+            std::string terse = util::sprintf( "%c%c%c%c", 'a'+src%8, '8'-src/8, 'a'+dst%8, '8'-dst/8 );
+            if( promotion>=1 && promotion<=4 )
+                terse += "nbrq"[promotion-1];
+            thc::Move mv;
+            ok = mv.TerseIn( &cr, terse.c_str() );
+            if( ok )
+            {
+                temp.variation.push_back(mv);
+                cr.PlayMove(mv);
+            }
+        }
+        if( !ok )
+            break;
+        temp.value = rec.value;
+        temp.depth = rec.depth;
+        pv = temp;
+        nodes = rec.nodes;
+        r->referenced = 1;
+        hits++;
+        return true;
+    }
+    misses++;
+    return false;
+}
+
+void sargon_cache_store( const thc::ChessPosition &cp, int depth, const PV &pv, unsigned long nodes )
+{
+    if( !cache_base || depth<1 || depth>255 || pv.variation.size()==0 )
+        return;
+    CACHE_RECORD rec;
+    memset( &rec, 0, sizeof(rec) );
+    rec.key    = make_key(cp,depth);
+    rec.nodes  = static_cast<uint32_t>(nodes);
+    rec.value  = static_cast<int16_t>(pv.value);
+    rec.depth  = static_cast<uint8_t>(depth);
+    for( thc::Move mv: pv.variation )
+    {
+        if( rec.pv_len >= CACHE_MAX_PV )
+            break;
+        int promotion = 0;
+        switch( mv.special )
+        {
+            case thc::SPECIAL_PROMOTION_KNIGHT: promotion = 1;  break;
+            case thc::SPECIAL_PROMOTION_BISHOP: promotion = 2;  break;
+            case thc::SPECIAL_PROMOTION_ROOK:   promotion = 3;  break;
+            case thc::SPECIAL_PROMOTION_QUEEN:  promotion = 4;  break;
+            default:                                            break;
+        }
+        rec.pv[rec.pv_len++] = static_cast<uint16_t>( mv.src | (mv.dst<<6) | (promotion<<12) );
+    }
+    rec.checksum = calculate_checksum(rec);
+
+    // Replace the same position and depth if present, else an empty (or
+    //  damaged) record, else the clock victim
+    CACHE_RECORD *r = bucket(rec.key);
+    CACHE_RECORD *victim = NULL;
+    for( int i=0; !victim && i<CACHE_WAYS; i++ )
+    {
+        if( r[i].key==rec.key && r[i].depth==rec.depth )
+            victim = &r[i];
+    }
+    for( int i=0; !victim && i<CACHE_WAYS; i++ )
+    {
+        if( r[i].depth==0 || r[i].checksum!=calculate_checksum(r[i]) )
+            victim = &r[i];
+    }
+    for( int i=0; !victim && i<2*CACHE_WAYS; i++ )
+    {
+        CACHE_RECORD *candidate = &r[i%CACHE_WAYS];
+        if( candidate->referenced )
+            candidate->referenced = 0;  // second chance
+        else
+        {
+            victim = candidate;
+            evictions++;
+        }
+    }
+    memcpy( victim, &rec, sizeof(rec) );
+    stores++;
+}
+
+std::string sargon_cache_report()
+{
+    return util::sprintf( "analysis cache hits=%lu, misses=%lu, stores=%lu, evictions=%lu",
+                            hits, misses, stores, evictions );
+}
+
+// Position key (see sargon_book_key()) plus depth and, since Sargon's
+//  scoring treats the first six moves as the opening phase, move number
+static uint64_t make_key( const thc::ChessPosition &cp, int depth )
+{
+    uint64_t key = sargon_book_key(cp);
+    int moveno = cp.full_move_count<7 ? cp.full_move_count : 7;
+    key ^= 0x9e3779b97f4a7c15ULL * static_cast<uint64_t>(depth);
+    key ^= 0xc2b2ae3d27d4eb4fULL * static_cast<uint64_t>(moveno);
+    return key;
+}
+
+// Fletcher style checksum of everything up to the checksum field
+static uint32_t calculate_checksum( const CACHE_RECORD &r )
+{
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(&r);
+    uint32_t a = 1, b = 0;
+    for( size_t i=0; i<offsetof(CACHE_RECORD,checksum); i++ )
+    {
+        a = (a + p[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b<<16) | a;
+}
+
+static CACHE_RECORD *bucket( uint64_t key )
+{
+    uint32_t idx = static_cast<uint32_t>( (key>>32) % cache_nbr_buckets );
+    return reinterpret_cast<CACHE_RECORD *>( cache_base + sizeof(CACHE_HEADER) ) + static_cast<size_t>(idx)*CACHE_WAYS;
+}
@@ -0,0 +1,35 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-cache.h
+ *       Persistent (memory mapped file) cache of completed iterations
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+#ifndef SARGON_CACHE_H_INCLUDED
+#define SARGON_CACHE_H_INCLUDED
+
+#include <string>
+#include "thc.h"
+#include "sargon-pv.h"
+
+// Open (creating if necessary) a cache file of the given size, closing any
+//  previous cache. An empty filename just closes. Returns false on failure
+bool sargon_cache_open( const std::string &filename, unsigned int megabytes );
+void sargon_cache_close();
+bool sargon_cache_is_open();
+
+// Look up the result of a completed Sargon search of a position to a depth
+//  (PLYMAX). Returns false if it isn't in the cache
+bool sargon_cache_lookup( const thc::ChessPosition &cp, int depth, PV &pv, unsigned long &nodes );
+
+// Add the result of a completed search, evicting an older result if needed
+void sargon_cache_store( const thc::ChessPosition &cp, int depth, const PV &pv, unsigned long nodes );
+
+// Hits, misses, stores and evictions since the cache was opened
+std::string sargon_cache_report();
+
+#endif // SARGON_CACHE_H_INCLUDED
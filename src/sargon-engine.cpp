@@ -27,12 +27,24 @@
 #include <mutex>
 #include <chrono>
 #include <condition_variable>
+#include <atomic>
 
 #include "util.h"
 #include "thc.h"
 #include "sargon-interface.h"
 #include "sargon-asm-interface.h"
 #include "sargon-pv.h"
+#include "sargon-bench.h"
+#include "sargon-profile.h"
+#include "sargon-stats.h"
+#include "sargon-log.h"
+#include "sargon-telemetry.h"
+#include "sargon-metrics.h"
+#include "sargon-session.h"
+#include "sargon-book.h"
+#include "sargon-bitbase.h"
+#include "sargon-cache.h"
+#include "sargon-annotate.h"
 
 // Measure elapsed time, nodes    
 static unsigned long base_time;
@@ -41,12 +53,33 @@ static unsigned long base_time;
 #define VERSION "1978 V1.01b"
 #define ENGINE_NAME "Sargon"
 static int depth_option;    // 0=auto, other values for fixed depth play
+static unsigned long nodes_option;  // 0=no limit, other values for node limited play
+static unsigned long nodes_limit;   // node budget for the search in progress, 0=no limit
 static std::string logfile_name;
+static std::string profile_file_name;
+static std::string cache_file_name;
+static unsigned int cache_megabytes = 64;
+static bool last_run_cached;    // last run_sargon() came from the analysis cache
+static bool debug_mode;     // UCI "debug on", report per ply search statistics
 static unsigned long total_callbacks;
 static unsigned long genmov_callbacks;
 static unsigned long bestmove_callbacks;
 static unsigned long end_of_points_callbacks;
 
+// Periodic progress info (nodes, nps, currmove) during long iterations
+#define PROGRESS_INTERVAL_MS 1000
+static bool          progress_enabled;      // set by go commands, cleared by bench
+static unsigned long progress_time;         // time of last report
+static int           progress_currmovenumber;
+static std::string   progress_currmove;
+static void progress_callback_after_genmov();
+
+// Metrics
+#define TIMER_RESOLUTION_MS 100             // see timer_thread()
+static unsigned long metrics_nodes;         // nodes reported to metrics so far this search
+static std::atomic<unsigned long> stop_time;    // when "stop" was read, 0 if none pending
+static unsigned long cutoff_ms;             // last cut off timer for this search, 0 if none
+
 // The current 'Master' postion
 static thc::ChessRules the_position;
 
@@ -67,22 +100,35 @@ static MATING mating;
 // The list of repetition moves to avoid, normally empty
 static std::vector<thc::Move> the_repetition_moves;
 
+// MultiPV and searchmoves, both edit the root move list like repetition
+//  avoidance does, see callback()
+static int multipv_option = 1;                  // number of lines reported by analysis
+static std::vector<thc::Move> the_search_moves; // "go searchmoves", search only these, normally empty
+static std::vector<thc::Move> the_multipv_moves;// best moves of lines found so far, excluded
+
 // Command line interface
 static bool process( const std::string &s );
 static std::string cmd_uci();
 static std::string cmd_isready();
 static std::string cmd_stop();
 static std::string cmd_go( const std::vector<std::string> &fields );
-static void        cmd_go_infinite();
+static void        cmd_go_infinite( const std::vector<std::string> &fields );
 static void        cmd_setoption( const std::vector<std::string> &fields );
 static void        cmd_position( const std::string &whole_cmd_line, const std::vector<std::string> &fields );
+static void        cmd_bench( const std::vector<std::string> &fields );
 
 // Misc
 static bool is_new_game();
 static int log( const char *fmt, ... );
 static bool run_sargon( int plymax, bool avoid_book );
+static bool run_sargon_multipv( int plymax, bool avoid_book, std::string &out );
+static void parse_searchmoves( const std::vector<std::string> &fields );
 static std::string generate_progress_report( bool &we_are_forcing_mate, bool &we_are_stalemating_now );
 static thc::Move calculate_next_move( bool new_game, unsigned long ms_time, unsigned long ms_inc, int depth );
+static thc::Move calculate_next_move_nodes( unsigned long nodes, int depth );
+static bool play_out_mate( thc::Move &mating_move );
+static bool book_move( thc::Move &bestmove );
+static bool bitbase_move( thc::Move &bestmove );
 static bool repetition_calculate( thc::ChessRules &cr, std::vector<thc::Move> &repetition_moves );
 static bool test_whether_move_repeats( thc::ChessRules &cr, thc::Move mv );
 static void repetition_remove_moves( const std::vector<thc::Move> &repetition_moves );
@@ -132,10 +178,12 @@ private:
 static SafeQueue<std::string> async_queue;
 static void timer_thread();
 static void read_stdin();
+static void replay_stdin( const std::vector<SESSION_EVENT> &events, bool fast );
 static void write_stdout();
 static void timer_clear();          // Clear the timer
 static void timer_end();            // End the timer subsystem system
 static void timer_set( int ms );    // Set a timeout event, ms millisecs into the future (0 and -1 are special values)
+static void uci_send( const std::string &s );   // All output to the GUI
 
 // main()
 int main( int argc, char *argv[] )
@@ -253,17 +301,115 @@ int main( int argc, char *argv[] )
     }
     return 0;
 #endif
-    std::thread first(read_stdin);
+
+    // Command line options (not used by GUIs);
+    //  -record file    record the session (commands and responses, with timing)
+    //  -replay file    replay a recorded session, with the original timing,
+    //                  instead of reading stdin, then compare bestmoves and
+    //                  latencies with the recording
+    //  -fast           replay without waiting, except for bestmove
+    //  -makebook in out [plies]
+    //                  make a book (for the BookFile option) from a text
+    //                  file of games, one per line, as UCI moves
+    //  -annotate in out [-depth n] [-nodes n] [-jobs n] [-cache file]
+    //                  annotate every move of every game in PGN file in
+    //                  with Sargon's score and PV, to PGN file out
+    std::string record_file, replay_file;
+    bool fast = false;
+    std::string annotate_in, annotate_out;
+    ANNOTATE_OPTIONS annotate_options;
+    int annotate_worker = -1;
+    for( int i=1; i<argc; i++ )
+    {
+        std::string arg = argv[i];
+        if( arg=="-makebook" && i+2<argc )
+        {
+            int plies = i+3<argc ? atoi(argv[i+3]) : 0;
+            if( plies <= 0 )
+                plies = 20;
+            std::string error;
+            if( !sargon_book_make(argv[i+1],argv[i+2],plies,error) )
+            {
+                fprintf( stderr, "%s\n", error.c_str() );
+                return -1;
+            }
+            return 0;
+        }
+        else if( arg=="-record" && i+1<argc )
+            record_file = argv[++i];
+        else if( arg=="-replay" && i+1<argc )
+            replay_file = argv[++i];
+        else if( arg == "-fast" )
+            fast = true;
+        else if( arg=="-annotate" && i+2<argc )
+        {
+            annotate_in  = argv[++i];
+            annotate_out = argv[++i];
+        }
+        else if( arg=="-depth" && i+1<argc )
+            annotate_options.depth = atoi(argv[++i]);
+        else if( arg=="-nodes" && i+1<argc )
+            annotate_options.nodes = strtoul(argv[++i],NULL,10);
+        else if( arg=="-jobs" && i+1<argc )
+            annotate_options.jobs = atoi(argv[++i]);
+        else if( arg=="-cache" && i+1<argc )
+            annotate_options.cache_file = argv[++i];
+        else if( arg=="-worker" && i+1<argc )
+            sscanf_s( argv[++i], "%d/%d", &annotate_worker, &annotate_options.jobs );   // internal, see sargon-annotate.cpp
+    }
+    if( annotate_in != "" )
+    {
+        std::string error;
+        bool ok;
+        if( annotate_worker >= 0 )
+            ok = sargon_annotate_worker( annotate_in, annotate_out, annotate_worker, annotate_options, error );
+        else
+            ok = sargon_annotate( argv[0], annotate_in, annotate_out, annotate_options, error );
+        if( !ok )
+        {
+            fprintf( stderr, "%s\n", error.c_str() );
+            return -1;
+        }
+        return 0;
+    }
+    std::vector<SESSION_EVENT> recorded;
+    if( replay_file != "" )
+    {
+        if( !sargon_session_read(replay_file,recorded) )
+        {
+            fprintf( stderr, "Error; cannot read session file %s\n", replay_file.c_str() );
+            return -1;
+        }
+        sargon_session_record( record_file );   // replayed session kept in memory, file optional
+    }
+    else if( record_file != "" )
+    {
+        if( !sargon_session_record(record_file) )
+            fprintf( stderr, "Error; cannot write session file %s\n", record_file.c_str() );
+    }
+    std::thread first = replay_file!="" ? std::thread(replay_stdin,recorded,fast) : std::thread(read_stdin);
     std::thread second(write_stdout);
     std::thread third(timer_thread);
 
     // Wait for main threads to finish
     first.join();                // pauses until first finishes
     second.join();               // pauses until second finishes
+    sargon_session_end();
+    if( replay_file != "" )
+    {
+        bool same;
+        std::string report = sargon_session_compare( recorded, sargon_session_events(), same );
+        fprintf( stdout, "%s", report.c_str() );
+        fflush( stdout );
+    }
 
     // Tell timer thread to finish, then kill it immediately
     timer_end();
     third.detach();
+    sargon_telemetry_close();
+    sargon_metrics_close();
+    sargon_cache_close();
+    sargon_log_end();
     return 0;
 }
 
@@ -279,6 +425,14 @@ static unsigned long elapsed_milliseconds()
     return ret;
 }
 
+// All output to the GUI goes through here, so it can be recorded
+static void uci_send( const std::string &s )
+{
+    fputs( s.c_str(), stdout );
+    fflush( stdout );
+    sargon_session_rsp( s );
+}
+
 // Very simple timer thread, controlled by timer_set(), timer_clear(), timer_end() 
 static std::mutex timer_mtx;
 static long future_time;
@@ -347,6 +501,7 @@ static void timer_set( int ms )
     // Schedule a new "TIMEOUT" event (unless 0 = timer_clear())
     else if( ms != 0 )
     {
+        cutoff_ms = ms;
         long now_time = elapsed_milliseconds();	
         long ft = now_time + ms;
         if( ft==0 || ft==-1 )   // avoid special values
@@ -368,6 +523,9 @@ static void read_stdin()
         {
             std::string s(buf);
             util::rtrim(s);
+            if( s == "stop" )
+                stop_time = elapsed_milliseconds() | 1;     // never 0
+            sargon_session_cmd(s);
             async_queue.enqueue(s);
             if( s == "quit" )
                 quit = true;
@@ -375,6 +533,52 @@ static void read_stdin()
     }
 }
 
+// Alternative to read_stdin(), replay a recorded session. Commands are sent
+//  with the original timing, or if fast as soon as the engine has responded
+//  to the previous go command
+static void replay_stdin( const std::vector<SESSION_EVENT> &events, bool fast )
+{
+    unsigned long base = elapsed_milliseconds();
+    unsigned long bestmoves_expected = 0;
+    bool quit = false;
+    for( unsigned int i=0; !quit && i<events.size(); i++ )
+    {
+        const SESSION_EVENT &e = events[i];
+        if( !e.cmd )
+        {
+            if( e.text.substr(0,9) == "bestmove " )
+                bestmoves_expected++;
+            continue;
+        }
+        if( fast )
+        {
+            while( sargon_session_bestmoves() < bestmoves_expected )
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        else
+        {
+            unsigned long now = elapsed_milliseconds();
+            if( base+e.ms > now )
+                std::this_thread::sleep_for(std::chrono::milliseconds(base+e.ms-now));
+        }
+        if( e.text == "stop" )
+            stop_time = elapsed_milliseconds() | 1;     // never 0
+        sargon_session_cmd(e.text);
+        async_queue.enqueue(e.text);
+        if( e.text == "quit" )
+            quit = true;
+    }
+
+    // Let the last search finish, then make sure the session ends
+    if( !quit )
+    {
+        while( sargon_session_bestmoves() < bestmoves_expected )
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        sargon_session_cmd("quit");
+        async_queue.enqueue("quit");
+    }
+}
+
 // Read queued commands and process them
 static void write_stdout()
 {
@@ -391,13 +595,131 @@ static void write_stdout()
 static jmp_buf jmp_buf_env;
 static bool run_sargon( int plymax, bool avoid_book )
 {
+    // Iterations completed before (perhaps in an earlier session) come from
+    //  the analysis cache. Not if the root move list is edited, or if
+    //  Sargon might play a (random) book move. Not in node limited searches
+    //  either, they must abort part way through an iteration at exactly the
+    //  same point whether the earlier iterations were cached or not
+    bool cacheable = sargon_cache_is_open() && the_search_moves.size()==0 &&
+                     the_repetition_moves.size()==0 && the_multipv_moves.size()==0 &&
+                     nodes_limit==0 && (avoid_book || the_position.full_move_count>1);
+    unsigned long nodes_before = sargon_nodes();
+    last_run_cached = false;
+    if( cacheable )
+    {
+        unsigned long nodes;
+        if( sargon_cache_lookup(the_position,plymax,the_pv,nodes) )
+        {
+            // The cached iteration's nodes count towards info nodes and nps,
+            //  but not the metrics' nodes searched
+            last_run_cached = true;
+            sargon_nodes_add( nodes );
+            if( progress_enabled )
+                metrics_nodes += nodes;
+            sargon_telemetry_event( elapsed_milliseconds()-base_time, util::sprintf("cache plymax=%d nodes=%lu",plymax,nodes) );
+            return false;
+        }
+    }
     bool aborted = false;
     int val;
     val = setjmp(jmp_buf_env);
     if( val )
+    {
         aborted = true;
+        sargon_perf_end();  // longjmp() bypassed the normal end of measurement
+        sargon_profile_leave();
+        sargon_metrics_abort();
+        bool by_nodes = (nodes_limit>0 && sargon_nodes()>=nodes_limit);
+        sargon_telemetry_iteration( plymax, sargon_nodes(), elapsed_milliseconds()-base_time, 0, "", by_nodes?"nodes":"event" );
+    }
     else
+    {
+        sargon_stats_clear(false);
+        progress_currmovenumber = 0;
+        progress_currmove.clear();
+        if( the_search_moves.size() > 0 )
+            avoid_book = true;  // a book move mightn't be one of the searchmoves
         sargon_run_engine(the_position,plymax,the_pv,avoid_book); // the_pv updated only if not aborted
+        if( cacheable )
+            sargon_cache_store( the_position, plymax, the_pv, sargon_nodes()-nodes_before );
+        std::string pv;
+        for( thc::Move mv: the_pv.variation )
+            pv += (pv.length()>0 ? " " : "") + mv.TerseOut();
+        sargon_telemetry_iteration( plymax, sargon_nodes(), elapsed_milliseconds()-base_time, the_position.white?the_pv.value:0-the_pv.value, pv );
+        if( debug_mode )
+        {
+            std::vector<std::string> lines;
+            sargon_stats_report( plymax, lines );
+            for( const std::string &line: lines )
+            {
+                log( "rsp>info string %s\n", line.c_str() );
+                uci_send( "info string " + line + "\n" );
+            }
+        }
+    }
+    if( progress_enabled )
+    {
+        sargon_metrics_nodes( sargon_nodes()-metrics_nodes );
+        metrics_nodes = sargon_nodes();
+    }
+    return aborted;
+}
+
+// Run Sargon analysis once for each of MultiPV lines. Each search excludes
+//  the best moves of the lines already found, so line k is the best of the
+//  moves not in lines 1 to k-1. Report lines are accumulated in out. On
+//  return the_pv is line 1, if line 1 completed (out isn't empty in that
+//  case). Returns true if aborted
+static bool run_sargon_multipv( int plymax, bool avoid_book, std::string &out )
+{
+    out.clear();
+
+    // Can't have more lines than there are moves to search
+    std::vector<thc::Move> moves;
+    the_position.GenLegalMoveList( moves );
+    int nbr_moves = 0;
+    for( thc::Move mv: moves )
+    {
+        bool listed = the_search_moves.size() == 0;
+        for( thc::Move sm: the_search_moves )
+        {
+            if( mv == sm )
+                listed = true;
+        }
+        if( listed )
+            nbr_moves++;
+    }
+    int nbr_lines = multipv_option<nbr_moves ? multipv_option : nbr_moves;
+    if( nbr_lines < 1 )
+        nbr_lines = 1;
+    bool aborted = false;
+    bool have_first = false;
+    PV first;
+    the_multipv_moves.clear();
+    for( int k=1; !aborted && k<=nbr_lines; k++ )
+    {
+        aborted = run_sargon(plymax,avoid_book);
+        if( aborted || the_pv.variation.size()==0 )
+            break;
+        bool we_are_forcing_mate, we_are_stalemating_now;
+        std::string line = generate_progress_report( we_are_forcing_mate, we_are_stalemating_now );
+        if( multipv_option > 1 )
+        {
+            size_t offset = line.find(" score ");
+            if( offset != std::string::npos )
+                line.insert( offset, util::sprintf(" multipv %d",k) );
+        }
+        out += line;
+        if( k == 1 )
+        {
+            first = the_pv;
+            have_first = true;
+        }
+        the_multipv_moves.push_back( the_pv.variation[0] );
+    }
+    the_multipv_moves.clear();
+    if( have_first )
+        the_pv = first;
     return aborted;
 }
 
@@ -424,19 +746,25 @@ static bool process( const std::string &s )
         rsp = cmd_isready();
     else if( cmd == "stop" )
         rsp = cmd_stop();
+    else if( cmd == "debug" )
+        debug_mode = (parm1 == "on");
     else if( cmd=="go" && parm1=="infinite" )
-        cmd_go_infinite();
+        cmd_go_infinite(fields);
     else if( cmd=="go" )
         rsp = cmd_go(fields);
     else if( cmd=="setoption" )
         cmd_setoption(fields);
     else if( cmd=="position" )
         cmd_position( s, fields );
+    else if( cmd=="bench" )
+        cmd_bench( fields );
     if( rsp != "" )
     {
         log( "rsp>%s\n", rsp.c_str() );
-        fprintf( stdout, "%s", rsp.c_str() );
-        fflush( stdout );
+        uci_send( rsp );
+        unsigned long t = stop_time.exchange(0);
+        if( t!=0 && rsp.find("bestmove")!=std::string::npos )
+            sargon_metrics_stop_latency( elapsed_milliseconds() - t );
     }
     log( "function process() returns, cmd=%s\n"
          "total callbacks=%lu\n"
@@ -449,6 +777,19 @@ static bool process( const std::string &s )
             genmov_callbacks,
             end_of_points_callbacks );
     log( "%s\n", sargon_pv_report_stats().c_str() );
+    if( sargon_cache_is_open() )
+        log( "%s\n", sargon_cache_report().c_str() );
+    if( cmd=="go" && sargon_perf_enabled() )
+        log( "%s\n", sargon_perf_report().c_str() );
+
+    // Profile accumulates over the session, rewrite files after each search
+    if( (cmd=="go" || cmd=="bench") && sargon_profile_running() )
+    {
+        log( "%s", sargon_profile_summary().c_str() );
+        if( !sargon_profile_write_flat(profile_file_name) ||
+            !sargon_profile_write_collapsed(profile_file_name+".collapsed") )
+            log( "Error; cannot write profile file %s\n", profile_file_name.c_str() );
+    }
     return quit;
 }
 
@@ -457,8 +798,18 @@ static std::string cmd_uci()
     std::string rsp=
     "id name " ENGINE_NAME " " VERSION "\n"
     "id author Dan and Kathe Spracklin, Windows port by Bill Forster\n"
+    "option name BitbaseFile type string default\n"
+    "option name BookFile type string default\n"
+    "option name CacheFileName type string default\n"
+    "option name CacheSize type spin min 1 max 512 default 64\n"
     "option name FixedDepth type spin min 0 max 20 default 0\n"
     "option name LogFileName type string default\n"
+    "option name MetricsFileName type string default\n"
+    "option name MultiPV type spin min 1 max 32 default 1\n"
+    "option name NodesLimit type spin min 0 max 2000000000 default 0\n"
+    "option name PerfCounters type check default false\n"
+    "option name ProfileFileName type string default\n"
+    "option name TelemetryFileName type string default\n"
     "uciok\n";
     return rsp;
 }
@@ -489,12 +840,138 @@ static void cmd_setoption( const std::vector<std::string> &fields )
             depth_option = 0;
     }
 
+    // Option "NodesLimit"
+    //  Default is 0. 0 indicates no limit, others limit each search to a
+    //   node budget rather than a time budget, a deterministic alternative
+    //   to timed play; the same budget gives the same move on any hardware
+    // eg "setoption name NodesLimit value 100000"
+    else if( fields.size()>4 && fields[1]=="name" && fields[2]=="nodeslimit" && fields[3]=="value" )
+    {
+        long n = atol(fields[4].c_str());
+        nodes_option = n>0 ? static_cast<unsigned long>(n) : 0;
+    }
+
+    // Option "MultiPV"
+    //  Range is 1-32, default is 1. Analysis (go infinite, go depth N and
+    //   go nodes N) reports this many lines per depth, ranked best first.
+    //   Each extra line costs a further search with the moves of the lines
+    //   already found excluded. Timed play always reports a single line
+    // eg "setoption name MultiPV value 3"
+    else if( fields.size()>4 && fields[1]=="name" && fields[2]=="multipv" && fields[3]=="value" )
+    {
+        multipv_option = atoi(fields[4].c_str());
+        if( multipv_option<1 || multipv_option>32 )
+            multipv_option = 1;
+    }
+
+    // Option "BitbaseFile"
+    //   string, default is empty string (no endgame tables in that case).
+    //   Endgame tables for K+Q v K, K+R v K and K+P v K, saved by the
+    //   sargon-tests 'k' tests. If the file can't be read the tables are
+    //   generated (a few seconds) and saved to it. Positions covered by the
+    //   tables are played instantly, without searching
+    // eg "setoption name BitbaseFile value c:\windows\temp\sargon-bitbase.bin"
+    else if( fields.size()>4 && fields[1]=="name" && fields[2]=="bitbasefile" && fields[3]=="value" )
+    {
+        if( !sargon_bitbase_read(fields[4]) )
+        {
+            log( "Generating endgame tables\n" );
+            sargon_bitbase_generate();
+            if( !sargon_bitbase_write(fields[4]) )
+                log( "Error; cannot write endgame tables to %s\n", fields[4].c_str() );
+        }
+    }
+
+    // Option "BookFile"
+    //   string, default is empty string (Sargon's own book only in that
+    //   case). An opening book, made with the -makebook command line option,
+    //   consulted before searching in normal play
+    // eg "setoption name BookFile value c:\windows\temp\sargon-book.bin"
+    else if( fields.size()>4 && fields[1]=="name" && fields[2]=="bookfile" && fields[3]=="value" )
+    {
+        if( !sargon_book_open(fields[4]) )
+            log( "Error; cannot open book file %s\n", fields[4].c_str() );
+    }
+
+    // Option "CacheFileName"
+    //   string, default is empty string (no analysis cache in that case).
+    //   Completed iterations are remembered in the named file (created if
+    //   necessary) across engine restarts, and repeat searches of the same
+    //   position and depth are skipped
+    // eg "setoption name CacheFileName value c:\windows\temp\sargon-cache.bin"
+    else if( fields.size()>4 && fields[1]=="name" && fields[2]=="cachefilename" && fields[3]=="value" )
+    {
+        cache_file_name = fields[4];
+        if( !sargon_cache_open(cache_file_name,cache_megabytes) )
+            log( "Error; cannot open analysis cache file %s\n", cache_file_name.c_str() );
+    }
+
+    // Option "CacheSize"
+    //  Range is 1-512, default is 64. Size of the analysis cache file in
+    //   megabytes, the least recently used iterations are evicted when full.
+    //   The whole file is mapped into our (32 bit) address space, larger
+    //   sizes are reduced to 512 which can reliably be mapped
+    // eg "setoption name CacheSize value 256"
+    else if( fields.size()>4 && fields[1]=="name" && fields[2]=="cachesize" && fields[3]=="value" )
+    {
+        int megabytes = atoi(fields[4].c_str());
+        cache_megabytes = megabytes<1 ? 64 : (megabytes>512 ? 512 : megabytes);
+        if( sargon_cache_is_open() && !sargon_cache_open(cache_file_name,cache_megabytes) )
+            log( "Error; cannot open analysis cache file %s\n", cache_file_name.c_str() );
+    }
+
     // Option "LogFileName"
     //   string, default is empty string (no log kept in that case)
     // eg "setoption name LogFileName value c:\windows\temp\sargon-log-file.txt"
     else if( fields.size()>4 && fields[1]=="name" && fields[2]=="logfilename" && fields[3]=="value" )
     {
         logfile_name = fields[4];
+        sargon_log_file( logfile_name );
+    }
+
+    // Option "MetricsFileName"
+    //   string, default is empty string (no metrics in that case). Every few
+    //   seconds rewrite the named file with cumulative metrics (searches,
+    //   nodes, nps, depth, aborts, stop latency etc.) in Prometheus text format
+    // eg "setoption name MetricsFileName value c:\windows\temp\sargon.prom"
+    else if( fields.size()>4 && fields[1]=="name" && fields[2]=="metricsfilename" && fields[3]=="value" )
+    {
+        sargon_metrics_file( fields[4] );
+    }
+
+    // Option "PerfCounters"
+    //   check, default is false. If true, hardware performance counters
+    //   (cycles, instructions etc.) for each search are written to the log
+    // eg "setoption name PerfCounters value true"
+    else if( fields.size()>4 && fields[1]=="name" && fields[2]=="perfcounters" && fields[3]=="value" )
+    {
+        bool enable = (fields[4]=="true");
+        bool ok = sargon_perf_enable( enable );
+        if( enable && !ok )
+            log( "Hardware performance counters unavailable\n" );
+    }
+
+    // Option "ProfileFileName"
+    //   string, default is empty string (no profiling in that case). Sample
+    //   Sargon's routines during searches, write a flat profile to the named
+    //   file and collapsed stacks (for flame graphs) to the name + ".collapsed"
+    // eg "setoption name ProfileFileName value c:\windows\temp\sargon-profile.txt"
+    else if( fields.size()>4 && fields[1]=="name" && fields[2]=="profilefilename" && fields[3]=="value" )
+    {
+        profile_file_name = fields[4];
+        if( !sargon_profile_start() )
+            log( "Sampling profiler unavailable\n" );
+    }
+
+    // Option "TelemetryFileName"
+    //   string, default is empty string (no telemetry in that case). Append
+    //   one line of JSON per go command to the named file; the position, time
+    //   control, state machine transitions, iterations, abort and repetition
+    //   avoidance events and the move played
+    // eg "setoption name TelemetryFileName value c:\windows\temp\sargon-telemetry.jsonl"
+    else if( fields.size()>4 && fields[1]=="name" && fields[2]=="telemetryfilename" && fields[3]=="value" )
+    {
+        sargon_telemetry_file( fields[4] );
     }
 }
 
@@ -503,6 +980,13 @@ static std::string cmd_go( const std::vector<std::string> &fields )
     the_pv.clear();
     stop_rsp = "";
     base_time = elapsed_milliseconds();
+    sargon_perf_clear();
+    sargon_stats_clear(true);
+    sargon_nodes_clear();
+    metrics_nodes = 0;
+    cutoff_ms = 0;
+    progress_enabled = true;
+    progress_time = base_time;
     total_callbacks = 0;
     bestmove_callbacks = 0;
     genmov_callbacks = 0;
@@ -520,9 +1004,11 @@ static std::string cmd_go( const std::vector<std::string> &fields )
     bool expecting_time = false;
     bool expecting_inc = false;
     bool expecting_depth = false;
+    bool expecting_nodes = false;
     int ms_time   = 0;
     int ms_inc    = 0;
     int depth     = 0;
+    long nodes    = 0;
     for( std::string parm: fields )
     {
         if( expecting_time )
@@ -540,6 +1026,11 @@ static std::string cmd_go( const std::vector<std::string> &fields )
             depth = atoi(parm.c_str());
             expecting_depth = false;
         }
+        else if( expecting_nodes )
+        {
+            nodes = atol(parm.c_str());
+            expecting_nodes = false;
+        }
         else
         {
             if( parm == stime )
@@ -548,40 +1039,76 @@ static std::string cmd_go( const std::vector<std::string> &fields )
                 expecting_inc = true;
             if( parm == "depth" )
                 expecting_depth = true;
+            if( parm == "nodes" )
+                expecting_nodes = true;
         }
     }
-    bool new_game = is_new_game();
-    thc::Move bestmove = calculate_next_move( new_game, ms_time, ms_inc, depth );
+    if( nodes<=0 && nodes_option>0 )
+        nodes = static_cast<long>(nodes_option);
+    parse_searchmoves( fields );
+    std::string go_cmd;
+    for( const std::string &parm: fields )
+        go_cmd += (go_cmd.length()>0 ? " " : "") + parm;
+    sargon_telemetry_begin( the_position.ForsythPublish(), go_cmd, ms_time, ms_inc, depth, nodes>0?nodes:0 );
+    thc::Move bestmove;
+    // MultiPV analysis only without a clock (go depth), timed games are played
+    //  by calculate_next_move() as usual
+    bool clock = (ms_time > 0);
+    if( nodes > 0 || (multipv_option>1 && !clock && (depth>0 || depth_option>0)) )
+        bestmove = calculate_next_move_nodes( nodes>0 ? static_cast<unsigned long>(nodes) : 0, depth );
+    else
+    {
+        static bool new_game_pending;   // until the first move out of book
+        if( is_new_game() )
+            new_game_pending = true;
+        if( the_search_moves.size()>0 || (!bitbase_move(bestmove) && !book_move(bestmove)) )
+        {
+            bestmove = calculate_next_move( new_game_pending, ms_time, ms_inc, depth );
+            new_game_pending = false;
+        }
+    }
+    unsigned long elapsed = elapsed_milliseconds()-base_time;
+    sargon_telemetry_end( bestmove.TerseOut(), sargon_nodes(), elapsed );
+    bool overrun = (cutoff_ms>0 && elapsed>cutoff_ms+TIMER_RESOLUTION_MS) || (ms_time>0 && elapsed>static_cast<unsigned long>(ms_time));
+    sargon_metrics_search( sargon_nodes(), elapsed, the_pv.depth, overrun );
+    the_search_moves.clear();
     return util::sprintf( "bestmove %s\n", bestmove.TerseOut().c_str() );
 }
 
-static void cmd_go_infinite()
+static void cmd_go_infinite( const std::vector<std::string> &fields )
 {
     the_pv.clear();
     stop_rsp = "";
     int plymax=1;
     bool aborted = false;
     base_time = elapsed_milliseconds();
+    sargon_perf_clear();
+    sargon_stats_clear(true);
+    sargon_nodes_clear();
+    metrics_nodes = 0;
+    cutoff_ms = 0;
+    progress_enabled = true;
+    progress_time = base_time;
     total_callbacks = 0;
     bestmove_callbacks = 0;
     genmov_callbacks = 0;
     end_of_points_callbacks = 0;
+    parse_searchmoves( fields );
+    std::string go_cmd;
+    for( const std::string &parm: fields )
+        go_cmd += (go_cmd.length()>0 ? " " : "") + parm;
+    sargon_telemetry_begin( the_position.ForsythPublish(), go_cmd, 0, 0, 0, 0 );
     while( !aborted )
     {
-        aborted = run_sargon(plymax,true);  // note avoid_book = true
+        std::string out;
+        aborted = run_sargon_multipv(plymax,true,out);  // note avoid_book = true
         if( plymax < 20 )
             plymax++;
-        if( !aborted )
+        if( out.length() > 0 )  // line 1 at least completed
         {
-            bool we_are_forcing_mate, we_are_stalemating_now;
-            std::string out = generate_progress_report( we_are_forcing_mate, we_are_stalemating_now );
-            if( out.length() > 0 )
-            {
-                fprintf( stdout, out.c_str() );
-                fflush( stdout );
-                log( "rsp>%s\n", out.c_str() );
-                stop_rsp = util::sprintf( "bestmove %s\n", the_pv.variation[0].TerseOut().c_str() ); 
-            }
+            uci_send( out );
+            log( "rsp>%s\n", out.c_str() );
+            stop_rsp = util::sprintf( "bestmove %s\n", the_pv.variation[0].TerseOut().c_str() ); 
         }
     }
     if( stop_rsp == "" )    // Shouldn't actually ever happen as callback polling doesn't abort
@@ -590,6 +1117,111 @@ static void cmd_go_infinite()
         std::string bestmove = sargon_export_move(BESTM);
         stop_rsp = util::sprintf( "bestmove %s\n", bestmove.c_str() ); 
     }
+    std::string bestmove = stop_rsp.substr( stop_rsp.find(' ')+1 );
+    util::rtrim( bestmove );
+    unsigned long elapsed = elapsed_milliseconds()-base_time;
+    sargon_telemetry_end( bestmove, sargon_nodes(), elapsed );
+    sargon_metrics_search( sargon_nodes(), elapsed, the_pv.depth, false );
+    the_search_moves.clear();
+}
+
+// Book hits return instantly, at zero search cost
+static bool book_move( thc::Move &bestmove )
+{
+    if( !sargon_book_is_open() || !sargon_book_probe(the_position,bestmove) )
+        return false;
+    the_pv.clear();
+    the_pv.variation.push_back( bestmove );
+    std::string out = "info string book\n";
+    uci_send( out );
+    log( "rsp>%s", out.c_str() );
+    sargon_telemetry_event( elapsed_milliseconds()-base_time, "book" );
+    return true;
+}
+
+// Endgame table hits also return instantly, the fastest mate, a drawing
+//  move or the longest resistance
+static bool bitbase_move( thc::Move &bestmove )
+{
+    int dtm;
+    if( !sargon_bitbase_available() || !sargon_bitbase_best_move(the_position,bestmove,dtm) )
+        return false;
+    the_pv.clear();
+    the_pv.variation.push_back( bestmove );
+    the_pv.depth = dtm>0 ? dtm : 0-dtm;
+    std::string score = "cp 0";
+    if( dtm > 0 )
+        score = util::sprintf( "mate %d", (dtm+1)/2 );
+    else if( dtm < 0 )
+        score = util::sprintf( "mate -%d", (0-dtm)/2 );
+    std::string out = util::sprintf( "info string bitbase\n"
+                                     "info depth %d score %s time %lu nodes 0 pv %s\n",
+                                     the_pv.depth, score.c_str(),
+                                     elapsed_milliseconds()-base_time,
+                                     bestmove.TerseOut().c_str() );
+    uci_send( out );
+    log( "rsp>%s", out.c_str() );
+    sargon_telemetry_event( elapsed_milliseconds()-base_time, "bitbase" );
+    return true;
+}
+
+// "go ... searchmoves e2e4 d2d4", restrict the search to the listed moves.
+//  The moves run until the end of the command or the first field that isn't
+//  a legal move
+static void parse_searchmoves( const std::vector<std::string> &fields )
+{
+    the_search_moves.clear();
+    bool expecting_moves = false;
+    for( const std::string &parm: fields )
+    {
+        if( expecting_moves )
+        {
+            thc::Move mv;
+            if( !mv.TerseIn(&the_position,parm.c_str()) )
+                break;
+            the_search_moves.push_back(mv);
+        }
+        else if( parm == "searchmoves" )
+            expecting_moves = true;
+    }
+}
+
+// cmd_bench(), not part of UCI, run a fixed depth benchmark, eg "bench" or "bench 6"
+static void bench_print( const std::string &line )
+{
+    log( "rsp>%s\n", line.c_str() );
+    uci_send( line + "\n" );
+}
+
+// Run one bench position. The setjmp() is here rather than around the whole
+//  bench so that callback()'s longjmp() only unwinds Sargon itself, just as
+//  in run_sargon()
+static bool bench_search( const thc::ChessPosition &cp, int plymax, PV &pv )
+{
+    if( setjmp(jmp_buf_env) )
+    {
+        sargon_perf_end();  // longjmp() bypassed the normal end of measurement
+        sargon_profile_leave();
+        return false;
+    }
+    sargon_run_engine( cp, plymax, pv, true );  // avoid_book = true for repeatability
+    return true;
+}
+
+static void cmd_bench( const std::vector<std::string> &fields )
+{
+    int depth = fields.size()>1 ? atoi(fields[1].c_str()) : 0;
+
+    // The bench must not be influenced by the game in progress
+    progress_enabled = false;
+    std::vector<thc::Move> save_repetition_moves = the_repetition_moves;
+    the_repetition_moves.clear();
+
+    // Like run_sargon(), a new command aborts the bench
+    BENCH bench = sargon_bench( depth, bench_print, bench_search );
+    if( bench.aborted )
+        bench_print( "bench aborted" );
+    the_repetition_moves = save_repetition_moves;
 }
 
 // cmd_position(), set a new (or same or same plus one or two half moves) position
@@ -690,6 +1322,50 @@ static void cmd_position( const std::string &whole_cmd_line, const std::vector<s
     prev_position = the_position;
 }
 
+// Nodes per second, use 64 bit intermediate, 1000 * nodes can overflow 32 bits
+static unsigned long calculate_nps( unsigned long nodes, unsigned long elapsed_ms )
+{
+    if( elapsed_ms == 0 )
+        elapsed_ms++;
+    return static_cast<unsigned long>( (1000ULL*nodes) / elapsed_ms );
+}
+
+// Throttled "info nodes nps time currmove currmovenumber" during an iteration,
+//  GUIs get to see progress even when iterations take a long time
+static void progress_callback_after_genmov()
+{
+    int ply = peekb(NPLY);
+
+    // At ply 2 MLPTRJ still points at the ply 1 (root) move being searched
+    if( ply == 2 )
+    {
+        progress_currmovenumber++;
+        progress_currmove = sargon_export_move(MLPTRJ);
+    }
+
+    // Only read the clock (and update metrics) occasionally
+    if( ply!=2 && (sargon_nodes()&0x3ff)!=0 )
+        return;
+    sargon_metrics_nodes( sargon_nodes()-metrics_nodes );
+    metrics_nodes = sargon_nodes();
+    unsigned long now_time = elapsed_milliseconds();
+    if( now_time-progress_time < PROGRESS_INTERVAL_MS )
+        return;
+    progress_time = now_time;
+    unsigned long elapsed_time = now_time-base_time;
+    unsigned long nodes = sargon_nodes();
+    std::string out = util::sprintf( "info depth %d time %lu nodes %lu nps %lu",
+                peekb(PLYMAX),
+                elapsed_time,
+                nodes,
+                calculate_nps( nodes, elapsed_time ) );
+    if( progress_currmovenumber > 0 && progress_currmove != "" )
+        out += util::sprintf( " currmove %s currmovenumber %d", progress_currmove.c_str(), progress_currmovenumber );
+    out += "\n";
+    uci_send( out );
+    log( "rsp>%s", out.c_str() );
+}
+
 // Return true if PV has us (the engine) forcing mate
 static std::string generate_progress_report( bool &we_are_forcing_mate, bool &we_are_stalemating_now )
 {
@@ -703,7 +1379,7 @@ static std::string generate_progress_report( bool &we_are_forcing_mate, bool &we
     std::string buf_score;
     bool done=false;
     unsigned long now_time = elapsed_milliseconds();	
-    int nodes = end_of_points_callbacks;
+    unsigned long nodes = sargon_nodes();
     unsigned long elapsed_time = now_time-base_time;
     if( elapsed_time == 0 )
         elapsed_time++;
@@ -807,14 +1483,146 @@ static std::string generate_progress_report( bool &we_are_forcing_mate, bool &we
         out = util::sprintf( "info depth %d score %s time %lu nodes %lu nps %lu pv%s\n",
                     depth,
                     buf_score.c_str(),
-                    (unsigned long) elapsed_time,
-                    (unsigned long) nodes,
-                    1000L * ((unsigned long) nodes / (unsigned long)elapsed_time ),
+                    elapsed_time,
+                    nodes,
+                    calculate_nps( nodes, elapsed_time ),
                     buf_pv.c_str() );
     }
     return out;
 }
 
+// If the opponent followed the mating line found by an earlier search, play
+//  the next move of the line without searching again
+static bool play_out_mate( thc::Move &mating_move )
+{
+    bool opponent_follows_line = false;
+    if( mating.active && mating.idx+2 < mating.variation.size() )
+    {
+        mating.position.PlayMove(mating.variation[mating.idx++]);
+        mating.position.PlayMove(mating.variation[mating.idx++]);
+        if( mating.position == the_position )
+            opponent_follows_line = true;
+    }
+    if( !opponent_follows_line )
+    {
+        mating.active = false;
+        return false;
+    }
+    thc::ChessRules cr = mating.position;
+    mating_move = mating.variation[mating.idx];
+    std::string buf_pv;
+    for( unsigned int i=0; mating.idx+i<mating.variation.size(); i++ )
+    {
+        thc::Move move=mating.variation[mating.idx+i];
+        cr.PlayMove( move );
+        buf_pv += " ";
+        buf_pv += move.TerseOut();
+    }
+    std::string out = util::sprintf( "info score mate %d pv%s\n",
+        --mating.nbr,
+        buf_pv.c_str() );
+    if( mating.nbr <= 1 )
+        mating.active = false;
+    uci_send( out );
+    log( "rsp>%s\n", out.c_str() );
+    log( "(%s mating line)\n", mating.nbr<=1 ? "Finishing" : "Continuing" );
+    stop_rsp = util::sprintf( "bestmove %s\n", mating_move.TerseOut().c_str() ); 
+    return true;
+}
+
+// Calculate next move within a node budget. Iterative deepening is abandoned
+//  (see callback()) when the budget is exhausted and the move from the last
+//  completed iteration is played. Nothing depends on the clock, the book
+//  (which makes random choices) is avoided, so the same budget always gives
+//  the same move. Repetition avoidance depends only on the game's moves, so
+//  it is done as in calculate_next_move(), as is playing out a mating line
+//  without searching again. Also used without a budget (nodes=0) for MultiPV
+//  fixed depth analysis
+static thc::Move calculate_next_move_nodes( unsigned long nodes, int depth )
+{
+    thc::Move mating_move;
+    if( play_out_mate(mating_move) )
+        return mating_move;
+    if( depth_option > 0 )
+        depth = depth_option;
+    int plymax_max = (depth>0 && depth<20) ? depth : 20;
+    the_repetition_moves.clear();
+    thc::Move bestmove;
+    bestmove.Invalid();
+    nodes_limit = nodes;
+    bool aborted = false;
+    int plymax_completed = 0;
+    for( int plymax=1; !aborted && plymax<=plymax_max; plymax++ )
+    {
+        std::string out;
+        aborted = run_sargon_multipv(plymax,true,out);  // note avoid_book = true
+        if( aborted )
+        {
+            log( "aborted at plymax=%d, nodes=%lu, nodes_limit=%lu\n",
+                    plymax, sargon_nodes(), nodes_limit );
+        }
+        if( out.length() > 0 )  // line 1 at least completed
+        {
+            uci_send( out );
+            log( "rsp>%s\n", out.c_str() );
+            bestmove = the_pv.variation[0];
+            plymax_completed = plymax;
+        }
+    }
+
+    // If we're better but the move repeats, search again at the last
+    //  completed depth without the repeating moves, with the same budget
+    //  again, and fall back if that leaves us worse or runs out of nodes
+    if( bestmove.Valid() && (the_position.white? the_pv.value>0 : the_pv.value<0) &&
+        test_whether_move_repeats(the_position,bestmove) )
+    {
+        log( "Repetition avoidance, %s repeats\n", bestmove.TerseOut().c_str() );
+        bool ok = repetition_calculate( the_position, the_repetition_moves );
+        sargon_telemetry_event( elapsed_milliseconds()-base_time, util::sprintf( "repetition avoidance, %s repeats, %s", bestmove.TerseOut().c_str(),
+                    ok ? "searching again without repeating moves" : "all moves repeat" ) );
+        if( ok )
+        {
+            PV repetition_fallback_pv = the_pv;
+            if( nodes > 0 )
+                nodes_limit = sargon_nodes() + nodes;
+            std::string out;
+            aborted = run_sargon_multipv(plymax_completed,true,out);
+            int score_after_repetition_avoid = the_pv.value;
+            bool fallback = aborted || out.length()==0 ||
+                            (the_position.white ? score_after_repetition_avoid<=0 : score_after_repetition_avoid>=0);
+            if( fallback )
+                the_pv = repetition_fallback_pv;
+            else
+            {
+                uci_send( out );
+                log( "rsp>%s\n", out.c_str() );
+                bestmove = the_pv.variation[0];
+            }
+            log( "After repetition avoidance, new value=%d, so %s\n", score_after_repetition_avoid, fallback ? "did fallback" : "didn't fallback" );
+        }
+        the_repetition_moves.clear();
+    }
+    nodes_limit = 0;
+    if( !bestmove.Valid() )     // Shouldn't happen, PLYMAX==1 isn't aborted
+    {
+        run_sargon(1,true);
+        std::string terse = sargon_export_move(BESTM);
+        bestmove.TerseIn( &the_position, terse.c_str() );
+    }
+
+    // If the move played starts a mating line (rather than mating now), play
+    //  the line out over the following moves
+    bool we_are_forcing_mate, we_are_stalemating_now;
+    mating.active = false;
+    if( the_pv.variation.size()>0 && the_pv.variation[0]==bestmove )
+        generate_progress_report( we_are_forcing_mate, we_are_stalemating_now );
+    if( mating.active && mating.variation.size()==1 )
+        mating.active = false;
+    else if( mating.active )
+        log( "(Starting mating line)\n" );
+    return bestmove;
+}
+
 /*
 
     Calculate next move efficiently using the available time.
@@ -1011,6 +1819,10 @@ static void log_state_changes( const std::string &msg, PlayingState old_state, P
         log( "%s, state = %s\n", msg.c_str(), old_txt );
     else
         log( "%s, state = %s -> %s\n", msg.c_str(), old_txt, new_txt );
+    std::string where = msg;
+    if( where.length()>0 && where[where.length()-1]==':' )
+        where = where.substr(0,where.length()-1);
+    sargon_telemetry_state( where, old_txt, new_txt );
 }
 
 static thc::Move calculate_next_move( bool new_game, unsigned long ms_time, unsigned long ms_inc, int depth )
@@ -1093,39 +1905,12 @@ static thc::Move calculate_next_move( bool new_game, unsigned long ms_time, unsi
         case PLAYING_OUT_MATE_FIXED:
         {
             // Play out a mating sequence
-            bool opponent_follows_line = false;
-            if( mating.active && mating.idx+2 < mating.variation.size() )
+            thc::Move mating_move;
+            if( play_out_mate(mating_move) )
             {
-                mating.position.PlayMove(mating.variation[mating.idx++]);
-                mating.position.PlayMove(mating.variation[mating.idx++]);
-                if( mating.position == the_position )
-                    opponent_follows_line = true;
-            }
-            if( opponent_follows_line )
-            {
-                thc::ChessRules cr = mating.position;
-                thc::Move mating_move = mating.variation[mating.idx];
-                std::string buf_pv;
-                for( unsigned int i=0; mating.idx+i<mating.variation.size(); i++ )
-                {
-                    thc::Move move=mating.variation[mating.idx+i];
-                    cr.PlayMove( move );
-                    buf_pv += " ";
-                    buf_pv += move.TerseOut();
-                }
-                std::string out = util::sprintf( "info score mate %d pv%s\n",
-                    --mating.nbr,
-                    buf_pv.c_str() );
-                if( mating.nbr <= 1 )
-                {
-                    mating.active = false;
+                if( !mating.active )
                     state = (state==PLAYING_OUT_MATE_ADAPTIVE ? ADAPTIVE_NO_TARGET_YET : FIXED);
-                }
-                fprintf( stdout, out.c_str() );
-                fflush( stdout );
-                log( "rsp>%s\n", out.c_str() );
-                log( "(%s mating line)\n", mating.nbr<=1 ? "Finishing" : "Continuing" );
-                stop_rsp = util::sprintf( "bestmove %s\n", mating_move.TerseOut().c_str() ); 
+                log_state_changes( "Initial state machine:", old_state, state );
                 return mating_move;
             }
             else
@@ -1134,7 +1919,6 @@ static thc::Move calculate_next_move( bool new_game, unsigned long ms_time, unsi
                 //  Sargon's fundamental chess algorithms), so used FIXED_WITH_LOOPING rather than
                 //  FIXED, in order to find it quickly and efficiently (this is why we have
                 //  FIXED_WITH_LOOPING)
-                mating.active = false;
                 state = (state==PLAYING_OUT_MATE_ADAPTIVE ? ADAPTIVE_NO_TARGET_YET : FIXED_WITH_LOOPING);
 
                 // Simulate fall through to ADAPTIVE_NO_TARGET_YET / FIXED_WITH_LOOPING
@@ -1231,19 +2015,19 @@ static thc::Move calculate_next_move( bool new_game, unsigned long ms_time, unsi
             log( "aborted=%s, elapsed=%lu, ms_lo=%lu, plymax=%d, plymax_target=%d\n",
                     aborted?"true @@":"false", //@@ marks move in log
                     elapsed, ms_lo, plymax, plymax_target );
+            sargon_telemetry_event( elapsed, util::sprintf("aborted plymax=%d plymax_target=%d",plymax,plymax_target) );
         }
         else
         {
             std::string s = the_pv.variation[0].TerseOut();
             std::string bestm = sargon_export_move(BESTM);
-            if( s.substr(0,4) != bestm )
+            if( !last_run_cached && s.substr(0,4) != bestm )
                 log( "Unexpected event: BESTM=%s != PV[0]=%s\n%s", bestm.c_str(), s.c_str(), the_position.ToDebugStr().c_str() );
             info = generate_progress_report( we_are_forcing_mate, we_are_stalemating_now );
             bool repeating = (state==REPEATING_ADAPTIVE || state==REPEATING_FIXED || state==REPEATING_FIXED_WITH_LOOPING);
             if( (!repeating||we_are_forcing_mate) && info.length() > 0 )
             {
-                fprintf( stdout, info.c_str() );
-                fflush( stdout );
+                uci_send( info );
                 log( "rsp>%s\n", info.c_str() );
                 stop_rsp = util::sprintf( "bestmove %s\n", the_pv.variation[0].TerseOut().c_str() ); 
                 info.clear();
@@ -1258,11 +2042,14 @@ static thc::Move calculate_next_move( bool new_game, unsigned long ms_time, unsi
             if( mating.variation.size() == 1 )
             {
                 log( "(Immediate mate in one available, play it)\n" );
+                sargon_telemetry_event( elapsed, "immediate mate in one" );
                 mating.active = false;
             }
             else
             {
                 log( "(Starting mating line)\n" );
+                sargon_telemetry_event( elapsed, util::sprintf("starting mating line, mate in %d",mating.nbr) );
+                old_state = state;
                 switch(state)
                 {
                     case ADAPTIVE_NO_TARGET_YET:        state = PLAYING_OUT_MATE_ADAPTIVE;  break;
@@ -1275,6 +2062,7 @@ static thc::Move calculate_next_move( bool new_game, unsigned long ms_time, unsi
                     case REPEATING_FIXED:               state = PLAYING_OUT_MATE_FIXED;     break;
                     case REPEATING_FIXED_WITH_LOOPING:  state = PLAYING_OUT_MATE_FIXED;     break;
                 }
+                log_state_changes( "Mating state machine:", old_state, state );
             }
             if( timer_running )
                 timer_clear();
@@ -1430,13 +2218,13 @@ static thc::Move calculate_next_move( bool new_game, unsigned long ms_time, unsi
                     the_pv = repetition_fallback_pv;
                 else if( info.length() > 0 )
                 {
-                    fprintf( stdout, info.c_str() );
-                    fflush( stdout );
+                    uci_send( info );
                     log( "rsp>%s\n", info.c_str() );
                     stop_rsp = util::sprintf( "bestmove %s\n", the_pv.variation[0].TerseOut().c_str() ); 
                     info.clear();
                 }
                 log( "After repetition avoidance, new value=%d, so %s\n", score_after_repetition_avoid, fallback ? "did fallback" : "didn't fallback" );
+                sargon_telemetry_event( elapsed, util::sprintf( "after repetition avoidance value=%d, %s", score_after_repetition_avoid, fallback ? "did fallback" : "didn't fallback" ) );
                 ready = true;
                 switch(state)
                 {
@@ -1464,6 +2252,8 @@ static thc::Move calculate_next_move( bool new_game, unsigned long ms_time, unsi
             {
                 log( "Repetition avoidance, %s repeats\n", mv.TerseOut().c_str() );
                 bool ok = repetition_calculate( the_position, the_repetition_moves );
+                sargon_telemetry_event( elapsed, util::sprintf( "repetition avoidance, %s repeats, %s", mv.TerseOut().c_str(),
+                            ok ? "searching again without repeating moves" : "all moves repeat" ) );
                 if( !ok )
                 {
                     the_repetition_moves.clear();   // don't do repetition avoidance - all moves repeat
@@ -1471,6 +2261,7 @@ static thc::Move calculate_next_move( bool new_game, unsigned long ms_time, unsi
                 else
                 {
                     repetition_fallback_pv = the_pv;
+                    old_state = state;
                     switch(state)
                     {
                         case ADAPTIVE_NO_TARGET_YET:        state = REPEATING_ADAPTIVE;             break;
@@ -1483,6 +2274,7 @@ static thc::Move calculate_next_move( bool new_game, unsigned long ms_time, unsi
                         case REPEATING_FIXED:               state = REPEATING_FIXED;                break;
                         case REPEATING_FIXED_WITH_LOOPING:  state = REPEATING_FIXED_WITH_LOOPING;   break;
                     }
+                    log_state_changes( "Repetition state machine:", old_state, state );
                     if( state == REPEATING_ADAPTIVE )
                     {
                         if( plymax > 1 )
@@ -1756,34 +2548,9 @@ static thc::Move calculate_next_move( bool new_game, unsigned long ms_time, unsi
 // Simple logging facility gives us some debug capability when running under control of a GUI
 static int log( const char *fmt, ... )
 {
-    static std::mutex mtx;
-    std::lock_guard<std::mutex> lck(mtx);
 	va_list args;
 	va_start( args, fmt );
-    if( logfile_name != "" )
-    {
-        static bool first=true;
-        FILE *file_log;
-        errno_t err = fopen_s( &file_log, logfile_name.c_str(), first? "wt" : "at" );
-        first = false;
-        if( !err )
-        {
-            static char buf[1024];
-            time_t t = time(NULL);
-            struct tm ptm;
-            localtime_s( &ptm, &t );
-            asctime_s( buf, sizeof(buf), &ptm );
-            char *p = strchr(buf,'\n');
-            if( p )
-                *p = '\0';
-            fputs( buf, file_log);
-            buf[0] = ':';
-            buf[1] = ' ';
-            vsnprintf( buf+2, sizeof(buf)-4, fmt, args ); 
-            fputs( buf, file_log );
-            fclose( file_log );
-        }
-    }
+    sargon_log_vprintf( fmt, args );  // queued, written by a background thread
     va_end(args);
     return 0;
 }
@@ -1827,16 +2594,6 @@ static bool test_whether_move_repeats( thc::ChessRules &cr, thc::Move mv )
     return (repetition_count > 1);
 }
 
-struct NativeMove
-{
-    unsigned char ptr_lo;
-    unsigned char ptr_hi;
-    unsigned char square_src;
-    unsigned char square_dst;
-    unsigned char flags;
-    unsigned char value;
-};
-
 static void show()
 {
     unsigned char nply = peekb(NPLY);
@@ -2011,105 +2768,7 @@ static bool repetition_test()
 // Remove candidate moves that will cause the position to repeat
 static void repetition_remove_moves(  const std::vector<thc::Move> &repetition_moves  )
 {
-    //show();
-
-    // Locate the list of candidate moves (ptr ends up being 0x400 always)
-    unsigned int addr = PLYIX;
-    unsigned int base = peekw(addr);
-    unsigned int ptr  = base;
-
-    // Read a vector of NativeMove
-    unsigned int mlnxt = peekw(MLNXT);
-    if( ptr!=0x400 || mlnxt<=ptr || ((mlnxt-ptr)%6)!=0 || ((mlnxt-ptr)/6>250) )
-        return; // sanity checks
-    std::vector<NativeMove> vin;
-    while( ptr < mlnxt )
-    {
-        NativeMove nm;
-        nm.ptr_lo = peekb(ptr++);
-        nm.ptr_hi = peekb(ptr++);
-        nm.square_src = peekb(ptr++);
-        nm.square_dst = peekb(ptr++);
-        nm.flags = peekb(ptr++);
-        nm.value = peekb(ptr++);
-        vin.push_back(nm);
-    }
-
-    // Create an edited (reduced) vector
-    std::vector<NativeMove> vout;
-    bool second_byte=false;
-    bool copy_move_and_second_byte_if_present = true;
-    for( NativeMove nm: vin )
-    {
-        if( second_byte )
-            second_byte = false;
-        else
-        {
-            if( nm.flags & 0x40 )
-                second_byte = true;
-            thc::Square src, dst;
-            copy_move_and_second_byte_if_present = true;
-            if( sargon_export_square(nm.square_src,src) && sargon_export_square(nm.square_dst,dst) )
-            {
-                for( thc::Move mv: repetition_moves )
-                {
-                    if( mv.src==src && mv.dst==dst )
-                    {
-                        copy_move_and_second_byte_if_present = false;
-                        break;
-                    }
-                }
-            }
-        }
-        if( copy_move_and_second_byte_if_present )
-            vout.push_back(nm);
-    }
-
-    // Fixup ptr fields
-    ptr = base;
-    unsigned int ptr_final_move = ptr;
-    unsigned int ptr_end = ptr + 6*vout.size();
-    second_byte=false;
-    for( NativeMove &nm: vout )
-    {
-        if( second_byte )
-        {
-            second_byte = false;
-            nm.ptr_lo = 0;
-            nm.ptr_hi = 0;
-        }
-        else
-        {
-            if( nm.flags & 0x40 )
-                second_byte = true;
-            ptr_final_move = ptr;
-            unsigned int ptr_next = (second_byte ? ptr+12 : ptr+6);
-            if( ptr_next == ptr_end )
-                ptr_next = 0;
-            nm.ptr_lo = ((ptr_next)&0xff);
-            nm.ptr_hi = (((ptr_next)>>8)&0xff);
-        }
-        ptr += 6;
-    }
-
-    // Write vector back
-    if( vout.size() )  // but if no moves left, make no changes
-    {
-        pokew( MLLST, ptr_final_move );
-        pokew( MLNXT, ptr_end );
-        ptr = base;
-        for( NativeMove nm: vout )
-        {
-            pokeb( ptr++, nm.ptr_lo );
-            pokeb( ptr++, nm.ptr_hi );
-            pokeb( ptr++, nm.square_src );
-            pokeb( ptr++, nm.square_dst );
-            pokeb( ptr++, nm.flags );
-            pokeb( ptr++, nm.value );
-        }
-    }
-
-    //show();
+    sargon_root_filter_moves( repetition_moves, false );
 }
 
 extern "C" {
@@ -2128,23 +2787,45 @@ extern "C" {
         if( 0 == strcmp(msg,"after GENMOV()") )
         {
             genmov_callbacks++;
-            if( peekb(NPLY)==1 && the_repetition_moves.size()>0 )
-                repetition_remove_moves( the_repetition_moves );
+            sargon_nodes_callback_after_genmov();
+            if( peekb(NPLY) == 1 )
+            {
+                if( the_search_moves.size() > 0 )
+                    sargon_root_filter_moves( the_search_moves, true );
+                if( the_repetition_moves.size() > 0 )
+                    repetition_remove_moves( the_repetition_moves );
+                if( the_multipv_moves.size() > 0 )
+                    sargon_root_filter_moves( the_multipv_moves, false );
+            }
+            if( debug_mode )
+                sargon_stats_callback_after_genmov();
+            if( progress_enabled )
+                progress_callback_after_genmov();
+            sargon_annotate_callback_after_genmov();
         }
         else if( 0 == strcmp(msg,"end of POINTS()") )
         {
             end_of_points_callbacks++;
+            sargon_nodes_callback_end_of_points();
             sargon_pv_callback_end_of_points();
         }
         else if( 0 == strcmp(msg,"Yes! Best move") )
         {
             bestmove_callbacks++;
             sargon_pv_callback_yes_best_move();
+            if( debug_mode )
+                sargon_stats_callback_yes_best_move();
+        }
+        else if( 0 == strcmp(msg,"Alpha beta cutoff?") )
+        {
+            if( debug_mode )
+                sargon_stats_callback_alpha_beta_cutoff( reg_eax, reg_ebx );
         }
 
-        // Abort run_sargon() if new event in queue (and not PLYMAX==1 which is
-        //  effectively instantaneous, finds a baseline move)
-        if( !async_queue.empty() && peekb(PLYMAX)>1 )
+        // Abort run_sargon() if new event in queue or node budget exhausted
+        //  (and not PLYMAX==1 which is effectively instantaneous, finds a
+        //  baseline move)
+        if( (!async_queue.empty() || (nodes_limit>0 && sargon_nodes()>=nodes_limit)) && peekb(PLYMAX)>1 )
         {
             longjmp( jmp_buf_env, 1 );
         }
@@ -0,0 +1,505 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-epd.cpp
+ *       EPD test suite solver, for sargon-tests
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+/*
+
+  Each EPD line is the first four fields of a FEN, then operations separated
+  by semicolons. We use "bm" (a best move, any of which solves the position),
+  "am" (moves to avoid, anything else solves the position) and "id".
+
+  A position is searched with PLYMAX 1, 2, 3 ... until the budget is used up.
+  Each iteration costs several times the one before, so the budget is also
+  checked from callback() (see sargon_epd_callback_after_genmov()) and an
+  iteration that runs out is abandoned part way through. After each
+  completed iteration we note whether Sargon's move solves the position; the
+  solution has stabilised at the first iteration from which every later
+  iteration also solves it, and the nodes and time used up to the end of that
+  iteration are what we report. Sargon is deterministic, so these figures
+  (unlike times) are exactly repeatable and are the better way to compare
+  configurations.
+
+  Sargon runs in a single global memory image, so we can't have several
+  searches in one process. Instead with more than one job we start that many
+  copies of sargon-tests as workers, each solves an interleaved share of the
+  positions and prints a machine readable line for each, which we read back
+  through a pipe. Each pipe has its own reader thread, so no worker ever
+  waits for us to get around to its pipe.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include "util.h"
+#include "thc.h"
+#include "sargon-asm-interface.h"
+#include "sargon-interface.h"
+#include "sargon-pv.h"
+#include "sargon-profile.h"
+#include "sargon-epd.h"
+
+#if defined(_WIN32)
+#define popen  _popen
+#define pclose _pclose
+#endif
+
+#define EPD_DEFAULT_MS 5000
+#define EPD_MAX_PLYMAX 20
+#define EPD_CLOCK_INTERVAL 256  // GENMOV callbacks between clock checks
+
+// The iteration in progress, and its limits, for callback()
+static bool searching;
+static jmp_buf jmp_buf_env;
+static unsigned long iteration_nodes_limit;     // 0 = no limit
+static bool iteration_deadline_set;
+static std::chrono::time_point<std::chrono::steady_clock> iteration_deadline;
+static unsigned int clock_countdown;
+
+struct EPD_POSITION
+{
+    int                     line;
+    std::string             id;
+    std::string             fen;
+    std::vector<thc::Move>  bm;
+    std::vector<thc::Move>  am;
+};
+
+struct EPD_RESULT
+{
+    int           idx;
+    bool          solved;
+    int           depth;            // last completed iteration
+    int           stable_depth;     // iteration from which it stayed solved
+    unsigned long nodes;
+    unsigned long stable_nodes;
+    unsigned long ms;
+    unsigned long stable_ms;
+    std::string   move;
+    EPD_RESULT() : idx(0), solved(false), depth(0), stable_depth(0), nodes(0),
+                   stable_nodes(0), ms(0), stable_ms(0) {}
+};
+
+static bool read_epd( const std::string &epd_file, std::vector<EPD_POSITION> &positions );
+static bool parse_epd_line( const std::string &line, EPD_POSITION &pos, std::string &error );
+static void solve( const EPD_POSITION &pos, const EPD_BUDGET &budget, EPD_RESULT &result );
+static bool run_iteration( const thc::ChessRules &cr, int plymax, PV &pv );
+static std::string format_result( const EPD_RESULT &result );
+static bool parse_result( const std::string &line, EPD_RESULT &result );
+static void print_result( const EPD_POSITION &pos, const EPD_RESULT &result );
+static void print_summary( const std::vector<EPD_RESULT> &results );
+
+bool sargon_epd_suite( const std::string &self, const std::string &epd_file, int jobs,
+                       const EPD_BUDGET &budget )
+{
+    std::vector<EPD_POSITION> positions;
+    if( !read_epd(epd_file,positions) )
+        return false;
+    if( jobs < 1 )
+        jobs = 1;
+    if( jobs > static_cast<int>(positions.size()) )
+        jobs = positions.size()>0 ? static_cast<int>(positions.size()) : 1;
+    printf( "* EPD tests, %d positions from %s", static_cast<int>(positions.size()), epd_file.c_str() );
+    if( budget.nodes )
+        printf( ", %lu nodes", budget.nodes );
+    if( budget.ms || !budget.nodes )
+        printf( ", %lu ms", budget.ms ? budget.ms : static_cast<unsigned long>(EPD_DEFAULT_MS) );
+    printf( " per position, %d job%s\n", jobs, jobs>1?"s":"" );
+    std::vector<EPD_RESULT> results;
+    bool ok = true;
+
+    // Solve the positions here
+    if( jobs == 1 )
+    {
+        for( size_t i=0; i<positions.size(); i++ )
+        {
+            EPD_RESULT result;
+            result.idx = static_cast<int>(i);
+            solve( positions[i], budget, result );
+            print_result( positions[i], result );
+            results.push_back( result );
+        }
+    }
+
+    // Or start the workers, then collect their results
+    else
+    {
+        std::vector<FILE *> pipes;
+        for( int worker=0; worker<jobs; worker++ )
+        {
+            std::string cmd = util::sprintf( "\"%s\" e -epd \"%s\" -worker %d/%d -nodes %lu -ms %lu",
+                                self.c_str(), epd_file.c_str(), worker, jobs, budget.nodes, budget.ms );
+        #if defined(_WIN32)
+            cmd = "\"" + cmd + "\"";    // cmd.exe strips the outer quotes
+        #endif
+            FILE *f = popen( cmd.c_str(), "r" );
+            if( !f )
+            {
+                printf( "Error; cannot start worker process %s\n", cmd.c_str() );
+                ok = false;
+                break;
+            }
+            pipes.push_back(f);
+        }
+        std::mutex results_mtx;
+        std::vector<std::thread> readers;
+        for( FILE *f: pipes )
+        {
+            readers.push_back( std::thread( [&,f]
+            {
+                char buf[1024];
+                while( fgets(buf,sizeof(buf),f) )
+                {
+                    EPD_RESULT result;
+                    if( parse_result(buf,result) && result.idx>=0 && result.idx<static_cast<int>(positions.size()) )
+                    {
+                        std::lock_guard<std::mutex> lck(results_mtx);
+                        print_result( positions[result.idx], result );
+                        results.push_back( result );
+                    }
+                }
+                int rc = pclose(f);
+                std::lock_guard<std::mutex> lck(results_mtx);
+                if( rc != 0 )
+                    ok = false;
+            } ) );
+        }
+        for( std::thread &t: readers )
+            t.join();
+        if( results.size() != positions.size() )
+        {
+            printf( "Error; %d of %d results received from worker processes\n",
+                        static_cast<int>(results.size()), static_cast<int>(positions.size()) );
+            ok = false;
+        }
+        std::sort( results.begin(), results.end(),
+                   []( const EPD_RESULT &a, const EPD_RESULT &b ) { return a.idx < b.idx; } );
+    }
+    print_summary( results );
+    return ok;
+}
+
+bool sargon_epd_worker( const std::string &epd_file, int worker, int jobs,
+                        const EPD_BUDGET &budget )
+{
+    std::vector<EPD_POSITION> positions;
+    if( !read_epd(epd_file,positions) )
+        return false;
+    for( size_t i=worker; jobs>0 && i<positions.size(); i+=jobs )
+    {
+        EPD_RESULT result;
+        result.idx = static_cast<int>(i);
+        solve( positions[i], budget, result );
+        printf( "%s\n", format_result(result).c_str() );
+        fflush( stdout );   // the parent is waiting on a pipe
+    }
+    return true;
+}
+
+// Read all the usable positions, reporting (but skipping) any others
+static bool read_epd( const std::string &epd_file, std::vector<EPD_POSITION> &positions )
+{
+    std::ifstream in( epd_file.c_str() );
+    if( !in )
+    {
+        printf( "Error; cannot open EPD file %s\n", epd_file.c_str() );
+        return false;
+    }
+    std::string line;
+    int line_nbr = 0;
+    while( std::getline(in,line) )
+    {
+        line_nbr++;
+        util::trim(line);
+        if( line.length()==0 || line[0]=='#' )
+            continue;
+        EPD_POSITION pos;
+        pos.line = line_nbr;
+        std::string error;
+        if( parse_epd_line(line,pos,error) )
+            positions.push_back(pos);
+        else
+            printf( "Error; %s line %d: %s, skipped\n", epd_file.c_str(), line_nbr, error.c_str() );
+    }
+    return true;
+}
+
+static bool parse_epd_line( const std::string &line, EPD_POSITION &pos, std::string &error )
+{
+    std::vector<std::string> fields;
+    util::split( line, fields );
+    if( fields.size() < 4 )
+    {
+        error = "expected at least four FEN fields";
+        return false;
+    }
+    pos.fen = fields[0] + " " + fields[1] + " " + fields[2] + " " + fields[3] + " 0 1";
+    thc::ChessRules cr;
+    if( !cr.Forsyth(pos.fen.c_str()) )
+    {
+        error = "bad position";
+        return false;
+    }
+
+    // Operations follow the fourth field
+    size_t offset = 0;
+    for( int i=0; i<4; i++ )
+    {
+        offset = line.find_first_not_of( " \t", offset );
+        offset = line.find_first_of( " \t", offset );
+    }
+    std::string operations = offset==std::string::npos ? "" : line.substr(offset);
+    size_t start = 0;
+    while( start < operations.length() )
+    {
+        size_t end = operations.find( ';', start );
+        if( end == std::string::npos )
+            end = operations.length();
+        std::string operation = operations.substr( start, end-start );
+        start = end+1;
+        std::vector<std::string> operands;
+        util::split( operation, operands );
+        if( operands.size() < 2 )
+            continue;
+        std::string opcode = operands[0];
+        if( opcode == "id" )
+        {
+            util::trim( operation );
+            pos.id = operation.substr(2);
+            util::trim( pos.id );
+            if( pos.id.length()>=2 && pos.id[0]=='"' && pos.id[pos.id.length()-1]=='"' )
+                pos.id = pos.id.substr( 1, pos.id.length()-2 );
+        }
+        else if( opcode=="bm" || opcode=="am" )
+        {
+            for( size_t i=1; i<operands.size(); i++ )
+            {
+                std::string san = operands[i];
+                while( san.length()>0 && strchr("+#!?",san[san.length()-1]) )
+                    san = san.substr( 0, san.length()-1 );
+                thc::Move mv;
+                if( !mv.NaturalIn(&cr,san.c_str()) )
+                {
+                    error = util::sprintf( "illegal %s move %s", opcode.c_str(), operands[i].c_str() );
+                    return false;
+                }
+                (opcode=="bm" ? pos.bm : pos.am).push_back(mv);
+            }
+        }
+    }
+    if( pos.bm.size()==0 && pos.am.size()==0 )
+    {
+        error = "no bm or am operation";
+        return false;
+    }
+    if( pos.id == "" )
+        pos.id = util::sprintf( "line %d", pos.line );
+    return true;
+}
+
+// Search with increasing PLYMAX until the budget is used up
+static void solve( const EPD_POSITION &pos, const EPD_BUDGET &budget, EPD_RESULT &result )
+{
+    thc::ChessRules cr;
+    cr.Forsyth( pos.fen.c_str() );
+    unsigned long ms_budget = budget.ms;
+    if( !budget.nodes && !budget.ms )
+        ms_budget = EPD_DEFAULT_MS;
+    for( int plymax=1; plymax<=EPD_MAX_PLYMAX; plymax++ )
+    {
+        PV pv;
+        sargon_nodes_clear();
+        std::chrono::time_point<std::chrono::steady_clock> base = std::chrono::steady_clock::now();
+        iteration_nodes_limit = budget.nodes ? budget.nodes-result.nodes : 0;
+        iteration_deadline_set = (ms_budget != 0);
+        if( iteration_deadline_set )   // result.ms < ms_budget, or we'd have stopped
+            iteration_deadline = base + std::chrono::milliseconds(ms_budget-result.ms);
+        bool completed = run_iteration( cr, plymax, pv );
+        std::chrono::time_point<std::chrono::steady_clock> now = std::chrono::steady_clock::now();
+        std::chrono::milliseconds ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - base);
+        result.ms += static_cast<unsigned long>(ms.count());
+        result.nodes += sargon_nodes();
+        if( !completed )
+            break;  // the budget ran out, keep the last completed iteration
+        result.depth = plymax;
+
+        // Sargon's move, from the PV or failing that BESTM
+        thc::Move mv;
+        bool have_move = false;
+        if( pv.variation.size() > 0 )
+        {
+            mv = pv.variation[0];
+            have_move = true;
+        }
+        else
+        {
+            std::string terse = sargon_export_move(BESTM);
+            have_move = mv.TerseIn( &cr, terse.c_str() );
+        }
+        bool solved = false;
+        if( have_move )
+        {
+            result.move = mv.NaturalOut(&cr);
+            if( pos.bm.size() > 0 )
+                solved = (std::find(pos.bm.begin(),pos.bm.end(),mv) != pos.bm.end());
+            else
+                solved = (std::find(pos.am.begin(),pos.am.end(),mv) == pos.am.end());
+        }
+        if( solved && !result.solved )
+        {
+            result.stable_depth = plymax;
+            result.stable_nodes = result.nodes;
+            result.stable_ms    = result.ms;
+        }
+        result.solved = solved;
+        if( (budget.nodes && result.nodes>=budget.nodes) || (ms_budget && result.ms>=ms_budget) )
+            break;
+    }
+    if( !result.solved )
+    {
+        result.stable_depth = 0;
+        result.stable_nodes = 0;
+        result.stable_ms    = 0;
+    }
+}
+
+// Run one iteration, returns false if it was abandoned because the budget
+//  ran out
+static bool run_iteration( const thc::ChessRules &cr, int plymax, PV &pv )
+{
+    if( setjmp(jmp_buf_env) )
+    {
+        searching = false;
+        sargon_perf_end();  // longjmp() bypassed the normal end of measurement
+        sargon_profile_leave();
+        return false;
+    }
+    clock_countdown = EPD_CLOCK_INTERVAL;
+    searching = true;
+    sargon_run_engine( cr, plymax, pv, true );  // avoid_book = true, we want a search
+    searching = false;
+    return true;
+}
+
+void sargon_epd_callback_after_genmov()
+{
+    // PLYMAX 1 is always completed, it's effectively instantaneous and gives
+    //  us a move
+    if( !searching || peekb(PLYMAX)<=1 )
+        return;
+    bool over = (iteration_nodes_limit && sargon_nodes()>=iteration_nodes_limit);
+    if( !over && iteration_deadline_set && --clock_countdown==0 )
+    {
+        clock_countdown = EPD_CLOCK_INTERVAL;
+        over = (std::chrono::steady_clock::now() >= iteration_deadline);
+    }
+    if( over )
+        longjmp( jmp_buf_env, 1 );
+}
+
+// Worker result line, for example;
+//  epd-result 12 solved 1 depth 6 stable-depth 4 nodes 123456 stable-nodes 2345 time 1234 stable-time 56 move Nf5
+static std::string format_result( const EPD_RESULT &result )
+{
+    return util::sprintf( "epd-result %d solved %d depth %d stable-depth %d nodes %lu stable-nodes %lu time %lu stable-time %lu move %s",
+                            result.idx, result.solved?1:0, result.depth, result.stable_depth, result.nodes,
+                            result.stable_nodes, result.ms, result.stable_ms,
+                            result.move=="" ? "-" : result.move.c_str() );
+}
+
+static bool parse_result( const std::string &line, EPD_RESULT &result )
+{
+    std::vector<std::string> fields;
+    util::split( line, fields );
+    if( fields.size()<2 || fields[0]!="epd-result" )
+        return false;
+    result.idx = atoi( fields[1].c_str() );
+    for( size_t i=2; i+1<fields.size(); i+=2 )
+    {
+        const std::string &key = fields[i];
+        const std::string &value = fields[i+1];
+        unsigned long n = strtoul( value.c_str(), NULL, 10 );
+        if( key == "solved" )
+            result.solved = (n != 0);
+        else if( key == "depth" )
+            result.depth = static_cast<int>(n);
+        else if( key == "stable-depth" )
+            result.stable_depth = static_cast<int>(n);
+        else if( key == "nodes" )
+            result.nodes = n;
+        else if( key == "stable-nodes" )
+            result.stable_nodes = n;
+        else if( key == "time" )
+            result.ms = n;
+        else if( key == "stable-time" )
+            result.stable_ms = n;
+        else if( key == "move" )
+            result.move = (value=="-" ? "" : value);
+    }
+    return true;
+}
+
+static void print_result( const EPD_POSITION &pos, const EPD_RESULT &result )
+{
+    std::string expected;
+    for( thc::Move mv: (pos.bm.size()>0 ? pos.bm : pos.am) )
+    {
+        thc::ChessRules cr;
+        cr.Forsyth( pos.fen.c_str() );
+        expected += " " + mv.NaturalOut(&cr);
+    }
+    printf( "%s: %s%s, Sargon %s, PLYMAX=%d", pos.id.c_str(), pos.bm.size()>0?"bm":"am",
+                expected.c_str(), result.move.c_str(), result.depth );
+    if( result.solved )
+        printf( " PASS (from PLYMAX=%d, %lu nodes, %.3f seconds)\n", result.stable_depth,
+                    result.stable_nodes, result.stable_ms/1000.0 );
+    else
+        printf( " FAIL\n" );
+}
+
+static void print_summary( const std::vector<EPD_RESULT> &results )
+{
+    std::vector<unsigned long> times, nodes;
+    for( const EPD_RESULT &result: results )
+    {
+        if( result.solved )
+        {
+            times.push_back( result.stable_ms );
+            nodes.push_back( result.stable_nodes );
+        }
+    }
+    printf( "Solved %d of %d\n", static_cast<int>(times.size()), static_cast<int>(results.size()) );
+    if( times.size() == 0 )
+        return;
+    std::sort( times.begin(), times.end() );
+    std::sort( nodes.begin(), nodes.end() );
+    size_t n = times.size();
+    printf( "Time to solution (seconds): min %.3f, median %.3f, 90%% %.3f, max %.3f\n",
+                times[0]/1000.0, times[n/2]/1000.0, times[(n*9)/10<n ? (n*9)/10 : n-1]/1000.0, times[n-1]/1000.0 );
+    printf( "Nodes to solution: min %lu, median %lu, 90%% %lu, max %lu\n",
+                nodes[0], nodes[n/2], nodes[(n*9)/10<n ? (n*9)/10 : n-1], nodes[n-1] );
+
+    // Cumulative distribution, number solved within each time
+    static const unsigned long limits[] = { 10, 100, 1000, 10000, 100000 };
+    printf( "Solved within:" );
+    for( unsigned long limit: limits )
+    {
+        int count = static_cast<int>( std::upper_bound(times.begin(),times.end(),limit) - times.begin() );
+        printf( " %gs %d,", limit/1000.0, count );
+    }
+    printf( " any time %d\n", static_cast<int>(n) );
+}
@@ -0,0 +1,47 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-epd.h
+ *       EPD test suite solver, for sargon-tests
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+#ifndef SARGON_EPD_H_INCLUDED
+#define SARGON_EPD_H_INCLUDED
+
+#include <string>
+
+// Per position search budget, Sargon searches with increasing PLYMAX until
+//  a budget is used up or PLYMAX 20 is done. An iteration that runs out is
+//  abandoned part way through, the result is from the last completed
+//  iteration. If neither budget is set, a 5 second time budget is used
+struct EPD_BUDGET
+{
+    unsigned long nodes;    // 0 = no node budget
+    unsigned long ms;       // 0 = no time budget
+    EPD_BUDGET() : nodes(0), ms(0) {}
+};
+
+// Solve the "bm" (best move) and "am" (avoid move) positions in an EPD file
+//  and report the number solved, the distribution of times to solution and
+//  the nodes at which each solution stabilised. Sargon's memory image is a
+//  single global, so with jobs > 1 the positions are shared between that
+//  many worker processes (each a copy of this program, self, started with
+//  the -worker option) rather than threads. Returns false if the file can't
+//  be read or a worker fails
+bool sargon_epd_suite( const std::string &self, const std::string &epd_file, int jobs,
+                       const EPD_BUDGET &budget );
+
+// Worker process, solve every jobs'th position starting with position
+//  worker (0 based) and print one machine readable result line for each
+bool sargon_epd_worker( const std::string &epd_file, int worker, int jobs,
+                        const EPD_BUDGET &budget );
+
+// The program's callback() must call this for each "after GENMOV()"
+//  callback, it abandons (longjmp()s out of) an iteration over budget
+void sargon_epd_callback_after_genmov();
+
+#endif // SARGON_EPD_H_INCLUDED
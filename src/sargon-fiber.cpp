@@ -0,0 +1,185 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-fiber.cpp
+ *       Run Sargon on a fiber, so a search can be paused and resumed
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+/*
+
+  Up to now the only way to get out of Sargon part way through a search
+  has been to longjmp() out of callback(), abandoning the search. Running
+  the search on a fiber (its own stack, switched to and from explicitly,
+  Windows fibers or POSIX ucontext) means callback() can instead switch
+  back to the code that started it, leaving Sargon's call stack intact on
+  the fiber's stack. Sargon's registers are on that stack too (callback()
+  is called with them pushed), and everything else is in Sargon's memory,
+  which is saved on the way out and restored on the way back in. So
+  searches can be paused and resumed, and several can take turns on one
+  thread.
+
+  A fiber's stack needs to be big enough for Sargon's recursion (shallow,
+  a few stack frames per ply) plus callback() and whatever it calls,
+  which is modest. 256K is plenty. It is address space rather than memory
+  though, only the pages actually used are committed (Windows commits a
+  little to start with then grows the stack on demand, and a large malloc()
+  is similarly lazy with POSIX), so many paused searches are cheap; what
+  each really costs is the part of Sargon's memory it saves, see
+  sargon_state_save().
+
+*/
+
+#include <stdlib.h>
+#include <new>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <ucontext.h>
+#endif
+#include "sargon-interface.h"
+#include "sargon-fiber.h"
+
+#define FIBER_STACK_SIZE   (256*1024)
+#define FIBER_STACK_COMMIT (16*1024)     // Windows, initially
+
+struct SARGON_FIBER
+{
+    void (*func)( void *arg );
+    void *arg;
+    bool started;
+    bool finished;
+    SARGON_STATE state;     // while paused
+#ifdef _WIN32
+    LPVOID handle;
+    LPVOID caller;
+#else
+    ucontext_t context;
+    ucontext_t caller;
+    void *stack;
+#endif
+};
+
+// The fiber running on this thread, if any
+static thread_local SARGON_FIBER *current;
+
+#ifdef _WIN32
+static VOID CALLBACK fiber_entry( LPVOID param )
+{
+    SARGON_FIBER *fiber = static_cast<SARGON_FIBER *>(param);
+    fiber->func( fiber->arg );
+    fiber->finished = true;
+    SwitchToFiber( fiber->caller );    // never returns, a finished fiber is never resumed
+}
+#else
+static void fiber_entry()
+{
+    SARGON_FIBER *fiber = current;
+    fiber->func( fiber->arg );
+    fiber->finished = true;
+    // returning continues with fiber->caller, via uc_link
+}
+#endif
+
+SARGON_FIBER *sargon_fiber_create( void (*func)( void *arg ), void *arg )
+{
+    SARGON_FIBER *fiber = new(std::nothrow) SARGON_FIBER;
+    if( !fiber )
+        return NULL;
+    fiber->func     = func;
+    fiber->arg      = arg;
+    fiber->started  = false;
+    fiber->finished = false;
+#ifdef _WIN32
+    fiber->caller = NULL;
+    fiber->handle = CreateFiberEx( FIBER_STACK_COMMIT, FIBER_STACK_SIZE, 0, fiber_entry, fiber );
+    if( !fiber->handle )
+    {
+        delete fiber;
+        return NULL;
+    }
+#else
+    fiber->stack = malloc( FIBER_STACK_SIZE );
+    if( !fiber->stack || getcontext(&fiber->context)!=0 )
+    {
+        free( fiber->stack );
+        delete fiber;
+        return NULL;
+    }
+    fiber->context.uc_stack.ss_sp   = fiber->stack;
+    fiber->context.uc_stack.ss_size = FIBER_STACK_SIZE;
+    fiber->context.uc_link          = &fiber->caller;
+    makecontext( &fiber->context, fiber_entry, 0 );
+#endif
+    return fiber;
+}
+
+int sargon_fiber_resume( SARGON_FIBER *fiber )
+{
+    if( fiber->finished )
+        return 1;
+#ifdef _WIN32
+    // Only a fiber can switch to a fiber. The thread belongs to whoever
+    //  called us (perhaps a program using the libsargon DLL), so if we
+    //  convert it we convert it back again
+    bool converted = false;
+    if( !IsThreadAFiber() )
+    {
+        if( !ConvertThreadToFiber(NULL) )
+            return -1;
+        converted = true;
+    }
+#endif
+    if( fiber->started )
+        sargon_state_restore( fiber->state );
+    fiber->started = true;
+    current = fiber;
+#ifdef _WIN32
+    fiber->caller = GetCurrentFiber();
+    SwitchToFiber( fiber->handle );
+    if( converted )
+        ConvertFiberToThread();
+#else
+    swapcontext( &fiber->caller, &fiber->context );
+#endif
+    current = NULL;
+    return fiber->finished ? 1 : 0;
+}
+
+bool sargon_fiber_active()
+{
+    return current != NULL;
+}
+
+void sargon_fiber_pause()
+{
+    SARGON_FIBER *fiber = current;
+    if( !fiber )
+        return;
+    sargon_state_save( fiber->state );
+#ifdef _WIN32
+    SwitchToFiber( fiber->caller );
+#else
+    swapcontext( &fiber->context, &fiber->caller );
+#endif
+}
+
+size_t sargon_fiber_bytes( const SARGON_FIBER *fiber )
+{
+    return sizeof(SARGON_FIBER) + fiber->state.memory.capacity();
+}
+
+void sargon_fiber_destroy( SARGON_FIBER *fiber )
+{
+    if( !fiber )
+        return;
+#ifdef _WIN32
+    DeleteFiber( fiber->handle );
+#else
+    free( fiber->stack );
+#endif
+    delete fiber;
+}
@@ -0,0 +1,48 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-fiber.h
+ *       Run Sargon on a fiber, so a search can be paused and resumed
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+#ifndef SARGON_FIBER_H_INCLUDED
+#define SARGON_FIBER_H_INCLUDED
+
+#include <stddef.h>
+
+struct SARGON_FIBER;
+
+// Create a fiber that will run func(arg) on its own stack (func normally
+//  calls into Sargon), it doesn't start until resumed. NULL if out of memory
+SARGON_FIBER *sargon_fiber_create( void (*func)( void *arg ), void *arg );
+
+// Run (or continue running) the fiber until it pauses or func returns.
+//  Returns 1 if func has returned, 0 if it paused, -1 if it couldn't be run
+//  (Windows, the calling thread couldn't be converted to a fiber; it is
+//  converted back afterwards if it wasn't one already). Call from ordinary
+//  code, not from another of our fibers
+int sargon_fiber_resume( SARGON_FIBER *fiber );
+
+// True if we are running on a fiber, so can pause
+bool sargon_fiber_active();
+
+// Pause the running fiber, returning from sargon_fiber_resume(). Only from
+//  callback(); Sargon's state is saved (sargon_state_save()) and restored
+//  when the fiber is resumed, other fibers or ordinary code can use Sargon
+//  meanwhile
+void sargon_fiber_pause();
+
+// Memory used by a fiber, apart from its stack; mostly the share of Sargon's
+//  memory saved while it is paused
+size_t sargon_fiber_bytes( const SARGON_FIBER *fiber );
+
+// Free a fiber, it must have finished or never been resumed, since the
+//  objects on its stack can't be destroyed any other way. To get rid of a
+//  paused search, stop it and resume it to the end
+void sargon_fiber_destroy( SARGON_FIBER *fiber );
+
+#endif // SARGON_FIBER_H_INCLUDED
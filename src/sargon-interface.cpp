@@ -9,16 +9,34 @@
  * Bill Forster, https://github.com/billforsternz/retro-sargon
  ****************************************************************************/
 
+#include <string.h>
 #include <string>
 #include <vector>
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#define SARGON_PERF_EVENTS
+#endif
 #include "util.h"
 #include "thc.h"
 #include "sargon-interface.h"
 #include "sargon-asm-interface.h"
+#include "sargon-profile.h"
 
 // Write chess position into Sargon (inner-most part)
 static void sargon_import_position_inner( const thc::ChessPosition &cp );
 
+// Snapshots of imported positions, so importing the same position again is
+//  just a few memcpy()s
+static uint64_t import_key( uint64_t hash, const thc::ChessPosition &cp, bool avoid_book );
+static bool import_snapshot_restore( uint64_t key, const thc::ChessPosition &cp, bool avoid_book );
+static void import_snapshot_save( uint64_t key, const thc::ChessPosition &cp, bool avoid_book );
+
+// All calls to Sargon go through here, so they can be measured
+static void sargon_call( int api_command_code, z80_registers *registers=NULL );
+
 // Convert Sargon value to pawns
 double sargon_export_value( unsigned int value )
 
@@ -248,7 +266,7 @@ bool sargon_play_move( thc::Move &mv )
         unsigned int file = terse[0 + 2*i] - 0x20;    // toupper for ASNTBI()
         unsigned int rank = terse[1 + 2*i];
         regs.hl = (file<<8) + rank;     // eg set hl registers = 0x4838 = "H8"
-        sargon( api_ASNTBI, &regs );    // ASNTBI = ASCII square name to board index
+        sargon_call( api_ASNTBI, &regs );    // ASNTBI = ASCII square name to board index
         ok = (((regs.bc>>8) & 0xff) == 0);  // ok if reg B eq 0
         if( ok )
         {
@@ -258,10 +276,10 @@ bool sargon_play_move( thc::Move &mv )
     }
     if( ok )
     {
-        sargon( api_VALMOV, &regs );
+        sargon_call( api_VALMOV, &regs );
         ok = ((regs.af & 0xff) == 0);  // ok if reg A eq 0
         if( ok )
-            sargon( api_EXECMV, &regs );
+            sargon_call( api_EXECMV, &regs );
     }
 
     // Restore COLOR and KOLOR
@@ -386,12 +404,19 @@ void sargon_import_position( const thc::ChessPosition &cp, bool avoid_book )
                         //  in part to make this flaw harmless. We set MLPTRJ to 0 before any sequence of
                         //  Sargon operations to lock down this behaviour.
 
+    // Batch analysis imports the same positions over and over, skip all the
+    //  work below if we've seen this one before
+    thc::ChessPosition cp_work = cp;
+    uint64_t hash = cp_work.Hash64Calculate();
+    uint64_t key = import_key( hash, cp, avoid_book );
+    if( import_snapshot_restore( key, cp, avoid_book ) )
+        return;
+
     // Sargon's move evaluation takes some account of the full move number (it
     //  prioritises moving unmoved pieces early). So get an approximation to
     //  that by counting pieces that aren't in their initial positions
     int moveno = 0;
-    thc::ChessRules init;
-    thc::ChessPosition cp_work = cp;
+    static thc::ChessRules init;
 
     // Special provision must be made for book moves after one White move from initial position
     //  If moveno==1 and Black to play, Sargon plays either 1...e5 or 1...d5 depending on what
@@ -426,20 +451,33 @@ void sargon_import_position( const thc::ChessPosition &cp, bool avoid_book )
     }
 
     // Check initial and one half move played positions, set moveno = 1 for
-    //  those cases only to get Book move
+    //  those cases only to get Book move. Compare square hashes (confirming
+    //  matches) rather than whole positions, the hashes of the 20 positions
+    //  after White's first move are calculated once only
+    static uint64_t init_hash;
+    static std::vector<thc::Move> first_moves;
+    static std::vector<uint64_t> first_move_hashes;
+    if( first_moves.size() == 0 )
+    {
+        init_hash = init.Hash64Calculate();
+        init.GenLegalMoveList( first_moves );
+        for( thc::Move mv: first_moves )
+            first_move_hashes.push_back( init.Hash64Update(init_hash,mv) );
+    }
     if( cp_work.WhiteToPlay() && white_count==0 )
     {
-        if( cp_work.ToDebugStr() == init.ToDebugStr() )
+        if( hash==init_hash && 0==memcmp(cp_work.squares,init.squares,64) )
             moveno = 1;
     }
     else if( !cp_work.WhiteToPlay() && black_count==0 )
     {
-        std::vector<thc::Move> moves;
-        init.GenLegalMoveList( moves );
-        for( thc::Move mv: moves )
+        for( size_t i=0; i<first_moves.size(); i++ )
         {
+            if( hash != first_move_hashes[i] )
+                continue;
+            thc::Move mv = first_moves[i];
             init.PushMove(mv);
-            if( cp_work.ToDebugStr() == init.ToDebugStr() )
+            if( 0 == memcmp(cp_work.squares,init.squares,64) )
             {
                 moveno = 1;
                 one_white_move_after_initial_position = true;
@@ -468,6 +506,7 @@ void sargon_import_position( const thc::ChessPosition &cp, bool avoid_book )
     // To support Black book moves, create initial position and play White's first
     //  move
     thc::Square sq = cp.enpassant_target;
+    bool snapshot = false;  // only if no moves are played within Sargon
     if( one_white_move_after_initial_position )
     {
         thc::ChessRules cr_initial;
@@ -480,6 +519,7 @@ void sargon_import_position( const thc::ChessPosition &cp, bool avoid_book )
     else if( sq == thc::SQUARE_INVALID )
     {
         sargon_import_position_inner( cp_work );
+        snapshot = true;
     }
     else
     {
@@ -517,6 +557,8 @@ void sargon_import_position( const thc::ChessPosition &cp, bool avoid_book )
             mv.special = (cp_work.white ? thc::SPECIAL_WPAWN_2SQUARES : thc::SPECIAL_BPAWN_2SQUARES);
             sargon_play_move( mv );
         }
+        else
+            snapshot = true;
     }
 
     // It's all very well to calculate a decent fake full_move_count, but if the originating
@@ -526,6 +568,91 @@ void sargon_import_position( const thc::ChessPosition &cp, bool avoid_book )
     //  worth getting it right if possible
     if( cp.full_move_count > 1 )
         pokeb(MOVENO,cp.full_move_count);
+    if( snapshot )
+        import_snapshot_save( key, cp, avoid_book );
+}
+
+// An imported position is BOARDA, plus the king and queen positions and the
+//  M1 board index left behind by ROYALT, plus COLOR and MOVENO. Positions
+//  that needed a move played within Sargon (en-passant, and Black's first
+//  move for book purposes) leave a move list behind too, so they aren't
+//  snapshotted. The cache is direct mapped, and each entry keeps what it
+//  was imported from, so a hash collision is just a miss
+#define IMPORT_SNAPSHOTS 1024
+struct IMPORT_SNAPSHOT
+{
+    uint64_t      key;
+    char          squares[64];
+    unsigned char white;
+    unsigned char castling;
+    unsigned char avoid_book;
+    unsigned char enpassant_target;
+    int           full_move_count;
+    bool          valid;
+    unsigned char board[120];
+    unsigned char royalty[4];
+    unsigned char m1;
+    unsigned char color;
+    unsigned char moveno;
+};
+static std::vector<IMPORT_SNAPSHOT> import_snapshots;
+
+static unsigned char import_castling( const thc::ChessPosition &cp )
+{
+    return static_cast<unsigned char>( (cp.wking?1:0) | (cp.wqueen?2:0) | (cp.bking?4:0) | (cp.bqueen?8:0) );
+}
+
+// Square hash plus everything else that affects the import
+static uint64_t import_key( uint64_t hash, const thc::ChessPosition &cp, bool avoid_book )
+{
+    uint64_t key = hash;
+    key ^= 0x9e3779b97f4a7c15ULL * static_cast<uint64_t>( (cp.white?1:0) | (import_castling(cp)<<1) | (avoid_book?0x20:0) );
+    key ^= 0xc2b2ae3d27d4eb4fULL * static_cast<uint64_t>( (cp.full_move_count<<8) | static_cast<int>(cp.enpassant_target) );
+    return key;
+}
+
+static bool import_snapshot_matches( const IMPORT_SNAPSHOT &snap, uint64_t key, const thc::ChessPosition &cp, bool avoid_book )
+{
+    return snap.valid && snap.key==key && 0==memcmp(snap.squares,cp.squares,64) &&
+           snap.white==(cp.white?1:0) && snap.castling==import_castling(cp) &&
+           snap.avoid_book==(avoid_book?1:0) &&
+           snap.enpassant_target==static_cast<unsigned char>(cp.enpassant_target) &&
+           snap.full_move_count==cp.full_move_count;
+}
+
+static bool import_snapshot_restore( uint64_t key, const thc::ChessPosition &cp, bool avoid_book )
+{
+    if( import_snapshots.size() == 0 )
+        return false;
+    const IMPORT_SNAPSHOT &snap = import_snapshots[key % IMPORT_SNAPSHOTS];
+    if( !import_snapshot_matches(snap,key,cp,avoid_book) )
+        return false;
+    memcpy( poke(BOARDA), snap.board, sizeof(snap.board) );
+    memcpy( poke(POSK), snap.royalty, sizeof(snap.royalty) );
+    pokeb( M1, snap.m1 );
+    pokeb( COLOR, snap.color );
+    pokeb( MOVENO, snap.moveno );
+    return true;
+}
+
+static void import_snapshot_save( uint64_t key, const thc::ChessPosition &cp, bool avoid_book )
+{
+    if( import_snapshots.size() == 0 )
+        import_snapshots.resize( IMPORT_SNAPSHOTS );
+    IMPORT_SNAPSHOT &snap = import_snapshots[key % IMPORT_SNAPSHOTS];
+    snap.key = key;
+    memcpy( snap.squares, cp.squares, 64 );
+    snap.white = cp.white?1:0;
+    snap.castling = import_castling(cp);
+    snap.avoid_book = avoid_book?1:0;
+    snap.enpassant_target = static_cast<unsigned char>(cp.enpassant_target);
+    snap.full_move_count = cp.full_move_count;
+    memcpy( snap.board, peek(BOARDA), sizeof(snap.board) );
+    memcpy( snap.royalty, peek(POSK), sizeof(snap.royalty) );
+    snap.m1 = peekb(M1);
+    snap.color = peekb(COLOR);
+    snap.moveno = peekb(MOVENO);
+    snap.valid = true;
 }
 
 // Write chess position into Sargon (inner-most part)
@@ -633,7 +760,7 @@ static void sargon_import_position_inner( const thc::ChessPosition &cp )
         }
     }
     memcpy( poke(BOARDA), board_position, sizeof(board_position) );
-    sargon(api_ROYALT);
+    sargon_call(api_ROYALT);
 }
 
 // Run Sargon move calculation
@@ -647,10 +774,444 @@ void sargon_run_engine( const thc::ChessPosition &cp, int plymax, PV &pv, bool a
     pokeb( PLYMAX, plymax );
     sargon_import_position( cp, avoid_book );
     pokeb( KOLOR, peekb(COLOR) );  // Set KOLOR (Sargon's colour) to COLOR (side to move)
-    sargon(api_CPTRMV);
+    sargon_call(api_CPTRMV);
     pv = sargon_pv_get(); // only update if CPTRMV completes (engine uses longjmp to abort if timeout)
 }
 
+// Sargon's move list entries
+struct NativeMove
+{
+    unsigned char ptr_lo;
+    unsigned char ptr_hi;
+    unsigned char square_src;
+    unsigned char square_dst;
+    unsigned char flags;
+    unsigned char value;
+};
+
+// Compare a Sargon move with a full thc::Move, including the special field.
+//  Given the position, src and dst determine everything except the promotion
+//  piece, and Sargon always promotes to Queen
+static bool native_move_equal( const NativeMove &nm, const thc::Move &mv )
+{
+    thc::Square src, dst;
+    if( !sargon_export_square(nm.square_src,src) || !sargon_export_square(nm.square_dst,dst) )
+        return false;
+    bool under_promotion = (mv.special==thc::SPECIAL_PROMOTION_ROOK   ||
+                            mv.special==thc::SPECIAL_PROMOTION_BISHOP ||
+                            mv.special==thc::SPECIAL_PROMOTION_KNIGHT);
+    return mv.src==src && mv.dst==dst && !under_promotion;
+}
+
+// Edit the root (ply 1) list of candidate moves, if keep is true keep only
+//  the listed moves, otherwise remove the listed moves
+void sargon_root_filter_moves( const std::vector<thc::Move> &moves, bool keep )
+{
+    // Locate the list of candidate moves (ptr ends up being 0x400 always)
+    unsigned int addr = PLYIX;
+    unsigned int base = peekw(addr);
+    unsigned int ptr  = base;
+
+    // Read a vector of NativeMove
+    unsigned int mlnxt = peekw(MLNXT);
+    if( ptr!=0x400 || mlnxt<=ptr || ((mlnxt-ptr)%6)!=0 || ((mlnxt-ptr)/6>250) )
+        return; // sanity checks
+    std::vector<NativeMove> vin;
+    while( ptr < mlnxt )
+    {
+        NativeMove nm;
+        nm.ptr_lo = peekb(ptr++);
+        nm.ptr_hi = peekb(ptr++);
+        nm.square_src = peekb(ptr++);
+        nm.square_dst = peekb(ptr++);
+        nm.flags = peekb(ptr++);
+        nm.value = peekb(ptr++);
+        vin.push_back(nm);
+    }
+
+    // Create an edited (reduced) vector
+    std::vector<NativeMove> vout;
+    bool second_byte=false;
+    bool copy_move_and_second_byte_if_present = true;
+    for( NativeMove nm: vin )
+    {
+        if( second_byte )
+            second_byte = false;
+        else
+        {
+            if( nm.flags & 0x40 )
+                second_byte = true;
+            bool listed = false;
+            for( thc::Move mv: moves )
+            {
+                if( native_move_equal(nm,mv) )
+                {
+                    listed = true;
+                    break;
+                }
+            }
+            copy_move_and_second_byte_if_present = (listed == keep);
+        }
+        if( copy_move_and_second_byte_if_present )
+            vout.push_back(nm);
+    }
+
+    // Fixup ptr fields
+    ptr = base;
+    unsigned int ptr_final_move = ptr;
+    unsigned int ptr_end = ptr + 6*vout.size();
+    second_byte=false;
+    for( NativeMove &nm: vout )
+    {
+        if( second_byte )
+        {
+            second_byte = false;
+            nm.ptr_lo = 0;
+            nm.ptr_hi = 0;
+        }
+        else
+        {
+            if( nm.flags & 0x40 )
+                second_byte = true;
+            ptr_final_move = ptr;
+            unsigned int ptr_next = (second_byte ? ptr+12 : ptr+6);
+            if( ptr_next == ptr_end )
+                ptr_next = 0;
+            nm.ptr_lo = ((ptr_next)&0xff);
+            nm.ptr_hi = (((ptr_next)>>8)&0xff);
+        }
+        ptr += 6;
+    }
+
+    // Write vector back
+    if( vout.size() )  // but if no moves left, make no changes
+    {
+        pokew( MLLST, ptr_final_move );
+        pokew( MLNXT, ptr_end );
+        ptr = base;
+        for( NativeMove nm: vout )
+        {
+            pokeb( ptr++, nm.ptr_lo );
+            pokeb( ptr++, nm.ptr_hi );
+            pokeb( ptr++, nm.square_src );
+            pokeb( ptr++, nm.square_dst );
+            pokeb( ptr++, nm.flags );
+            pokeb( ptr++, nm.value );
+        }
+    }
+
+}
+
+// Node counting
+static unsigned long nodes;
+static unsigned int move_list_peak;
+void sargon_nodes_clear()
+{
+    nodes = 0;
+    move_list_peak = 0;
+}
+
+unsigned long sargon_nodes()
+{
+    return nodes;
+}
+
+void sargon_nodes_add( unsigned long n )
+{
+    nodes += n;
+}
+
+void sargon_nodes_callback_after_genmov()
+{
+    nodes++;
+
+    // Each ply's move list has just been added, so MLNXT is at a high point
+    unsigned int mlnxt = peekw(MLNXT);
+    if( mlnxt > MLIST+move_list_peak )
+        move_list_peak = mlnxt - MLIST;
+}
+
+void sargon_nodes_callback_end_of_points()
+{
+    nodes++;
+}
+
+unsigned int sargon_move_list_peak()
+{
+    return move_list_peak;
+}
+
+static const void *call_stack_base;
+static void sargon_call( int api_command_code, z80_registers *registers )
+{
+    int stack_base;     // the sampling profiler scans the stack up to here
+    call_stack_base = &stack_base;
+    sargon_profile_enter( &stack_base );
+    sargon_perf_begin();
+    sargon( api_command_code, registers );
+    sargon_perf_end();
+    sargon_profile_leave();
+}
+
+// Save and restore a Sargon call in progress. Z80 EX AF,AF' and EXX are
+//  emulated with shadow registers in memory immediately before Sargon's
+//  data (see sargon-x86.asm), so they are saved too. Otherwise only the
+//  memory a search changes is saved (see the memory map in sargon-x86.asm);
+//  SCORE has a byte per ply plus dummy entries for plies -1 and 0, PLYIX a
+//  pair of pointers per ply, and Sargon goes one ply beyond PLYMAX if the
+//  king is in check there. The move list is a stack, nothing above MLNXT
+//  is needed by the plies in progress
+#define SHADOW_REGISTER_BYTES 8
+#define MOVE_BYTES 6
+#define MOVES_PER_PLY_MAX 250   // as checked by sargon_root_filter_moves()
+struct MEMORY_RANGE
+{
+    int begin;
+    int end;
+};
+#define NBR_STATE_RANGES 7
+static void state_ranges( int plymax, unsigned int mlnxt, MEMORY_RANGE ranges[NBR_STATE_RANGES] )
+{
+    if( plymax < 1 )
+        plymax = 1;
+    int plies = plymax + 1;     // one more ply for check
+    int score_end = SCORE + 2 + plies;
+    if( score_end > PLYIX )
+        score_end = PLYIX;
+    int plyix_end = PLYIX + 4*plies;
+    if( plyix_end > M1 )
+        plyix_end = M1;
+    if( mlnxt<MLIST || mlnxt>MLEND )
+        mlnxt = MLEND;
+    ranges[0].begin = -SHADOW_REGISTER_BYTES;   ranges[0].end = 0;
+    ranges[1].begin = BOARDA;                   ranges[1].end = POSQ+2;     // BOARDA, ATKLST, PLISTA, POSK, POSQ
+    ranges[2].begin = SCORE;                    ranges[2].end = score_end;
+    ranges[3].begin = PLYIX;                    ranges[3].end = plyix_end;
+    ranges[4].begin = M1;                       ranges[4].end = BMOVES;     // M1 to PTSCK
+    ranges[5].begin = LINECT;                   ranges[5].end = MVEMSG+5;
+    ranges[6].begin = MLIST;                    ranges[6].end = mlnxt;
+}
+
+void sargon_state_save( SARGON_STATE &state )
+{
+    state.plymax = peekb(PLYMAX);
+    state.mlnxt  = peekw(MLNXT);
+    MEMORY_RANGE ranges[NBR_STATE_RANGES];
+    state_ranges( state.plymax, state.mlnxt, ranges );
+    state.memory.clear();
+    for( int i=0; i<NBR_STATE_RANGES; i++ )
+        state.memory.insert( state.memory.end(), peek(ranges[i].begin), peek(ranges[i].end) );
+    state.nodes          = nodes;
+    state.move_list_peak = move_list_peak;
+    sargon_pv_state_save( state.pv );
+    state.stack_base = call_stack_base;
+    sargon_perf_end();      // close off measurement until resumed
+    sargon_profile_leave();
+}
+
+void sargon_state_restore( const SARGON_STATE &state )
+{
+    MEMORY_RANGE ranges[NBR_STATE_RANGES];
+    state_ranges( state.plymax, state.mlnxt, ranges );
+    const unsigned char *src = state.memory.data();
+    for( int i=0; i<NBR_STATE_RANGES; i++ )
+    {
+        int len = ranges[i].end - ranges[i].begin;
+        memcpy( poke(ranges[i].begin), src, len );
+        src += len;
+    }
+    nodes          = state.nodes;
+    move_list_peak = state.move_list_peak;
+    sargon_pv_state_restore( state.pv );
+    call_stack_base = state.stack_base;
+    sargon_profile_enter( state.stack_base );
+    sargon_perf_begin();
+}
+
+SARGON_STATE_BYTES sargon_state_bytes( int plymax )
+{
+    SARGON_STATE_BYTES bytes;
+    MEMORY_RANGE ranges[NBR_STATE_RANGES];
+    state_ranges( plymax, MLIST, ranges );
+    for( int i=0; i<NBR_STATE_RANGES; i++ )
+    {
+        int len = ranges[i].end - ranges[i].begin;
+        if( ranges[i].begin==SCORE || ranges[i].begin==PLYIX )
+            bytes.ply_tables += len;
+        else
+            bytes.fixed += len;
+    }
+    if( plymax < 1 )
+        plymax = 1;
+    unsigned int move_list_max = (plymax+1) * MOVES_PER_PLY_MAX * MOVE_BYTES;
+    bytes.move_list_max = move_list_max<MLEND-MLIST ? move_list_max : MLEND-MLIST;
+    bytes.shared = SHADOW_REGISTER_BYTES + MLEND - bytes.total();
+    return bytes;
+}
+
+// Hardware performance counters. The counters are opened as a single group,
+//  led by cycles, so they are all started and stopped together and are
+//  directly comparable. Counters the hardware, hypervisor or container don't
+//  support are simply left out of the group
+static bool perf_enabled;
+static bool perf_running;
+static PERF_COUNTERS perf_totals;
+#ifdef SARGON_PERF_EVENTS
+static int perf_fd[PERF_NBR_COUNTERS] = { -1, -1, -1, -1, -1 };
+static int perf_group_order[PERF_NBR_COUNTERS];    // group read returns values in this order
+static int perf_group_size;
+
+static int perf_open( unsigned int type, unsigned long long config, int group_fd )
+{
+    struct perf_event_attr attr;
+    memset( &attr, 0, sizeof(attr) );
+    attr.size           = sizeof(attr);
+    attr.type           = type;
+    attr.config         = config;
+    attr.disabled       = group_fd<0 ? 1 : 0;   // only the leader starts disabled
+    attr.exclude_kernel = 1;                    // usually required for unprivileged use
+    attr.exclude_hv     = 1;
+    attr.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>( syscall( __NR_perf_event_open, &attr, 0, -1, group_fd, 0 ) );
+}
+#endif
+
+bool sargon_perf_enable( bool enable )
+{
+    perf_running = false;
+#ifdef SARGON_PERF_EVENTS
+    for( int i=PERF_NBR_COUNTERS-1; i>=0; i-- )
+    {
+        if( perf_fd[i] >= 0 )
+            close( perf_fd[i] );
+        perf_fd[i] = -1;
+    }
+    perf_group_size = 0;
+    perf_enabled = false;
+    perf_totals = PERF_COUNTERS();
+    if( !enable )
+        return true;
+    const unsigned long long cache_read_miss = (PERF_COUNT_HW_CACHE_OP_READ<<8) | (PERF_COUNT_HW_CACHE_RESULT_MISS<<16);
+    for( int i=0; i<PERF_NBR_COUNTERS; i++ )
+    {
+        unsigned int type = PERF_TYPE_HARDWARE;
+        unsigned long long config = 0;
+        switch( i )
+        {
+            case PERF_CYCLES:        config = PERF_COUNT_HW_CPU_CYCLES;         break;
+            case PERF_INSTRUCTIONS:  config = PERF_COUNT_HW_INSTRUCTIONS;       break;
+            case PERF_BRANCH_MISSES: config = PERF_COUNT_HW_BRANCH_MISSES;      break;
+            case PERF_L1I_MISSES:    type   = PERF_TYPE_HW_CACHE;
+                                     config = PERF_COUNT_HW_CACHE_L1I | cache_read_miss;   break;
+            case PERF_L1D_MISSES:    type   = PERF_TYPE_HW_CACHE;
+                                     config = PERF_COUNT_HW_CACHE_L1D | cache_read_miss;   break;
+        }
+        perf_fd[i] = perf_open( type, config, i==PERF_CYCLES ? -1 : perf_fd[PERF_CYCLES] );
+        if( perf_fd[i] < 0 )
+        {
+            if( i == PERF_CYCLES )
+                return false;   // no leader, no counters at all
+            continue;
+        }
+        perf_totals.available[i] = true;
+        perf_group_order[perf_group_size++] = i;
+    }
+    perf_enabled = true;
+    return true;
+#else
+    perf_enabled = false;
+    perf_totals = PERF_COUNTERS();
+    return !enable;
+#endif
+}
+
+bool sargon_perf_enabled()
+{
+    return perf_enabled;
+}
+
+void sargon_perf_clear()
+{
+    PERF_COUNTERS cleared;
+    for( int i=0; i<PERF_NBR_COUNTERS; i++ )
+        cleared.available[i] = perf_totals.available[i];
+    perf_totals = cleared;
+}
+
+PERF_COUNTERS sargon_perf_get()
+{
+    return perf_totals;
+}
+
+void sargon_perf_begin()
+{
+    if( !perf_enabled )
+        return;
+#ifdef SARGON_PERF_EVENTS
+    ioctl( perf_fd[PERF_CYCLES], PERF_EVENT_IOC_RESET,  PERF_IOC_FLAG_GROUP );
+    ioctl( perf_fd[PERF_CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+    perf_running = true;
+#endif
+}
+
+void sargon_perf_end()
+{
+    if( !perf_running )
+        return;
+    perf_running = false;
+#ifdef SARGON_PERF_EVENTS
+    ioctl( perf_fd[PERF_CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP );
+
+    // Group read format is nr, time_enabled, time_running, then nr values
+    unsigned long long buf[3+PERF_NBR_COUNTERS];
+    ssize_t len = read( perf_fd[PERF_CYCLES], buf, sizeof(buf) );
+    if( len < static_cast<ssize_t>(3*sizeof(buf[0])) )
+        return;
+    unsigned long long nr           = buf[0];
+    unsigned long long time_enabled = buf[1];
+    unsigned long long time_running = buf[2];
+    if( nr > static_cast<unsigned long long>(perf_group_size) )
+        nr = perf_group_size;
+
+    // If the kernel had to multiplex the counters, scale up to estimate the
+    //  full count
+    double scale = 1.0;
+    if( time_running>0 && time_running<time_enabled )
+        scale = static_cast<double>(time_enabled) / static_cast<double>(time_running);
+    for( unsigned int i=0; i<nr; i++ )
+        perf_totals.count[ perf_group_order[i] ] += static_cast<unsigned long long>( buf[3+i] * scale );
+    perf_totals.calls++;
+#endif
+}
+
+// eg "perf calls 2 cycles 1234567 instructions 2345678 ipc 1.90 branch-misses 1234 l1i-misses n/a l1d-misses 567"
+std::string sargon_perf_report()
+{
+    if( !perf_enabled )
+        return "perf counters unavailable";
+    static const char *names[PERF_NBR_COUNTERS] =
+    {
+        "cycles", "instructions", "branch-misses", "l1i-misses", "l1d-misses"
+    };
+    std::string s = util::sprintf( "perf calls %lu", perf_totals.calls );
+    for( int i=0; i<PERF_NBR_COUNTERS; i++ )
+    {
+        if( perf_totals.available[i] )
+            s += util::sprintf( " %s %llu", names[i], perf_totals.count[i] );
+        else
+            s += util::sprintf( " %s n/a", names[i] );
+        if( i == PERF_INSTRUCTIONS )
+        {
+            if( perf_totals.available[i] && perf_totals.count[PERF_CYCLES]>0 )
+                s += util::sprintf( " ipc %.2f", static_cast<double>(perf_totals.count[PERF_INSTRUCTIONS]) /
+                                                 static_cast<double>(perf_totals.count[PERF_CYCLES]) );
+            else
+                s += " ipc n/a";
+        }
+    }
+    return s;
+}
+
 const unsigned char *peek(int offset)
 {
     unsigned char *sargon_mem_base = &sargon_base_address;
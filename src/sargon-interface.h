@@ -13,6 +13,7 @@
 #define SARGON_INTERFACE_H_INCLUDED
   
 #include <string>
+#include <vector>
 #include "sargon-pv.h"
 #include "thc.h"
 
@@ -43,6 +44,102 @@ std::string algebraic( unsigned int sq );
 // Run Sargon move calculation
 void sargon_run_engine( const thc::ChessPosition &cp, int plymax, PV &pv, bool avoid_book );
 
+// Edit the root (ply 1) list of candidate moves, if keep is true keep only
+//  the listed moves, otherwise remove the listed moves. Call from callback()
+//  on "after GENMOV()" when peekb(NPLY)==1. If no moves would be left, no
+//  change is made
+void sargon_root_filter_moves( const std::vector<thc::Move> &moves, bool keep );
+
+// Node counting, callback() must call sargon_nodes_callback_after_genmov() for
+//  each "after GENMOV()" callback (interior nodes, each position Sargon
+//  generates moves for) and sargon_nodes_callback_end_of_points() for each
+//  "end of POINTS()" callback (leaf nodes, each position evaluated)
+void sargon_nodes_clear();
+unsigned long sargon_nodes();
+void sargon_nodes_add( unsigned long n );   // nodes of an iteration that wasn't run (eg cached)
+void sargon_nodes_callback_after_genmov();
+void sargon_nodes_callback_end_of_points();
+
+// The most of the move list used (bytes from MLIST to MLNXT) since
+//  sargon_nodes_clear(), measured at each "after GENMOV()" callback
+unsigned int sargon_move_list_peak();
+
+// Optional hardware performance counters around each call into Sargon. Uses
+//  Linux perf_event_open(), unavailable on other platforms or if the kernel
+//  or container doesn't permit counting (check return from enable)
+enum
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_L1I_MISSES,
+    PERF_L1D_MISSES,
+    PERF_NBR_COUNTERS
+};
+struct PERF_COUNTERS
+{
+    unsigned long      calls;
+    bool               available[PERF_NBR_COUNTERS];
+    unsigned long long count[PERF_NBR_COUNTERS];
+    PERF_COUNTERS() : calls(0)
+    {
+        for( int i=0; i<PERF_NBR_COUNTERS; i++ )
+        {
+            available[i] = false;
+            count[i] = 0;
+        }
+    }
+};
+bool sargon_perf_enable( bool enable );
+bool sargon_perf_enabled();
+void sargon_perf_clear();
+PERF_COUNTERS sargon_perf_get();
+std::string sargon_perf_report();   // one line summary, including IPC
+
+// Counting brackets each sargon() call automatically. If a call is abandoned
+//  with longjmp() (eg engine timeout) call sargon_perf_end() to close it off
+void sargon_perf_begin();
+void sargon_perf_end();
+
+// Everything about a Sargon call in progress, apart from the call stack
+//  itself; the node count and PV calculation, and the parts of Sargon's
+//  memory a search changes. Saved when a search running on a fiber pauses
+//  and restored when it resumes (see sargon-fiber.h), so another search can
+//  use Sargon meanwhile. Only from within callback().
+//  The rest of Sargon's memory (the DIRECT, DPOINT, DCOUNT, PVALUE and PIECES
+//  tables, the BMOVES book, the unused page below them and padding) never
+//  changes, so all searches share it. What is saved is the board and its
+//  lists, the variables, the SCORE and PLYIX tables only as far as PLYMAX
+//  reaches and the move list only up to MLNXT
+struct SARGON_STATE
+{
+    std::vector<unsigned char> memory;
+    int                        plymax;
+    unsigned int               mlnxt;
+    unsigned long              nodes;
+    unsigned int               move_list_peak;
+    PV_STATE                   pv;
+    const void                *stack_base;     // of the sargon_call() in progress
+    SARGON_STATE() : plymax(0), mlnxt(0), nodes(0), move_list_peak(0), stack_base(NULL) {}
+};
+void sargon_state_save( SARGON_STATE &state );
+void sargon_state_restore( const SARGON_STATE &state );
+
+// Bytes of Sargon's memory, what all searches share and what a paused
+//  search saves (its SARGON_STATE) for a given PLYMAX. The move list is
+//  sized for the worst case, every ply of the deepest line having a full
+//  list of moves, in practice it is much less (see sargon_move_list_peak())
+struct SARGON_STATE_BYTES
+{
+    unsigned int shared;            // read-only tables and unused memory
+    unsigned int fixed;             // board, lists and variables
+    unsigned int ply_tables;        // SCORE and PLYIX
+    unsigned int move_list_max;
+    unsigned int total() const { return fixed + ply_tables + move_list_max; }
+    SARGON_STATE_BYTES() : shared(0), fixed(0), ply_tables(0), move_list_max(0) {}
+};
+SARGON_STATE_BYTES sargon_state_bytes( int plymax );
+
 // Peek and poke at Sargon
 const unsigned char *peek(int offset);
 unsigned char peekb(int offset);
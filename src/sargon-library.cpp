@@ -0,0 +1,429 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-library.cpp
+ *       libsargon, Sargon as an in-process library with a C interface
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+/*
+
+  This takes the place of sargon-engine.cpp, it provides the callback()
+  Sargon needs and drives Sargon through sargon-interface.cpp. Running
+  Sargon is protected by one mutex, since there's only one Sargon.
+
+  Stopping works as it does in sargon-engine, callback() longjmp()s out of
+  Sargon and the result of the last completed iteration stands.
+
+  Time-sliced searches run on a fiber (sargon-fiber.h), so that callback()
+  can also pause them at the end of each slice without losing any work.
+  Several searches can be in progress then, so everything about a search,
+  including its jmp_buf, belongs to its context. The mutex is held for a
+  slice, not the whole search.
+
+  A context's position includes the moves that led to it, so repetition is
+  avoided as sargon-engine avoids it; if Sargon thinks it's better but its
+  move repeats the position, search once more without the repeating moves
+  and play the new move unless that leaves us worse.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include "util.h"
+#include "thc.h"
+#include "sargon-interface.h"
+#include "sargon-asm-interface.h"
+#include "sargon-pv.h"
+#include "sargon-profile.h"
+#include "sargon-fiber.h"
+#include "sargon-library.h"
+
+#define LIBRARY_DEFAULT_DEPTH 5
+#define LIBRARY_MAX_DEPTH 20
+
+struct sargon_context
+{
+    thc::ChessRules   position;
+    std::atomic<bool> stop;
+
+    // The search, running or paused
+    thc::ChessRules            search_position;
+    std::vector<thc::Move>     search_moves;        // legal moves
+    int                        max_depth;
+    unsigned long              nodes_limit;
+    unsigned long              movetime_ms;
+    sargon_progress_callback   progress;
+    void                      *user;
+    std::chrono::time_point<std::chrono::steady_clock> base;
+    std::chrono::time_point<std::chrono::steady_clock> deadline;
+    std::chrono::time_point<std::chrono::steady_clock> slice_end;
+    bool                       slicing;
+    unsigned long              callbacks;
+    std::vector<thc::Move>     exclude;             // root moves to leave out
+    jmp_buf                    jmp_buf_env;
+    SARGON_FIBER              *fiber;               // time-sliced searches
+    char                       bestmove[8];
+    sargon_context() : stop(false), max_depth(0), nodes_limit(0), movetime_ms(0), progress(NULL),
+                       user(NULL), slicing(false), callbacks(0), fiber(NULL) { bestmove[0] = '\0'; }
+};
+
+// Sargon, and the context whose search is running on it
+static std::mutex sargon_mutex;
+static sargon_context *searching;
+
+static bool search_setup( sargon_context *ctx, const sargon_limits *limits,
+                          sargon_progress_callback progress, void *user );
+static void search_start_clock( sargon_context *ctx );
+static void search( sargon_context *ctx );
+static void search_fiber( void *arg );
+static bool run_iteration( sargon_context *ctx, int plymax, PV &pv );
+static void repetition_calculate( const thc::ChessRules &cr, const std::vector<thc::Move> &moves,
+                                  std::vector<thc::Move> &repetition_moves );
+static void report( sargon_context *ctx, const PV &pv );
+
+sargon_context *sargon_context_create( void )
+{
+    return new(std::nothrow) sargon_context;
+}
+
+void sargon_context_destroy( sargon_context *ctx )
+{
+    if( ctx && ctx->fiber )
+    {
+        // Finish a paused search, so the fiber's stack unwinds
+        ctx->stop = true;
+        char bestmove[8];
+        while( sargon_context_search_run(ctx,0,bestmove,sizeof(bestmove)) == 0 )
+            ;
+        if( ctx->fiber )
+        {
+            // It couldn't be run, free it anyway (leaking anything the
+            //  objects on its stack own, if it was paused)
+            sargon_fiber_destroy( ctx->fiber );
+            ctx->fiber = NULL;
+        }
+    }
+    delete ctx;
+}
+
+int sargon_context_set_position( sargon_context *ctx, const char *fen, const char *moves )
+{
+    thc::ChessRules cr;
+    if( fen && *fen && !cr.Forsyth(fen) )
+        return -1;
+    if( moves )
+    {
+        std::vector<std::string> fields;
+        util::split( moves, fields );
+        for( const std::string &field: fields )
+        {
+            thc::Move mv;
+            if( !mv.TerseIn(&cr,field.c_str()) )
+                return -2;
+            cr.PlayMove(mv);
+        }
+    }
+    ctx->position = cr;
+    return 0;
+}
+
+int sargon_context_search( sargon_context *ctx, const sargon_limits *limits,
+                           sargon_progress_callback progress, void *user,
+                           char *bestmove, size_t bestmove_size )
+{
+    if( !bestmove || bestmove_size<SARGON_BESTMOVE_SIZE )
+        return -3;
+    ctx->stop = false;
+    if( !search_setup(ctx,limits,progress,user) )
+        return -1;
+
+    // Wait our turn for Sargon, the time limit starts when we get it
+    std::lock_guard<std::mutex> lock(sargon_mutex);
+    search_start_clock( ctx );
+    ctx->slicing = false;
+    searching = ctx;
+    search( ctx );
+    searching = NULL;
+    strcpy_s( bestmove, bestmove_size, ctx->bestmove );
+    return 0;
+}
+
+int sargon_context_search_begin( sargon_context *ctx, const sargon_limits *limits,
+                                 sargon_progress_callback progress, void *user )
+{
+    if( ctx->fiber )
+    {
+        // Finish (quickly) and discard a search already begun
+        ctx->stop = true;
+        char bestmove[8];
+        while( sargon_context_search_run(ctx,0,bestmove,sizeof(bestmove)) == 0 )
+            ;
+        if( ctx->fiber )
+        {
+            // It couldn't be run, free it anyway (leaking anything the
+            //  objects on its stack own, if it was paused)
+            sargon_fiber_destroy( ctx->fiber );
+            ctx->fiber = NULL;
+        }
+    }
+    ctx->stop = false;
+    if( !search_setup(ctx,limits,progress,user) )
+        return -1;
+    ctx->fiber = sargon_fiber_create( search_fiber, ctx );
+    if( !ctx->fiber )
+        return -2;
+    search_start_clock( ctx );  // the time limit starts now, the search runs in slices
+    return 0;
+}
+
+int sargon_context_search_run( sargon_context *ctx, unsigned long slice_ms,
+                               char *bestmove, size_t bestmove_size )
+{
+    if( !ctx->fiber )
+        return -1;
+    if( !bestmove || bestmove_size<SARGON_BESTMOVE_SIZE )
+        return -3;
+    std::lock_guard<std::mutex> lock(sargon_mutex);
+    ctx->slicing = (slice_ms > 0);
+    ctx->slice_end = std::chrono::steady_clock::now() + std::chrono::milliseconds(slice_ms);
+    searching = ctx;
+    int ret = sargon_fiber_resume( ctx->fiber );
+    searching = NULL;
+    if( ret < 0 )
+        return -2;
+    if( ret == 0 )
+        return 0;
+    sargon_fiber_destroy( ctx->fiber );
+    ctx->fiber = NULL;
+    strcpy_s( bestmove, bestmove_size, ctx->bestmove );
+    return 1;
+}
+
+void sargon_context_stop( sargon_context *ctx )
+{
+    ctx->stop = true;
+}
+
+unsigned long sargon_context_bytes( sargon_context *ctx )
+{
+    std::lock_guard<std::mutex> lock(sargon_mutex);     // a paused search's state only changes when it runs
+    size_t bytes = sizeof(sargon_context)
+                 + (ctx->search_moves.capacity() + ctx->exclude.capacity()) * sizeof(thc::Move);
+    if( ctx->fiber )
+        bytes += sargon_fiber_bytes( ctx->fiber );
+    return static_cast<unsigned long>(bytes);
+}
+
+// Returns false if there are no legal moves
+static bool search_setup( sargon_context *ctx, const sargon_limits *limits,
+                          sargon_progress_callback progress, void *user )
+{
+    ctx->search_position = ctx->position;
+    ctx->search_position.GenLegalMoveList( ctx->search_moves );
+    if( ctx->search_moves.size() == 0 )
+        return false;
+    int max_depth = 0;
+    unsigned long nodes_limit = 0, movetime_ms = 0;
+    if( limits )
+    {
+        max_depth   = limits->depth;
+        nodes_limit = limits->nodes;
+        movetime_ms = limits->movetime_ms;
+    }
+    if( max_depth <= 0 )
+        max_depth = (nodes_limit>0 || movetime_ms>0) ? LIBRARY_MAX_DEPTH : LIBRARY_DEFAULT_DEPTH;
+    else if( max_depth > LIBRARY_MAX_DEPTH )
+        max_depth = LIBRARY_MAX_DEPTH;
+    ctx->max_depth   = max_depth;
+    ctx->nodes_limit = nodes_limit;
+    ctx->movetime_ms = movetime_ms;
+    ctx->progress    = progress;
+    ctx->user        = user;
+    ctx->callbacks   = 0;
+    ctx->exclude.clear();
+    return true;
+}
+
+static void search_start_clock( sargon_context *ctx )
+{
+    ctx->base = std::chrono::steady_clock::now();
+    ctx->deadline = ctx->base + std::chrono::milliseconds(ctx->movetime_ms);
+}
+
+// Run the search, on a fiber or not
+static void search_fiber( void *arg )
+{
+    search( static_cast<sargon_context *>(arg) );
+}
+
+static void search( sargon_context *ctx )
+{
+    const thc::ChessRules &cr = ctx->search_position;
+    sargon_nodes_clear();
+    PV best;
+    for( int plymax=1; plymax<=ctx->max_depth; plymax++ )
+    {
+        PV pv;
+        if( !run_iteration(ctx,plymax,pv) )
+            break;
+        if( pv.variation.size() > 0 )
+            best = pv;
+        report( ctx, best );
+        if( ctx->stop )
+            break;
+    }
+
+    // Avoid repetition if we are better
+    std::vector<thc::Move> repetition_moves;
+    if( best.variation.size()>0 && best.value!=0 && (cr.white ? best.value>0 : best.value<0) )
+        repetition_calculate( cr, ctx->search_moves, repetition_moves );
+    bool repeats = false;
+    for( thc::Move mv: repetition_moves )
+    {
+        if( best.variation.size()>0 && mv == best.variation[0] )
+            repeats = true;
+    }
+    if( repeats && repetition_moves.size()<ctx->search_moves.size() && !ctx->stop )
+    {
+        PV pv;
+        ctx->exclude = repetition_moves;
+        bool ok = run_iteration( ctx, best.depth, pv );
+        ctx->exclude.clear();
+        if( ok && pv.variation.size()>0 && (cr.white ? pv.value>0 : pv.value<0) )
+        {
+            best = pv;
+            report( ctx, best );
+        }
+    }
+
+    // PLYMAX 1 can't be interrupted, so there's always a move (unless Sargon
+    //  finds nothing to say, then any legal move will do)
+    thc::Move mv = best.variation.size()>0 ? best.variation[0] : ctx->search_moves[0];
+    std::string terse = mv.TerseOut();
+    strcpy_s( ctx->bestmove, terse.c_str() );
+}
+
+// Returns false if the iteration was stopped
+static bool run_iteration( sargon_context *ctx, int plymax, PV &pv )
+{
+    if( setjmp(ctx->jmp_buf_env) )
+    {
+        sargon_perf_end();  // longjmp() bypassed the normal end of measurement
+        sargon_profile_leave();
+        return false;
+    }
+    sargon_run_engine( ctx->search_position, plymax, pv, true );  // a search, not Sargon's book
+    return true;
+}
+
+// Calculate the list of moves that cause the position to repeat
+static void repetition_calculate( const thc::ChessRules &cr, const std::vector<thc::Move> &moves,
+                                  std::vector<thc::Move> &repetition_moves )
+{
+    repetition_moves.clear();
+    for( thc::Move mv: moves )
+    {
+        thc::ChessRules temp = cr;  // a copy, history and all
+        temp.PlayMove(mv);
+        if( temp.GetRepetitionCount() > 1 )
+            repetition_moves.push_back(mv);
+    }
+}
+
+static void report( sargon_context *ctx, const PV &pv )
+{
+    if( !ctx->progress )
+        return;
+    const thc::ChessRules &cr = ctx->search_position;
+    std::chrono::milliseconds ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - ctx->base);
+    sargon_info info;
+    memset( &info, 0, sizeof(info) );
+    info.depth    = pv.depth;
+    info.score_cp = cr.white ? pv.value : 0-pv.value;
+    info.nodes    = sargon_nodes();
+    info.time_ms  = static_cast<unsigned long>(ms.count());
+    thc::ChessRules temp = cr;
+    std::string bestmove, line;
+    for( size_t i=0; i<pv.variation.size(); i++ )
+    {
+        thc::Move mv = pv.variation[i];
+        std::string terse = mv.TerseOut();
+        if( i == 0 )
+            bestmove = terse;
+        line += (i>0 ? " " : "") + terse;
+        temp.PlayMove(mv);
+        thc::TERMINAL terminal;
+        if( temp.Evaluate(terminal) && (terminal==thc::TERMINAL_WCHECKMATE || terminal==thc::TERMINAL_BCHECKMATE) )
+        {
+            int mate = static_cast<int>(i+2)/2;
+            info.mate = (i%2==0) ? mate : 0-mate;   // even plies are the side to move's
+            break;
+        }
+    }
+    info.bestmove = bestmove.c_str();
+    info.pv       = line.c_str();
+    ctx->progress( &info, ctx->user );
+}
+
+// Sargon calls back into this function as it runs
+extern "C" {
+    void callback( uint32_t reg_edi, uint32_t reg_esi, uint32_t reg_ebp, uint32_t reg_esp,
+                   uint32_t reg_ebx, uint32_t reg_edx, uint32_t reg_ecx, uint32_t reg_eax,
+                   uint32_t reg_eflags )
+    {
+        uint32_t *sp = &reg_edi;
+        sp--;
+
+        // expecting code at return address to be 0xeb = 2 byte opcode, (0xeb + 8 bit relative jump),
+        uint32_t ret_addr = *sp;
+        const unsigned char *code = (const unsigned char *)ret_addr;
+        const char *msg = (const char *)(code+2);   // ASCIIZ text should come after that
+        if( 0 == strcmp(msg,"after GENMOV()") )
+        {
+            sargon_nodes_callback_after_genmov();
+            if( searching && searching->exclude.size()>0 && peekb(NPLY)==1 )
+                sargon_root_filter_moves( searching->exclude, false );
+        }
+        else if( 0 == strcmp(msg,"end of POINTS()") )
+        {
+            sargon_nodes_callback_end_of_points();
+            sargon_pv_callback_end_of_points();
+        }
+        else if( 0 == strcmp(msg,"Yes! Best move") )
+            sargon_pv_callback_yes_best_move();
+
+        // Abort the iteration if stopped, or out of nodes or time (but not
+        //  PLYMAX==1 which is effectively instantaneous, finds a baseline
+        //  move). Reading the clock is relatively expensive, so not every time
+        sargon_context *ctx = searching;
+        if( !ctx )
+            return;
+        bool read_clock = ((++ctx->callbacks&0x3ff) == 0);
+        if( peekb(PLYMAX) > 1 )
+        {
+            bool stop = ctx->stop ||
+                        (ctx->nodes_limit>0 && sargon_nodes()>=ctx->nodes_limit);
+            if( !stop && ctx->movetime_ms>0 && read_clock )
+                stop = (std::chrono::steady_clock::now() >= ctx->deadline);
+            if( stop )
+                longjmp( ctx->jmp_buf_env, 1 );
+        }
+
+        // Pause a time-sliced search at the end of its slice, Sargon's state
+        //  is saved and another search can run until this one is resumed
+        if( ctx->slicing && read_clock && sargon_fiber_active() &&
+            std::chrono::steady_clock::now() >= ctx->slice_end )
+            sargon_fiber_pause();
+    }
+};
@@ -0,0 +1,132 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-library.h
+ *       libsargon, Sargon as an in-process library with a C interface
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+#ifndef SARGON_LIBRARY_H_INCLUDED
+#define SARGON_LIBRARY_H_INCLUDED
+
+// Define LIBSARGON_STATIC when compiling libsargon's sources into a program
+//  (eg sargon-server) rather than building or using the DLL
+#if defined(_WIN32) && defined(LIBSARGON_EXPORTS)
+#define SARGON_API __declspec(dllexport)
+#elif defined(_WIN32) && !defined(LIBSARGON_STATIC)
+#define SARGON_API __declspec(dllimport)
+#else
+#define SARGON_API
+#endif
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Smallest bestmove buffer, room for a UCI move with a promotion ("e7e8q")
+   and the terminating nul */
+#define SARGON_BESTMOVE_SIZE 6
+
+/*
+    Each context has its own position and can be used from its own thread.
+    Sargon itself (the translated 1978 program) is one global memory image
+    though, so searches from different contexts take turns, a search waits
+    until any search already running has finished. All functions are safe
+    to call from any thread, but don't call sargon_context_search() from
+    within a progress callback.
+*/
+typedef struct sargon_context sargon_context;
+
+/* Search limits, zero means no limit. With no limits at all the search is
+   to depth 5. The node and time limits stop the search part way through an
+   iteration, the result is from the last completed iteration (depth 1 is
+   always completed) */
+typedef struct sargon_limits
+{
+    int           depth;        /* maximum PLYMAX, 1-20 */
+    unsigned long nodes;
+    unsigned long movetime_ms;
+} sargon_limits;
+
+/* Progress, reported after each completed iteration. Strings are only valid
+   during the callback */
+typedef struct sargon_info
+{
+    int           depth;
+    int           score_cp;     /* centipawns, from the side to move's point of view */
+    int           mate;         /* 0, or mate in n moves (negative if being mated) */
+    unsigned long nodes;        /* so far, all iterations */
+    unsigned long time_ms;      /* so far */
+    const char   *bestmove;     /* UCI notation, eg "e2e4", "e7e8q" */
+    const char   *pv;           /* UCI moves separated by spaces */
+} sargon_info;
+
+typedef void (*sargon_progress_callback)( const sargon_info *info, void *user );
+
+/* Create a context at the initial position, NULL if out of memory */
+SARGON_API sargon_context *sargon_context_create( void );
+SARGON_API void sargon_context_destroy( sargon_context *ctx );
+
+/* Set the position, fen NULL or "" for the initial position, then play moves
+   (NULL or UCI moves separated by spaces). Returns 0 on success, -1 for a
+   bad fen, -2 for a bad move (the position is unchanged after an error).
+   Pass the game's moves rather than just the fen of the latest position,
+   searches use them to avoid repeating the position when ahead */
+SARGON_API int sargon_context_set_position( sargon_context *ctx, const char *fen, const char *moves );
+
+/* Search the position, calling progress (which may be NULL) after each
+   iteration, and write the best move in UCI notation to bestmove, a buffer
+   of bestmove_size chars (at least SARGON_BESTMOVE_SIZE). Returns 0 on
+   success, -1 if there are no legal moves, -3 if bestmove is NULL or too
+   small (nothing is searched) */
+SARGON_API int sargon_context_search( sargon_context *ctx, const sargon_limits *limits,
+                                      sargon_progress_callback progress, void *user,
+                                      char *bestmove, size_t bestmove_size );
+
+/* Time-sliced searching. sargon_context_search_begin() sets up a search
+   with the same limits and progress reports as sargon_context_search(), but
+   doesn't run it, each sargon_context_search_run() runs it for about
+   slice_ms milliseconds (0 = to the end) then pauses it, keeping all its
+   work. Searches of many contexts can take turns on one thread this way,
+   or a search can be paused and resumed later. The time limit counts from
+   sargon_context_search_begin(), paused or not.
+   sargon_context_search_begin() returns 0 on success, -1 if there are no
+   legal moves, -2 if out of memory. sargon_context_search_run() returns 1
+   when the search is finished (bestmove written as for
+   sargon_context_search()), 0 if it was paused, -1 if there's no search,
+   -2 if the search couldn't be run (Windows, the calling thread couldn't
+   be converted to a fiber), -3 if bestmove is NULL or too small (the
+   search isn't run). The calling thread is left as it was found.
+   Beginning another search, or destroying the context, finishes an
+   unfinished search first (stopping it). Don't mix this with
+   sargon_context_search() on the same context */
+SARGON_API int sargon_context_search_begin( sargon_context *ctx, const sargon_limits *limits,
+                                            sargon_progress_callback progress, void *user );
+SARGON_API int sargon_context_search_run( sargon_context *ctx, unsigned long slice_ms,
+                                          char *bestmove, size_t bestmove_size );
+
+/* Ask a search of this context to stop as soon as possible (from another
+   thread, or from the progress callback). Also applies to a search still
+   waiting its turn, or paused. Depth 1 can't be stopped, so a search that
+   hasn't completed it yet still runs that iteration (it's quick) and
+   reports its move */
+SARGON_API void sargon_context_stop( sargon_context *ctx );
+
+/* Memory used by a context in bytes, including what a paused time-sliced
+   search saves of Sargon's memory (the board, variables and the parts of the
+   score, ply and move tables in use, typically a few KB; the read-only
+   tables are shared by all contexts). A paused search also has its own
+   stack, 256K of address space of which only a few pages are used. Not from
+   a progress callback */
+SARGON_API unsigned long sargon_context_bytes( sargon_context *ctx );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SARGON_LIBRARY_H_INCLUDED */
@@ -0,0 +1,272 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-log.cpp
+ *       Asynchronous log file, lock free queue drained by a writer thread
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+/*
+
+  Logging used to open, append to and close the log file for every line,
+  holding a mutex throughout. Now callers format their line into a slot of a
+  fixed size ring buffer and return, a writer thread owns the (one, open)
+  file and drains the ring buffer.
+
+  The ring buffer is the well known bounded queue where each slot carries a
+  sequence number (Dmitry Vyukov's design). Any number of threads can queue
+  lines without locking; a producer claims a slot by advancing the enqueue
+  position with compare and swap, then publishes the slot by updating its
+  sequence number. There is only one consumer, the writer thread. If the
+  queue is full the line is dropped and counted rather than waiting, the
+  writer notes drops in the file.
+
+  The writer thread sleeps on a condition variable when the queue is empty.
+  A producer only takes the wake up mutex to signal it when it is the first
+  to queue a line since the writer last woke, so a burst of lines costs one
+  signal.
+
+  Timestamps are milliseconds from a monotonic clock, taken when the line
+  is queued. The wall clock time is written once, when a file is opened.
+
+*/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "sargon-log.h"
+
+#define LOG_SLOTS     1024    // must be a power of 2
+#define LOG_LINE_MAX  1024    // longer lines are truncated
+
+struct LOG_SLOT
+{
+    std::atomic<size_t> seq;
+    unsigned long       ms;
+    char                text[LOG_LINE_MAX];
+};
+static LOG_SLOT slots[LOG_SLOTS];
+static std::atomic<size_t> enqueue_pos;
+static size_t dequeue_pos;                     // writer thread only
+static std::atomic<bool> enabled;
+static std::atomic<bool> stop_request;
+static std::atomic<unsigned long> dropped;
+
+// Wake up the writer thread
+static std::mutex              wake_mtx;
+static std::condition_variable wake_cv;
+static std::atomic<bool>       wake;
+
+// Writer thread and the file it should be writing to
+static std::mutex        control_mtx;          // not used by producers
+static std::thread       writer;
+static bool              writer_running;
+static std::string       requested_filename;
+
+static std::chrono::time_point<std::chrono::steady_clock> base = std::chrono::steady_clock::now();
+static unsigned long elapsed_milliseconds();
+static void writer_thread();
+static unsigned int drain( FILE *f );
+static FILE *open_log( const std::string &filename );
+static void wake_writer();
+
+void sargon_log_file( const std::string &filename )
+{
+    std::lock_guard<std::mutex> lck(control_mtx);
+    requested_filename = filename;
+    if( !writer_running && filename != "" )
+    {
+        for( size_t i=0; i<LOG_SLOTS; i++ )
+            slots[i].seq.store( i, std::memory_order_relaxed );
+        enqueue_pos.store( 0, std::memory_order_relaxed );
+        dequeue_pos = 0;
+        stop_request = false;
+        writer = std::thread(writer_thread);
+        writer_running = true;
+    }
+    enabled = (filename != "");
+    if( writer_running )
+        wake_writer();  // to switch files
+}
+
+void sargon_log_printf( const char *fmt, ... )
+{
+    va_list args;
+    va_start( args, fmt );
+    sargon_log_vprintf( fmt, args );
+    va_end( args );
+}
+
+void sargon_log_vprintf( const char *fmt, va_list args )
+{
+    if( !enabled.load(std::memory_order_relaxed) )
+        return;
+
+    // Claim a slot
+    LOG_SLOT *slot;
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    for(;;)
+    {
+        slot = &slots[pos & (LOG_SLOTS-1)];
+        size_t seq = slot->seq.load(std::memory_order_acquire);
+        ptrdiff_t diff = static_cast<ptrdiff_t>(seq) - static_cast<ptrdiff_t>(pos);
+        if( diff == 0 )
+        {
+            if( enqueue_pos.compare_exchange_weak( pos, pos+1, std::memory_order_relaxed ) )
+                break;
+        }
+        else if( diff < 0 )
+        {
+            dropped++;      // full
+            return;
+        }
+        else
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+    }
+
+    // Fill it in and publish it
+    slot->ms = elapsed_milliseconds();
+    vsnprintf( slot->text, sizeof(slot->text), fmt, args );
+    slot->seq.store( pos+1, std::memory_order_release );
+    wake_writer();
+}
+
+unsigned long sargon_log_dropped()
+{
+    return dropped;
+}
+
+void sargon_log_end()
+{
+    std::thread stopping;
+    {
+        std::lock_guard<std::mutex> lck(control_mtx);
+        enabled = false;
+        if( !writer_running )
+            return;
+        stop_request = true;
+        wake_writer();
+        stopping.swap( writer );
+        writer_running = false;
+    }
+    stopping.join();   // without the lock, the writer thread needs it
+}
+
+static unsigned long elapsed_milliseconds()
+{
+    std::chrono::time_point<std::chrono::steady_clock> now = std::chrono::steady_clock::now();
+    std::chrono::milliseconds ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - base);
+    return static_cast<unsigned long>(ms.count());
+}
+
+// Only the first signal since the writer last woke needs the mutex
+static void wake_writer()
+{
+    if( !wake.exchange(true) )
+    {
+        std::lock_guard<std::mutex> lck(wake_mtx);
+        wake_cv.notify_one();
+    }
+}
+
+static void writer_thread()
+{
+    FILE *f = NULL;
+    std::string filename;
+    unsigned long dropped_reported = 0;
+    for(;;)
+    {
+        // Stop only after the queue has been emptied
+        bool stopping = stop_request;
+
+        // Switch files if requested
+        {
+            std::lock_guard<std::mutex> lck(control_mtx);
+            if( requested_filename != filename )
+            {
+                if( f )
+                    fclose( f );
+                f = NULL;
+                filename = requested_filename;
+                if( filename != "" )
+                    f = open_log( filename );
+            }
+        }
+        unsigned int n = drain( f );
+        unsigned long d = dropped;
+        if( d != dropped_reported )
+        {
+            unsigned long ms = elapsed_milliseconds();
+            if( f )
+                fprintf( f, "%lu.%03lu: (%lu log lines dropped)\n", ms/1000, ms%1000, d-dropped_reported );
+            dropped_reported = d;
+        }
+        if( n > 0 && f )
+            fflush( f );
+        else if( stopping )
+            break;
+        else
+        {
+            std::unique_lock<std::mutex> lck(wake_mtx);
+            wake_cv.wait( lck, []{ return wake.load(); } );
+            wake = false;
+        }
+    }
+    if( f )
+        fclose( f );
+}
+
+// Write out queued lines, returns number of lines
+static unsigned int drain( FILE *f )
+{
+    unsigned int n = 0;
+    for(;;)
+    {
+        LOG_SLOT *slot = &slots[dequeue_pos & (LOG_SLOTS-1)];
+        size_t seq = slot->seq.load(std::memory_order_acquire);
+        if( seq != dequeue_pos+1 )
+            break;
+        if( f )
+        {
+            fprintf( f, "%lu.%03lu: ", slot->ms/1000, slot->ms%1000 );
+            fputs( slot->text, f );
+        }
+        slot->seq.store( dequeue_pos+LOG_SLOTS, std::memory_order_release );
+        dequeue_pos++;
+        n++;
+    }
+    return n;
+}
+
+// The first file is truncated, any later ones are appended to
+static FILE *open_log( const std::string &filename )
+{
+    static bool first=true;
+    FILE *f;
+    errno_t err = fopen_s( &f, filename.c_str(), first? "wt" : "at" );
+    first = false;
+    if( err )
+        return NULL;
+    char buf[100];
+    time_t t = time(NULL);
+    struct tm ptm;
+    localtime_s( &ptm, &t );
+    asctime_s( buf, sizeof(buf), &ptm );
+    char *p = strchr(buf,'\n');
+    if( p )
+        *p = '\0';
+    unsigned long ms = elapsed_milliseconds();
+    fprintf( f, "%lu.%03lu: Log opened %s\n", ms/1000, ms%1000, buf );
+    return f;
+}
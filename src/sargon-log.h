@@ -0,0 +1,33 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-log.h
+ *       Asynchronous log file, lock free queue drained by a writer thread
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+#ifndef SARGON_LOG_H_INCLUDED
+#define SARGON_LOG_H_INCLUDED
+
+#include <stdarg.h>
+#include <string>
+
+// Start logging to a file (truncated the first time it is used), or switch
+//  to a new file. An empty filename turns logging off
+void sargon_log_file( const std::string &filename );
+
+// Queue a line, safe to call from any thread, never blocks or waits for the
+//  file. Lines are dropped (and counted) if the writer thread falls behind
+void sargon_log_vprintf( const char *fmt, va_list args );
+void sargon_log_printf( const char *fmt, ... );
+
+// Number of lines dropped because the queue was full
+unsigned long sargon_log_dropped();
+
+// Write all queued lines and stop the writer thread, call before exiting
+void sargon_log_end();
+
+#endif // SARGON_LOG_H_INCLUDED
@@ -0,0 +1,216 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-metrics.cpp
+ *       Cumulative engine metrics in Prometheus text format
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+/*
+
+  Metrics accumulate over the life of the engine process (across many games)
+  in atomic counters, updated with relaxed ordering, so the search never
+  takes a lock to update them. A writer thread periodically formats them and
+  replaces the metrics file (write a temporary file then rename, so scrapers
+  never see a partial file).
+
+*/
+
+#include <stdio.h>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "util.h"
+#include "sargon-log.h"
+#include "sargon-metrics.h"
+
+#define METRICS_INTERVAL_MS 5000
+
+// Histogram with fixed upper bounds, plus an implicit +Inf bucket
+template <int N>
+struct HISTOGRAM
+{
+    const unsigned long *bounds;
+    std::atomic<unsigned long> buckets[N+1];
+    std::atomic<unsigned long long> sum;
+    std::atomic<unsigned long> count;
+    HISTOGRAM( const unsigned long *bounds_ ) : bounds(bounds_), buckets(), sum(0), count(0) {}
+    void observe( unsigned long value )
+    {
+        int i;
+        for( i=0; i<N && value>bounds[i]; i++ )
+            ;
+        buckets[i].fetch_add( 1, std::memory_order_relaxed );
+        sum.fetch_add( value, std::memory_order_relaxed );
+        count.fetch_add( 1, std::memory_order_relaxed );
+    }
+    std::string text( const char *name, const char *help )
+    {
+        std::string s = util::sprintf( "# HELP %s %s\n# TYPE %s histogram\n", name, help, name );
+        unsigned long cumulative = 0;
+        for( int i=0; i<N; i++ )
+        {
+            cumulative += buckets[i].load(std::memory_order_relaxed);
+            s += util::sprintf( "%s_bucket{le=\"%lu\"} %lu\n", name, bounds[i], cumulative );
+        }
+        cumulative += buckets[N].load(std::memory_order_relaxed);
+        s += util::sprintf( "%s_bucket{le=\"+Inf\"} %lu\n", name, cumulative );
+        s += util::sprintf( "%s_sum %llu\n", name, sum.load(std::memory_order_relaxed) );
+        s += util::sprintf( "%s_count %lu\n", name, count.load(std::memory_order_relaxed) );
+        return s;
+    }
+};
+
+static const unsigned long nps_bounds[]     = { 1000, 10000, 30000, 100000, 300000, 1000000, 3000000, 10000000 };
+static const unsigned long depth_bounds[]   = { 1, 2, 3, 4, 5, 6, 7, 8, 10, 12, 16, 20 };
+static const unsigned long latency_bounds[] = { 1, 5, 10, 50, 100, 500, 1000 };
+static HISTOGRAM<8>  nps_histogram( nps_bounds );
+static HISTOGRAM<12> depth_histogram( depth_bounds );
+static HISTOGRAM<7>  latency_histogram( latency_bounds );
+
+static std::atomic<unsigned long>      searches;
+static std::atomic<unsigned long long> nodes_total;
+static std::atomic<unsigned long long> search_ms_total;
+static std::atomic<unsigned long>      aborts;
+static std::atomic<unsigned long>      overruns;
+
+// Writer thread
+static std::mutex              mtx;
+static std::condition_variable cv;
+static std::string             metrics_filename;
+static bool                    stop_request;
+static bool                    writer_running;
+static std::thread             writer;
+
+static void writer_thread();
+static bool write_file( const std::string &filename );
+
+void sargon_metrics_nodes( unsigned long nodes )
+{
+    nodes_total.fetch_add( nodes, std::memory_order_relaxed );
+}
+
+void sargon_metrics_search( unsigned long nodes, unsigned long ms, int depth, bool overrun )
+{
+    searches.fetch_add( 1, std::memory_order_relaxed );
+    search_ms_total.fetch_add( ms, std::memory_order_relaxed );
+    unsigned long nps = static_cast<unsigned long>( (1000ULL*nodes) / (ms>0?ms:1) );
+    nps_histogram.observe( nps );
+    depth_histogram.observe( depth>0 ? static_cast<unsigned long>(depth) : 0 );
+    if( overrun )
+        overruns.fetch_add( 1, std::memory_order_relaxed );
+}
+
+void sargon_metrics_abort()
+{
+    aborts.fetch_add( 1, std::memory_order_relaxed );
+}
+
+void sargon_metrics_stop_latency( unsigned long ms )
+{
+    latency_histogram.observe( ms );
+}
+
+std::string sargon_metrics_text()
+{
+    std::string s;
+    s += "# HELP sargon_searches_total Searches (go commands) completed.\n";
+    s += "# TYPE sargon_searches_total counter\n";
+    s += util::sprintf( "sargon_searches_total %lu\n", searches.load(std::memory_order_relaxed) );
+    s += "# HELP sargon_nodes_total Nodes searched.\n";
+    s += "# TYPE sargon_nodes_total counter\n";
+    s += util::sprintf( "sargon_nodes_total %llu\n", nodes_total.load(std::memory_order_relaxed) );
+    s += "# HELP sargon_search_milliseconds_total Time spent searching.\n";
+    s += "# TYPE sargon_search_milliseconds_total counter\n";
+    s += util::sprintf( "sargon_search_milliseconds_total %llu\n", search_ms_total.load(std::memory_order_relaxed) );
+    s += nps_histogram.text( "sargon_search_nps", "Nodes per second, per search." );
+    s += depth_histogram.text( "sargon_search_depth", "Depth of the last completed iteration, per search." );
+    s += "# HELP sargon_aborts_total Iterations abandoned (time out, stop or other command, node limit).\n";
+    s += "# TYPE sargon_aborts_total counter\n";
+    s += util::sprintf( "sargon_aborts_total %lu\n", aborts.load(std::memory_order_relaxed) );
+    s += latency_histogram.text( "sargon_stop_latency_milliseconds", "Time from reading stop to sending bestmove." );
+    s += "# HELP sargon_time_overruns_total Searches that took longer than their cut off timer.\n";
+    s += "# TYPE sargon_time_overruns_total counter\n";
+    s += util::sprintf( "sargon_time_overruns_total %lu\n", overruns.load(std::memory_order_relaxed) );
+    s += "# HELP sargon_log_dropped_total Log lines dropped because the log queue was full.\n";
+    s += "# TYPE sargon_log_dropped_total counter\n";
+    s += util::sprintf( "sargon_log_dropped_total %lu\n", sargon_log_dropped() );
+    return s;
+}
+
+void sargon_metrics_file( const std::string &filename )
+{
+    if( filename == "" )
+    {
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            metrics_filename = "";
+        }
+        sargon_metrics_close();     // stop and join the writer thread, no final write
+        return;
+    }
+    std::lock_guard<std::mutex> lck(mtx);
+    metrics_filename = filename;
+    if( !writer_running )
+    {
+        stop_request = false;
+        writer = std::thread(writer_thread);
+        writer_running = true;
+    }
+    cv.notify_one();
+}
+
+void sargon_metrics_close()
+{
+    std::thread stopping;
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+        if( !writer_running )
+            return;
+        stop_request = true;
+        stopping.swap( writer );
+        writer_running = false;
+        cv.notify_one();
+    }
+    stopping.join();
+}
+
+static void writer_thread()
+{
+    std::unique_lock<std::mutex> lck(mtx);
+    for(;;)
+    {
+        std::string filename = metrics_filename;
+        bool stopping = stop_request;
+        lck.unlock();
+        if( filename != "" )
+            write_file( filename );
+        lck.lock();
+        if( stopping )
+            break;
+        cv.wait_for( lck, std::chrono::milliseconds(METRICS_INTERVAL_MS) );
+    }
+}
+
+// Write a temporary file then replace the real file with it
+static bool write_file( const std::string &filename )
+{
+    std::string temp = filename + ".tmp";
+    FILE *f;
+    errno_t err = fopen_s( &f, temp.c_str(), "wt" );
+    if( err )
+        return false;
+    std::string s = sargon_metrics_text();
+    bool ok = (fputs( s.c_str(), f ) >= 0);
+    fclose( f );
+    remove( filename.c_str() );     // rename() won't replace an existing file on Windows
+    if( ok )
+        ok = (0 == rename( temp.c_str(), filename.c_str() ));
+    return ok;
+}
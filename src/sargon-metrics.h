@@ -0,0 +1,34 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-metrics.h
+ *       Cumulative engine metrics in Prometheus text format
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+#ifndef SARGON_METRICS_H_INCLUDED
+#define SARGON_METRICS_H_INCLUDED
+
+#include <string>
+
+// Periodically rewrite the named file with the current metrics (eg for the
+//  Prometheus node exporter textfile collector). An empty filename stops
+//  writing and ends the writer thread
+void sargon_metrics_file( const std::string &filename );
+
+// Feed the metrics, all lock free and safe to call from any thread
+void sargon_metrics_nodes( unsigned long nodes );  // from the callback path, as searches progress
+void sargon_metrics_search( unsigned long nodes, unsigned long ms, int depth, bool overrun );
+void sargon_metrics_abort();
+void sargon_metrics_stop_latency( unsigned long ms );
+
+// Current metrics in Prometheus text exposition format
+std::string sargon_metrics_text();
+
+// Write the file a final time and stop the writer thread
+void sargon_metrics_close();
+
+#endif // SARGON_METRICS_H_INCLUDED
@@ -1290,6 +1290,7 @@ bool sargon_minimax_regression_test( bool quiet)
 }
 
 extern void after_genmov();
+extern void after_ldar( uint8_t a_reg );
 
 
 // Sargon calls back into this function as it runs, we can monitor what's going on by
@@ -1315,11 +1316,18 @@ extern "C" {
             a_reg++;
             volatile uint32_t *peax = &reg_eax;
             *peax = a_reg;
+            after_ldar(a_reg);
         }
         else if( std::string(msg) == "after GENMOV()" )
+        {
+            sargon_nodes_callback_after_genmov();
             after_genmov();
+        }
         else if( std::string(msg) == "end of POINTS()" )
+        {
+            sargon_nodes_callback_end_of_points();
             sargon_pv_callback_end_of_points();
+        }
         else if( std::string(msg) == "Yes! Best move" )
             sargon_pv_callback_yes_best_move();
 
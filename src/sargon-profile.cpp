@@ -0,0 +1,482 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-profile.cpp
+ *       Sampling profiler, attributes time to Sargon routines and labels
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+/*
+
+  All of Sargon is one giant _sargon PROC, so a conventional profiler can only
+  show anonymous addresses. The converters emit a table of the address of
+  every code label (sargon_label_addresses[], at the end of the code) and the
+  corresponding names (sargon_labels[] in sargon-asm-interface.h). Each sample
+  of the instruction pointer is attributed to the nearest preceding label, and
+  each label belongs to the nearest preceding routine (CALL target) in the
+  source.
+
+  For call stacks the stack is scanned conservatively from the sampled stack
+  pointer up to the stack base recorded when sargon() was called. Sargon's
+  data is 16 bit Z80 values, so any 32 bit word that falls within the code is
+  a return address.
+
+  Samples are taken by a SIGPROF handler on Linux, and by a thread that
+  suspends the searching thread on Windows. Either way samples are aggregated
+  into a fixed size table, no memory allocation or locking takes place while
+  sampling.
+
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#elif defined(__linux__)
+#include <signal.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#endif
+#include "util.h"
+#include "sargon-asm-interface.h"
+#include "sargon-profile.h"
+
+// Pseudo labels, for samples before the first label (the dispatch code at
+//  the start of _sargon) and outside Sargon altogether (in callback())
+#define LABEL_DISPATCH 0xfffe
+#define LABEL_OUTSIDE  0xffff
+
+// Aggregated samples, one entry per distinct stack
+#define PROFILE_MAX_FRAMES 32
+#define PROFILE_TABLE_SIZE 8192     // must be a power of 2
+#define PROFILE_MAX_PROBES 64
+struct STACK_ENTRY
+{
+    unsigned int   count;
+    unsigned short leaf;
+    unsigned short depth;
+    unsigned short frames[PROFILE_MAX_FRAMES];   // innermost first
+};
+static STACK_ENTRY stack_table[PROFILE_TABLE_SIZE];
+static unsigned long samples;
+static unsigned long samples_dropped;
+static unsigned int  sample_interval_us;
+
+// Labels sorted by address for lookup, prepared before sampling starts
+static uintptr_t      sorted_addr[sargon_nbr_labels];
+static unsigned short sorted_label[sargon_nbr_labels];
+static unsigned short routine_of[sargon_nbr_labels];
+static uintptr_t      code_lo;
+static uintptr_t      code_hi;
+
+// Sampling state
+static std::atomic<bool> profile_running;
+static std::atomic<bool> profile_in_sargon;
+static const void *profile_stack_base;
+
+static void prepare_labels();
+static unsigned short lookup( uintptr_t addr );
+static void record_sample( uintptr_t ip, uintptr_t sp );
+static bool sampling_start( unsigned int interval_us );
+static void sampling_stop();
+static std::string label_name( unsigned short label );
+static std::string routine_name( unsigned short label );
+
+bool sargon_profile_start( unsigned int interval_us )
+{
+    if( profile_running )
+        sargon_profile_stop();
+    memset( stack_table, 0, sizeof(stack_table) );
+    samples = 0;
+    samples_dropped = 0;
+    sample_interval_us = interval_us>0 ? interval_us : 1000;
+    prepare_labels();
+    profile_running = sampling_start( sample_interval_us );
+    return profile_running;
+}
+
+void sargon_profile_stop()
+{
+    if( !profile_running )
+        return;
+    profile_running = false;
+    sampling_stop();
+}
+
+bool sargon_profile_running()
+{
+    return profile_running;
+}
+
+static void prepare_labels()
+{
+    std::vector< std::pair<uintptr_t,unsigned short> > v;
+    unsigned short routine = LABEL_DISPATCH;
+    for( int i=0; i<sargon_nbr_labels; i++ )
+    {
+        v.push_back( std::pair<uintptr_t,unsigned short>( static_cast<uintptr_t>(sargon_label_addresses[i]),
+                                                          static_cast<unsigned short>(i) ) );
+
+        // Routine membership follows the source order, not the address order, so
+        //  code moved by profile guided layout is still attributed correctly
+        if( sargon_labels[i].routine )
+            routine = static_cast<unsigned short>(i);
+        routine_of[i] = routine;
+    }
+    std::sort( v.begin(), v.end() );
+    for( int i=0; i<sargon_nbr_labels; i++ )
+    {
+        sorted_addr[i]  = v[i].first;
+        sorted_label[i] = v[i].second;
+    }
+    code_lo = reinterpret_cast<uintptr_t>( &sargon );
+    code_hi = reinterpret_cast<uintptr_t>( sargon_label_addresses );   // table follows the code
+}
+
+// Nearest label at or before addr (binary search, safe in a signal handler)
+static unsigned short lookup( uintptr_t addr )
+{
+    int lo=0, hi=sargon_nbr_labels;
+    while( lo < hi )
+    {
+        int mid = (lo+hi)/2;
+        if( sorted_addr[mid] <= addr )
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo==0 ? LABEL_DISPATCH : sorted_label[lo-1];
+}
+
+// Called in signal handler context (Linux) or with the searching thread
+//  suspended (Windows), so no allocation, no locks, no library calls
+static void record_sample( uintptr_t ip, uintptr_t sp )
+{
+    STACK_ENTRY e;
+    e.count = 0;
+    e.leaf  = (code_lo<=ip && ip<code_hi) ? lookup(ip) : LABEL_OUTSIDE;
+    e.depth = 0;
+    const uintptr_t *p   = reinterpret_cast<const uintptr_t *>( (sp+sizeof(uintptr_t)-1) & ~(sizeof(uintptr_t)-1) );
+    const uintptr_t *end = reinterpret_cast<const uintptr_t *>( profile_stack_base );
+    if( end-p > 65536 )
+        end = p + 65536;    // a bad stack base must not cause a runaway scan
+    while( p<end && e.depth<PROFILE_MAX_FRAMES )
+    {
+        uintptr_t w = *p++;
+        if( code_lo<w && w<=code_hi )
+            e.frames[e.depth++] = lookup(w-1);   // return address follows the CALL
+    }
+    unsigned int hash = 2166136261u ^ e.leaf;
+    for( int i=0; i<e.depth; i++ )
+        hash = (hash*16777619u) ^ e.frames[i];
+    for( int probe=0; probe<PROFILE_MAX_PROBES; probe++ )
+    {
+        STACK_ENTRY &slot = stack_table[ (hash+probe) & (PROFILE_TABLE_SIZE-1) ];
+        if( slot.count == 0 )
+        {
+            slot = e;
+            slot.count = 1;
+            samples++;
+            return;
+        }
+        if( slot.leaf==e.leaf && slot.depth==e.depth &&
+            0 == memcmp(slot.frames,e.frames,e.depth*sizeof(e.frames[0])) )
+        {
+            slot.count++;
+            samples++;
+            return;
+        }
+    }
+    samples_dropped++;
+}
+
+#if defined(__linux__)
+
+static pid_t profile_tid;
+
+void sargon_profile_enter( const void *stack_base )
+{
+    if( !profile_running )
+        return;
+    profile_tid = static_cast<pid_t>( syscall(SYS_gettid) );
+    profile_stack_base = stack_base;
+    profile_in_sargon = true;
+}
+
+void sargon_profile_leave()
+{
+    profile_in_sargon = false;
+}
+
+static void sigprof_handler( int /*sig*/, siginfo_t * /*info*/, void *context )
+{
+    if( !profile_in_sargon || static_cast<pid_t>(syscall(SYS_gettid))!=profile_tid )
+        return;     // ITIMER_PROF signals whichever thread is running
+    ucontext_t *uc = static_cast<ucontext_t *>(context);
+#if defined(__i386__)
+    record_sample( static_cast<uintptr_t>(uc->uc_mcontext.gregs[REG_EIP]), static_cast<uintptr_t>(uc->uc_mcontext.gregs[REG_ESP]) );
+#elif defined(__x86_64__)
+    record_sample( static_cast<uintptr_t>(uc->uc_mcontext.gregs[REG_RIP]), static_cast<uintptr_t>(uc->uc_mcontext.gregs[REG_RSP]) );
+#endif
+}
+
+static bool sampling_start( unsigned int interval_us )
+{
+    struct sigaction sa;
+    memset( &sa, 0, sizeof(sa) );
+    sa.sa_sigaction = sigprof_handler;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset( &sa.sa_mask );
+    if( sigaction(SIGPROF,&sa,NULL) != 0 )
+        return false;
+    struct itimerval timer;
+    timer.it_interval.tv_sec  = interval_us / 1000000;
+    timer.it_interval.tv_usec = interval_us % 1000000;
+    timer.it_value = timer.it_interval;
+    return 0 == setitimer( ITIMER_PROF, &timer, NULL );
+}
+
+static void sampling_stop()
+{
+    struct itimerval timer;
+    memset( &timer, 0, sizeof(timer) );
+    setitimer( ITIMER_PROF, &timer, NULL );
+    signal( SIGPROF, SIG_IGN );     // a signal already in flight is harmless
+}
+
+#elif defined(_WIN32)
+
+static DWORD       profile_thread_id;
+static HANDLE      profile_thread_handle;
+static std::mutex  profile_mutex;
+static std::thread sampler;
+
+void sargon_profile_enter( const void *stack_base )
+{
+    if( !profile_running )
+        return;
+    DWORD id = GetCurrentThreadId();
+    if( id != profile_thread_id )
+    {
+        std::lock_guard<std::mutex> lock(profile_mutex);
+        if( profile_thread_handle )
+            CloseHandle( profile_thread_handle );
+        profile_thread_handle = OpenThread( THREAD_SUSPEND_RESUME|THREAD_GET_CONTEXT|THREAD_QUERY_INFORMATION, FALSE, id );
+        profile_thread_id = id;
+    }
+    profile_stack_base = stack_base;
+    profile_in_sargon = true;
+}
+
+void sargon_profile_leave()
+{
+    profile_in_sargon = false;
+}
+
+// Sleep resolution limits the effective sampling rate to the system timer
+//  resolution (often 1ms, sometimes 15.6ms)
+static void sampler_thread( unsigned int interval_us )
+{
+    while( profile_running )
+    {
+        std::this_thread::sleep_for( std::chrono::microseconds(interval_us) );
+        std::lock_guard<std::mutex> lock(profile_mutex);
+        if( !profile_in_sargon || !profile_thread_handle )
+            continue;
+        if( SuspendThread(profile_thread_handle) == (DWORD)-1 )
+            continue;
+        CONTEXT ctx;
+        memset( &ctx, 0, sizeof(ctx) );
+        ctx.ContextFlags = CONTEXT_CONTROL;
+        if( profile_in_sargon && GetThreadContext(profile_thread_handle,&ctx) )
+        {
+#if defined(_M_IX86)
+            record_sample( static_cast<uintptr_t>(ctx.Eip), static_cast<uintptr_t>(ctx.Esp) );
+#elif defined(_M_X64)
+            record_sample( static_cast<uintptr_t>(ctx.Rip), static_cast<uintptr_t>(ctx.Rsp) );
+#endif
+        }
+        ResumeThread( profile_thread_handle );
+    }
+}
+
+static bool sampling_start( unsigned int interval_us )
+{
+    profile_running = true;     // sampler thread runs while this is true
+    sampler = std::thread( sampler_thread, interval_us );
+    return true;
+}
+
+static void sampling_stop()
+{
+    if( sampler.joinable() )
+        sampler.join();
+}
+
+#else
+
+void sargon_profile_enter( const void *stack_base )
+{
+}
+
+void sargon_profile_leave()
+{
+}
+
+static bool sampling_start( unsigned int interval_us )
+{
+    return false;
+}
+
+static void sampling_stop()
+{
+}
+
+#endif
+
+static std::string label_name( unsigned short label )
+{
+    if( label == LABEL_DISPATCH )
+        return "sargon";
+    if( label == LABEL_OUTSIDE )
+        return "(callback)";
+    return sargon_labels[label].name;
+}
+
+static std::string routine_name( unsigned short label )
+{
+    if( label==LABEL_DISPATCH || label==LABEL_OUTSIDE )
+        return label_name(label);
+    return label_name( routine_of[label] );
+}
+
+// Per routine self and inclusive samples
+struct ROUTINE_SAMPLES
+{
+    std::string   name;
+    unsigned long self;
+    unsigned long inclusive;
+    ROUTINE_SAMPLES() : self(0), inclusive(0) {}
+};
+static void routine_samples( std::vector<ROUTINE_SAMPLES> &results )
+{
+    std::map<std::string,ROUTINE_SAMPLES> m;
+    for( int i=0; i<PROFILE_TABLE_SIZE; i++ )
+    {
+        const STACK_ENTRY &e = stack_table[i];
+        if( e.count == 0 )
+            continue;
+        std::string leaf = routine_name(e.leaf);
+        m[leaf].name = leaf;
+        m[leaf].self += e.count;
+        std::set<std::string> active;
+        active.insert(leaf);
+        for( int j=0; j<e.depth; j++ )
+            active.insert( routine_name(e.frames[j]) );
+        for( const std::string &s: active )
+        {
+            m[s].name = s;
+            m[s].inclusive += e.count;
+        }
+    }
+    results.clear();
+    for( const std::pair<const std::string,ROUTINE_SAMPLES> &p: m )
+        results.push_back(p.second);
+    std::sort( results.begin(), results.end(),
+        [](const ROUTINE_SAMPLES &a, const ROUTINE_SAMPLES &b) { return a.self>b.self || (a.self==b.self && a.name<b.name); } );
+}
+
+std::string sargon_profile_summary( int nbr_routines )
+{
+    std::string s = util::sprintf( "profile samples %lu dropped %lu interval %u us\n", samples, samples_dropped, sample_interval_us );
+    if( samples == 0 )
+        return s;
+    std::vector<ROUTINE_SAMPLES> results;
+    routine_samples( results );
+    s += "ROUTINE        SELF%  INCL%\n";
+    for( int i=0; i<nbr_routines && i<static_cast<int>(results.size()); i++ )
+    {
+        s += util::sprintf( "%-12s %6.1f %6.1f\n", results[i].name.c_str(),
+                            100.0 * results[i].self / samples,
+                            100.0 * results[i].inclusive / samples );
+    }
+    return s;
+}
+
+bool sargon_profile_write_flat( const std::string &filename )
+{
+    std::ofstream out( filename );
+    if( !out )
+        return false;
+    std::vector<ROUTINE_SAMPLES> results;
+    routine_samples( results );
+    util::putline( out, util::sprintf( "; Sargon sampling profile, %lu samples (%lu dropped), interval %u us",
+                                        samples, samples_dropped, sample_interval_us ) );
+    util::putline( out, ";" );
+    util::putline( out, "; ROUTINE           SELF  INCLUSIVE" );
+    for( const ROUTINE_SAMPLES &r: results )
+        util::putline( out, util::sprintf( "; %-12s %9lu  %9lu", r.name.c_str(), r.self, r.inclusive ) );
+    util::putline( out, ";" );
+    util::putline( out, "; Samples per label follow, this file can be used as convert-z80-to-x86" );
+    util::putline( out, "; -profile input (labels never sampled count as cold)" );
+    std::vector<unsigned long> label_samples( sargon_nbr_labels, 0 );
+    for( int i=0; i<PROFILE_TABLE_SIZE; i++ )
+    {
+        const STACK_ENTRY &e = stack_table[i];
+        if( e.count>0 && e.leaf<sargon_nbr_labels )
+            label_samples[e.leaf] += e.count;
+    }
+    for( int i=0; i<sargon_nbr_labels; i++ )
+        util::putline( out, util::sprintf( "%s %lu", sargon_labels[i].name, label_samples[i] ) );
+    return true;
+}
+
+bool sargon_profile_write_collapsed( const std::string &filename )
+{
+    std::ofstream out( filename );
+    if( !out )
+        return false;
+
+    // Different label level stacks can collapse to the same routine level stack
+    std::map<std::string,unsigned long> stacks;
+    for( int i=0; i<PROFILE_TABLE_SIZE; i++ )
+    {
+        const STACK_ENTRY &e = stack_table[i];
+        if( e.count == 0 )
+            continue;
+        std::string s;
+        std::string previous;
+        for( int j=e.depth-1; j>=-1; j-- )
+        {
+            std::string name = routine_name( j<0 ? e.leaf : e.frames[j] );
+            if( name == previous )
+                continue;   // eg a stale return address in the same routine
+            if( s.length() > 0 )
+                s += ";";
+            s += name;
+            previous = name;
+        }
+        stacks[s] += e.count;
+    }
+    for( const std::pair<const std::string,unsigned long> &p: stacks )
+        util::putline( out, util::sprintf( "%s %lu", p.first.c_str(), p.second ) );
+    return true;
+}
@@ -0,0 +1,41 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-profile.h
+ *       Sampling profiler, attributes time to Sargon routines and labels
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+#ifndef SARGON_PROFILE_H_INCLUDED
+#define SARGON_PROFILE_H_INCLUDED
+
+#include <string>
+
+// Start sampling (clears any previous results). Samples are only taken while
+//  the thread that calls into Sargon is inside sargon()
+bool sargon_profile_start( unsigned int interval_us=1000 );
+void sargon_profile_stop();
+bool sargon_profile_running();
+
+// Bracket each call to sargon(), stack_base is the address of a local
+//  variable in the caller, the stack is scanned for Sargon return addresses
+//  up to this point. If the call is abandoned with longjmp() (eg engine
+//  timeout) call sargon_profile_leave() to close it off
+void sargon_profile_enter( const void *stack_base );
+void sargon_profile_leave();
+
+// Results; a short human readable summary of the busiest routines
+std::string sargon_profile_summary( int nbr_routines=10 );
+
+// Flat profile, samples per routine as comments, then one "LABEL count" line
+//  per label, so the file can be used as convert-z80-to-x86 -profile input
+bool sargon_profile_write_flat( const std::string &filename );
+
+// One line per distinct call stack, eg "sargon;CPTRMV;FNDMOV;GENMOV;MPIECE 123",
+//  the input format for flamegraph.pl and similar tools
+bool sargon_profile_write_collapsed( const std::string &filename );
+
+#endif // SARGON_PROFILE_H_INCLUDED
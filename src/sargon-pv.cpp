@@ -17,21 +17,6 @@
 #include "sargon-asm-interface.h"
 #include "sargon-pv.h"
 
-// A move in Sargon's evaluation graph, in this program a move that is marked as
-//  the best move found so far at a given level
-struct NODE
-{
-    unsigned int level;
-    unsigned char from;
-    unsigned char to;
-    char adjusted_material;
-    char brdc;
-    NODE() : level(0), from(0), to(0), adjusted_material(0), brdc(0) {}
-    NODE( unsigned int l, unsigned char f, unsigned char t,
-          char a, char b ) :
-                level(l), from(f), to(t), adjusted_material(a), brdc(b) {}
-};
-
 //
 //  Build Sargon's PV (Principal Variation)
 //
@@ -295,6 +280,22 @@ static void calculate_pv( PV &pv )
     pv.value = static_cast<int>(centipawns);
 }
 
+void sargon_pv_state_save( PV_STATE &state )
+{
+    state.base_position       = pv_base_position;
+    state.nodes               = nodes;
+    state.provisional         = provisional;
+    state.end_of_points_color = end_of_points_color;
+}
+
+void sargon_pv_state_restore( const PV_STATE &state )
+{
+    pv_base_position    = state.base_position;
+    nodes               = state.nodes;
+    provisional         = state.provisional;
+    end_of_points_color = state.end_of_points_color;
+}
+
 std::string sargon_pv_report_stats()
 {
     return util::sprintf( "max length of build PV vector=%lu\n", max_len_so_far );
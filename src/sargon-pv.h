@@ -13,6 +13,7 @@
 #define SARGON_PV_H_INCLUDED
   
 #include <string>
+#include <vector>
 #include "thc.h"
 
 // PV
@@ -25,10 +26,38 @@ struct PV
     PV () {clear();}
 };
 
+// A move in Sargon's evaluation graph, in this program a move that is marked as
+//  the best move found so far at a given level
+struct NODE
+{
+    unsigned int level;
+    unsigned char from;
+    unsigned char to;
+    char adjusted_material;
+    char brdc;
+    NODE() : level(0), from(0), to(0), adjusted_material(0), brdc(0) {}
+    NODE( unsigned int l, unsigned char f, unsigned char t,
+          char a, char b ) :
+                level(l), from(f), to(t), adjusted_material(a), brdc(b) {}
+};
+
+// The PV calculation in progress, saved and restored so that a search can be
+//  paused while another search runs (see sargon-fiber.h)
+struct PV_STATE
+{
+    thc::ChessRules   base_position;
+    std::vector<NODE> nodes;
+    PV                provisional;
+    unsigned char     end_of_points_color;
+    PV_STATE() : end_of_points_color(0) {}
+};
+
 void sargon_pv_clear( const thc::ChessPosition &current_position );
 PV sargon_pv_get();
 void sargon_pv_callback_end_of_points();
 void sargon_pv_callback_yes_best_move();
 std::string sargon_pv_report_stats();
+void sargon_pv_state_save( PV_STATE &state );
+void sargon_pv_state_restore( const PV_STATE &state );
 
 #endif // SARGON_PV_H_INCLUDED
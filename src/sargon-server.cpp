@@ -0,0 +1,661 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-server.cpp
+ *       sargon-server, many UCI sessions in one process, over local sockets
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+/*
+
+  One sargon-engine process per game is wasteful when a game server is
+  running many games at once. sargon-server listens on a localhost TCP port
+  (or a Unix domain socket) and each connection is a UCI session, as if
+  talking to its own sargon-engine.
+
+  Each session is a libsargon context (sargon-library.h) and keeps its own
+  position, including the moves that led to it so that repetition is
+  avoided, its own mating line (see MATING in sargon-engine.cpp, a mate
+  that has been found is played out without searching again) and the PV
+  of its last search.
+
+  There's only one Sargon though (the translated 1978 program is a single
+  global memory image), so the pool of workers that runs searches is one
+  thread. Searches are time-sliced (see sargon-fiber.h), sessions wanting a
+  search join a run queue, the search at the front runs for a slice (-slice
+  ms) and, unless it has finished, goes to the back, paused. So busy
+  sessions share Sargon round robin. Each search has a time budget, from
+  the go command's movetime or its clock and increment, and the time spent
+  waiting its turn comes out of that budget, so a session's clock is
+  respected however busy the server is. No search can run longer than the
+  server's -maxms limit.
+
+  Nothing that the worker or the server lock depends on waits for a client.
+  Output to a session is queued and written by the session's own writer
+  thread, and a client that stops reading long enough to let a lot of
+  output pile up is disconnected.
+
+  Only the UCI commands needed to play games are supported; uci, isready,
+  ucinewgame, position, go (depth, nodes, movetime, wtime, btime, winc,
+  binc and infinite, which is limited to -maxms like everything else), stop
+  and quit. Everything else is ignored.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib,"ws2_32.lib")
+#else
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define SD_BOTH SHUT_RDWR
+#define closesocket close
+#endif
+#include "util.h"
+#include "thc.h"
+#include "sargon-library.h"
+
+#define SERVER_NAME "Sargon 1978 server"
+#define SERVER_DEFAULT_PORT 7878
+#define SERVER_DEFAULT_MAX_MS 30000
+#define SERVER_DEFAULT_SLICE_MS 20
+#define SERVER_MAX_OUTGOING (1024*1024)    // bytes queued for a session that isn't reading
+
+// Play down mating sequence without searching again if possible
+struct MATING
+{
+    bool                   active;
+    thc::ChessRules        position;    // start position
+    std::vector<thc::Move> variation;   // leads to mate
+    unsigned int           idx;         // idx into variation
+    int                    nbr;         // nbr of moves left to mate
+    MATING() : active(false), idx(0), nbr(0) {}
+};
+
+struct SESSION
+{
+    int             id;
+    SOCKET          sock;
+    sargon_context *ctx;
+
+    // Output waiting for the session's writer thread, protected by send_mutex
+    std::mutex              send_mutex;
+    std::condition_variable send_cv;
+    std::string             outgoing;
+    bool                    send_closed;
+
+    // The rest is protected by server_mutex
+    bool            closed;
+    bool            queued;             // to begin a search
+    bool            searching;          // begun, running or paused
+    bool            stop_requested;
+    std::string     fen;                // as last set by position, "" = startpos
+    std::string     moves;
+    thc::ChessRules position;
+    MATING          mating;
+    std::string     pv;                 // of the last search
+    int             pv_mate;
+
+    // The search queued or running
+    sargon_limits   limits;
+    unsigned long   budget_ms;          // 0 = none (only -maxms applies)
+    std::chrono::time_point<std::chrono::steady_clock> queued_time;
+
+    SESSION( int id_, SOCKET sock_ ) : id(id_), sock(sock_), ctx(NULL), send_closed(false), closed(false),
+                                       queued(false), searching(false), stop_requested(false), pv_mate(0),
+                                       budget_ms(0)
+    {
+        memset( &limits, 0, sizeof(limits) );
+    }
+    ~SESSION()
+    {
+        if( ctx )
+            sargon_context_destroy( ctx );
+        closesocket( sock );
+    }
+};
+
+// Sessions with a search to begin or continue, round robin
+static std::mutex server_mutex;
+static std::condition_variable server_cv;
+static std::deque<std::shared_ptr<SESSION>> run_queue;
+static unsigned long max_ms = SERVER_DEFAULT_MAX_MS;
+static unsigned long slice_ms = SERVER_DEFAULT_SLICE_MS;
+
+static void session_run( std::shared_ptr<SESSION> session );
+static void session_write( std::shared_ptr<SESSION> session );
+static bool session_command( const std::shared_ptr<SESSION> &session, const std::string &line );
+static void session_position( const std::shared_ptr<SESSION> &session, const std::vector<std::string> &fields );
+static void session_go( const std::shared_ptr<SESSION> &session, const std::vector<std::string> &fields );
+static bool session_mating_move( SESSION *session, std::string &out );
+static void session_send( SESSION *session, const std::string &s );
+static void worker();
+static void progress( const sargon_info *info, void *user );
+
+int main( int argc, char *argv[] )
+{
+    // Command line options;
+    //  -port n         listen on localhost TCP port n (default 7878)
+    //  -unix path      listen on Unix domain socket path instead
+    //  -maxms n        maximum time for any one search, in milliseconds
+    //                  (default 30000)
+    //  -slice n        searches take turns n milliseconds at a time
+    //                  (default 20)
+    int port = SERVER_DEFAULT_PORT;
+    std::string unix_path;
+    for( int i=1; i<argc; i++ )
+    {
+        std::string arg = argv[i];
+        if( arg=="-port" && i+1<argc )
+            port = atoi(argv[++i]);
+        else if( arg=="-unix" && i+1<argc )
+            unix_path = argv[++i];
+        else if( arg=="-maxms" && i+1<argc )
+            max_ms = static_cast<unsigned long>(atol(argv[++i]));
+        else if( arg=="-slice" && i+1<argc )
+            slice_ms = static_cast<unsigned long>(atol(argv[++i]));
+        else
+        {
+            printf( "Usage: sargon-server [-port n | -unix path] [-maxms n] [-slice n]\n" );
+            return -1;
+        }
+    }
+    if( port<=0 || port>65535 || max_ms==0 || slice_ms==0 )
+    {
+        printf( "Error; bad -port, -maxms or -slice\n" );
+        return -1;
+    }
+
+#ifdef _WIN32
+    WSADATA wsa;
+    if( WSAStartup(MAKEWORD(2,2),&wsa) != 0 )
+    {
+        printf( "Error; cannot start Winsock\n" );
+        return -1;
+    }
+#else
+    signal( SIGPIPE, SIG_IGN );     // a session closing mid response isn't fatal
+#endif
+
+    // Listen
+    SOCKET listener = INVALID_SOCKET;
+    std::string where;
+    if( unix_path.length() > 0 )
+    {
+#ifdef _WIN32
+        printf( "Error; -unix is not supported on Windows, use -port\n" );
+        return -1;
+#else
+        struct sockaddr_un addr;
+        memset( &addr, 0, sizeof(addr) );
+        addr.sun_family = AF_UNIX;
+        if( unix_path.length() >= sizeof(addr.sun_path) )
+        {
+            printf( "Error; Unix socket path %s too long\n", unix_path.c_str() );
+            return -1;
+        }
+        strcpy( addr.sun_path, unix_path.c_str() );
+        unlink( unix_path.c_str() );
+        listener = socket( AF_UNIX, SOCK_STREAM, 0 );
+        if( listener!=INVALID_SOCKET && bind(listener,(struct sockaddr *)&addr,sizeof(addr))!=0 )
+        {
+            closesocket( listener );
+            listener = INVALID_SOCKET;
+        }
+        where = unix_path;
+#endif
+    }
+    else
+    {
+        struct sockaddr_in addr;
+        memset( &addr, 0, sizeof(addr) );
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons( static_cast<unsigned short>(port) );
+        addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );    // local connections only
+        listener = socket( AF_INET, SOCK_STREAM, 0 );
+        if( listener != INVALID_SOCKET )
+        {
+            int yes = 1;
+            setsockopt( listener, SOL_SOCKET, SO_REUSEADDR, (const char *)&yes, sizeof(yes) );
+            if( bind(listener,(struct sockaddr *)&addr,sizeof(addr)) != 0 )
+            {
+                closesocket( listener );
+                listener = INVALID_SOCKET;
+            }
+        }
+        where = util::sprintf( "127.0.0.1:%d", port );
+    }
+    if( listener==INVALID_SOCKET || listen(listener,SOMAXCONN)!=0 )
+    {
+        printf( "Error; cannot listen on %s\n", where.c_str() );
+        return -1;
+    }
+    printf( "%s listening on %s\n", SERVER_NAME, where.c_str() );
+    fflush( stdout );
+
+    // One worker, since there's only one Sargon
+    std::thread( worker ).detach();
+
+    // Each connection is a session, with its own threads reading its
+    //  commands and writing its output
+    int nbr_sessions = 0;
+    for(;;)
+    {
+        SOCKET sock = accept( listener, NULL, NULL );
+        if( sock == INVALID_SOCKET )
+            continue;
+        std::shared_ptr<SESSION> session = std::make_shared<SESSION>( ++nbr_sessions, sock );
+        session->ctx = sargon_context_create();
+        if( !session->ctx )
+        {
+            printf( "Error; out of memory, session %d refused\n", session->id );
+            continue;   // session destructor closes the socket
+        }
+        std::thread( session_write, session ).detach();
+        std::thread( session_run, session ).detach();
+    }
+    return 0;
+}
+
+// Read and run a session's commands until it quits or disconnects
+static void session_run( std::shared_ptr<SESSION> session )
+{
+    printf( "Session %d connected\n", session->id );
+    fflush( stdout );
+    std::string pending;
+    bool quit = false;
+    while( !quit )
+    {
+        char buf[1024];
+        int n = recv( session->sock, buf, sizeof(buf), 0 );
+        if( n <= 0 )
+            break;
+        pending.append( buf, n );
+        size_t offset;
+        while( !quit && (offset=pending.find('\n')) != std::string::npos )
+        {
+            std::string line = pending.substr(0,offset);
+            pending = pending.substr(offset+1);
+            util::rtrim(line);
+            quit = !session_command( session, line );
+        }
+    }
+
+    // A queued search is dropped by the worker, a search in progress is
+    //  stopped (and finished off when the session is destroyed). The writer
+    //  stops too, shutdown() wakes it if it's stuck in send()
+    {
+        std::lock_guard<std::mutex> lock(server_mutex);
+        session->closed = true;
+    }
+    sargon_context_stop( session->ctx );
+    {
+        std::lock_guard<std::mutex> lock(session->send_mutex);
+        session->send_closed = true;
+    }
+    session->send_cv.notify_one();
+    shutdown( session->sock, SD_BOTH );
+    printf( "Session %d closed\n", session->id );
+    fflush( stdout );
+}
+
+// Returns false on quit
+static bool session_command( const std::shared_ptr<SESSION> &session, const std::string &line )
+{
+    std::vector<std::string> fields;
+    util::split( line, fields );
+    if( fields.size() == 0 )
+        return true;
+    const std::string &cmd = fields[0];
+    if( cmd == "quit" )
+        return false;
+    else if( cmd == "uci" )
+    {
+        session_send( session.get(),
+            "id name " SERVER_NAME "\n"
+            "id author Dan and Kathe Spracklin, Windows port by Bill Forster\n"
+            "uciok\n" );
+    }
+    else if( cmd == "isready" )
+        session_send( session.get(), "readyok\n" );
+    else if( cmd == "ucinewgame" )
+    {
+        std::lock_guard<std::mutex> lock(server_mutex);
+        session->mating.active = false;
+    }
+    else if( cmd == "position" )
+        session_position( session, fields );
+    else if( cmd == "go" )
+        session_go( session, fields );
+    else if( cmd == "stop" )
+    {
+        std::lock_guard<std::mutex> lock(server_mutex);
+        session->stop_requested = true;
+        if( session->searching )
+            sargon_context_stop( session->ctx );
+    }
+    return true;
+}
+
+// eg "position startpos moves e2e4 e7e5"
+//    "position fen 7k/8/8/8/8/8/8/N6K b - - 0 1 moves h8g7"
+static void session_position( const std::shared_ptr<SESSION> &session, const std::vector<std::string> &fields )
+{
+    std::string fen, moves;
+    size_t i = 1;
+    if( i<fields.size() && fields[i]=="fen" )
+    {
+        for( i++; i<fields.size() && fields[i]!="moves"; i++ )
+            fen += (fen.length()>0 ? " " : "") + fields[i];
+    }
+    else if( i<fields.size() && fields[i]=="startpos" )
+        i++;
+    else
+    {
+        session_send( session.get(), "info string Error; expected position startpos or position fen\n" );
+        return;
+    }
+    if( i<fields.size() && fields[i]=="moves" )
+    {
+        for( i++; i<fields.size(); i++ )
+            moves += (moves.length()>0 ? " " : "") + fields[i];
+    }
+
+    // Check it here, so the worker can't fail to set it
+    thc::ChessRules cr;
+    if( fen.length()>0 && !cr.Forsyth(fen.c_str()) )
+    {
+        session_send( session.get(), "info string Error; bad fen, position unchanged\n" );
+        return;
+    }
+    std::vector<std::string> terse;
+    util::split( moves, terse );
+    for( const std::string &s: terse )
+    {
+        thc::Move mv;
+        if( !mv.TerseIn(&cr,s.c_str()) )
+        {
+            session_send( session.get(), util::sprintf("info string Error; bad move %s, position unchanged\n",s.c_str()) );
+            return;
+        }
+        cr.PlayMove(mv);
+    }
+    std::lock_guard<std::mutex> lock(server_mutex);
+    session->fen      = fen;
+    session->moves    = moves;
+    session->position = cr;
+}
+
+// eg "go wtime 30000 btime 30000 winc 0 binc 0"
+static void session_go( const std::shared_ptr<SESSION> &session, const std::vector<std::string> &fields )
+{
+    std::unique_lock<std::mutex> lock(server_mutex);
+    if( session->queued || session->searching )
+    {
+        lock.unlock();
+        session_send( session.get(), "info string Error; already searching\n" );
+        return;
+    }
+    std::string out;
+    if( session_mating_move(session.get(),out) )
+    {
+        lock.unlock();
+        session_send( session.get(), out );
+        return;
+    }
+
+    // Work out our time and increment
+    std::string stime = session->position.white ? "wtime" : "btime";
+    std::string sinc  = session->position.white ? "winc"  : "binc";
+    unsigned long ms_time=0, ms_inc=0, movetime=0;
+    sargon_limits limits;
+    memset( &limits, 0, sizeof(limits) );
+    for( size_t i=1; i+1<fields.size(); i++ )
+    {
+        const std::string &parm = fields[i];
+        const char *value = fields[i+1].c_str();
+        if( parm == stime )
+            ms_time = static_cast<unsigned long>(atol(value));
+        else if( parm == sinc )
+            ms_inc = static_cast<unsigned long>(atol(value));
+        else if( parm == "movetime" )
+            movetime = static_cast<unsigned long>(atol(value));
+        else if( parm == "depth" )
+            limits.depth = atoi(value);
+        else if( parm == "nodes" )
+            limits.nodes = static_cast<unsigned long>(atol(value));
+    }
+
+    // Budget roughly as sargon-engine does, a thirtieth of our remaining
+    //  time (plus most of the increment), never more than half of it
+    unsigned long budget_ms = movetime;
+    if( budget_ms==0 && ms_time>0 )
+    {
+        budget_ms = ms_time/30 + ms_inc/2;
+        if( budget_ms > ms_time/2 )
+            budget_ms = ms_time/2;
+        if( budget_ms == 0 )
+            budget_ms = 1;
+    }
+    session->limits         = limits;
+    session->budget_ms      = budget_ms;
+    session->queued_time    = std::chrono::steady_clock::now();
+    session->queued         = true;
+    session->stop_requested = false;
+    run_queue.push_back( session );
+    server_cv.notify_one();
+}
+
+// If the opponent has followed our mating line, play the next move of the
+//  line without searching, out is the response. Called with server_mutex
+//  locked
+static bool session_mating_move( SESSION *session, std::string &out )
+{
+    MATING &mating = session->mating;
+    bool opponent_follows_line = false;
+    if( mating.active && mating.idx+2 < mating.variation.size() )
+    {
+        mating.position.PlayMove(mating.variation[mating.idx++]);
+        mating.position.PlayMove(mating.variation[mating.idx++]);
+        if( mating.position == session->position )
+            opponent_follows_line = true;
+    }
+    if( !opponent_follows_line )
+    {
+        mating.active = false;
+        return false;
+    }
+    thc::Move mating_move = mating.variation[mating.idx];
+    std::string buf_pv;
+    for( unsigned int i=0; mating.idx+i<mating.variation.size(); i++ )
+    {
+        buf_pv += " ";
+        buf_pv += mating.variation[mating.idx+i].TerseOut();
+    }
+    out = util::sprintf( "info score mate %d pv%s\n", --mating.nbr, buf_pv.c_str() );
+    if( mating.nbr <= 1 )
+        mating.active = false;
+    session->pv      = buf_pv.substr(1);
+    session->pv_mate = mating.nbr;
+    out += util::sprintf( "bestmove %s\n", mating_move.TerseOut().c_str() );
+    return true;
+}
+
+// Run the searches a slice at a time, round robin
+static void worker()
+{
+    for(;;)
+    {
+        std::shared_ptr<SESSION> session;
+        bool begin = false;
+        std::string fen, moves;
+        sargon_limits limits;
+        {
+            std::unique_lock<std::mutex> lock(server_mutex);
+            server_cv.wait( lock, []{ return run_queue.size() > 0; } );
+            session = run_queue.front();
+            run_queue.pop_front();
+            if( session->closed )
+                continue;   // a paused search is finished off by sargon_context_destroy()
+            if( session->queued )
+            {
+                // The budget includes the time spent waiting to begin, if
+                //  that's used up (or stop came first), depth 1 only, which
+                //  is effectively instantaneous
+                begin = true;
+                limits = session->limits;
+                std::chrono::milliseconds waited = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - session->queued_time);
+                unsigned long budget_ms = session->budget_ms;
+                if( budget_ms==0 || budget_ms>max_ms )
+                    budget_ms = max_ms;
+                unsigned long waited_ms = static_cast<unsigned long>(waited.count());
+                if( session->stop_requested || waited_ms>=budget_ms )
+                    limits.depth = 1;
+                else
+                    limits.movetime_ms = budget_ms - waited_ms;
+                fen   = session->fen;
+                moves = session->moves;
+                session->queued    = false;
+                session->searching = true;
+                session->pv.clear();
+                session->pv_mate = 0;
+            }
+        }
+
+        // Begin and/or continue the search, if it pauses back of the queue
+        char bestmove[8];
+        int ret = 0;    // 1 finished, 0 paused, <0 failed
+        if( begin )
+        {
+            ret = sargon_context_set_position( session->ctx, fen.c_str(), moves.c_str() );
+            if( ret == 0 )
+                ret = sargon_context_search_begin( session->ctx, &limits, progress, session.get() );
+        }
+        if( ret == 0 )
+            ret = sargon_context_search_run( session->ctx, slice_ms, bestmove, sizeof(bestmove) );
+        if( ret == 0 )
+        {
+            std::lock_guard<std::mutex> lock(server_mutex);
+            run_queue.push_back( session );
+            continue;
+        }
+        if( ret < 0 )
+            strcpy_s( bestmove, "0000" );   // no legal moves, the game is over
+        session_send( session.get(), util::sprintf("bestmove %s\n",bestmove) );
+
+        // If we've found a mate, play it out
+        std::lock_guard<std::mutex> lock(server_mutex);
+        session->searching = false;
+        MATING &mating = session->mating;
+        mating.active = false;
+        if( ret>0 && session->pv_mate>1 )
+        {
+            thc::ChessRules cr = session->position;
+            mating.position = cr;
+            mating.variation.clear();
+            std::vector<std::string> terse;
+            util::split( session->pv, terse );
+            for( const std::string &s: terse )
+            {
+                thc::Move mv;
+                if( !mv.TerseIn(&cr,s.c_str()) )
+                    break;
+                cr.PlayMove(mv);
+                mating.variation.push_back(mv);
+            }
+            mating.idx    = 0;
+            mating.nbr    = session->pv_mate;
+            mating.active = (mating.variation.size() == terse.size());
+        }
+    }
+}
+
+// Report each completed iteration to the session, and keep the PV
+static void progress( const sargon_info *info, void *user )
+{
+    SESSION *session = static_cast<SESSION *>(user);
+    {
+        std::lock_guard<std::mutex> lock(server_mutex);
+        session->pv      = info->pv;
+        session->pv_mate = info->mate;
+
+        // A stop (or close) can arrive just before the search begins, and
+        //  beginning clears the context's stop flag, so check again
+        if( session->stop_requested || session->closed )
+            sargon_context_stop( session->ctx );
+        if( session->closed )
+            return;
+    }
+    std::string score = info->mate ? util::sprintf("mate %d",info->mate) : util::sprintf("cp %d",info->score_cp);
+    session_send( session, util::sprintf( "info depth %d score %s nodes %lu time %lu pv %s\n",
+                                          info->depth, score.c_str(), info->nodes, info->time_ms, info->pv ) );
+}
+
+// Queue output for the session's writer, never waits for the client
+static void session_send( SESSION *session, const std::string &s )
+{
+    std::lock_guard<std::mutex> lock(session->send_mutex);
+    if( session->send_closed )
+        return;
+    if( session->outgoing.length()+s.length() > SERVER_MAX_OUTGOING )
+    {
+        // The client isn't reading, disconnect it rather than queue output
+        //  forever, its reader sees the shutdown and closes the session
+        printf( "Session %d not reading, disconnected\n", session->id );
+        fflush( stdout );
+        session->send_closed = true;
+        session->outgoing.clear();
+        session->send_cv.notify_one();
+        shutdown( session->sock, SD_BOTH );
+        return;
+    }
+    session->outgoing += s;
+    session->send_cv.notify_one();
+}
+
+// Write a session's queued output until it closes
+static void session_write( std::shared_ptr<SESSION> session )
+{
+    for(;;)
+    {
+        std::string s;
+        {
+            std::unique_lock<std::mutex> lock(session->send_mutex);
+            session->send_cv.wait( lock, [&]{ return session->send_closed || session->outgoing.length()>0; } );
+            if( session->send_closed )
+                break;
+            s.swap( session->outgoing );
+        }
+        const char *p = s.c_str();
+        size_t len = s.length();
+        while( len > 0 )
+        {
+            int n = send( session->sock, p, static_cast<int>(len), 0 );
+            if( n <= 0 )
+                return;     // the session has gone, its reader will notice
+            p   += n;
+            len -= n;
+        }
+    }
+}
@@ -0,0 +1,241 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-session.cpp
+ *       Record UCI sessions, compare a replayed session with the original
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+/*
+
+  Session file format, one line per command or response line, the time in
+  milliseconds since recording started then '>' for a command from the GUI
+  or '<' for a response from the engine, eg
+
+    0 > uci
+    1 < id name Sargon 1978 V1.01b
+    ...
+    2310 > position startpos moves e2e4
+    2311 > go wtime 30000 btime 30000 winc 0 binc 0
+    3315 < info depth 5 score cp -12 time 1003 nodes 61234 nps 61051 pv e7e5
+    3315 < bestmove e7e5
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include "util.h"
+#include "sargon-session.h"
+
+static std::mutex                 mtx;
+static bool                       recording;
+static FILE                      *session_file;
+static std::vector<SESSION_EVENT> session_events;
+static std::atomic<unsigned long> bestmoves;
+static std::chrono::time_point<std::chrono::steady_clock> base;
+
+static void add( bool cmd, const std::string &text );
+
+// A search, from go to bestmove
+struct SEARCH
+{
+    std::string   go;
+    std::string   bestmove;
+    unsigned long latency;
+};
+static void extract_searches( const std::vector<SESSION_EVENT> &events, std::vector<SEARCH> &searches );
+
+bool sargon_session_record( const std::string &filename )
+{
+    std::lock_guard<std::mutex> lck(mtx);
+    if( session_file )
+        fclose( session_file );
+    session_file = NULL;
+    if( filename != "" )
+    {
+        errno_t err = fopen_s( &session_file, filename.c_str(), "wt" );
+        if( err )
+        {
+            session_file = NULL;
+            return false;
+        }
+    }
+    session_events.clear();
+    bestmoves = 0;
+    base = std::chrono::steady_clock::now();
+    recording = true;
+    return true;
+}
+
+bool sargon_session_recording()
+{
+    return recording;
+}
+
+void sargon_session_cmd( const std::string &cmd )
+{
+    if( recording )
+        add( true, cmd );
+}
+
+void sargon_session_rsp( const std::string &rsp )
+{
+    if( !recording )
+        return;
+    size_t start = 0;
+    while( start < rsp.length() )
+    {
+        size_t end = rsp.find('\n',start);
+        if( end == std::string::npos )
+            end = rsp.length();
+        std::string line = rsp.substr(start,end-start);
+        util::rtrim(line);
+        if( line.length() > 0 )
+            add( false, line );
+        start = end+1;
+    }
+}
+
+unsigned long sargon_session_bestmoves()
+{
+    return bestmoves;
+}
+
+void sargon_session_end()
+{
+    std::lock_guard<std::mutex> lck(mtx);
+    recording = false;
+    if( session_file )
+        fclose( session_file );
+    session_file = NULL;
+}
+
+std::vector<SESSION_EVENT> sargon_session_events()
+{
+    std::lock_guard<std::mutex> lck(mtx);
+    return session_events;
+}
+
+static void add( bool cmd, const std::string &text )
+{
+    std::chrono::time_point<std::chrono::steady_clock> now = std::chrono::steady_clock::now();
+    std::chrono::milliseconds ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - base);
+    SESSION_EVENT e;
+    e.ms   = static_cast<unsigned long>(ms.count());
+    e.cmd  = cmd;
+    e.text = text;
+    std::lock_guard<std::mutex> lck(mtx);
+    session_events.push_back(e);
+    if( session_file )
+    {
+        fprintf( session_file, "%lu %c %s\n", e.ms, cmd?'>':'<', text.c_str() );
+        fflush( session_file );     // a session that ends in a crash is the interesting one
+    }
+    if( !cmd && text.substr(0,9)=="bestmove " )
+        bestmoves++;
+}
+
+bool sargon_session_read( const std::string &filename, std::vector<SESSION_EVENT> &events )
+{
+    events.clear();
+    std::ifstream in(filename);
+    if( !in )
+        return false;
+    std::string line;
+    while( std::getline(in,line) )
+    {
+        util::rtrim(line);
+        size_t offset = line.find(' ');
+        if( offset==std::string::npos || offset+2>=line.length() || (line[offset+1]!='>' && line[offset+1]!='<') )
+            continue;
+        SESSION_EVENT e;
+        e.ms   = strtoul( line.c_str(), NULL, 10 );
+        e.cmd  = (line[offset+1] == '>');
+        e.text = offset+3<=line.length() ? line.substr(offset+3) : "";
+        events.push_back(e);
+    }
+    return true;
+}
+
+static void extract_searches( const std::vector<SESSION_EVENT> &events, std::vector<SEARCH> &searches )
+{
+    searches.clear();
+    bool searching = false;
+    SEARCH search;
+    unsigned long go_time = 0;
+    for( const SESSION_EVENT &e: events )
+    {
+        if( e.cmd && e.text.substr(0,2)=="go" )
+        {
+            searching = true;
+            search.go = e.text;
+            go_time = e.ms;
+        }
+        else if( !e.cmd && searching && e.text.substr(0,9)=="bestmove " )
+        {
+            searching = false;
+            search.bestmove = e.text.substr(9);
+            search.latency  = e.ms - go_time;
+            searches.push_back(search);
+        }
+    }
+}
+
+// eg
+//  search 1 go wtime 30000 btime 30000: recorded e7e5 1004ms, replayed e7e5 998ms (-6ms)
+//  search 2 go wtime 28996 btime 30000: recorded g8f6 1312ms, replayed b8c6 1297ms (-15ms) DIFFERENT
+//  2 searches recorded, 2 replayed, 1 different bestmove, latency recorded 2316ms replayed 2295ms, max difference 15ms
+std::string sargon_session_compare( const std::vector<SESSION_EVENT> &recorded,
+                                    const std::vector<SESSION_EVENT> &replayed, bool &same )
+{
+    std::vector<SEARCH> r1, r2;
+    extract_searches( recorded, r1 );
+    extract_searches( replayed, r2 );
+    std::string s;
+    same = (r1.size() == r2.size());
+    size_t n = r1.size()>r2.size() ? r1.size() : r2.size();
+    int nbr_different = 0;
+    unsigned long total1=0, total2=0;
+    long max_diff=0;
+    for( size_t i=0; i<n; i++ )
+    {
+        if( i >= r2.size() )
+        {
+            s += util::sprintf( "search %d %s: recorded %s %lums, not replayed\n",
+                    (int)i+1, r1[i].go.c_str(), r1[i].bestmove.c_str(), r1[i].latency );
+            continue;
+        }
+        if( i >= r1.size() )
+        {
+            s += util::sprintf( "search %d %s: not recorded, replayed %s %lums\n",
+                    (int)i+1, r2[i].go.c_str(), r2[i].bestmove.c_str(), r2[i].latency );
+            continue;
+        }
+        bool different = (r1[i].bestmove != r2[i].bestmove);
+        if( different )
+        {
+            same = false;
+            nbr_different++;
+        }
+        long diff = static_cast<long>(r2[i].latency) - static_cast<long>(r1[i].latency);
+        if( labs(diff) > max_diff )
+            max_diff = labs(diff);
+        total1 += r1[i].latency;
+        total2 += r2[i].latency;
+        s += util::sprintf( "search %d %s: recorded %s %lums, replayed %s %lums (%+ldms)%s\n",
+                (int)i+1, r1[i].go.c_str(), r1[i].bestmove.c_str(), r1[i].latency,
+                r2[i].bestmove.c_str(), r2[i].latency, diff, different?" DIFFERENT":"" );
+    }
+    s += util::sprintf( "%d searches recorded, %d replayed, %d different bestmove%s, latency recorded %lums replayed %lums, max difference %ldms\n",
+            (int)r1.size(), (int)r2.size(), nbr_different, nbr_different==1?"":"s", total1, total2, max_diff );
+    return s;
+}
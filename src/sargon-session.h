@@ -0,0 +1,50 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-session.h
+ *       Record UCI sessions, compare a replayed session with the original
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+#ifndef SARGON_SESSION_H_INCLUDED
+#define SARGON_SESSION_H_INCLUDED
+
+#include <string>
+#include <vector>
+
+// One command from the GUI, or one response to it, ms is the time since
+//  recording started
+struct SESSION_EVENT
+{
+    unsigned long ms;
+    bool          cmd;      // true if command, false if response
+    std::string   text;     // one line, no trailing newline
+};
+
+// Start recording, to the named file if filename isn't empty, and in memory
+bool sargon_session_record( const std::string &filename );
+bool sargon_session_recording();
+
+// Record a command or a response (possibly several lines), thread safe
+void sargon_session_cmd( const std::string &cmd );
+void sargon_session_rsp( const std::string &rsp );
+
+// Number of bestmove responses so far
+unsigned long sargon_session_bestmoves();
+
+// Stop recording, close the file. The events remain available
+void sargon_session_end();
+std::vector<SESSION_EVENT> sargon_session_events();
+
+// Read a recorded session
+bool sargon_session_read( const std::string &filename, std::vector<SESSION_EVENT> &events );
+
+// Compare the bestmoves and latencies (go to bestmove) of two sessions,
+//  return a report, same is set false if any bestmove differs
+std::string sargon_session_compare( const std::vector<SESSION_EVENT> &recorded,
+                                    const std::vector<SESSION_EVENT> &replayed, bool &same );
+
+#endif // SARGON_SESSION_H_INCLUDED
@@ -0,0 +1,145 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-stats.cpp
+ *       Per ply search statistics (move ordering and pruning quality)
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+#include <math.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "util.h"
+#include "sargon-interface.h"
+#include "sargon-asm-interface.h"
+#include "sargon-stats.h"
+
+/*
+
+  Statistics are gathered from callbacks in FNDMOV(), Sargon's minimax
+  routine;
+
+    "after GENMOV()"      a node at ply NPLY has generated its moves
+    "Alpha beta cutoff?"  a move at ply NPLY has been searched (evaluated, or
+                          its subtree completed), Sargon cuts off the rest
+                          of the node's moves if the move's value (AL) is no
+                          better than the score two plies above ([BX])
+    "Yes! Best move"      a move at ply NPLY is the best found so far
+
+  Ply numbers can exceed PLYMAX, Sargon searches one more ply after a check.
+
+*/
+
+#define STATS_MAX_PLY 32
+struct PLY_STATS
+{
+    unsigned long nodes;                // nodes that generated moves
+    unsigned long moves_generated;
+    unsigned long moves_searched;
+    unsigned long cutoffs;
+    unsigned long first_move_cutoffs;
+    unsigned long moves_before_cutoff;  // total, to calculate average
+    unsigned long best_move_changes;
+};
+static PLY_STATS stats[STATS_MAX_PLY+1];
+static unsigned long searched_this_node[STATS_MAX_PLY+1];
+static int max_ply_seen;
+static unsigned long previous_iteration_total;
+
+void sargon_stats_clear( bool new_search )
+{
+    if( new_search )
+        previous_iteration_total = 0;
+    else
+    {
+        unsigned long total = 0;
+        for( int ply=1; ply<=max_ply_seen; ply++ )
+            total += stats[ply].moves_searched;
+        if( total > 0 )
+            previous_iteration_total = total;
+    }
+    memset( stats, 0, sizeof(stats) );
+    memset( searched_this_node, 0, sizeof(searched_this_node) );
+    max_ply_seen = 0;
+}
+
+void sargon_stats_callback_after_genmov()
+{
+    int ply = peekb(NPLY);
+    if( ply<1 || ply>STATS_MAX_PLY )
+        return;
+    if( ply > max_ply_seen )
+        max_ply_seen = ply;
+    stats[ply].nodes++;
+    searched_this_node[ply] = 0;
+
+    // GENMOV() records the start of this ply's move list two bytes before
+    //  where MLPTRI points, moves are 6 bytes each
+    unsigned int first = peekw( peekw(MLPTRI)-2 );
+    unsigned int mlnxt = peekw(MLNXT);
+    if( first<=mlnxt && ((mlnxt-first)%6)==0 )
+        stats[ply].moves_generated += (mlnxt-first)/6;
+}
+
+void sargon_stats_callback_alpha_beta_cutoff( unsigned int al, unsigned int bx )
+{
+    int ply = peekb(NPLY);
+    if( ply<1 || ply>STATS_MAX_PLY )
+        return;
+    if( ply > max_ply_seen )
+        max_ply_seen = ply;
+    stats[ply].moves_searched++;
+    searched_this_node[ply]++;
+    bool cutoff = ((al&0xff) <= peekb(bx&0xffff));   // same test as the code that follows the callback
+    if( cutoff )
+    {
+        stats[ply].cutoffs++;
+        stats[ply].moves_before_cutoff += searched_this_node[ply];
+        if( searched_this_node[ply] == 1 )
+            stats[ply].first_move_cutoffs++;
+    }
+}
+
+void sargon_stats_callback_yes_best_move()
+{
+    int ply = peekb(NPLY);
+    if( ply<1 || ply>STATS_MAX_PLY )
+        return;
+    stats[ply].best_move_changes++;
+}
+
+// eg
+//  stats ply 1 nodes 1 generated 34 searched 34 cutoffs 0 firstcut 0.0% beforecut 0.00 best 3 bf 34.00
+//  stats ply 2 nodes 34 generated 1123 searched 412 cutoffs 33 firstcut 81.8% beforecut 1.42 best 57 bf 12.12
+//  ...
+//  stats depth 3 searched 4567 ebf 16.59 iteration ratio 11.21
+void sargon_stats_report( int plymax, std::vector<std::string> &lines )
+{
+    lines.clear();
+    unsigned long total = 0;
+    unsigned long parent = 1;   // the root
+    for( int ply=1; ply<=max_ply_seen; ply++ )
+    {
+        const PLY_STATS &s = stats[ply];
+        total += s.moves_searched;
+        double first_cut_rate  = s.cutoffs>0 ? 100.0*s.first_move_cutoffs/s.cutoffs : 0.0;
+        double before_cut      = s.cutoffs>0 ? static_cast<double>(s.moves_before_cutoff)/s.cutoffs : 0.0;
+        double branching       = parent>0 ? static_cast<double>(s.moves_searched)/parent : 0.0;
+        lines.push_back( util::sprintf( "stats ply %d nodes %lu generated %lu searched %lu cutoffs %lu firstcut %.1f%% beforecut %.2f best %lu bf %.2f",
+            ply, s.nodes, s.moves_generated, s.moves_searched, s.cutoffs,
+            first_cut_rate, before_cut, s.best_move_changes, branching ) );
+        parent = s.moves_searched;
+    }
+
+    // Effective branching factor, the uniform branching factor that would
+    //  give the same number of moves searched at this depth
+    double ebf = (plymax>0 && total>0) ? pow( static_cast<double>(total), 1.0/plymax ) : 0.0;
+    std::string s = util::sprintf( "stats depth %d searched %lu ebf %.2f", plymax, total, ebf );
+    if( previous_iteration_total > 0 )
+        s += util::sprintf( " iteration ratio %.2f", static_cast<double>(total)/previous_iteration_total );
+    lines.push_back(s);
+}
@@ -0,0 +1,29 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-stats.h
+ *       Per ply search statistics (move ordering and pruning quality)
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+#ifndef SARGON_STATS_H_INCLUDED
+#define SARGON_STATS_H_INCLUDED
+
+#include <string>
+#include <vector>
+
+// Start a new search (forget previous iterations) or a new iteration
+void sargon_stats_clear( bool new_search );
+
+// Feed from callback(), al and bx are the registers at "Alpha beta cutoff?"
+void sargon_stats_callback_after_genmov();
+void sargon_stats_callback_alpha_beta_cutoff( unsigned int al, unsigned int bx );
+void sargon_stats_callback_yes_best_move();
+
+// One line per ply plus a summary line for the iteration just completed
+void sargon_stats_report( int plymax, std::vector<std::string> &lines );
+
+#endif // SARGON_STATS_H_INCLUDED
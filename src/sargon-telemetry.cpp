@@ -0,0 +1,221 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-telemetry.cpp
+ *       Structured per search records, one JSON object per line
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+/*
+
+  One record (one line of JSON) per go command, eg (wrapped here)
+
+    {"fen":"rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1",
+     "go":"go wtime 30000 btime 30000 winc 0 binc 0",
+     "ms_time":30000,"ms_inc":0,"depth":0,"nodes":0,
+     "states":[{"where":"Initial state machine","from":"ADAPTIVE_WITH_TARGET","to":"ADAPTIVE_WITH_TARGET"}],
+     "iterations":[{"depth":1,"nodes":43,"time":1,"score":-12,"pv":"e7e5"},
+                   {"depth":2,"nodes":289,"time":3,"score":0,"pv":"e7e5 d2d4"},
+                   ...
+                   {"depth":5,"nodes":60123,"time":997,"score":0,"pv":"","aborted":"event"}],
+     "events":[],
+     "bestmove":"e7e5","total_nodes":61234,"total_time":1003}
+
+  The record is built in memory as the search proceeds. The completed line
+  is handed to a writer thread, which owns the file, so the search thread
+  never waits for file I/O before sending bestmove.
+
+*/
+
+#include <stdio.h>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "util.h"
+#include "sargon-telemetry.h"
+
+// Record being built
+static bool        active;
+static std::string record;
+static std::string states;
+static std::string iterations;
+static std::string events;
+
+// Writer thread
+static std::mutex              mtx;
+static std::condition_variable cv;
+static std::deque<std::string> queue;
+static std::string             requested_filename;
+static bool                    enabled;
+static bool                    stop_request;
+static bool                    writer_running;
+static std::thread             writer;
+
+static void writer_thread();
+static std::string json_string( const std::string &s );
+static void append( std::string &list, const std::string &item );
+
+void sargon_telemetry_file( const std::string &filename )
+{
+    std::lock_guard<std::mutex> lck(mtx);
+    requested_filename = filename;
+    enabled = (filename != "");
+    if( enabled && !writer_running )
+    {
+        stop_request = false;
+        writer = std::thread(writer_thread);
+        writer_running = true;
+    }
+    cv.notify_one();
+}
+
+void sargon_telemetry_begin( const std::string &fen, const std::string &go_cmd,
+                             unsigned long ms_time, unsigned long ms_inc, int depth, unsigned long nodes )
+{
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+        active = enabled;
+    }
+    if( !active )
+        return;
+    record = util::sprintf( "{\"fen\":%s,\"go\":%s,\"ms_time\":%lu,\"ms_inc\":%lu,\"depth\":%d,\"nodes\":%lu",
+                json_string(fen).c_str(), json_string(go_cmd).c_str(), ms_time, ms_inc, depth, nodes );
+    states.clear();
+    iterations.clear();
+    events.clear();
+}
+
+void sargon_telemetry_state( const std::string &where, const char *old_state, const char *new_state )
+{
+    if( !active )
+        return;
+    append( states, util::sprintf( "{\"where\":%s,\"from\":%s,\"to\":%s}",
+                json_string(where).c_str(), json_string(old_state).c_str(), json_string(new_state).c_str() ) );
+}
+
+void sargon_telemetry_iteration( int depth, unsigned long nodes, unsigned long ms, int score_cp,
+                                 const std::string &pv, const char *aborted_by )
+{
+    if( !active )
+        return;
+    std::string s = util::sprintf( "{\"depth\":%d,\"nodes\":%lu,\"time\":%lu,\"score\":%d,\"pv\":%s",
+                depth, nodes, ms, score_cp, json_string(pv).c_str() );
+    if( aborted_by )
+        s += util::sprintf( ",\"aborted\":%s", json_string(aborted_by).c_str() );
+    s += "}";
+    append( iterations, s );
+}
+
+void sargon_telemetry_event( unsigned long ms, const std::string &event )
+{
+    if( !active )
+        return;
+    append( events, util::sprintf( "{\"time\":%lu,\"event\":%s}", ms, json_string(event).c_str() ) );
+}
+
+void sargon_telemetry_end( const std::string &bestmove, unsigned long nodes, unsigned long ms )
+{
+    if( !active )
+        return;
+    active = false;
+    record += ",\"states\":[" + states + "]";
+    record += ",\"iterations\":[" + iterations + "]";
+    record += ",\"events\":[" + events + "]";
+    record += util::sprintf( ",\"bestmove\":%s,\"total_nodes\":%lu,\"total_time\":%lu}\n",
+                json_string(bestmove).c_str(), nodes, ms );
+    std::lock_guard<std::mutex> lck(mtx);
+    queue.push_back( record );
+    cv.notify_one();
+}
+
+void sargon_telemetry_close()
+{
+    std::thread stopping;
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+        if( !writer_running )
+            return;
+        stop_request = true;
+        stopping.swap( writer );
+        writer_running = false;
+        cv.notify_one();
+    }
+    stopping.join();
+}
+
+static void writer_thread()
+{
+    FILE *f = NULL;
+    std::string filename;
+    std::unique_lock<std::mutex> lck(mtx);
+    for(;;)
+    {
+        cv.wait( lck, [&filename]{ return stop_request || !queue.empty() || requested_filename!=filename; } );
+        if( requested_filename != filename )
+        {
+            if( f )
+                fclose( f );
+            f = NULL;
+            filename = requested_filename;
+            if( filename != "" )
+            {
+                errno_t err = fopen_s( &f, filename.c_str(), "at" );
+                if( err )
+                    f = NULL;
+            }
+        }
+        while( !queue.empty() )
+        {
+            std::string s = queue.front();
+            queue.pop_front();
+
+            // Write without holding the lock
+            lck.unlock();
+            if( f )
+            {
+                fputs( s.c_str(), f );
+                fflush( f );
+            }
+            lck.lock();
+        }
+        if( stop_request )
+            break;
+    }
+    if( f )
+        fclose( f );
+}
+
+static void append( std::string &list, const std::string &item )
+{
+    if( list.length() > 0 )
+        list += ",";
+    list += item;
+}
+
+static std::string json_string( const std::string &s )
+{
+    std::string ret = "\"";
+    for( char c: s )
+    {
+        if( c=='"' || c=='\\' )
+        {
+            ret += '\\';
+            ret += c;
+        }
+        else if( c == '\n' )
+            ret += "\\n";
+        else if( c == '\t' )
+            ret += "\\t";
+        else if( static_cast<unsigned char>(c) < ' ' )
+            ret += util::sprintf( "\\u%04x", c );
+        else
+            ret += c;
+    }
+    ret += "\"";
+    return ret;
+}
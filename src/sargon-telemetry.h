@@ -0,0 +1,37 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-telemetry.h
+ *       Structured per search records, one JSON object per line
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+#ifndef SARGON_TELEMETRY_H_INCLUDED
+#define SARGON_TELEMETRY_H_INCLUDED
+
+#include <string>
+
+// Start writing records to a file (appended to), or switch to a new file. An
+//  empty filename turns telemetry off
+void sargon_telemetry_file( const std::string &filename );
+
+// Build up a record for one search. Calls outside begin() / end() are
+//  ignored, as are all calls if telemetry is off
+void sargon_telemetry_begin( const std::string &fen, const std::string &go_cmd,
+                             unsigned long ms_time, unsigned long ms_inc, int depth, unsigned long nodes );
+void sargon_telemetry_state( const std::string &where, const char *old_state, const char *new_state );
+void sargon_telemetry_iteration( int depth, unsigned long nodes, unsigned long ms, int score_cp,
+                                 const std::string &pv, const char *aborted_by=NULL );
+void sargon_telemetry_event( unsigned long ms, const std::string &event );
+
+// Complete the record and queue it for the writer thread, never waits for
+//  the file
+void sargon_telemetry_end( const std::string &bestmove, unsigned long nodes, unsigned long ms );
+
+// Write all queued records and stop the writer thread, call before exiting
+void sargon_telemetry_close();
+
+#endif // SARGON_TELEMETRY_H_INCLUDED
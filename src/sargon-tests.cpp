@@ -20,12 +20,22 @@
 #include "sargon-asm-interface.h"
 #include "sargon-interface.h"
 #include "sargon-pv.h"
+#include "sargon-z80.h"
+#include "sargon-bench.h"
+#include "sargon-profile.h"
+#include "sargon-bitbase.h"
+#include "sargon-epd.h"
+#include "sargon-book.h"
 
 // Individual tests
 bool sargon_position_tests( bool quiet, int comprehensive );
 bool sargon_timing_tests( bool quiet, int comprehensive );
 bool sargon_whole_game_tests( bool quiet, int comprehensive );
 bool sargon_timed_game_test( bool quiet, int comprehensive, bool dummy=false );
+bool sargon_z80_comparison_test( bool quiet, int nbr_iterations, const std::string &z80_hex_file );
+bool sargon_bitbase_tests( bool quiet, const std::string &bitbase_file );
+bool sargon_book_key_tests( bool quiet );
+static void bench_print( const std::string &line );
 extern void sargon_minimax_main();
 extern bool sargon_minimax_regression_test( bool quiet);
 
@@ -50,15 +60,52 @@ int main( int argc, const char *argv[] )
     "Sargon test suite\n"
     "\n"
     "Usage:\n"
-    "sargon-tests tests [-1|-2|-3] [-v] [-doc]\n"
+    "sargon-tests tests [-1|-2|-3] [-v] [-doc] [depth] [-json file] [-baseline file] [-perf]\n"
+    "             [-profile file] [-bitbase file] [-epd file] [-jobs n] [-nodes n] [-ms n]\n"
+    "             [-z80 file]\n"
     "\n"
     "tests = combine 'p' for position tests, 'g' for whole game tests, 'm' for\n"
-    "        minimax tests, 't' for timing tests, 'c' for calibrated timing test\n"
+    "        minimax tests, 't' for timing tests, 'c' for calibrated timing test,\n"
+    "        'o' to compare with the original Z80 program, 'b' for fixed depth\n"
+    "        benchmark (same as sargon-engine bench command), 'r' for robust\n"
+    "        (repeated, statistically analysed) timing tests, 'k' for endgame\n"
+    "        table (KQK, KRK, KPK) generation tests, 'e' for an EPD test suite\n"
+    "        (needs -epd), 'z' for bytes per context (the memory a paused search\n"
+    "        needs) at each depth up to depth, 'h' for opening book (Polyglot)\n"
+    "        key tests\n"
+    "\n"
+    "depth = benchmark (or bytes per context) depth, default is 5\n"
+    "\n"
+    "-json file = write robust timing test results to file\n"
+    "\n"
+    "-baseline file = compare robust timing test results to an earlier -json file,\n"
+    "                 statistically significant regressions fail the test\n"
+    "\n"
+    "-perf = report hardware performance counters (cycles, instructions, IPC,\n"
+    "        branch and L1 cache misses) for each type of test, where available\n"
+    "\n"
+    "-profile file = sample Sargon's routines while running the tests, write a flat\n"
+    "                profile to file and collapsed stacks (for flame graphs) to\n"
+    "                file.collapsed\n"
+    "\n"
+    "-bitbase file = save the endgame tables generated by the 'k' tests, for the\n"
+    "                sargon-engine BitbaseFile option\n"
+    "\n"
+    "-epd file = EPD test suite, positions with bm (best move) or am (avoid move)\n"
+    "            operations, for the 'e' tests\n"
+    "\n"
+    "-jobs n = solve EPD positions in n worker processes, default is 1\n"
+    "\n"
+    "-nodes n, -ms n = node and/or millisecond budget per EPD position, default\n"
+    "                  is -ms 5000, an iteration that runs out is abandoned\n"
     "\n"
     "-1|-2|-3 = fast, middling or comprehensive suite of tests respectively\n"
     "\n"
     "-v means verbose, (i.e. print extra information)\n"
     "\n"
+    "-z80 file = the assembled Z80 program for 'o', an Intel HEX file (with the\n"
+    "     zmac listing alongside), default stages\\sargon-z80.hex\n"
+    "\n"
     "-doc means don't run any tests, instead run minimax models and print results\n"
     "     in the form of documentation\n"
     "\n"
@@ -67,17 +114,36 @@ int main( int argc, const char *argv[] )
     "    Run a comprehensive, verbose set of position and whole game tests\n"
     " sargon-tests c -3\n"
     "    Run the calibration test, -3 specifies many iterations for accuracy\n"
+    " sargon-tests o -3\n"
+    "    Play the calibration game on the original Z80 program (interpreted, with\n"
+    "    exact timing) and on the x86 program, check they search the same nodes,\n"
+    "    and calculate the speed up ratio\n"
+    " sargon-tests b 6\n"
+    "    Run the benchmark at depth 6, prints machine readable node counts and nps\n"
+    " sargon-tests r -2 -json after.json -baseline before.json\n"
+    "    Run robust timing tests, save results and compare them to earlier results\n"
+    " sargon-tests k -bitbase sargon-bitbase.bin\n"
+    "    Generate and check the endgame tables, then save them\n"
+    " sargon-tests z 8\n"
+    "    Report bytes per context at depths 1 to 8\n"
+    " sargon-tests e -epd wac.epd -jobs 4 -ms 10000\n"
+    "    Solve an EPD test suite, four positions at a time, 10 seconds each\n"
     " sargon-tests t\n"
     "    Run original timing tests (but note improved calibration timing test)\n"
     " sargon-tests -doc\n"        
     "    Run the minimax models and print out the results as documentation\n";
-    bool ok = false, minimax_doc=false, quiet=true;
+    bool ok = false, minimax_doc=false, quiet=true, perf=false;
     std::string test_types;
+    std::string z80_hex_file = "stages\\sargon-z80.hex";
     int comprehensive = 1;
+    int bench_depth = 0;
+    std::string json_file, baseline_file, profile_file, bitbase_file, epd_file;
+    int epd_jobs = 1, epd_worker = -1;
+    EPD_BUDGET epd_budget;
     for( int i=1; i<argc; i++ )
     {
         std::string s = argv[i];
-        if( i==1 && s.find_first_not_of("gptmc") == std::string::npos )
+        if( i==1 && s.find_first_not_of("gptmcobrkezh") == std::string::npos )
         {
             test_types = s;
             ok = true;
@@ -95,19 +161,75 @@ int main( int argc, const char *argv[] )
         {
             quiet = false;
         }
+        else if( s=="-z80" && i+1<argc )
+        {
+            z80_hex_file = argv[++i];
+        }
+        else if( s=="-perf" )
+        {
+            perf = true;
+        }
+        else if( (s=="-json" || s=="-baseline" || s=="-profile" || s=="-bitbase" || s=="-epd") && i+1<argc )
+        {
+            i++;
+            if( s == "-json" )
+                json_file = argv[i];
+            else if( s == "-baseline" )
+                baseline_file = argv[i];
+            else if( s == "-bitbase" )
+                bitbase_file = argv[i];
+            else if( s == "-epd" )
+                epd_file = argv[i];
+            else
+                profile_file = argv[i];
+        }
+        else if( (s=="-jobs" || s=="-nodes" || s=="-ms") && i+1<argc )
+        {
+            i++;
+            unsigned long n = strtoul( argv[i], NULL, 10 );
+            if( s == "-jobs" )
+                epd_jobs = static_cast<int>(n);
+            else if( s == "-nodes" )
+                epd_budget.nodes = n;
+            else
+                epd_budget.ms = n;
+        }
+        else if( s=="-worker" && i+1<argc )
+        {
+            // Internal, sargon_epd_suite() starts worker processes with
+            //  -worker k/n
+            i++;
+            if( 2 != sscanf_s(argv[i],"%d/%d",&epd_worker,&epd_jobs) )
+            {
+                ok = false;
+                break;
+            }
+        }
+        else if( i>1 && (test_types.find('b')!=std::string::npos || test_types.find('z')!=std::string::npos) && s.find_first_not_of("0123456789")==std::string::npos )
+        {
+            bench_depth = atoi(s.c_str());
+        }
         else
         {
             ok = false;
             break;
         }
     }
+    if( test_types.find('e')!=std::string::npos && epd_file=="" )
+        ok = false;
     if( !ok )
     {
         printf( usage );
         return -1;
     }
+    if( epd_worker >= 0 )
+        return sargon_epd_worker(epd_file,epd_worker,epd_jobs,epd_budget) ? 0 : -1;
 
     util::tests();
+    if( perf && !sargon_perf_enable(true) )
+        printf( "Hardware performance counters unavailable, continuing without them\n" );
+    if( profile_file!="" && !sargon_profile_start() )
+        printf( "Sampling profiler unavailable, continuing without it\n" );
     if( minimax_doc )
         sargon_minimax_main();
     else
@@ -146,6 +268,7 @@ int main( int argc, const char *argv[] )
                 {
                     for( char c: test_types )
                     {
+                        sargon_perf_clear();
                         if( c == 'p' )
                         {
                             passed = sargon_position_tests(quiet,comprehensive);
@@ -170,6 +293,48 @@ int main( int argc, const char *argv[] )
                             if( !passed )
                                 ok = false;
                         }
+                        else if( c == 'o' )
+                        {
+                            passed = sargon_z80_comparison_test(quiet,nbr_iterations,z80_hex_file);
+                            if( !passed )
+                                ok = false;
+                        }
+                        else if( c == 'b' )
+                        {
+                            sargon_bench( bench_depth, bench_print );
+                        }
+                        else if( c == 'z' )
+                        {
+                            passed = sargon_bench_context_bytes( bench_depth, bench_print );
+                            if( !passed )
+                                ok = false;
+                        }
+                        else if( c == 'r' )
+                        {
+                            passed = sargon_bench_timing(comprehensive,quiet,json_file,baseline_file);
+                            if( !passed )
+                                ok = false;
+                        }
+                        else if( c == 'k' )
+                        {
+                            passed = sargon_bitbase_tests(quiet,bitbase_file);
+                            if( !passed )
+                                ok = false;
+                        }
+                        else if( c == 'h' )
+                        {
+                            passed = sargon_book_key_tests(quiet);
+                            if( !passed )
+                                ok = false;
+                        }
+                        else if( c == 'e' )
+                        {
+                            passed = sargon_epd_suite(argv[0],epd_file,epd_jobs,epd_budget);
+                            if( !passed )
+                                ok = false;
+                        }
+                        if( sargon_perf_enabled() )
+                            printf( "'%c' tests %s\n", c, sargon_perf_report().c_str() );
                     }
                     break;
                 }
@@ -250,6 +415,15 @@ int main( int argc, const char *argv[] )
             }
         }
     }
+    if( sargon_profile_running() )
+    {
+        sargon_profile_stop();
+        printf( "\n%s", sargon_profile_summary().c_str() );
+        if( sargon_profile_write_flat(profile_file) && sargon_profile_write_collapsed(profile_file+".collapsed") )
+            printf( "Profile written to %s and %s.collapsed\n", profile_file.c_str(), profile_file.c_str() );
+        else
+            printf( "Error; cannot write profile file %s\n", profile_file.c_str() );
+    }
     return ok ? 0 : -1;
 }
 
@@ -467,6 +641,136 @@ bool sargon_timed_game_test( bool quiet, int nbr_iterations, bool dummy )
     return ok;
 }
 
+// Nodes searched by the x86 program (recorded by after_genmov()), and the
+//  random numbers it used for book moves (recorded by after_ldar()), for
+//  comparison with the Z80 program
+static std::vector<uint32_t> *x86_trace;
+static std::vector<uint8_t>  *x86_ldar;
+static size_t z80_ldar_idx;
+
+// The Z80 program calls back here, give it the same random numbers
+static void z80_callback( const char *msg, z80_registers &registers )
+{
+    if( 0==strcmp(msg,"LDAR") && x86_ldar && z80_ldar_idx<x86_ldar->size() )
+        registers.af = static_cast<uint16_t>( (registers.af&0xff00) | (*x86_ldar)[z80_ldar_idx++] );
+}
+
+bool sargon_z80_comparison_test( bool quiet, int nbr_iterations, const std::string &z80_hex_file )
+{
+    printf( "* Original Z80 program comparison test\n" );
+    std::string error;
+    if( !sargon_z80_load(z80_hex_file,error) )
+    {
+        printf( "%s\n", error.c_str() );
+        return false;
+    }
+    sargon_z80_callback( z80_callback );
+    sargon_z80_clear();
+
+    // Play the timing calibration game, with each of Sargon's moves calculated
+    //  by both programs from the same position
+    std::vector<std::string> fields;
+    util::split( timing_calibration_game, fields );
+    thc::ChessRules cr;
+    sargon_import_position(cr);
+    unsigned char moveno=1;
+    pokeb(MOVENO,moveno);
+    pokeb(KOLOR,0x80); // Sargon is black
+    pokeb(PLYMAX,2);
+    bool ok = true;
+    unsigned long nbr_nodes = 0;
+    for( size_t i=0; ok && i<fields.size(); i++ )
+    {
+        thc::Move mv;
+        ok = mv.NaturalIn( &cr, fields[i].c_str() );
+        if( !ok )
+            break;
+        bool white_to_move = ((i&1) == 0);
+        if( white_to_move )
+        {
+            pokeb(COLOR,0); // White to move
+            ok = sargon_play_move(mv);
+        }
+        else
+        {
+            pokeb(COLOR,0x80); // Black to move
+            std::vector<uint32_t> trace86, trace80;
+            std::vector<uint8_t>  ldar;
+            sargon_z80_import();
+            x86_trace = &trace86;
+            x86_ldar  = &ldar;
+            sargon(api_CPTRMV);
+            x86_trace = NULL;
+            std::string terse86 = sargon_export_move(BESTM);
+            z80_ldar_idx = 0;
+            sargon_z80_trace( &trace80 );
+            unsigned long long base = sargon_z80_search_tstates();
+            ok = sargon_z80(api_CPTRMV);
+            sargon_z80_trace( NULL );
+            x86_ldar = NULL;
+            if( !ok )
+            {
+                printf( "\n%s\n", sargon_z80_error().c_str() );
+                break;
+            }
+            std::string terse80 = sargon_z80_export_move();
+            nbr_nodes += static_cast<unsigned long>(trace80.size());
+            size_t n = 0;
+            while( n<trace80.size() && n<trace86.size() && trace80[n]==trace86[n] )
+                n++;
+            if( terse80!=terse86 || n<trace80.size() || n<trace86.size() )
+            {
+                printf( "\nMismatch at Sargon's move %s; x86 program plays %s after %u nodes, Z80 program plays %s after %u nodes\n",
+                        fields[i].c_str(), terse86.c_str(), static_cast<unsigned int>(trace86.size()),
+                        terse80.c_str(), static_cast<unsigned int>(trace80.size()) );
+                printf( "First different node is node %u\n", static_cast<unsigned int>(n+1) );
+                ok = false;
+            }
+            else if( terse86 != mv.TerseOut() )
+            {
+                printf( "\nSargon played %s instead of %s\n", terse86.c_str(), fields[i].c_str() );
+                ok = false;
+            }
+            else if( !quiet )
+            {
+                double secs = (sargon_z80_search_tstates()-base) / (SARGON_Z80_MHZ*1000000.0);
+                printf( "%s %.1fs ", fields[i].c_str(), secs );
+            }
+            if( moveno <= 254 )
+            {
+                moveno++;
+                pokeb(MOVENO,moveno);
+            }
+        }
+        if( ok )
+            cr.PlayMove(mv);
+    }
+    if( !ok )
+        return false;
+    double z80_search = sargon_z80_search_tstates() / (SARGON_Z80_MHZ*1000000.0);
+    double z80_total  = sargon_z80_tstates() / (SARGON_Z80_MHZ*1000000.0);
+    printf( "\nx86 and Z80 programs played the same moves, searching the same %lu nodes\n", nbr_nodes );
+    printf( "On a %.2fMHz Z80 Sargon's searches take %llu T-states = %.1f seconds (%.1f seconds\n"
+            "including showing the moves), Hans W Kramer's hand timing was 2664 seconds\n",
+            SARGON_Z80_MHZ, sargon_z80_search_tstates(), z80_search, z80_total );
+
+    // Time the x86 program as for the calibration test
+    std::chrono::time_point<std::chrono::steady_clock> base = std::chrono::steady_clock::now();
+    ok = sargon_timed_game_test(true,nbr_iterations);
+    std::chrono::time_point<std::chrono::steady_clock> middle = std::chrono::steady_clock::now();
+    ok = ok && sargon_timed_game_test(true,nbr_iterations,true);
+    std::chrono::time_point<std::chrono::steady_clock> end = std::chrono::steady_clock::now();
+    if( ok )
+    {
+        std::chrono::microseconds main_us = std::chrono::duration_cast<std::chrono::microseconds>(middle - base);
+        std::chrono::microseconds null_us = std::chrono::duration_cast<std::chrono::microseconds>(end - middle);
+        double x86 = static_cast<double>(main_us.count()-null_us.count()) / 1000000.0 / nbr_iterations;
+        printf( "\nThe x86 program takes %.6f seconds, so the speed up ratio on this machine is\n"
+                "%.1f / %.6f = %.0f\n", x86, z80_search, x86, x86>0.0 ? z80_search/x86 : 0.0 );
+    }
+    return ok;
+}
+
 struct TEST
 {
     const char *fen;
@@ -776,6 +1080,167 @@ bool sargon_position_tests( bool quiet, int comprehensive )
     return ok;
 }
 
+// Endgame tables, generate then check some well known positions
+bool sargon_bitbase_tests( bool quiet, const std::string &bitbase_file )
+{
+    bool ok = true;
+    printf( "* Endgame table tests\n" );
+    std::chrono::time_point<std::chrono::steady_clock> base = std::chrono::steady_clock::now();
+    sargon_bitbase_generate();
+    std::chrono::time_point<std::chrono::steady_clock> now = std::chrono::steady_clock::now();
+    std::chrono::milliseconds ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - base);
+    printf( "KQK, KRK and KPK tables generated in %.3f seconds\n", static_cast<double>(ms.count())/1000.0 );
+    struct BITBASE_TEST
+    {
+        const char *fen;
+        const char *move;   // best move
+        int dtm;            // distance to mate in half moves, 0 draw
+        const char *description;
+    };
+    static BITBASE_TEST bitbase_tests[] =
+    {
+        { "8/3k4/8/8/3PK3/8/8/8 w - - 0 1",    "e4d5",  29, "K+P v K, Kd5 (see README) is the only win" },
+        { "7k/5K2/8/8/8/8/8/6Q1 w - - 0 1",    NULL,     1, "K+Q v K, mate in one (Qg7 or Qh1)" },
+        { "8/8/8/4k3/8/8/8/KR6 w - - 0 1",     "a1b2",  29, "K+R v K, rook and king far apart" },
+        { "k7/8/K7/P7/8/8/8/8 w - - 0 1",      NULL,     0, "K+P v K, rook's pawn, drawn" },
+        { "8/8/8/8/8/8/2k5/K1q5 w - - 0 1",    "a1a2",  -2, "K v K+Q, mated next move" },
+    };
+    int nbr_tests = sizeof(bitbase_tests)/sizeof(bitbase_tests[0]);
+    for( int i=0; i<nbr_tests; i++ )
+    {
+        BITBASE_TEST *pt = &bitbase_tests[i];
+        thc::ChessRules cr;
+        cr.Forsyth(pt->fen);
+        if( !quiet )
+            printf( "%s\n", cr.ToDebugStr(pt->description).c_str() );
+        printf( "Test %d of %d: %s:", i+1, nbr_tests, pt->description );
+        thc::Move mv;
+        int dtm;
+        bool pass = sargon_bitbase_best_move(cr,mv,dtm);
+        if( !pass )
+            printf( " FAIL\n Fail reason: Position not found\n" );
+        else if( dtm != pt->dtm )
+        {
+            pass = false;
+            printf( " FAIL\n Fail reason: Expected distance to mate=%d, Calculated=%d\n", pt->dtm, dtm );
+        }
+        else if( pt->move && mv.TerseOut()!=std::string(pt->move) )
+        {
+            pass = false;
+            printf( " FAIL\n Fail reason: Expected move=%s, Calculated move=%s\n", pt->move, mv.TerseOut().c_str() );
+        }
+        else
+            printf( " PASS\n" );
+        if( !pass )
+            ok = false;
+    }
+
+    // Play out K+R v K, the tables must deliver mate in exactly the distance
+    //  they predict
+    thc::ChessRules cr;
+    cr.Forsyth("8/8/8/4k3/8/8/8/KR6 w - - 0 1");
+    int plies = 0, dtm = 0;
+    for(;;)
+    {
+        thc::Move mv;
+        int temp;
+        if( !sargon_bitbase_best_move(cr,mv,temp) || plies>100 )
+            break;
+        if( plies == 0 )
+            dtm = temp;
+        cr.PlayMove(mv);
+        plies++;
+    }
+    thc::TERMINAL score_terminal;
+    bool pass = cr.Evaluate(score_terminal) && score_terminal==thc::TERMINAL_BCHECKMATE && plies==dtm;
+    printf( "Test K+R v K play out: %s\n", pass?"PASS":"FAIL" );
+    if( !pass )
+        ok = false;
+
+    // A checkmated side to move must not look like a draw
+    cr.Forsyth("k7/1Q6/1K6/8/8/8/8/8 b - - 0 1");
+    thc::Move mv;
+    int mated_dtm = 0, best_dtm = 0;
+    pass = sargon_bitbase_probe(cr,mated_dtm) && mated_dtm==SARGON_BITBASE_MATED &&
+           !sargon_bitbase_best_move(cr,mv,best_dtm) && best_dtm==SARGON_BITBASE_MATED;
+    printf( "Test K v K+Q checkmated: %s\n", pass?"PASS":"FAIL" );
+    if( !pass )
+        ok = false;
+    if( bitbase_file != "" )
+    {
+        if( sargon_bitbase_write(bitbase_file) )
+            printf( "Endgame tables written to %s\n", bitbase_file.c_str() );
+        else
+        {
+            printf( "Error; cannot write endgame tables to %s\n", bitbase_file.c_str() );
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Book keys must be the Polyglot keys, so that Polyglot books work. The
+//  expected keys are the published examples from the Polyglot book format
+//  specification
+bool sargon_book_key_tests( bool quiet )
+{
+    bool ok = true;
+    printf( "* Opening book key tests\n" );
+    struct BOOK_KEY_TEST
+    {
+        const char *moves;
+        uint64_t key;
+    };
+    static BOOK_KEY_TEST book_key_tests[] =
+    {
+        { "",                             0x463b96181691fc9cULL },
+        { "e4",                           0x823c9b50fd114196ULL },
+        { "e4 d5",                        0x0756b94461c50fb0ULL },
+        { "e4 d5 e5",                     0x662fafb965db29d4ULL },
+        { "e4 d5 e5 f5",                  0x22a48b5a8e47ff78ULL },
+        { "e4 d5 e5 f5 Ke2",              0x652a607ca3f242c1ULL },
+        { "e4 d5 e5 f5 Ke2 Kf7",          0x00fdd303c946bdd9ULL },
+        { "a4 b5 h4 b4 c4",               0x3c8123ea7b067637ULL },
+        { "a4 b5 h4 b4 c4 bxc3 Ra3",      0x5c3f9b829b279560ULL },
+    };
+    int nbr_tests = sizeof(book_key_tests)/sizeof(book_key_tests[0]);
+    for( int i=0; i<nbr_tests; i++ )
+    {
+        BOOK_KEY_TEST *pt = &book_key_tests[i];
+        thc::ChessRules cr;
+        std::vector<std::string> moves;
+        util::split( std::string(pt->moves), moves );
+        bool pass = true;
+        for( const std::string &s: moves )
+        {
+            thc::Move mv;
+            if( !mv.NaturalIn(&cr,s.c_str()) )
+            {
+                pass = false;
+                break;
+            }
+            cr.PlayMove(mv);
+        }
+        if( !quiet )
+            printf( "%s\n", cr.ToDebugStr().c_str() );
+        uint64_t key = sargon_book_key(cr);
+        printf( "Test %d of %d: \"%s\":", i+1, nbr_tests, pt->moves );
+        if( !pass )
+            printf( " FAIL\n Fail reason: Bad move list\n" );
+        else if( key != pt->key )
+        {
+            pass = false;
+            printf( " FAIL\n Fail reason: Expected key=%016llx, Calculated=%016llx\n",
+                        static_cast<unsigned long long>(pt->key), static_cast<unsigned long long>(key) );
+        }
+        else
+            printf( " PASS\n" );
+        if( !pass )
+            ok = false;
+    }
+    return ok;
+}
+
 bool sargon_timing_tests( bool quiet, int comprehensive )
 {
     bool ok = true;
@@ -952,6 +1417,11 @@ Level 6: ..................................   34 tests
     return ok;
 }
 
+static void bench_print( const std::string &line )
+{
+    printf( "%s\n", line.c_str() );
+}
+
 static void show()
 {
     unsigned char nply = peekb(NPLY);
@@ -993,6 +1463,15 @@ static void show()
 
 void after_genmov()
 {
+    if( x86_trace )
+        x86_trace->push_back( sargon_z80_node_signature(peek(BOARDA),peekb(NPLY)) );
+    sargon_epd_callback_after_genmov();
     //printf( "\nafter genmov()\n" );
     //show();
 }
+
+void after_ldar( uint8_t a_reg )
+{
+    if( x86_ldar )
+        x86_ldar->push_back( a_reg );
+}
@@ -2772,6 +2772,205 @@ EX14:   POP     eax                             ; Restore registers
         RET                                     ; Return
 
 
+;
+; Code label addresses, for profiling (names in sargon-asm-interface.h)
+;
+PUBLIC   _sargon_label_addresses
+_sargon_label_addresses:
+        DD      INITBD
+        DD      back01
+        DD      IB2
+        DD      PATH
+        DD      PA1
+        DD      PA2
+        DD      MPIECE
+        DD      rel001
+        DD      MP5
+        DD      MP10
+        DD      MP15
+        DD      MP20
+        DD      MP25
+        DD      MP26
+        DD      MP30
+        DD      MP31
+        DD      MP35
+        DD      MP37
+        DD      MP36
+        DD      ENPSNT
+        DD      rel002
+        DD      rel003
+        DD      ADJPTR
+        DD      CASTLE
+        DD      CA5
+        DD      CA10
+        DD      CA15
+        DD      CA20
+        DD      ADMOVE
+        DD      rel004
+        DD      AM10
+        DD      GENMOV
+        DD      GM5
+        DD      GM10
+        DD      INCHK
+        DD      INCHK1
+        DD      rel005
+        DD      ATTACK
+        DD      AT5
+        DD      AT10
+        DD      AT12
+        DD      AT13
+        DD      AT14A
+        DD      AT14B
+        DD      AT14
+        DD      AT15
+        DD      AT16
+        DD      AT20
+        DD      AT21
+        DD      AT25
+        DD      AT30
+        DD      AT31
+        DD      AT32
+        DD      ATKSAV
+        DD      rel006
+        DD      rel007
+        DD      AS19
+        DD      AS20
+        DD      AS25
+        DD      PNCK
+        DD      PC1
+        DD      PC3
+        DD      PC5
+        DD      PINFND
+        DD      PF1
+        DD      PF2
+        DD      PF5
+        DD      PF10
+        DD      PF15
+        DD      PF19
+        DD      back02
+        DD      rel008
+        DD      PF20
+        DD      PF25
+        DD      PF26
+        DD      PF27
+        DD      XCHNG
+        DD      rel009
+        DD      XC10
+        DD      XC15
+        DD      XC18
+        DD      XC19
+        DD      rel010
+        DD      NEXTAD
+        DD      back03
+        DD      NX6
+        DD      POINTS
+        DD      PT5
+        DD      PT6AA
+        DD      PT6A
+        DD      PT6B
+        DD      PT6C
+        DD      PT6D
+        DD      PT6X
+        DD      back04
+        DD      PT20
+        DD      rel011
+        DD      PT23
+        DD      rel012
+        DD      PT25
+        DD      PT25A
+        DD      rel013
+        DD      rel014
+        DD      rel015
+        DD      rel026
+        DD      rel016
+        DD      LIMIT
+        DD      LIM10
+        DD      MOVE
+        DD      MV1
+        DD      MV5
+        DD      MV10
+        DD      MV15
+        DD      MV20
+        DD      MV21
+        DD      MV22
+        DD      MV30
+        DD      MV40
+        DD      UNMOVE
+        DD      UM1
+        DD      UM5
+        DD      UM6
+        DD      UM10
+        DD      UM15
+        DD      UM16
+        DD      UM20
+        DD      UM21
+        DD      UM22
+        DD      UM30
+        DD      UM40
+        DD      SORTM
+        DD      SR5
+        DD      SR10
+        DD      SR15
+        DD      SR25
+        DD      SR30
+        DD      EVAL
+        DD      EV5
+        DD      EV10
+        DD      FNDMOV
+        DD      back05
+        DD      FM5
+        DD      FM15
+        DD      rel017
+        DD      FM18
+        DD      FM19
+        DD      rel018
+        DD      FM25
+        DD      FM30
+        DD      FM35
+        DD      FM36
+        DD      FM37
+        DD      FM40
+        DD      ASCEND
+        DD      rel019
+        DD      BOOK
+        DD      BM5
+        DD      BM9
+        DD      CPTRMV
+        DD      CP0C
+        DD      CP10
+        DD      rel020
+        DD      rel021
+        DD      CP1C
+        DD      CP24
+        DD      BITASN
+        DD      ASNTBI
+        DD      AT04
+        DD      VALMOV
+        DD      VA5
+        DD      VA6
+        DD      VA7
+        DD      VA8
+        DD      VA9
+        DD      VA10
+        DD      ROYALT
+        DD      back06
+        DD      RY04
+        DD      rel023
+        DD      RY08
+        DD      RY0C
+        DD      DIVIDE
+        DD      DD04
+        DD      rel027
+        DD      rel024
+        DD      MLTPLY
+        DD      ML04
+        DD      rel025
+        DD      EXECMV
+        DD      EX04
+        DD      EX08
+        DD      EX0C
+        DD      EX10
+        DD      EX14
 _sargon ENDP
 _TEXT   ENDS
 END
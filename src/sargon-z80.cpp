@@ -0,0 +1,1322 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-z80.cpp
+ *       Run the original Z80 Sargon on a cycle counting Z80 interpreter
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+/*
+
+  The x86 Sargon is a translation of the Z80 program. To measure it
+  against the original, and to check that translating and optimising
+  haven't changed what it does, this module runs the original too; the
+  Z80 code of stages/sargon-z80.asm, assembled by zmac into an Intel HEX
+  file, on a straightforward Z80 interpreter that counts T-states (clock
+  cycles). T-states divided by the clock rate is exactly the time the
+  original hardware would take, no stopwatch needed.
+
+  The two programs have different memory layouts (the x86 port moved the
+  variables up and enlarged the tables), so data is copied across by name,
+  looking up Z80 addresses in the symbol table at the end of the zmac
+  listing. Pointers into the tables and the move list are translated on
+  the way. The x86 program calls back into C at points marked CALLBACK in
+  sargon-x86.asm, the interpreter calls back when it reaches the
+  equivalent Z80 instructions, so the same monitoring (node counting,
+  tracing) works on both.
+
+  The only other system dependence in the Z80 program is output to the
+  Jove monitor with RST 38h followed by inline parameters (see the macros
+  in sargon-z80.asm), which is skipped. Time spent there on the original
+  hardware isn't counted, but the code that draws the board (which
+  includes deliberate delays to blink moved pieces) is, which is why
+  the search (FNDMOV) is counted separately.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "util.h"
+#include "thc.h"
+#include "sargon-asm-interface.h"
+#include "sargon-interface.h"
+#include "sargon-z80.h"
+
+// Z80 registers, flags and memory
+struct Z80_CPU
+{
+    uint8_t  a, f, b, c, d, e, h, l;
+    uint8_t  a2, f2, b2, c2, d2, e2, h2, l2;    // alternate set, EX AF,AF' and EXX
+    uint16_t ix, iy, sp, pc;
+    uint8_t  i, r;
+};
+static Z80_CPU  cpu;
+static uint8_t  mem[65536];
+static unsigned long long tstates;
+static unsigned long long search_tstates;
+static unsigned long long search_start;
+#define FLAG_S  0x80
+#define FLAG_Z  0x40
+#define FLAG_H  0x10
+#define FLAG_PV 0x04
+#define FLAG_N  0x02
+#define FLAG_C  0x01
+static uint8_t szp[256];    // S, Z and parity flags of each result
+
+// Run state
+static bool loaded;
+static bool running;
+static std::string error_message;
+static void (*user_callback)( const char *msg, z80_registers &registers );
+static std::vector<uint32_t> *node_trace;
+#define RETURN_SENTINEL 0xffff          // return address that ends a sargon_z80() call
+#define MONITOR_ADDRESS 0x0038          // RST 38h, Jove monitor call
+#define TSTATES_RUNAWAY 1000000000000ULL
+
+// Symbols (upper case) and addresses needed from the listing
+static std::map<std::string,int> symbols;
+static int z80_entry[7];                // indexed by api_INITBD (1) to api_EXECMV (6)
+static int z80_fndmov, z80_after_fndmov, z80_after_genmov;
+static int z80_boarda, z80_score, z80_plyix, z80_m1, z80_bmoves, z80_mlist, z80_mlend, z80_stack;
+static int z80_plymax_limit;
+
+// Callback sites, the Z80 instruction the x86 CALLBACK precedes, as an offset
+//  from a nearby label
+struct CALLBACK_SITE
+{
+    const char *msg;
+    const char *label;
+    int         offset;
+    int         address;
+};
+static CALLBACK_SITE callback_sites[] =
+{
+    { "Suppress King moves", "MP10",    3, 0 },     // after CALL PATH
+    { "end of POINTS()",     "REL016",  2, 0 },     // after ADD A,80H
+    { "after GENMOV()",      "FM5",    11, 0 },     // after CALL GENMOV
+    { "Alpha beta cutoff?",  "FM37",    0, 0 },
+    { "No. Best move?",      "FM37",    9, 0 },     // after CP (HL), compare to score 1 ply above
+    { "Yes! Best move",      "FM37",   16, 0 },     // after LD (HL),A, save as new score
+    { "LDAR",                "BOOK",   23, 0 },     // after LD A,R
+    { "After FNDMOV()",      "CPTRMV",  3, 0 }      // after CALL FNDMOV
+};
+#define NBR_CALLBACK_SITES (sizeof(callback_sites)/sizeof(callback_sites[0]))
+static uint8_t is_callback_site[65536/8];
+
+static bool load_hex( const std::string &hex_file, std::string &error );
+static bool load_symbols( const std::string &lst_file, std::string &error );
+static int  symbol( const char *name );
+static int  translate_pointer( int x86_ptr );
+static void run();
+static void step();
+static void callback_site( uint16_t addr );
+static bool monitor_call();
+
+bool sargon_z80_load( const std::string &hex_file, std::string &error )
+{
+    loaded = false;
+    for( int i=0; i<256; i++ )
+    {
+        int parity = 0;
+        for( int bit=0; bit<8; bit++ )
+            parity ^= (i>>bit) & 1;
+        szp[i] = (i&0x80) | (i==0?FLAG_Z:0) | (parity?0:FLAG_PV);
+    }
+    memset( mem, 0, sizeof(mem) );
+    if( !load_hex(hex_file,error) )
+        return false;
+    std::string lst_file = hex_file;
+    size_t dot = lst_file.find_last_of( '.' );
+    if( dot != std::string::npos )
+        lst_file = lst_file.substr( 0, dot );
+    lst_file += ".lst";
+    if( !load_symbols(lst_file,error) )
+        return false;
+    static const char *entries[7] = { NULL, "INITBD", "ROYALT", "CPTRMV", "VALMOV", "ASNTBI", "EXECMV" };
+    for( int i=1; i<7; i++ )
+        z80_entry[i] = symbol( entries[i] );
+    z80_fndmov = symbol( "FNDMOV" );
+    z80_boarda = symbol( "BOARDA" );
+    z80_score  = symbol( "SCORE" );
+    z80_plyix  = symbol( "PLYIX" );
+    z80_m1     = symbol( "M1" );
+    z80_bmoves = symbol( "BMOVES" );
+    z80_mlist  = symbol( "MLIST" );
+    z80_mlend  = symbol( "MLEND" );
+    z80_stack  = symbol( "STACK" );
+    memset( is_callback_site, 0, sizeof(is_callback_site) );
+    for( unsigned int i=0; i<NBR_CALLBACK_SITES; i++ )
+    {
+        CALLBACK_SITE &site = callback_sites[i];
+        int label = symbol( site.label );
+        site.address = label<0 ? -1 : label+site.offset;
+        if( site.address >= 0 )
+            is_callback_site[site.address>>3] |= (1<<(site.address&7));
+        if( 0 == strcmp(site.msg,"After FNDMOV()") )
+            z80_after_fndmov = site.address;
+        else if( 0 == strcmp(site.msg,"after GENMOV()") )
+            z80_after_genmov = site.address;
+    }
+    error = "";
+    static const char *required[] = { "INITBD", "ROYALT", "CPTRMV", "VALMOV", "ASNTBI", "EXECMV",
+                                      "FNDMOV", "BOARDA", "ATKLST", "PLISTA", "POSK", "POSQ", "SCORE",
+                                      "PLYIX", "M1", "BMOVES", "MLIST", "MLEND", "STACK", "MP10",
+                                      "REL016", "FM5", "FM37", "BOOK", "MVEMSG" };
+    for( const char *name: required )
+    {
+        if( symbol(name) < 0 )
+            error += util::sprintf( "%s%s", error==""?"":" ", name );
+    }
+    if( error != "" )
+    {
+        error = "Error; symbols missing from " + lst_file + ": " + error;
+        return false;
+    }
+
+    // The original tables are only big enough for modest depths; SCORE has a
+    //  byte per ply plus two, PLYIX two words per ply, and one extra ply is
+    //  searched if in check at PLYMAX
+    int score_limit = (z80_plyix - z80_score) - 3;
+    int plyix_limit = (z80_stack - z80_plyix) / 4 - 1;
+    z80_plymax_limit = score_limit<plyix_limit ? score_limit : plyix_limit;
+    memset( &cpu, 0, sizeof(cpu) );
+    loaded = true;
+    return true;
+}
+
+// Intel HEX, records of ":LLAAAATT" + data + checksum
+static bool load_hex( const std::string &hex_file, std::string &error )
+{
+    FILE *f;
+    errno_t err = fopen_s( &f, hex_file.c_str(), "rt" );
+    if( err )
+    {
+        error = "Error; cannot open " + hex_file;
+        return false;
+    }
+    bool ok = false;
+    int line_nbr = 0;
+    char buf[600];
+    while( fgets(buf,sizeof(buf),f) )
+    {
+        line_nbr++;
+        std::string line(buf);
+        util::rtrim(line);
+        if( line == "" )
+            continue;
+        unsigned int bytes[300];
+        unsigned int nbr_bytes = 0;
+        bool good = (line[0]==':' && line.length()>=11 && line.length()%2==1);
+        for( size_t i=1; good && i+1<line.length() && nbr_bytes<300; i+=2 )
+        {
+            if( 1 != sscanf_s(line.substr(i,2).c_str(),"%2x",&bytes[nbr_bytes++]) )
+                good = false;
+        }
+        unsigned int sum = 0;
+        for( unsigned int i=0; good && i<nbr_bytes; i++ )
+            sum += bytes[i];
+        if( !good || (sum&0xff)!=0 || nbr_bytes!=bytes[0]+5 )
+        {
+            error = util::sprintf( "Error; bad record in %s line %d", hex_file.c_str(), line_nbr );
+            fclose(f);
+            return false;
+        }
+        unsigned int addr = (bytes[1]<<8) | bytes[2];
+        unsigned int type = bytes[3];
+        if( type == 1 )
+        {
+            ok = true;
+            break;
+        }
+        else if( type == 0 )
+        {
+            for( unsigned int i=0; i<bytes[0]; i++ )
+                mem[(addr+i)&0xffff] = static_cast<uint8_t>(bytes[4+i]);
+        }
+    }
+    fclose(f);
+    if( !ok )
+        error = "Error; no end of file record in " + hex_file;
+    return ok;
+}
+
+// zmac lists symbols at the end of the listing, one per line, name then
+//  hex value ('=' precedes the value of EQUates)
+static bool load_symbols( const std::string &lst_file, std::string &error )
+{
+    symbols.clear();
+    FILE *f;
+    errno_t err = fopen_s( &f, lst_file.c_str(), "rb" );
+    if( err )
+    {
+        error = "Error; cannot open " + lst_file;
+        return false;
+    }
+    char buf[600];
+    while( fgets(buf,sizeof(buf),f) )
+    {
+        char name[100], value[100];
+        if( !isalpha(buf[0]) || strlen(buf)>sizeof(name) ||
+            2!=sscanf_s(buf,"%s %s",name,static_cast<unsigned>(sizeof(name)),value,static_cast<unsigned>(sizeof(value))) )
+            continue;
+        const char *v = value;
+        if( value[0] == '=' )
+        {
+            v = value+1;
+            if( *v == '\0' )
+            {
+                if( 1 != sscanf_s(buf,"%*s = %s",value,static_cast<unsigned>(sizeof(value))) )
+                    continue;
+                v = value;
+            }
+        }
+        char *end;
+        unsigned long n = strtoul( v, &end, 16 );
+        if( *end != '\0' )
+            continue;
+        std::string s(name);
+        for( char &c: s )
+            c = static_cast<char>(toupper(c));
+        symbols[s] = static_cast<int>(n & 0xffff);
+    }
+    fclose(f);
+    return true;
+}
+
+static int symbol( const char *name )
+{
+    auto it = symbols.find(name);
+    return it==symbols.end() ? -1 : it->second;
+}
+
+// A pointer into the x86 tables or move list, to the Z80 equivalent
+static int translate_pointer( int x86_ptr )
+{
+    if( SCORE<=x86_ptr && x86_ptr<PLYIX )
+        return z80_score + (x86_ptr-SCORE);
+    if( PLYIX-2<=x86_ptr && x86_ptr<M1 )
+        return z80_plyix + (x86_ptr-PLYIX);
+    if( BMOVES-2<=x86_ptr && x86_ptr<LINECT )
+        return z80_bmoves + (x86_ptr-BMOVES);
+    if( MLIST<=x86_ptr && x86_ptr<=MLEND )
+        return z80_mlist + (x86_ptr-MLIST);
+    return x86_ptr;
+}
+
+void sargon_z80_import()
+{
+    if( !loaded )
+        return;
+    memcpy( mem+z80_boarda, peek(BOARDA), 120 );
+    memcpy( mem+symbol("ATKLST"), peek(ATKLST), 14 );
+    memcpy( mem+symbol("PLISTA"), peek(PLISTA), 20 );
+    memcpy( mem+symbol("POSK"), peek(POSK), 2 );
+    memcpy( mem+symbol("POSQ"), peek(POSQ), 2 );
+    memcpy( mem+symbol("MVEMSG"), peek(MVEMSG), 5 );  // move for VALMOV
+
+    // The variables are in the same order in both, pointers need translating
+    memcpy( mem+z80_m1, peek(M1), BMOVES-M1 );
+    static const int pointers[] = { MLPTRI, MLPTRJ, SCRIX, BESTM, MLLST, MLNXT };
+    for( int ptr: pointers )
+    {
+        int z80_ptr = translate_pointer( peekw(ptr) );
+
+        // sargon_import_position() sets MLPTRJ to 0, harmless in the x86
+        //  image where the root score is then stored in unused memory at
+        //  address 5, but in the Z80 image that's the high byte of M3. Use
+        //  the spare bytes at the end of the Z80 move list instead
+        if( ptr==MLPTRJ && z80_ptr==0 )
+        {
+            z80_ptr = z80_mlend;
+            memset( mem+z80_mlend, 0, 6 );
+        }
+        mem[z80_m1+(ptr-M1)]   = static_cast<uint8_t>(z80_ptr&0xff);
+        mem[z80_m1+(ptr-M1)+1] = static_cast<uint8_t>(z80_ptr>>8);
+    }
+}
+
+bool sargon_z80( int api_command_code, z80_registers *registers )
+{
+    error_message = "";
+    if( !loaded )
+    {
+        error_message = "Error; Z80 image not loaded";
+        return false;
+    }
+    if( api_command_code<api_INITBD || api_command_code>api_EXECMV )
+    {
+        error_message = util::sprintf( "Error; unknown api command %d", api_command_code );
+        return false;
+    }
+    if( api_command_code==api_CPTRMV && mem[z80_m1+(PLYMAX-M1)]>z80_plymax_limit )
+    {
+        error_message = util::sprintf( "Error; the original Sargon's tables only allow PLYMAX up to %d", z80_plymax_limit );
+        return false;
+    }
+    if( registers )
+    {
+        cpu.a = registers->af & 0xff;     // see z80_registers, x86 convention
+        cpu.f = registers->af >> 8;
+        cpu.h = registers->hl >> 8;    cpu.l = registers->hl & 0xff;
+        cpu.b = registers->bc >> 8;    cpu.c = registers->bc & 0xff;
+        cpu.d = registers->de >> 8;    cpu.e = registers->de & 0xff;
+        cpu.ix = registers->ix;
+        cpu.iy = registers->iy;
+    }
+    cpu.sp = static_cast<uint16_t>(z80_stack+1);
+    cpu.sp -= 2;
+    mem[cpu.sp]   = RETURN_SENTINEL & 0xff;
+    mem[cpu.sp+1] = RETURN_SENTINEL >> 8;
+    cpu.pc = static_cast<uint16_t>(z80_entry[api_command_code]);
+    running = true;
+    run();
+    if( registers )
+    {
+        registers->af = static_cast<uint16_t>((cpu.f<<8) | cpu.a);
+        registers->hl = static_cast<uint16_t>((cpu.h<<8) | cpu.l);
+        registers->bc = static_cast<uint16_t>((cpu.b<<8) | cpu.c);
+        registers->de = static_cast<uint16_t>((cpu.d<<8) | cpu.e);
+        registers->ix = cpu.ix;
+        registers->iy = cpu.iy;
+    }
+    return error_message == "";
+}
+
+std::string sargon_z80_error()
+{
+    return error_message;
+}
+
+std::string sargon_z80_export_move()
+{
+    std::string s;
+    if( !loaded )
+        return s;
+    int bestm = z80_m1 + (BESTM-M1);
+    unsigned int p = mem[bestm] | (mem[bestm+1]<<8);
+    thc::Square f, t;
+    if( sargon_export_square(mem[(p+2)&0xffff],f) && sargon_export_square(mem[(p+3)&0xffff],t) )
+    {
+        s += thc::get_file(f);
+        s += thc::get_rank(f);
+        s += thc::get_file(t);
+        s += thc::get_rank(t);
+    }
+    return s;
+}
+
+void sargon_z80_clear()
+{
+    tstates = 0;
+    search_tstates = 0;
+}
+
+unsigned long long sargon_z80_tstates()
+{
+    return tstates;
+}
+
+unsigned long long sargon_z80_search_tstates()
+{
+    return search_tstates;
+}
+
+void sargon_z80_callback( void (*func)( const char *msg, z80_registers &registers ) )
+{
+    user_callback = func;
+}
+
+void sargon_z80_trace( std::vector<uint32_t> *trace )
+{
+    node_trace = trace;
+}
+
+// FNV-1a hash of the board and ply number
+uint32_t sargon_z80_node_signature( const unsigned char *boarda, unsigned char nply )
+{
+    uint32_t hash = 2166136261u;
+    for( int i=0; i<120; i++ )
+        hash = (hash ^ boarda[i]) * 16777619u;
+    hash = (hash ^ nply) * 16777619u;
+    return hash;
+}
+
+static void run()
+{
+    unsigned long long runaway = tstates + TSTATES_RUNAWAY;
+    while( running )
+    {
+        uint16_t pc = cpu.pc;
+        if( pc == RETURN_SENTINEL )
+            break;
+        if( pc == MONITOR_ADDRESS )
+        {
+            if( !monitor_call() )
+                break;
+            continue;
+        }
+        if( is_callback_site[pc>>3] & (1<<(pc&7)) )
+        {
+            callback_site( pc );
+            if( !running )
+                break;
+        }
+        if( pc == z80_fndmov )
+            search_start = tstates;
+        step();
+        if( tstates > runaway )
+        {
+            error_message = util::sprintf( "Error; runaway Z80 program, PC=%04x", cpu.pc );
+            break;
+        }
+    }
+    running = false;
+}
+
+static void callback_site( uint16_t addr )
+{
+    const char *msg = "";
+    for( unsigned int i=0; i<NBR_CALLBACK_SITES; i++ )
+    {
+        if( callback_sites[i].address == addr )
+            msg = callback_sites[i].msg;
+    }
+    if( addr == z80_after_fndmov )
+        search_tstates += tstates - search_start;
+    else if( addr == z80_after_genmov )
+    {
+        int mlnxt = mem[z80_m1+(MLNXT-M1)] | (mem[z80_m1+(MLNXT-M1)+1]<<8);
+        if( mlnxt > z80_mlend )
+        {
+            error_message = util::sprintf( "Error; the original Sargon's move list overflows (MLNXT=%04x)", mlnxt );
+            running = false;
+            return;
+        }
+        if( node_trace )
+            node_trace->push_back( sargon_z80_node_signature(mem+z80_boarda,mem[z80_m1+(NPLY-M1)]) );
+    }
+    if( user_callback )
+    {
+        z80_registers regs;
+        regs.af = static_cast<uint16_t>((cpu.f<<8) | cpu.a);
+        regs.hl = static_cast<uint16_t>((cpu.h<<8) | cpu.l);
+        regs.bc = static_cast<uint16_t>((cpu.b<<8) | cpu.c);
+        regs.de = static_cast<uint16_t>((cpu.d<<8) | cpu.e);
+        regs.ix = cpu.ix;
+        regs.iy = cpu.iy;
+        user_callback( msg, regs );
+        cpu.a = regs.af & 0xff;     cpu.f = regs.af >> 8;
+        cpu.h = regs.hl >> 8;       cpu.l = regs.hl & 0xff;
+        cpu.b = regs.bc >> 8;       cpu.c = regs.bc & 0xff;
+        cpu.d = regs.de >> 8;       cpu.e = regs.de & 0xff;
+        cpu.ix = regs.ix;
+        cpu.iy = regs.iy;
+    }
+}
+
+// RST 38h then inline parameters, a function code and (apart from EXIT) a
+//  second byte, then for the output functions one or two words. Skip them
+//  and return as the monitor would (character input returns <CR>)
+static bool monitor_call()
+{
+    uint16_t ret = static_cast<uint16_t>(mem[cpu.sp] | (mem[(cpu.sp+1)&0xffff]<<8));
+    cpu.sp += 2;
+    uint8_t function = mem[ret];
+    int len = 0;
+    switch( function )
+    {
+        case 0x1f:  error_message = "Error; Z80 program exited to the monitor";
+                    return false;
+        case 0x81:  len = 2;    cpu.a = 0x0d;   break;  // character in (0) or echo (1AH)
+        case 0x92:  len = 4;    break;                  // CARRET
+        case 0xb2:
+        case 0xb3:  len = 6;    break;                  // PRTLIN, CLRSCR, PRTBLK
+        default:    error_message = util::sprintf( "Error; unknown monitor call %02x from %04x", function, ret-1 );
+                    return false;
+    }
+    cpu.pc = static_cast<uint16_t>(ret+len);
+    tstates += 10;  // the RET
+    return true;
+}
+
+/*
+    The interpreter. Instructions are decoded by fields of the opcode
+    byte, x = bits 7-6, y = bits 5-3, z = bits 2-0, p = bits 5-4 and
+    q = bit 3, the usual way of making sense of the Z80 instruction set.
+    DD and FD prefixes substitute IX or IY for HL (and IX+d or IY+d for
+    (HL)). T-states are as documented by Zilog. Undocumented flag bits 3
+    and 5 aren't modelled, Sargon never looks at them.
+*/
+
+static inline uint16_t rd16( uint16_t addr )
+{
+    return static_cast<uint16_t>(mem[addr] | (mem[static_cast<uint16_t>(addr+1)]<<8));
+}
+
+static inline void wr16( uint16_t addr, uint16_t val )
+{
+    mem[addr] = static_cast<uint8_t>(val&0xff);
+    mem[static_cast<uint16_t>(addr+1)] = static_cast<uint8_t>(val>>8);
+}
+
+static inline uint8_t fetch8()
+{
+    return mem[cpu.pc++];
+}
+
+static inline uint16_t fetch16()
+{
+    uint16_t val = rd16(cpu.pc);
+    cpu.pc += 2;
+    return val;
+}
+
+static inline void push16( uint16_t val )
+{
+    cpu.sp -= 2;
+    wr16( cpu.sp, val );
+}
+
+static inline uint16_t pop16()
+{
+    uint16_t val = rd16(cpu.sp);
+    cpu.sp += 2;
+    return val;
+}
+
+static inline void bump_r()
+{
+    cpu.r = static_cast<uint8_t>((cpu.r&0x80) | ((cpu.r+1)&0x7f));
+}
+
+static inline uint16_t get_bc() { return static_cast<uint16_t>((cpu.b<<8)|cpu.c); }
+static inline uint16_t get_de() { return static_cast<uint16_t>((cpu.d<<8)|cpu.e); }
+static inline uint16_t get_hl() { return static_cast<uint16_t>((cpu.h<<8)|cpu.l); }
+static inline void set_bc( uint16_t v ) { cpu.b = static_cast<uint8_t>(v>>8); cpu.c = static_cast<uint8_t>(v); }
+static inline void set_de( uint16_t v ) { cpu.d = static_cast<uint8_t>(v>>8); cpu.e = static_cast<uint8_t>(v); }
+static inline void set_hl( uint16_t v ) { cpu.h = static_cast<uint8_t>(v>>8); cpu.l = static_cast<uint8_t>(v); }
+
+// HL, IX or IY according to prefix (0, 1 or 2)
+static inline uint16_t get_xy( int prefix )
+{
+    return prefix==0 ? get_hl() : (prefix==1 ? cpu.ix : cpu.iy);
+}
+
+static inline void set_xy( int prefix, uint16_t v )
+{
+    if( prefix == 0 )
+        set_hl(v);
+    else if( prefix == 1 )
+        cpu.ix = v;
+    else
+        cpu.iy = v;
+}
+
+// rp[p] = BC, DE, HL, SP and rp2[p] = BC, DE, HL, AF
+static uint16_t get_rp( int p, int prefix )
+{
+    switch( p )
+    {
+        case 0:  return get_bc();
+        case 1:  return get_de();
+        case 2:  return get_xy(prefix);
+        default: return cpu.sp;
+    }
+}
+
+static void set_rp( int p, int prefix, uint16_t v )
+{
+    switch( p )
+    {
+        case 0:  set_bc(v);         break;
+        case 1:  set_de(v);         break;
+        case 2:  set_xy(prefix,v);  break;
+        default: cpu.sp = v;        break;
+    }
+}
+
+// r[i] = B, C, D, E, H, L, (HL), A; with a prefix H and L are the halves of
+//  IX or IY, (HL) is handled by the caller
+static uint8_t get_r( int i, int prefix )
+{
+    switch( i )
+    {
+        case 0:  return cpu.b;
+        case 1:  return cpu.c;
+        case 2:  return cpu.d;
+        case 3:  return cpu.e;
+        case 4:  return prefix==0 ? cpu.h : static_cast<uint8_t>(get_xy(prefix)>>8);
+        case 5:  return prefix==0 ? cpu.l : static_cast<uint8_t>(get_xy(prefix)&0xff);
+        default: return cpu.a;
+    }
+}
+
+static void set_r( int i, int prefix, uint8_t v )
+{
+    switch( i )
+    {
+        case 0:  cpu.b = v; break;
+        case 1:  cpu.c = v; break;
+        case 2:  cpu.d = v; break;
+        case 3:  cpu.e = v; break;
+        case 4:  if( prefix == 0 )
+                     cpu.h = v;
+                 else
+                     set_xy( prefix, static_cast<uint16_t>((v<<8) | (get_xy(prefix)&0xff)) );
+                 break;
+        case 5:  if( prefix == 0 )
+                     cpu.l = v;
+                 else
+                     set_xy( prefix, static_cast<uint16_t>((get_xy(prefix)&0xff00) | v) );
+                 break;
+        default: cpu.a = v; break;
+    }
+}
+
+static bool condition( int cc )
+{
+    switch( cc )
+    {
+        case 0:  return (cpu.f&FLAG_Z)  == 0;   // NZ
+        case 1:  return (cpu.f&FLAG_Z)  != 0;   // Z
+        case 2:  return (cpu.f&FLAG_C)  == 0;   // NC
+        case 3:  return (cpu.f&FLAG_C)  != 0;   // C
+        case 4:  return (cpu.f&FLAG_PV) == 0;   // PO
+        case 5:  return (cpu.f&FLAG_PV) != 0;   // PE
+        case 6:  return (cpu.f&FLAG_S)  == 0;   // P
+        default: return (cpu.f&FLAG_S)  != 0;   // M
+    }
+}
+
+// 8 bit arithmetic and logic, alu[y] = ADD, ADC, SUB, SBC, AND, XOR, OR, CP
+static void alu( int op, uint8_t v )
+{
+    int a = cpu.a;
+    int carry = (op==1 || op==3) ? (cpu.f&FLAG_C) : 0;
+    int result;
+    switch( op )
+    {
+        case 0:
+        case 1:
+            result = a + v + carry;
+            cpu.f = static_cast<uint8_t>( (szp[result&0xff] & (FLAG_S|FLAG_Z))
+                                        | ((a^v^result) & FLAG_H)
+                                        | ((((a^~v)&(a^result))&0x80) ? FLAG_PV : 0)
+                                        | (result>0xff ? FLAG_C : 0) );
+            cpu.a = static_cast<uint8_t>(result);
+            break;
+        case 2:
+        case 3:
+        case 7:
+            result = a - v - carry;
+            cpu.f = static_cast<uint8_t>( (szp[result&0xff] & (FLAG_S|FLAG_Z))
+                                        | ((a^v^result) & FLAG_H)
+                                        | ((((a^v)&(a^result))&0x80) ? FLAG_PV : 0)
+                                        | FLAG_N
+                                        | ((result&0x100) ? FLAG_C : 0) );
+            if( op != 7 )
+                cpu.a = static_cast<uint8_t>(result);
+            break;
+        case 4:
+            cpu.a = static_cast<uint8_t>(a & v);
+            cpu.f = szp[cpu.a] | FLAG_H;
+            break;
+        case 5:
+            cpu.a = static_cast<uint8_t>(a ^ v);
+            cpu.f = szp[cpu.a];
+            break;
+        default:
+            cpu.a = static_cast<uint8_t>(a | v);
+            cpu.f = szp[cpu.a];
+            break;
+    }
+}
+
+static uint8_t inc8( uint8_t v )
+{
+    uint8_t result = static_cast<uint8_t>(v+1);
+    cpu.f = static_cast<uint8_t>( (cpu.f&FLAG_C) | (szp[result]&(FLAG_S|FLAG_Z))
+                                | ((result&0x0f)==0 ? FLAG_H : 0) | (result==0x80 ? FLAG_PV : 0) );
+    return result;
+}
+
+static uint8_t dec8( uint8_t v )
+{
+    uint8_t result = static_cast<uint8_t>(v-1);
+    cpu.f = static_cast<uint8_t>( (cpu.f&FLAG_C) | FLAG_N | (szp[result]&(FLAG_S|FLAG_Z))
+                                | ((v&0x0f)==0 ? FLAG_H : 0) | (v==0x80 ? FLAG_PV : 0) );
+    return result;
+}
+
+static uint16_t add16( uint16_t a, uint16_t b )
+{
+    unsigned int result = a + b;
+    cpu.f = static_cast<uint8_t>( (cpu.f&(FLAG_S|FLAG_Z|FLAG_PV))
+                                | (((a^b^result)>>8) & FLAG_H) | (result>0xffff ? FLAG_C : 0) );
+    return static_cast<uint16_t>(result);
+}
+
+static uint16_t adc_sbc16( uint16_t a, uint16_t b, bool subtract )
+{
+    int carry = cpu.f & FLAG_C;
+    int result = subtract ? a-b-carry : a+b+carry;
+    bool overflow = subtract ? (((a^b)&(a^result)&0x8000) != 0) : (((a^~b)&(a^result)&0x8000) != 0);
+    cpu.f = static_cast<uint8_t>( ((result&0x8000) ? FLAG_S : 0) | ((result&0xffff)==0 ? FLAG_Z : 0)
+                                | (((a^b^result)>>8) & FLAG_H) | (overflow ? FLAG_PV : 0)
+                                | (subtract ? FLAG_N : 0) | ((result&0x10000) ? FLAG_C : 0) );
+    return static_cast<uint16_t>(result);
+}
+
+// CB prefix rotates and shifts, rot[y] = RLC, RRC, RL, RR, SLA, SRA, SLL, SRL
+static uint8_t rotate_shift( int op, uint8_t v )
+{
+    int carry = cpu.f & FLAG_C;
+    int out;
+    uint8_t result;
+    switch( op )
+    {
+        case 0:  out = v>>7;  result = static_cast<uint8_t>((v<<1) | out);        break;
+        case 1:  out = v&1;   result = static_cast<uint8_t>((v>>1) | (out<<7));   break;
+        case 2:  out = v>>7;  result = static_cast<uint8_t>((v<<1) | carry);      break;
+        case 3:  out = v&1;   result = static_cast<uint8_t>((v>>1) | (carry<<7)); break;
+        case 4:  out = v>>7;  result = static_cast<uint8_t>(v<<1);                break;
+        case 5:  out = v&1;   result = static_cast<uint8_t>((v>>1) | (v&0x80));   break;
+        case 6:  out = v>>7;  result = static_cast<uint8_t>((v<<1) | 1);          break;
+        default: out = v&1;   result = static_cast<uint8_t>(v>>1);                break;
+    }
+    cpu.f = static_cast<uint8_t>(szp[result] | (out ? FLAG_C : 0));
+    return result;
+}
+
+static void daa()
+{
+    int a = cpu.a;
+    int correction = 0;
+    int carry = cpu.f & FLAG_C;
+    if( (cpu.f&FLAG_H) || (a&0x0f)>9 )
+        correction |= 0x06;
+    if( carry || a>0x99 )
+    {
+        correction |= 0x60;
+        carry = FLAG_C;
+    }
+    int result = (cpu.f&FLAG_N) ? a-correction : a+correction;
+    cpu.f = static_cast<uint8_t>( szp[result&0xff] | (cpu.f&FLAG_N) | carry | ((a^result)&FLAG_H) );
+    cpu.a = static_cast<uint8_t>(result);
+}
+
+// CB prefix, on register or (given) memory operand
+static void cb_instruction( int op, bool indexed, uint16_t addr )
+{
+    int x = op>>6, y = (op>>3)&7, z = op&7;
+    bool memory = indexed || z==6;
+    uint8_t v = memory ? mem[addr] : get_r(z,0);
+    uint8_t result = v;
+    if( x == 0 )
+        result = rotate_shift( y, v );
+    else if( x == 1 )
+    {
+        cpu.f = static_cast<uint8_t>( (cpu.f&FLAG_C) | FLAG_H | ((v&(1<<y)) ? 0 : (FLAG_Z|FLAG_PV))
+                                    | ((y==7 && (v&0x80)) ? FLAG_S : 0) );
+        tstates += indexed ? 20 : (memory ? 12 : 8);
+        return;
+    }
+    else if( x == 2 )
+        result = static_cast<uint8_t>(v & ~(1<<y));
+    else
+        result = static_cast<uint8_t>(v | (1<<y));
+    if( memory )
+    {
+        mem[addr] = result;
+        if( indexed && z!=6 )
+            set_r( z, 0, result );  // undocumented, result also to register
+    }
+    else
+        set_r( z, 0, result );
+    tstates += indexed ? 23 : (memory ? 15 : 8);
+}
+
+// ED prefix
+static void ed_instruction()
+{
+    bump_r();
+    int op = fetch8();
+    int x = op>>6, y = (op>>3)&7, z = op&7, p = y>>1, q = y&1;
+    if( x == 1 )
+    {
+        switch( z )
+        {
+            case 0: // IN r,(C), no I/O so always 0FFH
+            {
+                uint8_t v = 0xff;
+                if( y != 6 )
+                    set_r( y, 0, v );
+                cpu.f = static_cast<uint8_t>((cpu.f&FLAG_C) | szp[v]);
+                tstates += 12;
+                return;
+            }
+            case 1: tstates += 12;  return;     // OUT (C),r
+            case 2:
+                set_hl( adc_sbc16(get_hl(),get_rp(p,0),q==0) );
+                tstates += 15;
+                return;
+            case 3:
+            {
+                uint16_t addr = fetch16();
+                if( q == 0 )
+                    wr16( addr, get_rp(p,0) );
+                else
+                    set_rp( p, 0, rd16(addr) );
+                tstates += 20;
+                return;
+            }
+            case 4: // NEG
+            {
+                uint8_t v = cpu.a;
+                cpu.a = 0;
+                alu( 2, v );
+                tstates += 8;
+                return;
+            }
+            case 5: // RETN, RETI
+                cpu.pc = pop16();
+                tstates += 14;
+                return;
+            case 6: tstates += 8;   return;     // IM
+            default:
+                switch( y )
+                {
+                    case 0: cpu.i = cpu.a;  tstates += 9;   return;
+                    case 1: cpu.r = cpu.a;  tstates += 9;   return;
+                    case 2:
+                    case 3:
+                        cpu.a = (y==2) ? cpu.i : cpu.r;
+                        cpu.f = static_cast<uint8_t>((cpu.f&FLAG_C) | (szp[cpu.a]&(FLAG_S|FLAG_Z)));   // IFF2 = 0
+                        tstates += 9;
+                        return;
+                    case 4: // RRD
+                    {
+                        uint8_t v = mem[get_hl()];
+                        mem[get_hl()] = static_cast<uint8_t>((cpu.a<<4) | (v>>4));
+                        cpu.a = static_cast<uint8_t>((cpu.a&0xf0) | (v&0x0f));
+                        cpu.f = static_cast<uint8_t>((cpu.f&FLAG_C) | szp[cpu.a]);
+                        tstates += 18;
+                        return;
+                    }
+                    case 5: // RLD
+                    {
+                        uint8_t v = mem[get_hl()];
+                        mem[get_hl()] = static_cast<uint8_t>((v<<4) | (cpu.a&0x0f));
+                        cpu.a = static_cast<uint8_t>((cpu.a&0xf0) | (v>>4));
+                        cpu.f = static_cast<uint8_t>((cpu.f&FLAG_C) | szp[cpu.a]);
+                        tstates += 18;
+                        return;
+                    }
+                    default:
+                        tstates += 8;
+                        return;
+                }
+        }
+    }
+    else if( x==2 && z<=1 && y>=4 )
+    {
+        // Block transfer (LDI, LDD, LDIR, LDDR) and search (CPI, CPD, CPIR, CPDR)
+        int step = (y&1) ? -1 : 1;
+        bool repeat = (y>=6);
+        uint16_t bc = static_cast<uint16_t>(get_bc()-1);
+        set_bc( bc );
+        if( z == 0 )
+        {
+            mem[get_de()] = mem[get_hl()];
+            set_de( static_cast<uint16_t>(get_de()+step) );
+            set_hl( static_cast<uint16_t>(get_hl()+step) );
+            cpu.f = static_cast<uint8_t>((cpu.f&(FLAG_S|FLAG_Z|FLAG_C)) | (bc ? FLAG_PV : 0));
+            repeat = repeat && bc!=0;
+        }
+        else
+        {
+            uint8_t v = mem[get_hl()];
+            int result = cpu.a - v;
+            set_hl( static_cast<uint16_t>(get_hl()+step) );
+            cpu.f = static_cast<uint8_t>( (cpu.f&FLAG_C) | FLAG_N | (szp[result&0xff]&(FLAG_S|FLAG_Z))
+                                        | ((cpu.a^v^result)&FLAG_H) | (bc ? FLAG_PV : 0) );
+            repeat = repeat && bc!=0 && result!=0;
+        }
+        if( repeat )
+        {
+            cpu.pc -= 2;
+            tstates += 21;
+        }
+        else
+            tstates += 16;
+    }
+    else if( x==2 && z<=3 && y>=4 )
+    {
+        // Block I/O, no I/O so just count B down
+        cpu.b--;
+        cpu.f = static_cast<uint8_t>(FLAG_N | (cpu.b==0 ? FLAG_Z : 0));
+        if( y>=6 && cpu.b!=0 )
+        {
+            cpu.pc -= 2;
+            tstates += 21;
+        }
+        else
+            tstates += 16;
+    }
+    else
+        tstates += 8;   // NOP
+}
+
+static void step()
+{
+    bump_r();
+    int op = fetch8();
+    int prefix = 0;
+    while( op==0xdd || op==0xfd )
+    {
+        prefix = (op==0xdd) ? 1 : 2;
+        tstates += 4;
+        bump_r();
+        op = fetch8();
+    }
+    if( op == 0xed )
+    {
+        ed_instruction();
+        return;
+    }
+    if( op == 0xcb )
+    {
+        if( prefix )
+        {
+            // DDCB d op, the displacement comes before the opcode
+            int8_t d = static_cast<int8_t>(fetch8());
+            int cb_op = fetch8();
+            cb_instruction( cb_op, true, static_cast<uint16_t>(get_xy(prefix)+d) );
+            tstates -= 4;   // prefix included in the 20/23 T-states
+        }
+        else
+        {
+            bump_r();
+            int cb_op = fetch8();
+            cb_instruction( cb_op, false, get_hl() );
+        }
+        return;
+    }
+    int x = op>>6, y = (op>>3)&7, z = op&7, p = y>>1, q = y&1;
+
+    // (HL) operand address, (IX+d) or (IY+d) with a prefix
+    auto operand_address = [prefix]() -> uint16_t
+    {
+        if( prefix == 0 )
+            return get_hl();
+        int8_t d = static_cast<int8_t>(fetch8());
+        return static_cast<uint16_t>(get_xy(prefix)+d);
+    };
+    switch( x )
+    {
+        case 0:
+        {
+            switch( z )
+            {
+                case 0:
+                    if( y == 0 )        // NOP
+                        tstates += 4;
+                    else if( y == 1 )   // EX AF,AF'
+                    {
+                        std::swap( cpu.a, cpu.a2 );
+                        std::swap( cpu.f, cpu.f2 );
+                        tstates += 4;
+                    }
+                    else if( y == 2 )   // DJNZ d
+                    {
+                        int8_t d = static_cast<int8_t>(fetch8());
+                        if( --cpu.b != 0 )
+                        {
+                            cpu.pc = static_cast<uint16_t>(cpu.pc+d);
+                            tstates += 13;
+                        }
+                        else
+                            tstates += 8;
+                    }
+                    else                // JR d, JR cc,d
+                    {
+                        int8_t d = static_cast<int8_t>(fetch8());
+                        if( y==3 || condition(y-4) )
+                        {
+                            cpu.pc = static_cast<uint16_t>(cpu.pc+d);
+                            tstates += 12;
+                        }
+                        else
+                            tstates += 7;
+                    }
+                    break;
+                case 1:
+                    if( q == 0 )        // LD rp,nn
+                    {
+                        set_rp( p, prefix, fetch16() );
+                        tstates += 10;
+                    }
+                    else                // ADD HL,rp
+                    {
+                        set_xy( prefix, add16(get_xy(prefix),get_rp(p,prefix)) );
+                        tstates += 11;
+                    }
+                    break;
+                case 2:
+                    switch( y )
+                    {
+                        case 0: mem[get_bc()] = cpu.a;              tstates += 7;   break;
+                        case 1: cpu.a = mem[get_bc()];              tstates += 7;   break;
+                        case 2: mem[get_de()] = cpu.a;              tstates += 7;   break;
+                        case 3: cpu.a = mem[get_de()];              tstates += 7;   break;
+                        case 4: wr16( fetch16(), get_xy(prefix) );  tstates += 16;  break;
+                        case 5: set_xy( prefix, rd16(fetch16()) );  tstates += 16;  break;
+                        case 6: mem[fetch16()] = cpu.a;             tstates += 13;  break;
+                        default: cpu.a = mem[fetch16()];            tstates += 13;  break;
+                    }
+                    break;
+                case 3:                 // INC rp, DEC rp
+                    set_rp( p, prefix, static_cast<uint16_t>(get_rp(p,prefix) + (q==0?1:-1)) );
+                    tstates += 6;
+                    break;
+                case 4:
+                case 5:                 // INC r, DEC r
+                    if( y == 6 )
+                    {
+                        uint16_t addr = operand_address();
+                        mem[addr] = (z==4) ? inc8(mem[addr]) : dec8(mem[addr]);
+                        tstates += prefix ? 19 : 11;
+                    }
+                    else
+                    {
+                        set_r( y, prefix, (z==4) ? inc8(get_r(y,prefix)) : dec8(get_r(y,prefix)) );
+                        tstates += 4;
+                    }
+                    break;
+                case 6:                 // LD r,n
+                    if( y == 6 )
+                    {
+                        uint16_t addr = operand_address();
+                        mem[addr] = fetch8();
+                        tstates += prefix ? 15 : 10;
+                    }
+                    else
+                    {
+                        set_r( y, prefix, fetch8() );
+                        tstates += 7;
+                    }
+                    break;
+                default:
+                {
+                    int carry;
+                    switch( y )
+                    {
+                        case 0: carry = cpu.a>>7;                                               // RLCA
+                                cpu.a = static_cast<uint8_t>((cpu.a<<1) | carry);
+                                cpu.f = static_cast<uint8_t>((cpu.f&(FLAG_S|FLAG_Z|FLAG_PV)) | carry);
+                                break;
+                        case 1: carry = cpu.a&1;                                                // RRCA
+                                cpu.a = static_cast<uint8_t>((cpu.a>>1) | (carry<<7));
+                                cpu.f = static_cast<uint8_t>((cpu.f&(FLAG_S|FLAG_Z|FLAG_PV)) | carry);
+                                break;
+                        case 2: carry = cpu.a>>7;                                               // RLA
+                                cpu.a = static_cast<uint8_t>((cpu.a<<1) | (cpu.f&FLAG_C));
+                                cpu.f = static_cast<uint8_t>((cpu.f&(FLAG_S|FLAG_Z|FLAG_PV)) | carry);
+                                break;
+                        case 3: carry = cpu.a&1;                                                // RRA
+                                cpu.a = static_cast<uint8_t>((cpu.a>>1) | ((cpu.f&FLAG_C)<<7));
+                                cpu.f = static_cast<uint8_t>((cpu.f&(FLAG_S|FLAG_Z|FLAG_PV)) | carry);
+                                break;
+                        case 4: daa();                                                          // DAA
+                                break;
+                        case 5: cpu.a = static_cast<uint8_t>(~cpu.a);                           // CPL
+                                cpu.f |= (FLAG_H|FLAG_N);
+                                break;
+                        case 6: cpu.f = static_cast<uint8_t>((cpu.f&(FLAG_S|FLAG_Z|FLAG_PV)) | FLAG_C);     // SCF
+                                break;
+                        default: cpu.f = static_cast<uint8_t>( (cpu.f&(FLAG_S|FLAG_Z|FLAG_PV))             // CCF
+                                                             | ((cpu.f&FLAG_C) ? FLAG_H : FLAG_C) );
+                                break;
+                    }
+                    tstates += 4;
+                    break;
+                }
+            }
+            break;
+        }
+        case 1:
+        {
+            if( y==6 && z==6 )          // HALT
+            {
+                error_message = util::sprintf( "Error; Z80 program halted at %04x", cpu.pc-1 );
+                running = false;
+                tstates += 4;
+            }
+            else if( y == 6 )           // LD (HL),r
+            {
+                uint16_t addr = operand_address();
+                mem[addr] = get_r( z, 0 );
+                tstates += prefix ? 15 : 7;
+            }
+            else if( z == 6 )           // LD r,(HL)
+            {
+                uint16_t addr = operand_address();
+                set_r( y, 0, mem[addr] );
+                tstates += prefix ? 15 : 7;
+            }
+            else                        // LD r,r'
+            {
+                set_r( y, prefix, get_r(z,prefix) );
+                tstates += 4;
+            }
+            break;
+        }
+        case 2:                         // alu A,r
+        {
+            if( z == 6 )
+            {
+                uint16_t addr = operand_address();
+                alu( y, mem[addr] );
+                tstates += prefix ? 15 : 7;
+            }
+            else
+            {
+                alu( y, get_r(z,prefix) );
+                tstates += 4;
+            }
+            break;
+        }
+        default:
+        {
+            switch( z )
+            {
+                case 0:                 // RET cc
+                    if( condition(y) )
+                    {
+                        cpu.pc = pop16();
+                        tstates += 11;
+                    }
+                    else
+                        tstates += 5;
+                    break;
+                case 1:
+                    if( q == 0 )        // POP rp2
+                    {
+                        uint16_t v = pop16();
+                        if( p == 3 )
+                        {
+                            cpu.a = static_cast<uint8_t>(v>>8);
+                            cpu.f = static_cast<uint8_t>(v&0xff);
+                        }
+                        else
+                            set_rp( p, prefix, v );
+                        tstates += 10;
+                    }
+                    else if( p == 0 )   // RET
+                    {
+                        cpu.pc = pop16();
+                        tstates += 10;
+                    }
+                    else if( p == 1 )   // EXX
+                    {
+                        std::swap( cpu.b, cpu.b2 );
+                        std::swap( cpu.c, cpu.c2 );
+                        std::swap( cpu.d, cpu.d2 );
+                        std::swap( cpu.e, cpu.e2 );
+                        std::swap( cpu.h, cpu.h2 );
+                        std::swap( cpu.l, cpu.l2 );
+                        tstates += 4;
+                    }
+                    else if( p == 2 )   // JP (HL)
+                    {
+                        cpu.pc = get_xy(prefix);
+                        tstates += 4;
+                    }
+                    else                // LD SP,HL
+                    {
+                        cpu.sp = get_xy(prefix);
+                        tstates += 6;
+                    }
+                    break;
+                case 2:                 // JP cc,nn
+                {
+                    uint16_t addr = fetch16();
+                    if( condition(y) )
+                        cpu.pc = addr;
+                    tstates += 10;
+                    break;
+                }
+                case 3:
+                    switch( y )
+                    {
+                        case 0: cpu.pc = fetch16();     tstates += 10;  break;  // JP nn
+                        case 2: fetch8();               tstates += 11;  break;  // OUT (n),A
+                        case 3: fetch8(); cpu.a = 0xff; tstates += 11;  break;  // IN A,(n)
+                        case 4:                                                 // EX (SP),HL
+                        {
+                            uint16_t v = rd16(cpu.sp);
+                            wr16( cpu.sp, get_xy(prefix) );
+                            set_xy( prefix, v );
+                            tstates += 19;
+                            break;
+                        }
+                        case 5:                                                 // EX DE,HL
+                        {
+                            uint16_t v = get_de();
+                            set_de( get_hl() );
+                            set_hl( v );
+                            tstates += 4;
+                            break;
+                        }
+                        default:        tstates += 4;   break;                  // DI, EI
+                    }
+                    break;
+                case 4:                 // CALL cc,nn
+                {
+                    uint16_t addr = fetch16();
+                    if( condition(y) )
+                    {
+                        push16( cpu.pc );
+                        cpu.pc = addr;
+                        tstates += 17;
+                    }
+                    else
+                        tstates += 10;
+                    break;
+                }
+                case 5:
+                    if( q == 0 )        // PUSH rp2
+                    {
+                        push16( p==3 ? static_cast<uint16_t>((cpu.a<<8)|cpu.f) : get_rp(p,prefix) );
+                        tstates += 11;
+                    }
+                    else                // CALL nn (p==0, other values are prefixes, handled above)
+                    {
+                        uint16_t addr = fetch16();
+                        push16( cpu.pc );
+                        cpu.pc = addr;
+                        tstates += 17;
+                    }
+                    break;
+                case 6:                 // alu A,n
+                    alu( y, fetch8() );
+                    tstates += 7;
+                    break;
+                default:                // RST
+                    push16( cpu.pc );
+                    cpu.pc = static_cast<uint16_t>(y*8);
+                    tstates += 11;
+                    break;
+            }
+            break;
+        }
+    }
+}
@@ -0,0 +1,61 @@
+/****************************************************************************
+ * This project is a Windows port of the classic program Sargon, as
+ * presented in the book "Sargon a Z80 Computer Chess Program" by Dan
+ * and Kathe Spracklen (Hayden Books 1978).
+ *
+ * File: sargon-z80.h
+ *       Run the original Z80 Sargon on a cycle counting Z80 interpreter
+ *
+ * Bill Forster, https://github.com/billforsternz/retro-sargon
+ ****************************************************************************/
+
+#ifndef SARGON_Z80_H_INCLUDED
+#define SARGON_Z80_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "sargon-asm-interface.h"
+
+// Clock speed of Hans W Kramer's Microprofessor, our reference Z80 hardware
+#define SARGON_Z80_MHZ 1.79
+
+// Load the Z80 image, an Intel HEX file assembled by zmac from
+//  stages/sargon-z80.asm (see rebuild-and-compare.bat). Symbols come from the
+//  zmac listing with the same name and a .lst extension. Returns false, with
+//  an error message, if either is missing or unusable
+bool sargon_z80_load( const std::string &hex_file, std::string &error );
+
+// Copy Sargon's board, lists and variables from the x86 image (which is
+//  where positions are set up, see sargon_import_position()) to the Z80
+//  image, so the next sargon_z80() call works on the same position
+void sargon_z80_import();
+
+// Like sargon(), call a Sargon API function (api_CPTRMV etc.), but on the
+//  Z80 image. Returns false if the Z80 program goes wrong (runs off the end
+//  of its move list, halts, etc.), see sargon_z80_error()
+bool sargon_z80( int api_command_code, z80_registers *registers=NULL );
+std::string sargon_z80_error();
+
+// Read the best move out of the Z80 image after api_CPTRMV, in the same
+//  terse form as sargon_export_move(BESTM)
+std::string sargon_z80_export_move();
+
+// T-states (clock cycles) used since sargon_z80_clear(), in total and within
+//  FNDMOV() (the search itself, leaving out displaying the move)
+void sargon_z80_clear();
+unsigned long long sargon_z80_tstates();
+unsigned long long sargon_z80_search_tstates();
+
+// Optional callback, called at the same points as callback() is called by
+//  the x86 Sargon, with the same messages ("after GENMOV()" etc.), registers
+//  can be inspected and modified
+void sargon_z80_callback( void (*func)( const char *msg, z80_registers &registers ) );
+
+// Record a signature of each position Sargon generates moves for (the
+//  "after GENMOV()" callback) in trace, NULL to stop. Compare with x86 Sargon
+//  by recording sargon_z80_node_signature() from its callback
+void sargon_z80_trace( std::vector<uint32_t> *trace );
+uint32_t sargon_z80_node_signature( const unsigned char *boarda, unsigned char nply );
+
+#endif // SARGON_Z80_H_INCLUDED
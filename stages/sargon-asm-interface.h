@@ -84,5 +84,208 @@ extern "C" {
     const int api_VALMOV = 4;
     const int api_ASNTBI = 5;
     const int api_EXECMV = 6;
+
+    // Code labels, for profiling. The assembly language exports the address of
+    //  each label in the same order, routine is true for CALL targets
+    extern uint32_t sargon_label_addresses[];
+    struct sargon_label { const char *name; bool routine; };
+    const int sargon_nbr_labels = 194;
+    const sargon_label sargon_labels[] =
+    {
+        { "INITBD", true },
+        { "back01", false },
+        { "IB2", false },
+        { "PATH", true },
+        { "PA1", false },
+        { "PA2", false },
+        { "MPIECE", true },
+        { "rel001", false },
+        { "MP5", false },
+        { "MP10", false },
+        { "MP15", false },
+        { "MP20", false },
+        { "MP25", false },
+        { "MP26", false },
+        { "MP30", false },
+        { "MP31", false },
+        { "MP35", false },
+        { "MP37", false },
+        { "MP36", false },
+        { "ENPSNT", true },
+        { "rel002", false },
+        { "rel003", false },
+        { "ADJPTR", true },
+        { "CASTLE", true },
+        { "CA5", false },
+        { "CA10", false },
+        { "CA15", false },
+        { "CA20", false },
+        { "ADMOVE", true },
+        { "rel004", false },
+        { "AM10", false },
+        { "GENMOV", true },
+        { "GM5", false },
+        { "GM10", false },
+        { "INCHK", true },
+        { "INCHK1", true },
+        { "rel005", false },
+        { "ATTACK", true },
+        { "AT5", false },
+        { "AT10", false },
+        { "AT12", false },
+        { "AT13", false },
+        { "AT14A", false },
+        { "AT14B", false },
+        { "AT14", false },
+        { "AT15", false },
+        { "AT16", false },
+        { "AT20", false },
+        { "AT21", false },
+        { "AT25", false },
+        { "AT30", false },
+        { "AT31", false },
+        { "AT32", false },
+        { "ATKSAV", true },
+        { "rel006", false },
+        { "rel007", false },
+        { "AS19", false },
+        { "AS20", false },
+        { "AS25", false },
+        { "PNCK", true },
+        { "PC1", false },
+        { "PC3", false },
+        { "PC5", false },
+        { "PINFND", true },
+        { "PF1", false },
+        { "PF2", false },
+        { "PF5", false },
+        { "PF10", false },
+        { "PF15", false },
+        { "PF19", false },
+        { "back02", false },
+        { "rel008", false },
+        { "PF20", false },
+        { "PF25", false },
+        { "PF26", false },
+        { "PF27", false },
+        { "XCHNG", true },
+        { "rel009", false },
+        { "XC10", false },
+        { "XC15", false },
+        { "XC18", false },
+        { "XC19", false },
+        { "rel010", false },
+        { "NEXTAD", true },
+        { "back03", false },
+        { "NX6", false },
+        { "POINTS", true },
+        { "PT5", false },
+        { "PT6AA", false },
+        { "PT6A", false },
+        { "PT6B", false },
+        { "PT6C", false },
+        { "PT6D", false },
+        { "PT6X", false },
+        { "back04", false },
+        { "PT20", false },
+        { "rel011", false },
+        { "PT23", false },
+        { "rel012", false },
+        { "PT25", false },
+        { "PT25A", false },
+        { "rel013", false },
+        { "rel014", false },
+        { "rel015", false },
+        { "rel026", false },
+        { "rel016", false },
+        { "LIMIT", true },
+        { "LIM10", false },
+        { "MOVE", true },
+        { "MV1", false },
+        { "MV5", false },
+        { "MV10", false },
+        { "MV15", false },
+        { "MV20", false },
+        { "MV21", false },
+        { "MV22", false },
+        { "MV30", false },
+        { "MV40", false },
+        { "UNMOVE", true },
+        { "UM1", false },
+        { "UM5", false },
+        { "UM6", false },
+        { "UM10", false },
+        { "UM15", false },
+        { "UM16", false },
+        { "UM20", false },
+        { "UM21", false },
+        { "UM22", false },
+        { "UM30", false },
+        { "UM40", false },
+        { "SORTM", true },
+        { "SR5", false },
+        { "SR10", false },
+        { "SR15", false },
+        { "SR25", false },
+        { "SR30", false },
+        { "EVAL", true },
+        { "EV5", false },
+        { "EV10", false },
+        { "FNDMOV", true },
+        { "back05", false },
+        { "FM5", false },
+        { "FM15", false },
+        { "rel017", false },
+        { "FM18", false },
+        { "FM19", false },
+        { "rel018", false },
+        { "FM25", false },
+        { "FM30", false },
+        { "FM35", false },
+        { "FM36", false },
+        { "FM37", false },
+        { "FM40", false },
+        { "ASCEND", true },
+        { "rel019", false },
+        { "BOOK", true },
+        { "BM5", false },
+        { "BM9", false },
+        { "CPTRMV", true },
+        { "CP0C", false },
+        { "CP10", false },
+        { "rel020", false },
+        { "rel021", false },
+        { "CP1C", false },
+        { "CP24", false },
+        { "BITASN", true },
+        { "ASNTBI", true },
+        { "AT04", false },
+        { "VALMOV", true },
+        { "VA5", false },
+        { "VA6", false },
+        { "VA7", false },
+        { "VA8", false },
+        { "VA9", false },
+        { "VA10", false },
+        { "ROYALT", true },
+        { "back06", false },
+        { "RY04", false },
+        { "rel023", false },
+        { "RY08", false },
+        { "RY0C", false },
+        { "DIVIDE", true },
+        { "DD04", false },
+        { "rel027", false },
+        { "rel024", false },
+        { "MLTPLY", true },
+        { "ML04", false },
+        { "rel025", false },
+        { "EXECMV", true },
+        { "EX04", false },
+        { "EX08", false },
+        { "EX0C", false },
+        { "EX10", false },
+        { "EX14", false }
+    };
 };
 #endif //SARGON_ASM_INTERFACE_H_INCLUDED